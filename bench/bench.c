@@ -0,0 +1,76 @@
+/**
+ * @file bench.c
+ * @brief File containing the helpers shared by the benchmarks.
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_rm(const char *path, const struct stat *sb, int flag,
+		struct FTW *ftw)
+{
+	(void)sb;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+int bench_rmtree(const char *path)
+{
+	return nftw(path, bench_rm, 16, FTW_DEPTH | FTW_PHYS) ? -1 : 0;
+}
+
+int bench_touch(const char *path, mode_t mode)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, mode);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+int bench_registry(libxvman_t *ctx, const char *home, long nprogs,
+		long nlocs)
+{
+	char (*paths)[PATH_MAX] = calloc(nprogs * nlocs, PATH_MAX);
+	char (*names)[24] = calloc(nprogs, sizeof(*names));
+	libxvman_op_t *ops = calloc(nprogs * nlocs, sizeof(libxvman_op_t));
+	int result = paths && names && ops ? LIBXVMAN_OK : LIBXVMAN_ENOMEM;
+	for (long p = 0; !result && p < nprogs; ++p) {
+		char *dir = paths[nlocs * p];
+		snprintf(names[p], sizeof(names[p]), "p%ld", p);
+		snprintf(dir, PATH_MAX, "%s/p%ld", home, p);
+		mkdir(dir, S_IRWXU);
+		for (long l = 0; !result && l < nlocs; ++l) {
+			char *path = paths[nlocs * p + l];
+			snprintf(path, PATH_MAX, "%s/p%ld/%ld", home, p, l);
+			if (bench_touch(path, S_IRWXU))
+				result = LIBXVMAN_EMISSING;
+			ops[nlocs * p + l] = (libxvman_op_t){LIBXVMAN_ADD,
+				names[p], path};
+		}
+	}
+	if (!result)
+		result = libxvman_apply(ctx, ops, nprogs * nlocs, NULL);
+	free(paths);
+	free(names);
+	free(ops);
+	return result;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file bench.h
+ * @brief Helpers shared by the benchmarks.
+ * @details The timer, the removal of the temporary trees and the fixtures the
+ * benchmarks build their registries from.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../inc/libxvman.h"
+
+#include <sys/types.h>
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return Returns the time in seconds.
+ */
+double bench_now(void);
+
+/**
+ * @brief Remove a directory tree, symlinks not followed.
+ *
+ * @param path - string containing the root of the tree.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int bench_rmtree(const char *path);
+
+/**
+ * @brief Create an empty file standing in for an installed program.
+ *
+ * @param path - string containing the path of the file.
+ * @param mode - permissions of the file.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int bench_touch(const char *path, mode_t mode);
+
+/**
+ * @brief Fill a registry with programs having install locations of their
+ * own.
+ *
+ * The programs are named p0 and up, every one of them gets the files
+ * <home>/p<n>/0 and up, added in a single apply. The last location added is
+ * the default one, the first one the oldest.
+ *
+ * @param ctx - pointer to the context.
+ * @param home - string containing the directory the files are created in.
+ * @param nprogs - number of programs.
+ * @param nlocs - number of install locations of every program.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+int bench_registry(libxvman_t *ctx, const char *home, long nprogs,
+		long nlocs);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file bench_arena.c
+ * @brief Benchmark of building the location list of a command.
+ *
+ * Collects copies of a set of install locations into a growing array the way
+ * xvman_config does, once with a heap allocation per copy freed one by one
+ * afterwards and once from the arena released with a single reset.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/arena.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_ROUNDS 100000
+#define BENCH_LOCATIONS 32
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_ROUNDS;
+	char paths[BENCH_LOCATIONS][64];
+	for (int i = 0; i < BENCH_LOCATIONS; ++i)
+		snprintf(paths[i], sizeof(paths[i]),
+				"/opt/toolchains/gcc-%d.%d/bin/gcc", 8 + i / 4,
+				i % 4);
+
+	/* a heap allocation per copy */
+	size_t sum = 0;
+	double start = bench_now();
+	for (long r = 0; r < n; ++r) {
+		char **list = NULL;
+		size_t cap = 0, len = 0;
+		for (int i = 0; i < BENCH_LOCATIONS; ++i) {
+			if (len == cap) {
+				cap = cap ? cap * 2 : 8;
+				list = realloc(list, cap * sizeof(char *));
+			}
+			list[len++] = strndup(paths[i], sizeof(paths[i]));
+		}
+		sum += list[r % len][0];
+		for (size_t i = 0; i < len; ++i)
+			free(list[i]);
+		free(list);
+	}
+	double heap = (bench_now() - start) / n;
+
+	/* copies from the arena, released with a reset */
+	arena_t arena = {0};
+	start = bench_now();
+	for (long r = 0; r < n; ++r) {
+		char **list = NULL;
+		size_t cap = 0, len = 0;
+		for (int i = 0; i < BENCH_LOCATIONS; ++i) {
+			if (len == cap) {
+				size_t ncap = cap ? cap * 2 : 8;
+				list = arena_grow(&arena, list,
+						cap * sizeof(char *),
+						ncap * sizeof(char *));
+				cap = ncap;
+			}
+			list[len++] = arena_strndup(&arena, paths[i],
+					sizeof(paths[i]));
+		}
+		sum += list[r % len][0];
+		arena_reset(&arena);
+	}
+	double bump = (bench_now() - start) / n;
+
+	printf("arena: %ld lists of %d locations (%zu)\n", n, BENCH_LOCATIONS,
+			sum % 2);
+	printf("arena: heap per copy     %10.3f us/list, %d allocations\n",
+			heap * 1e6, BENCH_LOCATIONS + 3);
+	printf("arena: arena and reset   %10.3f us/list, %zu allocations "
+			"(%.1fx)\n", bump * 1e6, arena.nallocs / n,
+			heap / bump);
+	printf("arena: chunks held after the run %zu\n", arena.nchunks);
+
+	arena_free(&arena);
+	return 0;
+}
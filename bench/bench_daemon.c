@@ -0,0 +1,145 @@
+/**
+ * @file bench_daemon.c
+ * @brief Latency benchmark of switching the default version of a program.
+ *
+ * Compares a switch done the way every xvman invocation does it, setting up
+ * the pre-requisites, switching and releasing everything again, against a
+ * switch requested from a running xvmand. When the CLI has been built the
+ * switch through a fresh xvman process is measured too, and the bare atomic
+ * symlink switch is measured as the lower bound. Everything runs inside a
+ * temporary HOME.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/xvman.h"
+#include "../inc/xvmand.h"
+#include "../inc/util.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_SWITCHES 5000
+#define BENCH_CLI "build/xvman"
+
+static void bench_tool(const char *home, int i, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/v%d", home, i);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/v%d/tool", home, i);
+	bench_touch(path, S_IRWXU);
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_SWITCHES;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home) || setenv("HOME", home, 1)) {
+		fprintf(stderr, "daemon: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	/* the setup greets on the first run and says goodbye on every one */
+	fflush(stdout);
+	int out = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	char locs[2][PATH_MAX], data[3 * PATH_MAX];
+	xvmanconf_t config;
+	xvman_setup_prereq(&config);
+	for (int i = 0; i < 2; ++i) {
+		bench_tool(home, i, locs[i]);
+		snprintf(data, sizeof(data), "tool %s", locs[i]);
+		xvman_add(data);
+	}
+	xvman_free_mem();
+
+	pid_t daemon = fork();
+	if (daemon == 0) {
+		xvman_setup_prereq(&config);
+		int result = xvmand_serve();
+		xvman_free_mem();
+		_exit(result ? 1 : 0);
+	}
+	while (xvmand_request("ping", NULL) == XVMAND_OFFLINE)
+		usleep(1000);
+
+	/* every invocation of xvman on its own */
+	double start = bench_now();
+	for (long i = 0; i < n; ++i) {
+		xvman_setup_prereq(&config);
+		xvman_select("tool", locs[i % 2]);
+		xvman_free_mem();
+	}
+	double local = (bench_now() - start) / n;
+
+	/* requests to the daemon */
+	char request[3 * PATH_MAX];
+	start = bench_now();
+	for (long i = 0; i < n; ++i) {
+		snprintf(request, sizeof(request), "select tool %s",
+				locs[i % 2]);
+		xvmand_request(request, NULL);
+	}
+	double remote = (bench_now() - start) / n;
+
+	kill(daemon, SIGTERM);
+	waitpid(daemon, NULL, 0);
+
+	/* a fresh process per switch, fed through a batch manifest */
+	double cli = 0;
+	long ncli = n / 10 ? n / 10 : 1;
+	char manifest[2][PATH_MAX];
+	for (int i = 0; i < 2; ++i) {
+		snprintf(manifest[i], PATH_MAX, "%s/manifest%d", home, i);
+		FILE *f = fopen(manifest[i], "w");
+		if (f) {
+			fprintf(f, "select tool %s\n", locs[i]);
+			fclose(f);
+		}
+	}
+	if (access(BENCH_CLI, X_OK) == 0) {
+		start = bench_now();
+		for (long i = 0; i < ncli; ++i) {
+			pid_t pid = fork();
+			if (pid == 0) {
+				execl(BENCH_CLI, BENCH_CLI, "-b",
+						manifest[i % 2], (char *)NULL);
+				_exit(127);
+			}
+			waitpid(pid, NULL, 0);
+		}
+		cli = (bench_now() - start) / ncli;
+	}
+
+	/* the symlink switch alone */
+	int dfd = open(home, O_PATH | O_DIRECTORY);
+	start = bench_now();
+	for (long i = 0; i < n; ++i)
+		util_symlink_switch(locs[i % 2], dfd, "tool");
+	double bare = (bench_now() - start) / n;
+	close(dfd);
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+
+	printf("daemon: %ld switches\n", n);
+	printf("daemon: setup per switch %10.2f us/switch\n", local * 1e6);
+	printf("daemon: xvmand request   %10.2f us/switch (%.1fx)\n",
+			remote * 1e6, local / remote);
+	if (cli > 0)
+		printf("daemon: xvman process    %10.2f us/switch (%.1fx)\n",
+				cli * 1e6, cli / remote);
+	printf("daemon: symlink switch   %10.2f us/switch\n", bare * 1e6);
+
+	bench_rmtree(home);
+	return 0;
+}
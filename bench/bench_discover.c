@@ -0,0 +1,115 @@
+/**
+ * @file bench_discover.c
+ * @brief Benchmark of the discovery of installed versions in a large tree.
+ *
+ * Lays out 1,000 vendor directories of 100 entries each inside a temporary
+ * HOME: a bin directory holding ten executables named after registered
+ * programs and ten other files, and a share directory holding the rest. The
+ * whole tree is scanned twice, the first scan registering the 10,000
+ * executables and the second one finding all of them registered already.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_VENDORS 1000
+#define BENCH_PROGS 10
+#define BENCH_OTHERS 10
+#define BENCH_SHARED 78
+
+static int bench_build(const char *home, long nvendors)
+{
+	char path[PATH_MAX];
+	int result = 0;
+	for (long v = 0; !result && v < nvendors; ++v) {
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0", home, v);
+		mkdir(path, S_IRWXU);
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0/bin", home, v);
+		mkdir(path, S_IRWXU);
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0/share", home, v);
+		mkdir(path, S_IRWXU);
+		for (int f = 0; !result && f < BENCH_PROGS + BENCH_OTHERS;
+				++f) {
+			snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0/bin/%s%d",
+					home, v, f < BENCH_PROGS ? "prog" :
+					"other", f);
+			result = bench_touch(path, S_IRWXU);
+		}
+		for (int f = 0; !result && f < BENCH_SHARED; ++f) {
+			snprintf(path, PATH_MAX,
+					"%s/opt/vendor-%ld.0/share/data%d",
+					home, v, f);
+			result = bench_touch(path, S_IRUSR | S_IWUSR);
+		}
+	}
+	return result;
+}
+
+static int bench_count(const char *pname, const char *path, int status,
+		void *arg)
+{
+	(void)pname;
+	(void)path;
+	long *counts = arg;
+	counts[status == LIBXVMAN_OK ? 0 : 1]++;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long nvendors = argc > 1 ? atol(argv[1]) : BENCH_VENDORS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX", path[PATH_MAX];
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "discover: unable to set up a temporary "
+				"HOME\n");
+		return 1;
+	}
+
+	/* every program starts out with a location of its own */
+	libxvman_t *ctx = NULL;
+	snprintf(path, PATH_MAX, "%s/opt", home);
+	int result = mkdir(path, S_IRWXU) || bench_build(home, nvendors) ?
+		LIBXVMAN_ESETUP : libxvman_open(&ctx, home, 0);
+	for (int p = 0; !result && p < BENCH_PROGS; ++p) {
+		char pname[16];
+		snprintf(pname, sizeof(pname), "prog%d", p);
+		snprintf(path, PATH_MAX, "%s/opt/vendor-0.0/bin/%s", home,
+				pname);
+		result = libxvman_add(ctx, pname, path);
+	}
+
+	snprintf(path, PATH_MAX, "%s/opt", home);
+	long first[2] = {0, 0}, again[2] = {0, 0};
+	double start = bench_now();
+	if (!result)
+		result = libxvman_discover(ctx, path, "*/*/*", bench_count,
+				first);
+	double tfirst = bench_now() - start;
+	start = bench_now();
+	if (!result)
+		result = libxvman_discover(ctx, path, "*/*/*", bench_count,
+				again);
+	double tagain = bench_now() - start;
+	if (result)
+		fprintf(stderr, "discover: %s\n", libxvman_strerror(result));
+
+	long nentries = nvendors * (2 + BENCH_PROGS + BENCH_OTHERS +
+			BENCH_SHARED);
+	printf("discover: %ld entries, %ld processors\n", nentries,
+			sysconf(_SC_NPROCESSORS_ONLN));
+	printf("discover: first scan  %10.3f ms (%ld added, %ld known)\n",
+			tfirst * 1e3, first[0], first[1]);
+	printf("discover: second scan %10.3f ms (%ld added, %ld known)\n",
+			tagain * 1e3, again[0], again[1]);
+
+	libxvman_close(ctx);
+	bench_rmtree(home);
+	return result ? 1 : 0;
+}
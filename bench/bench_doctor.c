@@ -0,0 +1,96 @@
+/**
+ * @file bench_doctor.c
+ * @brief Benchmark of the health check of a large registry.
+ *
+ * Registers 10,000 programs with two install locations of their own inside a
+ * temporary HOME and times the check of all of them, first healthy, then with
+ * the default install location of every hundredth program deleted. The
+ * repairs of those are timed last, followed by a check that nothing is left.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_PROGS 10000
+#define BENCH_RUNS 5
+#define BENCH_BROKEN 100
+#define BENCH_LOCS 2
+
+static int bench_count(const libxvman_finding_t *finding, void *arg)
+{
+	long *counts = arg;
+	counts[0]++;
+	counts[1] += finding->fixed != 0;
+	return 0;
+}
+
+/* best of a few runs, the issues found by the last one are kept */
+static double bench_check(libxvman_t *ctx, int flags, int runs, long *counts)
+{
+	double best = -1;
+	for (int r = 0; r < runs; ++r) {
+		counts[0] = counts[1] = 0;
+		double start = bench_now();
+		if (libxvman_doctor(ctx, flags, bench_count, counts))
+			return -1;
+		double took = bench_now() - start;
+		if (best < 0 || took < best)
+			best = took;
+	}
+	return best;
+}
+
+int main(int argc, char *argv[])
+{
+	long nprogs = argc > 1 ? atol(argv[1]) : BENCH_PROGS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "doctor: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	libxvman_t *ctx = NULL;
+	int result = libxvman_open(&ctx, home, 0);
+	if (!result)
+		result = bench_registry(ctx, home, nprogs, BENCH_LOCS);
+	if (result) {
+		fprintf(stderr, "doctor: %s\n", libxvman_strerror(result));
+		libxvman_close(ctx);
+		bench_rmtree(home);
+		return 1;
+	}
+
+	long healthy[2], broken[2], fixed[2], after[2];
+	double clean = bench_check(ctx, 0, BENCH_RUNS, healthy);
+
+	/* the default install location is the one added last */
+	char path[PATH_MAX];
+	for (long p = 0; p < nprogs; p += BENCH_BROKEN) {
+		snprintf(path, PATH_MAX, "%s/p%ld/%d", home, p,
+				BENCH_LOCS - 1);
+		unlink(path);
+	}
+	double check = bench_check(ctx, 0, BENCH_RUNS, broken);
+	double fix = bench_check(ctx, LIBXVMAN_DOCTOR_FIX, 1, fixed);
+	bench_check(ctx, 0, 1, after);
+
+	printf("doctor: %ld programs, %d locations each\n", nprogs,
+			BENCH_LOCS);
+	printf("doctor: healthy check %10.3f ms (%ld problems)\n",
+			clean * 1e3, healthy[0]);
+	printf("doctor: broken check  %10.3f ms (%ld problems)\n",
+			check * 1e3, broken[0]);
+	printf("doctor: fix           %10.3f ms (%ld of %ld fixed)\n",
+			fix * 1e3, fixed[1], fixed[0]);
+	printf("doctor: left after fix %ld problems\n", after[0]);
+
+	libxvman_close(ctx);
+	bench_rmtree(home);
+	return clean < 0 || check < 0 || fix < 0 || after[0] ? 1 : 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file bench_journal.c
+ * @brief Group commit benchmark of the registry journal.
+ *
+ * Records the same number of program updates once as a transaction per
+ * update, each synced on its own, and once as a single transaction synced
+ * once, as done for a batch manifest. The replay of the pending transactions
+ * is timed as well.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/journal.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_UPDATES 500
+
+static int bench_apply(const regprog_t *progs, size_t n, void *arg)
+{
+	*(size_t *)arg += n;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_UPDATES;
+	char path[] = "/tmp/xvman-bench-journal.XXXXXX";
+	close(mkstemp(path));
+
+	char names[n][32];
+	char paths[2][64] = {"/opt/tool/1/bin/tool", "/opt/tool/2/bin/tool"};
+	regloc_t locs[2];
+	regprog_t *progs = calloc(n, sizeof(regprog_t));
+	if (!progs)
+		return 1;
+	for (int j = 0; j < 2; ++j)
+		locs[j] = (regloc_t){paths[j], strlen(paths[j]), 0, 0};
+	for (long i = 0; i < n; ++i) {
+		snprintf(names[i], sizeof(names[i]), "tool%ld", i);
+		progs[i] = (regprog_t){names[i], locs, 2};
+	}
+
+	journal_t jnl;
+	if (journal_open(&jnl, path)) {
+		fprintf(stderr, "journal: unable to open %s\n", path);
+		return 1;
+	}
+
+	off_t txn;
+	double start = bench_now();
+	for (long i = 0; i < n; ++i)
+		journal_commit(&jnl, &progs[i], 1, &txn);
+	double single_time = bench_now() - start;
+
+	journal_reset(&jnl);
+	start = bench_now();
+	journal_commit(&jnl, progs, n, &txn);
+	double group_time = bench_now() - start;
+
+	size_t replayed = 0;
+	start = bench_now();
+	journal_replay(&jnl, bench_apply, &replayed);
+	double replay_time = bench_now() - start;
+
+	printf("journal: %ld updates\n", n);
+	printf("journal: sync per update   %10.2f us/update\n",
+			single_time / n * 1e6);
+	printf("journal: group commit      %10.2f us/update (%.1fx)\n",
+			group_time / n * 1e6, single_time / group_time);
+	printf("journal: replay            %10.2f us/update (%zu)\n",
+			replay_time / n * 1e6, replayed);
+
+	journal_close(&jnl);
+	unlink(path);
+	free(progs);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file bench_lib.c
+ * @brief Throughput benchmark of switching programs through libxvman.
+ *
+ * Switches thousands of programs from a single process holding one context,
+ * first one call per switch and then all of them in one libxvman_apply(),
+ * against a fresh xvman process per switch when the CLI has been built.
+ * Everything runs inside a temporary HOME.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_PROGRAMS 2000
+#define BENCH_CLI "build/xvman"
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_PROGRAMS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (n < 1 || !mkdtemp(home) || setenv("HOME", home, 1)) {
+		fprintf(stderr, "lib: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	/* two versions of a tool, shared by all the programs */
+	char locs[2][PATH_MAX];
+	for (int i = 0; i < 2; ++i) {
+		snprintf(locs[i], PATH_MAX, "%s/v%d", home, i);
+		mkdir(locs[i], S_IRWXU);
+		snprintf(locs[i], PATH_MAX, "%s/v%d/tool", home, i);
+		bench_touch(locs[i], S_IRWXU);
+	}
+
+	libxvman_t *ctx;
+	char (*names)[32] = calloc(n, sizeof(*names));
+	libxvman_op_t *ops = calloc(2 * n, sizeof(libxvman_op_t));
+	int result = names && ops ? libxvman_open(&ctx, home, 0) :
+		LIBXVMAN_ENOMEM;
+	if (result) {
+		fprintf(stderr, "lib: %s\n", libxvman_strerror(result));
+		return 1;
+	}
+	for (long i = 0; i < n; ++i) {
+		snprintf(names[i], sizeof(names[i]), "tool%ld", i);
+		for (int v = 0; v < 2; ++v)
+			ops[2 * i + v] = (libxvman_op_t){LIBXVMAN_ADD,
+				names[i], locs[v]};
+	}
+	result = libxvman_apply(ctx, ops, 2 * n, NULL);
+
+	/* one call per switch */
+	double start = bench_now();
+	for (long i = 0; !result && i < n; ++i)
+		result = libxvman_select(ctx, names[i], locs[0]);
+	double single = (bench_now() - start) / n;
+
+	/* all the switches in one call */
+	for (long i = 0; i < n; ++i)
+		ops[i] = (libxvman_op_t){LIBXVMAN_SELECT, names[i], locs[1]};
+	start = bench_now();
+	if (!result)
+		result = libxvman_apply(ctx, ops, n, NULL);
+	double batch = (bench_now() - start) / n;
+	libxvman_close(ctx);
+	if (result) {
+		fprintf(stderr, "lib: %s\n", libxvman_strerror(result));
+		return 1;
+	}
+
+	/* a fresh process per switch, fed through a batch manifest */
+	double cli = 0;
+	long ncli = n / 20 ? n / 20 : 1;
+	char manifest[PATH_MAX];
+	snprintf(manifest, PATH_MAX, "%s/manifest", home);
+	if (access(BENCH_CLI, X_OK) == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		start = bench_now();
+		for (long i = 0; i < ncli; ++i) {
+			FILE *f = fopen(manifest, "w");
+			if (f) {
+				fprintf(f, "select %s %s\n", names[i],
+						locs[0]);
+				fclose(f);
+			}
+			pid_t pid = fork();
+			if (pid == 0) {
+				dup2(null, STDOUT_FILENO);
+				execl(BENCH_CLI, BENCH_CLI, "-b", manifest,
+						(char *)NULL);
+				_exit(127);
+			}
+			waitpid(pid, NULL, 0);
+		}
+		cli = (bench_now() - start) / ncli;
+		close(null);
+	}
+
+	printf("lib: %ld programs\n", n);
+	printf("lib: libxvman_select      %10.2f us/switch\n", single * 1e6);
+	printf("lib: libxvman_apply       %10.2f us/switch (%.1fx)\n",
+			batch * 1e6, single / batch);
+	if (cli > 0)
+		printf("lib: xvman process        %10.2f us/switch (%.1fx)\n",
+				cli * 1e6, cli / single);
+
+	free(names);
+	free(ops);
+	bench_rmtree(home);
+	return 0;
+}
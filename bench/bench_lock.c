@@ -0,0 +1,159 @@
+/**
+ * @file bench_lock.c
+ * @brief Lock contention stress test of the registry.
+ *
+ * Several processes keep switching the default location of a program, each
+ * switch being a look up, a registry update and a symlink switch done under
+ * the lock. The time spent waiting for the lock is reported for the lock of
+ * the whole registry, for program locks with every process on a program of
+ * its own and for program locks with all the processes on the same program.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/registry.h"
+#include "../inc/util.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_WORKERS 8
+#define BENCH_SWITCHES 2000
+
+enum bench_mode {
+	BENCH_GLOBAL,
+	BENCH_DISTINCT,
+	BENCH_SAME
+};
+
+struct bench_result {
+	double wait;			/* total time waiting for the lock */
+	double max;			/* longest single wait */
+	long n;				/* number of switches */
+};
+
+static void bench_worker(const char *dir, const char *regpath, int id,
+		enum bench_mode mode, long n, int out)
+{
+	registry_t reg;
+	struct bench_result result = {0, 0, n};
+	char name[32], link[PATH_MAX];
+	snprintf(name, sizeof(name), "tool%d", mode == BENCH_SAME ? 0 : id);
+	snprintf(link, sizeof(link), "%s/%s", dir, name);
+	if (registry_open(&reg, regpath))
+		_exit(1);
+
+	for (long i = 0; i < n; ++i) {
+		double start = bench_now();
+		int locked = mode == BENCH_GLOBAL ? registry_lock(&reg) :
+			registry_lock_prog(&reg, name, true);
+		double wait = bench_now() - start;
+		if (locked)
+			_exit(1);
+		result.wait += wait;
+		if (wait > result.max)
+			result.max = wait;
+
+		/* rotate the locations, the last one becomes the default */
+		regentry_t entry;
+		regloc_t locs[4];
+		uint32_t nlocs = 0;
+		if (registry_lookup(&reg, name, &entry))
+			for (; nlocs < entry.nlocs && nlocs < 4; ++nlocs)
+				registry_loc(&reg, &entry, (nlocs + 1) %
+						entry.nlocs, &locs[nlocs]);
+		if (nlocs && !registry_put(&reg, name, locs, nlocs, 0))
+			util_symlink_switch(locs[0].path, AT_FDCWD, link);
+
+		if (mode == BENCH_GLOBAL)
+			registry_unlock(&reg);
+		else
+			registry_unlock_prog(&reg, name);
+	}
+
+	registry_close(&reg);
+	if (write(out, &result, sizeof(result)) != sizeof(result))
+		_exit(1);
+	_exit(0);
+}
+
+static void bench_run(const char *dir, const char *regpath,
+		enum bench_mode mode, const char *label, long n)
+{
+	int fds[2];
+	if (pipe(fds))
+		return;
+
+	double start = bench_now();
+	for (int i = 0; i < BENCH_WORKERS; ++i)
+		if (fork() == 0)
+			bench_worker(dir, regpath, i, mode, n, fds[1]);
+	close(fds[1]);
+
+	struct bench_result total = {0, 0, 0}, one;
+	while (read(fds[0], &one, sizeof(one)) == sizeof(one)) {
+		total.wait += one.wait;
+		total.n += one.n;
+		if (one.max > total.max)
+			total.max = one.max;
+	}
+	close(fds[0]);
+	while (wait(NULL) > 0)
+		;
+	double elapsed = bench_now() - start;
+
+	if (total.n != (long)BENCH_WORKERS * n) {
+		printf("lock: %-16s worker failed\n", label);
+		return;
+	}
+	printf("lock: %-16s wait avg %9.2f us max %9.2f us, "
+			"%8.0f switches/s\n", label,
+			total.wait / total.n * 1e6, total.max * 1e6,
+			total.n / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_SWITCHES;
+	char dir[] = "/tmp/xvman-bench-lock.XXXXXX";
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "lock: unable to create a directory\n");
+		return 1;
+	}
+	char regpath[PATH_MAX];
+	snprintf(regpath, sizeof(regpath), "%s/registry", dir);
+
+	/* every program has a few locations to rotate through */
+	registry_t reg;
+	if (registry_open(&reg, regpath) || registry_lock(&reg)) {
+		fprintf(stderr, "lock: unable to set up the registry\n");
+		return 1;
+	}
+	char paths[4][64];
+	regloc_t locs[4];
+	for (int j = 0; j < 4; ++j) {
+		snprintf(paths[j], sizeof(paths[j]), "/opt/tool/%d/bin/tool", j);
+		locs[j] = (regloc_t){paths[j], strlen(paths[j]), 0, 0};
+	}
+	for (int i = 0; i < BENCH_WORKERS; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "tool%d", i);
+		registry_put(&reg, name, locs, 4, 0);
+	}
+	registry_unlock(&reg);
+	registry_close(&reg);
+
+	printf("lock: %d processes, %ld switches each\n", BENCH_WORKERS, n);
+	bench_run(dir, regpath, BENCH_GLOBAL, "whole registry", n);
+	bench_run(dir, regpath, BENCH_DISTINCT, "distinct programs", n);
+	bench_run(dir, regpath, BENCH_SAME, "same program", n);
+
+	bench_rmtree(dir);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file bench_log.c
+ * @brief Throughput benchmark of the logging module.
+ *
+ * Compares the buffered logger against the previous behaviour of opening,
+ * writing and closing the log file for every single record, and the text
+ * format of the buffered logger against the binary one.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/log.h"
+#include "bench.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RECORDS 200000
+
+/* the logger as it used to be: reopen the file and format the time stamp
+ * on every call */
+static void bench_old_write(const char *lf, const char *fmt, const char *fi,
+		const char *fu, long ln, ...)
+{
+	va_list vp;
+	va_start(vp, ln);
+	FILE *f = fopen(lf, "a+");
+	time_t rawtime;
+	time(&rawtime);
+	char *ltime = asctime(localtime(&rawtime));
+	char *index = strchr(ltime, '\n');
+	if (index)
+		*index = '\0';
+	fprintf(f, LOG_STRF, ltime, "DEBUG : ", fi, fu, ln);
+	fputc(' ', f);
+	vfprintf(f, fmt, vp);
+	fputc('\n', f);
+	fclose(f);
+	va_end(vp);
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RECORDS;
+	char old_lf[] = "/tmp/xvman-bench-log-old.XXXXXX";
+	char new_lf[] = "/tmp/xvman-bench-log-new.XXXXXX";
+	close(mkstemp(old_lf));
+	close(mkstemp(new_lf));
+
+	double start = bench_now();
+	for (long i = 0; i < n; ++i)
+		bench_old_write(old_lf, "Line content: %s, length: %ld",
+				__FILE__, __FUNCTION__, __LINE__,
+				"/opt/tool/bin/tool", i);
+	double old_time = bench_now() - start;
+
+	start = bench_now();
+	log_init(new_lf, DEBUG);
+	log_set_stream(false, true);
+	for (long i = 0; i < n; ++i)
+		debug("Line content: %s, length: %ld", "/opt/tool/bin/tool",
+				i);
+	log_free_lf();
+	double new_time = bench_now() - start;
+
+	char bin_lf[sizeof(new_lf) + sizeof(LOG_BINARY_SUFFIX)];
+	snprintf(bin_lf, sizeof(bin_lf), "%s" LOG_BINARY_SUFFIX, new_lf);
+	start = bench_now();
+	log_init(new_lf, DEBUG);
+	log_set_stream(false, true);
+	log_set_format(LOG_FORMAT_BINARY);
+	for (long i = 0; i < n; ++i)
+		debug("Line content: %s, length: %ld", "/opt/tool/bin/tool",
+				i);
+	log_free_lf();
+	double bin_time = bench_now() - start;
+	log_set_format(LOG_FORMAT_TEXT);
+
+	printf("log: %ld records\n", n);
+	printf("log: reopen per record  %10.0f records/s\n", n / old_time);
+	printf("log: buffered writer    %10.0f records/s (%.1fx)\n",
+			n / new_time, old_time / new_time);
+	printf("log: binary format      %10.0f records/s (%.1fx)\n",
+			n / bin_time, old_time / bin_time);
+
+	unlink(old_lf);
+	unlink(new_lf);
+	unlink(bin_lf);
+	return 0;
+}
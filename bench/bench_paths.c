@@ -0,0 +1,191 @@
+/**
+ * @file bench_paths.c
+ * @brief Memory and instruction count benchmark of building the paths.
+ *
+ * Compares the way every run used to build its paths, with a configuration
+ * holding one PATH_MAX buffer per path, PATH_MAX stack buffers cleared before
+ * use and CLI options holding three PATH_MAX arrays each, against interning
+ * them into the table of paths.h. The instructions are counted through
+ * perf_event_open(2) when the kernel allows it, the time is measured anyway.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/paths.h"
+#include "../inc/xvman.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS 20000
+#define BENCH_OPTIONS 9
+
+/* the configuration and the CLI options as they used to be */
+typedef struct {
+	char paths[6][PATH_MAX];
+} bench_oldconf_t;
+
+typedef struct {
+	char sname[PATH_MAX];
+	char lname[PATH_MAX];
+	char values[PATH_MAX];
+	bool has_args;
+	bool is_present;
+	unsigned int argvalc;
+} bench_oldopt_t;
+
+/* the configuration and the CLI options as they are now */
+typedef struct {
+	const char *paths[6];
+} bench_newconf_t;
+
+typedef struct {
+	const char *sname;
+	const char *lname;
+	char *values;
+	bool has_args;
+	bool is_present;
+	unsigned int argvalc;
+} bench_newopt_t;
+
+static const char *bench_rel[6] = {
+	CBIN, CONFDIR, CONF_FPATH, CONF_LOGFPATH, CONF_REGPATH,
+	CONF_JOURNALPATH
+};
+
+/* keep the compiler from dropping the work done on a buffer */
+static void bench_use(void *p)
+{
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+static __attribute__((noinline)) void bench_old(const char *home)
+{
+	bench_oldopt_t options[BENCH_OPTIONS] = {
+		{"-a", "--add", "", true, false, 2},
+		{"-d", "--debug", "", false, false, 0}
+	};
+	bench_use(options);
+
+	bench_oldconf_t config;
+	for (int i = 0; i < 6; ++i)
+		snprintf(config.paths[i], PATH_MAX, "%s/%s", home,
+				bench_rel[i]);
+	bench_use(&config);
+
+	char bashrc[PATH_MAX], export[PATH_MAX], lockfile[PATH_MAX];
+	memset(bashrc, '\0', PATH_MAX);
+	memset(export, '\0', PATH_MAX);
+	memset(lockfile, '\0', PATH_MAX);
+	sprintf(bashrc, "%s/%s", home, BASH_CONF_FILE);
+	sprintf(export, "\nexport %s\n", RCUPDATE);
+	sprintf(lockfile, "%s/%s", home, LOCKFILE);
+	bench_use(bashrc);
+	bench_use(export);
+	bench_use(lockfile);
+}
+
+static __attribute__((noinline)) void bench_new(const char *home)
+{
+	bench_newopt_t options[BENCH_OPTIONS] = {
+		{"-a", "--add", NULL, true, false, 2},
+		{"-d", "--debug", NULL, false, false, 0}
+	};
+	bench_use(options);
+
+	paths_init(home);
+	bench_newconf_t config = {{
+		paths_get(PATHS_CBIN), paths_get(PATHS_CONFDIR),
+		paths_get(PATHS_CONF), paths_get(PATHS_LOG),
+		paths_get(PATHS_REGISTRY), paths_get(PATHS_JOURNAL)
+	}};
+	bench_use(&config);
+
+	const char *bashrc = paths_get(PATHS_BASHRC);
+	const char *lockfile = paths_get(PATHS_LOCKFILE);
+	bench_use((void *)bashrc);
+	bench_use((void *)lockfile);
+}
+
+static int bench_counter(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* run a variant n times, returns the average time and instruction count */
+static double bench_run(void (*fn)(const char *), const char **homes, long n,
+		int counter, double *instructions)
+{
+	uint64_t count = 0;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	double start = bench_now();
+	for (long i = 0; i < n; ++i)
+		fn(homes[i % 2]);
+	double elapsed = bench_now() - start;
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(counter, &count, sizeof(count)) != sizeof(count))
+			count = 0;
+	}
+	*instructions = (double)count / n;
+	return elapsed / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RUNS;
+
+	/* every run interns the paths below a new $HOME, as a fresh process
+	 * does */
+	const char *homes[2] = {"/home/bench-user-one", "/home/bench-user-two"};
+	int counter = bench_counter();
+
+	double oldins, newins;
+	double oldtime = bench_run(bench_old, homes, n, counter, &oldins);
+	double newtime = bench_run(bench_new, homes, n, counter, &newins);
+	if (counter >= 0)
+		close(counter);
+
+	size_t oldmem = sizeof(bench_oldconf_t) + 3 * PATH_MAX +
+		BENCH_OPTIONS * sizeof(bench_oldopt_t);
+	size_t newmem = sizeof(bench_newconf_t) +
+		BENCH_OPTIONS * sizeof(bench_newopt_t);
+	size_t table = 0;
+	for (int id = 0; id < PATHS_COUNT; ++id)
+		table += paths_len(id) + 1;
+
+	printf("paths: %ld runs\n", n);
+	printf("paths: PATH_MAX buffers  %10.3f us/run, %8zu bytes",
+			oldtime * 1e6, oldmem);
+	if (counter >= 0)
+		printf(", %8.0f instructions", oldins);
+	printf("\npaths: interned table    %10.3f us/run, %8zu bytes",
+			newtime * 1e6, newmem + table);
+	if (counter >= 0)
+		printf(", %8.0f instructions", newins);
+	printf(" (%.1fx)\n", oldtime / newtime);
+	if (counter < 0)
+		printf("paths: instruction counter not available\n");
+
+	return 0;
+}
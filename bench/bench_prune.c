@@ -0,0 +1,78 @@
+/**
+ * @file bench_prune.c
+ * @brief Benchmark of the pruning of a large registry.
+ *
+ * Registers 10,000 programs with four install locations of their own inside a
+ * temporary HOME and deletes the oldest location of every tenth program. The
+ * prune of those is timed first, then a prune keeping two locations per
+ * program, then a prune finding nothing left to do.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_PROGS 10000
+#define BENCH_LOCS 4
+#define BENCH_DEAD 10
+
+static double bench_prune(libxvman_t *ctx, const libxvman_policy_t *policy,
+		libxvman_pruned_t *pruned)
+{
+	double start = bench_now();
+	if (libxvman_prune(ctx, policy, NULL, NULL, pruned))
+		return -1;
+	return bench_now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	long nprogs = argc > 1 ? atol(argv[1]) : BENCH_PROGS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "prune: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	libxvman_t *ctx = NULL;
+	int result = libxvman_open(&ctx, home, 0);
+	if (!result)
+		result = bench_registry(ctx, home, nprogs, BENCH_LOCS);
+	if (result) {
+		fprintf(stderr, "prune: %s\n", libxvman_strerror(result));
+		libxvman_close(ctx);
+		bench_rmtree(home);
+		return 1;
+	}
+
+	/* the location added first is the last one of a program */
+	char path[PATH_MAX];
+	for (long p = 0; p < nprogs; p += BENCH_DEAD) {
+		snprintf(path, PATH_MAX, "%s/p%ld/0", home, p);
+		unlink(path);
+	}
+
+	libxvman_policy_t keep = {2, 0};
+	libxvman_pruned_t dead, kept, none;
+	double tdead = bench_prune(ctx, NULL, &dead);
+	double tkept = bench_prune(ctx, &keep, &kept);
+	double tnone = bench_prune(ctx, &keep, &none);
+
+	printf("prune: %ld programs, %d locations each\n", nprogs,
+			BENCH_LOCS);
+	printf("prune: missing  %10.3f ms (%zu locations, %zu bytes)\n",
+			tdead * 1e3, dead.entries, dead.bytes);
+	printf("prune: keep 2   %10.3f ms (%zu locations, %zu bytes)\n",
+			tkept * 1e3, kept.entries, kept.bytes);
+	printf("prune: nothing  %10.3f ms (%zu locations)\n", tnone * 1e3,
+			none.entries);
+
+	libxvman_close(ctx);
+	bench_rmtree(home);
+	return tdead < 0 || tkept < 0 || tnone < 0 || none.entries ? 1 : 0;
+}
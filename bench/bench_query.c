@@ -0,0 +1,124 @@
+/**
+ * @file bench_query.c
+ * @brief Latency benchmark of the read-only commands.
+ *
+ * Fills a registry inside a temporary HOME with a few thousand programs and
+ * measures what a run of --current, --query and --list does past the parsing
+ * of the arguments, against the locked query on top of the regular setup.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/xvman.h"
+#include "../inc/registry.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PROGRAMS 5000
+#define BENCH_RUNS 2000
+
+enum bench_cmd {
+	BENCH_CURRENT,
+	BENCH_QUERY,
+	BENCH_LIST,
+	BENCH_LOCKED
+};
+
+/* returns the average time of a run in seconds */
+static double bench_run(enum bench_cmd cmd, long n, FILE *out)
+{
+	xvmanconf_t config;
+	double start = bench_now();
+	for (long i = 0; i < n; ++i) {
+		int result = cmd == BENCH_LOCKED ?
+			xvman_setup_prereq(&config) :
+			xvman_setup_readonly(&config);
+		if (!result && cmd == BENCH_CURRENT)
+			result = xvman_show("tool42", false, true, out);
+		else if (!result && cmd == BENCH_QUERY)
+			result = xvman_show("tool42", true, true, out);
+		else if (!result && cmd == BENCH_LIST)
+			result = xvman_list(out, true);
+		else if (!result)
+			result = xvman_query("tool42", out);
+		xvman_free_mem();
+		if (result) {
+			fprintf(stderr, "query: command failed\n");
+			exit(1);
+		}
+	}
+	return (bench_now() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RUNS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home) || setenv("HOME", home, 1)) {
+		fprintf(stderr, "query: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	/* the regular setup creates the registry, which is then filled */
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	xvmanconf_t config;
+	if (xvman_setup_prereq(&config)) {
+		fprintf(stderr, "query: setup failed\n");
+		return 1;
+	}
+	xvman_free_mem();
+
+	registry_t reg;
+	regprog_t *progs = calloc(BENCH_PROGRAMS, sizeof(regprog_t));
+	char (*names)[32] = calloc(BENCH_PROGRAMS, sizeof(*names));
+	char paths[4][64];
+	regloc_t locs[4];
+	for (int j = 0; j < 4; ++j) {
+		snprintf(paths[j], sizeof(paths[j]), "/opt/tool/%d/bin/tool", j);
+		locs[j] = (regloc_t){paths[j], strlen(paths[j]), 0, 0};
+	}
+	for (int i = 0; progs && names && i < BENCH_PROGRAMS; ++i) {
+		snprintf(names[i], sizeof(names[i]), "tool%d", i);
+		progs[i] = (regprog_t){names[i], locs, 4};
+	}
+	if (!progs || !names || registry_open(&reg, config.conf_regpath) ||
+			registry_lock(&reg) ||
+			registry_put_many(&reg, progs, BENCH_PROGRAMS)) {
+		fprintf(stderr, "query: unable to fill the registry\n");
+		return 1;
+	}
+	registry_unlock(&reg);
+	registry_close(&reg);
+	free(progs);
+	free(names);
+
+	FILE *out = fopen("/dev/null", "w");
+	double current = bench_run(BENCH_CURRENT, n, out);
+	double query = bench_run(BENCH_QUERY, n, out);
+	double list = bench_run(BENCH_LIST, n / 10 + 1, out);
+	double locked = bench_run(BENCH_LOCKED, n, out);
+	fclose(out);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	printf("query: %d programs, %ld runs\n", BENCH_PROGRAMS, n);
+	printf("query: setup and query      %10.2f us/run\n", locked * 1e6);
+	printf("query: --current            %10.2f us/run (%.1fx)\n",
+			current * 1e6, locked / current);
+	printf("query: --query              %10.2f us/run (%.1fx)\n",
+			query * 1e6, locked / query);
+	printf("query: --list               %10.2f us/run\n", list * 1e6);
+
+	bench_rmtree(home);
+	return 0;
+}
@@ -0,0 +1,359 @@
+/**
+ * @file bench_scale.c
+ * @brief Reproducible benchmark of the registry and the switches at scale.
+ *
+ * Builds synthetic registries of up to 10,000 programs with up to 500 install
+ * locations each inside a temporary HOME and measures the latency of single
+ * additions, selections and queries through libxvman, of opening a context
+ * and of a fresh xvman process reading the current location. Every operation
+ * is timed on its own, the median, the 99th percentile and the throughput are
+ * reported on stdout and as JSON.
+ *
+ * The programs and locations picked are drawn from a generator with a fixed
+ * seed, so two runs over the same tree do the same work. The default grid
+ * keeps every fixture below about 100,000 locations, XVMAN_BENCH_FULL=1 runs
+ * the whole cross product of the program and location counts instead.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "../inc/buildinfo.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SAMPLES 200
+#define BENCH_PROCESSES 50
+#define BENCH_SEED 0x5eed5eedU
+#define BENCH_CLI "build/xvman"
+#define BENCH_JSON "bench_output.json"
+
+/**
+ * @brief Shape of a synthetic registry.
+ */
+typedef struct {
+	long nprogs;			/* programs registered */
+	long nlocs;			/* install locations of every program */
+} bench_fixture_t;
+
+/* spread over the whole range while staying quick enough for make bench */
+static const bench_fixture_t bench_grid[] = {
+	{1, 1}, {100, 10}, {10000, 1}, {100, 500}, {1000, 100},
+	{10000, 10}
+};
+
+static const long bench_full_progs[] = {1, 100, 1000, 10000};
+static const long bench_full_locs[] = {1, 10, 100, 500};
+
+/**
+ * @brief Operations measured on every fixture.
+ */
+enum {
+	BENCH_ADD,
+	BENCH_SELECT,
+	BENCH_QUERY,
+	BENCH_OPEN,
+	BENCH_STARTUP,
+	BENCH_OPS
+};
+
+static const char *bench_names[BENCH_OPS] = {
+	"add", "select", "query", "open", "startup"
+};
+
+/**
+ * @brief Latencies of an operation, in seconds.
+ */
+typedef struct {
+	double *samples;
+	long n;
+} bench_series_t;
+
+static uint32_t bench_state = BENCH_SEED;
+
+/* xorshift, the same sequence on every machine */
+static uint32_t bench_rand(void)
+{
+	bench_state ^= bench_state << 13;
+	bench_state ^= bench_state >> 17;
+	bench_state ^= bench_state << 5;
+	return bench_state;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* nearest rank percentile of sorted samples */
+static double bench_pct(const bench_series_t *s, double q)
+{
+	return s->n ? s->samples[(long)(q * (s->n - 1) + 0.5)] : 0;
+}
+
+static double bench_sum(const bench_series_t *s)
+{
+	double sum = 0;
+	for (long i = 0; i < s->n; ++i)
+		sum += s->samples[i];
+	return sum;
+}
+
+static int bench_count(const libxvman_loc_t *loc, void *arg)
+{
+	(void)loc;
+	(*(long *)arg)++;
+	return 0;
+}
+
+/* build the registry of a fixture in one apply */
+static int bench_build(libxvman_t *ctx, const bench_fixture_t *fx,
+		char (*names)[24], char (*locs)[PATH_MAX])
+{
+	libxvman_op_t *ops = calloc(fx->nprogs * fx->nlocs,
+			sizeof(libxvman_op_t));
+	if (!ops)
+		return LIBXVMAN_ENOMEM;
+	long n = 0;
+	for (long p = 0; p < fx->nprogs; ++p)
+		for (long l = 0; l < fx->nlocs; ++l)
+			ops[n++] = (libxvman_op_t){LIBXVMAN_ADD, names[p],
+				locs[l]};
+	int result = libxvman_apply(ctx, ops, n, NULL);
+	free(ops);
+	return result;
+}
+
+/* a fresh process reading the current location of a program */
+static double bench_process(const char *pname, int null)
+{
+	double start = bench_now();
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(null, STDOUT_FILENO);
+		execl(BENCH_CLI, BENCH_CLI, "-w", pname, (char *)NULL);
+		_exit(127);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ?
+		bench_now() - start : -1;
+}
+
+/*
+ * Note:
+ * Each fixture gets a HOME of its own, the programs are named prog0 and up and
+ * share the files loc0 and up as their install locations, so the fixture costs
+ * no more files than the locations of a single program. The additions go to
+ * files of their own, one per sample.
+ */
+static int bench_fixture(const bench_fixture_t *fx, long samples,
+		FILE *json, bool first)
+{
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home) || setenv("HOME", home, 1)) {
+		fprintf(stderr, "scale: unable to set up a temporary HOME\n");
+		return -1;
+	}
+
+	char (*names)[24] = calloc(fx->nprogs, sizeof(*names));
+	char (*locs)[PATH_MAX] = calloc(fx->nlocs + samples, PATH_MAX);
+	bench_series_t series[BENCH_OPS];
+	for (int op = 0; op < BENCH_OPS; ++op) {
+		series[op].samples = calloc(samples, sizeof(double));
+		series[op].n = 0;
+	}
+	int result = names && locs ? LIBXVMAN_OK : LIBXVMAN_ENOMEM;
+	for (int op = 0; op < BENCH_OPS; ++op)
+		if (!series[op].samples)
+			result = LIBXVMAN_ENOMEM;
+	for (long p = 0; !result && p < fx->nprogs; ++p)
+		snprintf(names[p], sizeof(names[p]), "prog%ld", p);
+	for (long l = 0; !result && l < fx->nlocs + samples; ++l) {
+		snprintf(locs[l], PATH_MAX, "%s/loc%ld", home, l);
+		if (bench_touch(locs[l], S_IRWXU))
+			result = LIBXVMAN_EMISSING;
+	}
+
+	libxvman_t *ctx = NULL;
+	if (!result)
+		result = libxvman_open(&ctx, home, 0);
+	double start = bench_now();
+	if (!result)
+		result = bench_build(ctx, fx, names, locs);
+	double build = bench_now() - start;
+
+	/* additions of a new location to random programs */
+	for (long i = 0; !result && i < samples; ++i) {
+		const char *pname = names[bench_rand() % fx->nprogs];
+		start = bench_now();
+		result = libxvman_add(ctx, pname, locs[fx->nlocs + i]);
+		series[BENCH_ADD].samples[series[BENCH_ADD].n++] =
+			bench_now() - start;
+	}
+
+	/* switches of random programs to one of their first locations */
+	for (long i = 0; !result && i < samples; ++i) {
+		const char *pname = names[bench_rand() % fx->nprogs];
+		start = bench_now();
+		result = libxvman_select(ctx, pname,
+				locs[bench_rand() % fx->nlocs]);
+		series[BENCH_SELECT].samples[series[BENCH_SELECT].n++] =
+			bench_now() - start;
+	}
+
+	/* queries walking all the locations of random programs */
+	long seen = 0;
+	for (long i = 0; !result && i < samples; ++i) {
+		const char *pname = names[bench_rand() % fx->nprogs];
+		start = bench_now();
+		result = libxvman_query(ctx, pname, bench_count, &seen);
+		series[BENCH_QUERY].samples[series[BENCH_QUERY].n++] =
+			bench_now() - start;
+	}
+	libxvman_close(ctx);
+
+	/* opening a context on the registry, the recovery scan included */
+	for (long i = 0; !result && i < samples; ++i) {
+		start = bench_now();
+		result = libxvman_open(&ctx, home, 0);
+		libxvman_close(ctx);
+		series[BENCH_OPEN].samples[series[BENCH_OPEN].n++] =
+			bench_now() - start;
+	}
+
+	/* a whole xvman process, when the CLI has been built */
+	long nproc = samples < BENCH_PROCESSES ? samples : BENCH_PROCESSES;
+	if (!result && access(BENCH_CLI, X_OK) == 0) {
+		int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		for (long i = 0; null >= 0 && i < nproc; ++i) {
+			double t = bench_process(
+					names[bench_rand() % fx->nprogs], null);
+			if (t < 0) {
+				result = LIBXVMAN_ESETUP;
+				break;
+			}
+			series[BENCH_STARTUP].samples[
+				series[BENCH_STARTUP].n++] = t;
+		}
+		if (null >= 0)
+			close(null);
+	}
+
+	struct stat details;
+	char regpath[PATH_MAX];
+	snprintf(regpath, PATH_MAX, "%s/.config/xvman/registry", home);
+	long long regsize = stat(regpath, &details) ? -1 :
+		(long long)details.st_size;
+
+	if (result) {
+		fprintf(stderr, "scale: %ld programs x %ld locations: %s\n",
+				fx->nprogs, fx->nlocs,
+				libxvman_strerror(result));
+	} else {
+		printf("scale: %ld programs x %ld locations, built in %.3f s, "
+				"registry %lld bytes\n", fx->nprogs,
+				fx->nlocs, build, regsize);
+		fprintf(json, "%s\n    {\"programs\": %ld, \"locations\": %ld, "
+				"\"build_s\": %.6f, \"registry_bytes\": %lld, "
+				"\"ops\": {", first ? "" : ",", fx->nprogs,
+				fx->nlocs, build, regsize);
+	}
+	for (int op = 0; !result && op < BENCH_OPS; ++op) {
+		bench_series_t *s = &series[op];
+		if (!s->n)
+			continue;
+		qsort(s->samples, s->n, sizeof(double), bench_cmp);
+		double sum = bench_sum(s);
+		printf("scale:   %-8s p50 %10.2f us  p99 %10.2f us  "
+				"%10.0f ops/s\n", bench_names[op],
+				bench_pct(s, 0.5) * 1e6,
+				bench_pct(s, 0.99) * 1e6, s->n / sum);
+		fprintf(json, "%s\n      \"%s\": {\"n\": %ld, \"p50_us\": "
+				"%.3f, \"p99_us\": %.3f, \"ops_per_s\": %.1f}",
+				op ? "," : "", bench_names[op], s->n,
+				bench_pct(s, 0.5) * 1e6,
+				bench_pct(s, 0.99) * 1e6, s->n / sum);
+	}
+	if (!result)
+		fputs("\n    }}", json);
+
+	for (int op = 0; op < BENCH_OPS; ++op)
+		free(series[op].samples);
+	free(names);
+	free(locs);
+	bench_rmtree(home);
+	return result ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long samples = argc > 1 ? atol(argv[1]) : BENCH_SAMPLES;
+	const char *path = getenv("XVMAN_BENCH_JSON");
+	bool full = getenv("XVMAN_BENCH_FULL") &&
+		strcmp(getenv("XVMAN_BENCH_FULL"), "1") == 0;
+	if (samples < 1) {
+		fprintf(stderr, "scale: at least one sample is needed\n");
+		return 1;
+	}
+
+	bench_fixture_t fixtures[sizeof(bench_full_progs) /
+		sizeof(bench_full_progs[0]) * sizeof(bench_full_locs) /
+		sizeof(bench_full_locs[0])];
+	size_t nfixtures = 0;
+	if (full) {
+		for (size_t p = 0; p < sizeof(bench_full_progs) /
+				sizeof(bench_full_progs[0]); ++p)
+			for (size_t l = 0; l < sizeof(bench_full_locs) /
+					sizeof(bench_full_locs[0]); ++l)
+				fixtures[nfixtures++] = (bench_fixture_t){
+					bench_full_progs[p],
+					bench_full_locs[l]};
+	} else {
+		nfixtures = sizeof(bench_grid) / sizeof(bench_grid[0]);
+		memcpy(fixtures, bench_grid, sizeof(bench_grid));
+	}
+
+	FILE *json = fopen(path ? path : BENCH_JSON, "w");
+	if (!json) {
+		fprintf(stderr, "scale: unable to write %s\n",
+				path ? path : BENCH_JSON);
+		return 1;
+	}
+
+	/* enough of the environment to tell two result files apart */
+	struct utsname uts;
+	uname(&uts);
+	time_t now = time(NULL);
+	fprintf(json, "{\n  \"version\": \"%d.%d.%d\", \"seed\": %u, "
+			"\"samples\": %ld, \"grid\": \"%s\",\n  \"kernel\": "
+			"\"%s\", \"machine\": \"%s\", \"cpus\": %ld, "
+			"\"time\": %lld,\n  \"fixtures\": [", MAJOR, MINOR,
+			BUILD_NUMBER, BENCH_SEED, samples,
+			full ? "full" : "default", uts.release, uts.machine,
+			sysconf(_SC_NPROCESSORS_ONLN), (long long)now);
+	printf("scale: %ld samples per operation, seed %#x, %s grid\n",
+			samples, BENCH_SEED, full ? "full" : "default");
+
+	int result = 0;
+	for (size_t i = 0; !result && i < nfixtures; ++i)
+		result = bench_fixture(&fixtures[i], samples, json, i == 0);
+	fputs("\n  ]\n}\n", json);
+	if (fclose(json))
+		result = -1;
+
+	printf("scale: results written to %s\n", path ? path : BENCH_JSON);
+	return result ? 1 : 0;
+}
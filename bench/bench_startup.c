@@ -0,0 +1,75 @@
+/**
+ * @file bench_startup.c
+ * @brief Latency benchmark of the start up of xvman.
+ *
+ * Measures xvman_setup_prereq() along with the release of the resources it
+ * takes, once with the full setup forced on every run by removing the setup
+ * stamp and once on the fast path taken when the stamp is in place. The
+ * setup runs inside a temporary HOME.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/xvman.h"
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS 2000
+
+/* run the setup n times, returns the average time of a run in seconds */
+static double bench_setup(long n, const char *stamp)
+{
+	xvmanconf_t config;
+	double total = 0;
+	for (long i = 0; i < n; ++i) {
+		if (stamp)
+			unlink(stamp);
+		double start = bench_now();
+		if (xvman_setup_prereq(&config)) {
+			fprintf(stderr, "startup: setup failed\n");
+			exit(1);
+		}
+		xvman_free_mem();
+		total += bench_now() - start;
+	}
+	return total / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RUNS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX";
+	if (!mkdtemp(home) || setenv("HOME", home, 1)) {
+		fprintf(stderr, "startup: unable to set up a temporary HOME\n");
+		return 1;
+	}
+	char stamp[PATH_MAX];
+	snprintf(stamp, sizeof(stamp), "%s/%s/%s", home, CONFDIR,
+			SETUP_STAMP);
+
+	/* the setup greets on the first run and says goodbye on every one */
+	fflush(stdout);
+	int out = dup(STDOUT_FILENO);
+	int null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+
+	double full = bench_setup(n, stamp);
+	double fast = bench_setup(n, NULL);
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+
+	printf("startup: %ld runs\n", n);
+	printf("startup: full setup     %10.2f us/run\n", full * 1e6);
+	printf("startup: stamped setup  %10.2f us/run (%.1fx)\n", fast * 1e6,
+			full / fast);
+
+	bench_rmtree(home);
+	return 0;
+}
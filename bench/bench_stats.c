@@ -0,0 +1,47 @@
+/**
+ * @file bench_stats.c
+ * @brief Benchmark of the instrumentation left in the hot paths.
+ *
+ * Times a phase with a count inside it, the way every open along the add path
+ * is instrumented, once with the instrumentation disabled as it is by default
+ * and once enabled, where every phase reads /proc/self/io twice.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/stats.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_RUNS 1000000
+#define BENCH_ENABLED_RUNS 20000
+
+static double bench_run(long n)
+{
+	double start = bench_now();
+	for (long i = 0; i < n; ++i) {
+		stats_begin(STATS_LINK);
+		stats_count(STATS_OPENS);
+		stats_end(STATS_LINK);
+	}
+	return (bench_now() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RUNS;
+
+	double disabled = bench_run(n);
+
+	/* the report goes nowhere visible, only the cost of the phases is of
+	 * interest here */
+	stats_enable("bench", "/dev/null");
+	double enabled = bench_run(BENCH_ENABLED_RUNS);
+	stats_report();
+
+	printf("stats: %ld phases\n", n);
+	printf("stats: disabled          %10.3f ns/phase\n", disabled * 1e9);
+	printf("stats: enabled           %10.3f ns/phase\n", enabled * 1e9);
+	return 0;
+}
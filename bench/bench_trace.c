@@ -0,0 +1,60 @@
+/**
+ * @file bench_trace.c
+ * @brief Benchmark of the spans left in the hot paths.
+ *
+ * Calls a function holding a span the way registry_lookup does, against the
+ * same function without one, once with the tracer stopped as it is by
+ * default and once writing the trace into /dev/null.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/trace.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_RUNS 10000000
+#define BENCH_TRACED_RUNS 200000
+
+static __attribute__((noinline)) long bench_plain(long v)
+{
+	__asm__ volatile("" : "+r"(v));
+	return v + 1;
+}
+
+static __attribute__((noinline)) long bench_span(long v)
+{
+	trace_span("bench.span");
+
+	__asm__ volatile("" : "+r"(v));
+	return v + 1;
+}
+
+static double bench_run(long (*fn)(long), long n, long *sum)
+{
+	double start = bench_now();
+	for (long i = 0; i < n; ++i)
+		*sum += fn(i);
+	return (bench_now() - start) / n;
+}
+
+int main(int argc, char *argv[])
+{
+	long n = argc > 1 ? atol(argv[1]) : BENCH_RUNS;
+	long sum = 0;
+
+	double plain = bench_run(bench_plain, n, &sum);
+	double stopped = bench_run(bench_span, n, &sum);
+
+	trace_start("/dev/null", "bench");
+	double traced = bench_run(bench_span, BENCH_TRACED_RUNS, &sum);
+	trace_stop();
+
+	printf("trace: %ld calls (%ld)\n", n, sum % 2);
+	printf("trace: no span           %10.3f ns/call\n", plain * 1e9);
+	printf("trace: span, stopped     %10.3f ns/call (+%.3f ns)\n",
+			stopped * 1e9, (stopped - plain) * 1e9);
+	printf("trace: span, tracing     %10.3f ns/call\n", traced * 1e9);
+	return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file bench_version.c
+ * @brief Benchmark of the version ranking of install locations.
+ *
+ * Computes the sort keys of 100,000 generated install locations ten times
+ * over first.
+ * Then registers 1,000 releases of a program in a shuffled order inside a
+ * temporary HOME, switching it to the automatic selection mode after the
+ * first one so that the rest are ranked as they come. Times the additions,
+ * the look up of the default release and the ranking of the whole list when
+ * the program is switched back to that mode.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "../inc/version.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_KEYS 100000
+#define BENCH_ROUNDS 10
+#define BENCH_PATH 48
+#define BENCH_RELEASES 1000
+#define BENCH_LOOKUPS 100000
+
+/* release n of the program, every tenth one a release candidate */
+static int bench_release(char *path, const char *home, long n)
+{
+	return snprintf(path, PATH_MAX, "%s/opt/tool-v%ld.%ld.%ld%s/bin/tool",
+			home, n / 100, n / 10 % 10, n % 10, n % 10 == 9 ?
+			"-rc1" : "");
+}
+
+static int bench_install(const char *path)
+{
+	char dir[PATH_MAX];
+	snprintf(dir, PATH_MAX, "%s", path);
+	for (char *slash = strchr(dir + 1, '/'); slash;
+			slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		mkdir(dir, S_IRWXU);
+		*slash = '/';
+	}
+	return bench_touch(path, S_IRWXU);
+}
+
+int main(int argc, char *argv[])
+{
+	long nreleases = argc > 1 ? atol(argv[1]) : BENCH_RELEASES;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX", path[PATH_MAX];
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "version: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	/* the releases are generated oldest first, so are their keys */
+	char (*paths)[BENCH_PATH] = calloc(BENCH_KEYS, BENCH_PATH);
+	int *lens = calloc(BENCH_KEYS, sizeof(int));
+	for (long n = 0; paths && lens && n < BENCH_KEYS; ++n)
+		lens[n] = snprintf(paths[n], BENCH_PATH,
+				"/opt/tool-v%ld.%ld.%ld%s/bin/tool", n / 100,
+				n / 10 % 10, n % 10, n % 10 == 9 ? "-rc1" : "");
+	uint64_t last = 0;
+	bool sorted = paths && lens;
+	double start = bench_now();
+	for (int r = 0; sorted && r < BENCH_ROUNDS; ++r) {
+		last = 0;
+		for (long n = 0; n < BENCH_KEYS; ++n) {
+			uint64_t key = version_key(paths[n], lens[n]);
+			sorted = sorted && key > last;
+			last = key;
+		}
+	}
+	double tkeys = bench_now() - start;
+	free(paths);
+	free(lens);
+
+	/* every 7th release after the other, or every 11th one for a number
+	 * of releases which 7 divides, visits all of them shuffled */
+	long step = nreleases % 7 ? 7 : 11;
+	int result = 0;
+	for (long n = 0; !result && n < nreleases; ++n) {
+		bench_release(path, home, n);
+		result = bench_install(path);
+	}
+	libxvman_t *ctx = NULL;
+	if (!result)
+		result = libxvman_open(&ctx, home, 0);
+	start = bench_now();
+	for (long i = 0, n = 0; !result && i < nreleases; ++i) {
+		n = (n + step) % nreleases;
+		bench_release(path, home, n);
+		result = libxvman_add(ctx, "tool", path);
+		if (!result && !i)
+			result = libxvman_auto(ctx, "tool");
+	}
+	double tadd = bench_now() - start;
+
+	char current[PATH_MAX];
+	start = bench_now();
+	for (long i = 0; !result && i < BENCH_LOOKUPS; ++i)
+		result = libxvman_current(ctx, "tool", current, PATH_MAX);
+	double tcurrent = bench_now() - start;
+
+	long newest = nreleases - 1;
+	bench_release(path, home, newest);
+	bool chosen = !result && strcmp(current, path) == 0;
+
+	bench_release(path, home, 0);
+	if (!result)
+		result = libxvman_select(ctx, "tool", path);
+	start = bench_now();
+	if (!result)
+		result = libxvman_auto(ctx, "tool");
+	double tauto = bench_now() - start;
+	if (!result)
+		result = libxvman_current(ctx, "tool", current, PATH_MAX);
+	bench_release(path, home, newest);
+	chosen = chosen && !result && strcmp(current, path) == 0;
+	if (result)
+		fprintf(stderr, "version: %s\n", libxvman_strerror(result));
+
+	printf("version: %d keys, %ld releases\n", BENCH_KEYS, nreleases);
+	printf("version: keys     %10.3f ns per location\n",
+			tkeys * 1e9 / BENCH_KEYS / BENCH_ROUNDS);
+	printf("version: add      %10.3f us per release, ranked\n",
+			tadd * 1e6 / nreleases);
+	printf("version: current  %10.3f us per look up\n",
+			tcurrent * 1e6 / BENCH_LOOKUPS);
+	printf("version: auto     %10.3f ms to rank all releases\n",
+			tauto * 1e3);
+	printf("version: default  %s\n", chosen ? "newest release" :
+			"wrong release");
+
+	libxvman_close(ctx);
+	bench_rmtree(home);
+	return result || !sorted || !chosen ? 1 : 0;
+}
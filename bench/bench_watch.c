@@ -0,0 +1,159 @@
+/**
+ * @file bench_watch.c
+ * @brief Benchmark of the watch of an install root.
+ *
+ * Lays out 200 vendor directories with a bin directory of ten executables
+ * named after registered programs inside a temporary HOME and watches them.
+ * The catch up of the first update is timed, then the time from the install
+ * of a release to the registry holding it, then a burst of 100 releases and
+ * the removal of all of them. The processor time spent while nothing changes
+ * is measured last.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "bench.h"
+
+#include <linux/limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_VENDORS 200
+#define BENCH_PROGS 10
+#define BENCH_BURST 100
+#define BENCH_IDLE 500
+
+/* installs <home>/opt/vendor-<first>.0/bin/prog<n> and up */
+static int bench_install(const char *home, long first, long n)
+{
+	char path[PATH_MAX];
+	int result = 0;
+	for (long v = first; !result && v < first + n; ++v) {
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0", home, v);
+		mkdir(path, S_IRWXU);
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0/bin", home, v);
+		mkdir(path, S_IRWXU);
+		for (int p = 0; !result && p < BENCH_PROGS; ++p) {
+			snprintf(path, PATH_MAX,
+					"%s/opt/vendor-%ld.0/bin/prog%d",
+					home, v, p);
+			result = bench_touch(path, S_IRWXU);
+		}
+	}
+	return result;
+}
+
+static int bench_uninstall(const char *home, long first, long n)
+{
+	char path[PATH_MAX];
+	for (long v = first; v < first + n; ++v) {
+		snprintf(path, PATH_MAX, "%s/opt/vendor-%ld.0", home, v);
+		bench_rmtree(path);
+	}
+	return 0;
+}
+
+static int bench_count(const libxvman_op_t *op, int status, void *arg)
+{
+	long *counts = arg;
+	counts[status ? 2 : op->op == LIBXVMAN_MISSING]++;
+	return 0;
+}
+
+/* wait for the watch and update till it is quiet, counting the updates */
+static double bench_sync(libxvman_watch_t *watch, long *counts, long *nsyncs)
+{
+	struct pollfd pfd = {libxvman_watch_fd(watch), POLLIN, 0};
+	double start = bench_now(), done = start;
+	counts[0] = counts[1] = counts[2] = 0;
+	*nsyncs = 0;
+	while (poll(&pfd, 1, *nsyncs ? 0 : 1000) > 0) {
+		if (libxvman_watch_process(watch, bench_count, counts))
+			return -1;
+		done = bench_now();
+		(*nsyncs)++;
+	}
+	return done - start;
+}
+
+int main(int argc, char *argv[])
+{
+	long nvendors = argc > 1 ? atol(argv[1]) : BENCH_VENDORS;
+	char home[] = "/tmp/xvman-bench-home.XXXXXX", path[PATH_MAX];
+	if (!mkdtemp(home)) {
+		fprintf(stderr, "watch: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	/* every program starts out with a location of its own */
+	libxvman_t *ctx = NULL;
+	libxvman_watch_t *watch = NULL;
+	snprintf(path, PATH_MAX, "%s/opt", home);
+	int result = mkdir(path, S_IRWXU) || bench_install(home, 0,
+			nvendors) ? LIBXVMAN_ESETUP : libxvman_open(&ctx, home,
+				0);
+	for (int p = 0; !result && p < BENCH_PROGS; ++p) {
+		char pname[16];
+		snprintf(pname, sizeof(pname), "prog%d", p);
+		snprintf(path, PATH_MAX, "%s/opt/vendor-0.0/bin/%s", home,
+				pname);
+		result = libxvman_add(ctx, pname, path);
+	}
+	if (!result)
+		result = libxvman_watch_open(ctx, &watch);
+	snprintf(path, PATH_MAX, "%s/opt", home);
+	if (!result)
+		result = libxvman_watch_add(watch, path, "*/bin/*");
+
+	long caught[3] = {0, 0, 0}, one[3], burst[3], gone[3];
+	double start = bench_now();
+	if (!result)
+		result = libxvman_watch_process(watch, bench_count, caught);
+	double tcatch = bench_now() - start;
+
+	double tone = -1, tburst = -1, tgone = -1;
+	long oncesyncs = 0, burstsyncs = 0, gonesyncs = 0;
+	if (!result && !bench_install(home, nvendors, 1))
+		tone = bench_sync(watch, one, &oncesyncs);
+	if (tone >= 0 && !bench_install(home, nvendors + 1, BENCH_BURST))
+		tburst = bench_sync(watch, burst, &burstsyncs);
+	if (tburst >= 0 && !bench_uninstall(home, nvendors + 1, BENCH_BURST))
+		tgone = bench_sync(watch, gone, &gonesyncs);
+	if (result)
+		fprintf(stderr, "watch: %s\n", libxvman_strerror(result));
+
+	/* nothing changes, the process sleeps in poll() */
+	struct rusage before, after;
+	struct pollfd pfd = {libxvman_watch_fd(watch), POLLIN, 0};
+	getrusage(RUSAGE_SELF, &before);
+	int woken = watch ? poll(&pfd, 1, BENCH_IDLE) : -1;
+	getrusage(RUSAGE_SELF, &after);
+	double idle = (after.ru_utime.tv_sec - before.ru_utime.tv_sec +
+			after.ru_stime.tv_sec - before.ru_stime.tv_sec) * 1e3 +
+		(after.ru_utime.tv_usec - before.ru_utime.tv_usec +
+		 after.ru_stime.tv_usec - before.ru_stime.tv_usec) / 1e3;
+
+	printf("watch: %ld releases of %d programs\n", nvendors, BENCH_PROGS);
+	printf("watch: catch up  %10.3f ms (%ld added)\n", tcatch * 1e3,
+			caught[0]);
+	printf("watch: install   %10.3f ms (%ld added, %ld updates)\n",
+			tone * 1e3, one[0], oncesyncs);
+	printf("watch: burst     %10.3f ms (%ld added, %ld updates)\n",
+			tburst * 1e3, burst[0], burstsyncs);
+	printf("watch: removal   %10.3f ms (%ld missing, %ld updates)\n",
+			tgone * 1e3, gone[1], gonesyncs);
+	printf("watch: idle      %10.3f ms of processor time in %d ms\n",
+			idle, BENCH_IDLE);
+
+	libxvman_watch_close(watch);
+	libxvman_close(ctx);
+	bench_rmtree(home);
+	return result || tgone < 0 || woken || one[0] != BENCH_PROGS ||
+		burst[0] != BENCH_BURST * BENCH_PROGS || gone[1] != burst[0] ||
+		caught[2] + one[2] + burst[2] + gone[2] ? 1 : 0;
+}
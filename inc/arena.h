@@ -0,0 +1,97 @@
+/**
+ * @file arena.h
+ * @brief Per-command bump allocator.
+ * @details The memory a command needs for its whole run, like the lines of a
+ * file it reads and the install locations it collects, is carved out of large
+ * chunks and released in one go with arena_reset(). Nothing allocated from an
+ * arena is freed on its own.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Default size of a chunk, larger allocations get a chunk of their own.
+ */
+#define ARENA_CHUNK (64 * 1024)
+
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * @brief Arena along with its counters.
+ */
+typedef struct {
+	arena_chunk_t *head;		/* chunk allocations are made from */
+	void *last;			/* latest allocation, can grow in place */
+	size_t nallocs;			/* allocations since the arena was set up */
+	size_t bytes;			/* bytes allocated since then */
+	size_t nchunks;			/* chunks currently held */
+	size_t nresets;			/* resets since then */
+} arena_t;
+
+/**
+ * @brief Allocate zeroed memory from the arena.
+ *
+ * @param arena - pointer to the arena, zero initialized before the first use.
+ * @param size - size of the allocation in bytes.
+ *
+ * @return Returns a pointer aligned for any type, NULL on failure.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Grow an allocation made from the arena.
+ *
+ * The latest allocation grows in place when its chunk has room left, any
+ * other one is copied over to a new allocation.
+ *
+ * @param arena - pointer to the arena.
+ * @param ptr - pointer to the allocation, NULL for a new one.
+ * @param old - current size of the allocation.
+ * @param size - new size of the allocation, the new part is zeroed.
+ *
+ * @return Returns a pointer to the grown allocation, NULL on failure.
+ */
+void *arena_grow(arena_t *arena, void *ptr, size_t old, size_t size);
+
+/**
+ * @brief Copy a string into the arena.
+ *
+ * @param arena - pointer to the arena.
+ * @param s - string to be copied.
+ * @param len - number of characters to copy.
+ *
+ * @return Returns the terminated copy, NULL on failure.
+ */
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+
+/**
+ * @brief Read everything left in a file into the arena.
+ *
+ * @param arena - pointer to the arena.
+ * @param fd - descriptor of the file.
+ * @param len - pointer filled with the number of bytes read.
+ *
+ * @return Returns the terminated contents, NULL on failure.
+ */
+char *arena_read(arena_t *arena, int fd, size_t *len);
+
+/**
+ * @brief Release everything allocated from the arena.
+ *
+ * The first chunk is kept for the next command, the counters go on.
+ *
+ * @param arena - pointer to the arena.
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * @brief Release the arena along with all its chunks.
+ *
+ * @param arena - pointer to the arena.
+ */
+void arena_free(arena_t *arena);
+
+#endif
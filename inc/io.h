@@ -8,7 +8,10 @@
  * @brief Function to create the directories specified in the path.
  *
  * This function can be used to create a single directory as well as to create
- * all the directories provided in the path.
+ * all the directories provided in the path. Absolute paths, paths relative to
+ * the current directory and paths starting with ~ for the $HOME directory are
+ * accepted. The recursive creation resolves every component of the path only
+ * once, walking down from the descriptor of the parent directory.
  *
  * @param path - string containing the path to the directory.
  * @param mode - mode type for the directory to be created.
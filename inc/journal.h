@@ -0,0 +1,170 @@
+/**
+ * @file journal.h
+ * @brief Write-ahead journal of the registry updates.
+ * @details An update touches the registry and the symlinks of the custom
+ * binary directory in separate steps. The complete new install locations of
+ * the programs are appended to the journal and synced to disk first, then
+ * the update is applied and marked as done. Updates left incomplete by a
+ * crash are replayed from the journal when xvman starts up.
+ *
+ * The journal is a text file made of the following records, one per line,
+ * with an empty line ahead of every transaction:
+ *   B <programs>                   start of a transaction
+ *   R <locations> <flags> <program>
+ *                                  program along with its location count
+ *   K <added> <flags> <priority> <version> <location>
+ *                                  install location, active first
+ *   C                              end of a transaction
+ *   D <offset> <boot>              transaction at the offset is done
+ *   A <offset>                     transaction at the offset is abandoned
+ *
+ * Journals written before the programs had flags and the locations had
+ * priorities hold the records P <locations> <program> and L <added> <flags>
+ * <location> instead, which are still read. The version of such a location
+ * is worked out from its path again.
+ *
+ * A transaction is written with a single append and synced once, no matter
+ * how many programs it holds. The done records are not synced, and neither
+ * are the registry and the symlinks they vouch for, so a done record only
+ * counts during the boot it was written in. After a reboot, clean or not,
+ * every transaction since the last checkpoint is replayed, which applies the
+ * same state once more and does no harm. A transaction which changed nothing
+ * is abandoned instead and never replayed.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "../inc/registry.h"
+
+#include <linux/limits.h>
+#include <sys/types.h>
+
+/**
+ * @brief Size past which the journal gets truncated after syncing the
+ * registry and the custom binary directory.
+ */
+#define JOURNAL_CHECKPOINT (16 * 1024)
+
+/**
+ * @brief Size of the boot identifier along with its terminator.
+ */
+#define JOURNAL_BOOT_LEN 40
+
+/**
+ * @brief Handle to an opened journal.
+ */
+typedef struct {
+	int fd;				/* descriptor of the journal file */
+	char path[PATH_MAX];		/* path of the journal file */
+	char boot[JOURNAL_BOOT_LEN];	/* identifier of the current boot,
+					   empty when unknown */
+} journal_t;
+
+/**
+ * @brief Callback applying a replayed transaction.
+ *
+ * @param progs - programs of the transaction with their complete location
+ * lists, valid only during the call.
+ * @param n - number of programs.
+ * @param arg - argument passed to journal_replay().
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+typedef int (*journal_apply_t)(const regprog_t *progs, size_t n, void *arg);
+
+/**
+ * @brief Open the journal, creating an empty one if it does not exist.
+ *
+ * @param jnl - pointer to the journal handle to be filled.
+ * @param path - string containing the path of the journal file.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int journal_open(journal_t *jnl, const char *path);
+
+/**
+ * @brief Close the journal.
+ *
+ * @param jnl - pointer to the journal handle.
+ */
+void journal_close(journal_t *jnl);
+
+/**
+ * @brief Record an update of a set of programs and sync it to disk.
+ *
+ * Has to be called with the programs locked, before the update is applied.
+ *
+ * @param jnl - pointer to the journal handle.
+ * @param progs - array of programs along with their complete location lists.
+ * @param n - number of programs in the array.
+ * @param txn - pointer filled with the offset identifying the transaction.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int journal_commit(journal_t *jnl, const regprog_t *progs, size_t n,
+		off_t *txn);
+
+/**
+ * @brief Mark a transaction as done.
+ *
+ * @param jnl - pointer to the journal handle.
+ * @param txn - offset of the transaction returned by journal_commit().
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int journal_done(journal_t *jnl, off_t txn);
+
+/**
+ * @brief Mark a transaction as abandoned, when none of its update has been
+ * applied.
+ *
+ * @param jnl - pointer to the journal handle.
+ * @param txn - offset of the transaction returned by journal_commit().
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int journal_abandon(journal_t *jnl, off_t txn);
+
+/**
+ * @brief Replay the transactions which are not done yet.
+ *
+ * A program is only replayed out of the latest transaction touching it. The
+ * replayed transactions are marked as done, whether the callback succeeds or
+ * not. When the callback is NULL the pending transactions are only counted.
+ * The transactions marked as done during an earlier boot, or during this one
+ * when it is unknown, are pending again.
+ *
+ * The whole registry has to be locked with registry_lock() while replaying,
+ * so that no transaction in progress is taken for an interrupted one.
+ *
+ * @param jnl - pointer to the journal handle.
+ * @param apply - callback applying a transaction, can be NULL.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns the number of pending transactions, -1 on failure.
+ */
+int journal_replay(journal_t *jnl, journal_apply_t apply, void *arg);
+
+/**
+ * @brief Get the current size of the journal.
+ *
+ * @param jnl - pointer to the journal handle.
+ *
+ * @return Returns the size in bytes, -1 on failure.
+ */
+off_t journal_size(const journal_t *jnl);
+
+/**
+ * @brief Drop all the records of the journal.
+ *
+ * Every transaction has to be done and its effects synced to disk, with the
+ * whole registry locked.
+ *
+ * @param jnl - pointer to the journal handle.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int journal_reset(journal_t *jnl);
+
+#endif
@@ -0,0 +1,549 @@
+/**
+ * @file libxvman.h
+ * @brief Embeddable C API of xvman.
+ * @details The library keeps the registry, the journal and the custom binary
+ * directory open in a context handle, so that a process can switch any number
+ * of programs without starting xvman for each of them. Nothing is printed,
+ * every call returns LIBXVMAN_OK or one of the negative error codes below,
+ * which libxvman_strerror() turns into a message.
+ *
+ * Build with `make lib`, which produces build/libxvman.a and
+ * build/libxvman.so from release objects; the shared library exports the
+ * libxvman_ calls only. The xvman command line is a client of this API.
+ *
+ * The calls on a single context must not be made from several threads at
+ * once, separate contexts and separate processes may work on the same
+ * registry concurrently.
+ */
+
+#ifndef LIBXVMAN_H
+#define LIBXVMAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Marks the calls of the API, the only symbols the shared library
+ * exports.
+ */
+#define LIBXVMAN_API __attribute__((visibility("default")))
+
+/**
+ * @brief Error codes returned by the library.
+ */
+enum libxvman_err {
+	LIBXVMAN_OK = 0,		/* success */
+	LIBXVMAN_EINVAL = -1,		/* invalid argument */
+	LIBXVMAN_ENOMEM = -2,		/* out of memory */
+	LIBXVMAN_ESETUP = -3,		/* unable to open the configuration */
+	LIBXVMAN_EREADONLY = -4,	/* context opened for reading only */
+	LIBXVMAN_ELOCK = -5,		/* unable to lock the registry */
+	LIBXVMAN_ENOPROG = -6,		/* program not registered */
+	LIBXVMAN_ENOLOC = -7,		/* install location not registered */
+	LIBXVMAN_EEXIST = -8,		/* install location already added */
+	LIBXVMAN_EMISSING = -9,		/* install location does not exist */
+	LIBXVMAN_EJOURNAL = -10,	/* unable to write the journal */
+	LIBXVMAN_EREGISTRY = -11,	/* unable to update the registry */
+	LIBXVMAN_ELINK = -12		/* unable to switch the symlink */
+};
+
+/**
+ * @brief Flags of libxvman_open().
+ */
+enum libxvman_flags {
+	LIBXVMAN_READONLY = 1 << 0	/* map the registry for reading only,
+					   nothing is created or locked */
+};
+
+/**
+ * @brief Flags of libxvman_doctor().
+ */
+enum libxvman_doctor_flags {
+	LIBXVMAN_DOCTOR_FIX = 1 << 0	/* repair what is found */
+};
+
+/**
+ * @brief Opaque context handle.
+ */
+typedef struct libxvman libxvman_t;
+
+/**
+ * @brief Opaque handle of a watch of install roots.
+ */
+typedef struct libxvman_watch libxvman_watch_t;
+
+/**
+ * @brief View of an install location, valid only during the callback it is
+ * passed to.
+ */
+typedef struct {
+	const char *path;		/* install location */
+	size_t len;			/* length of the install location */
+	int64_t added;			/* time at which the location was added */
+	int32_t priority;		/* priority given when it was added */
+	int missing;			/* set while flagged missing */
+} libxvman_loc_t;
+
+/**
+ * @brief Kind of an operation.
+ */
+typedef enum {
+	LIBXVMAN_ADD,			/* add the location, which becomes the
+					   default one unless it ranks below it
+					   in the automatic selection mode, or
+					   bring back one flagged missing */
+	LIBXVMAN_SELECT,		/* make a registered location default,
+					   leaving the automatic selection */
+	LIBXVMAN_REMOVE,		/* remove a registered location */
+	LIBXVMAN_MISSING		/* flag a registered location missing,
+					   keeping it */
+} libxvman_opcode_t;
+
+/**
+ * @brief Operation on a program, as taken by libxvman_apply().
+ */
+typedef struct {
+	libxvman_opcode_t op;		/* operation to be applied */
+	const char *pname;		/* name of the program */
+	const char *ilocation;		/* install location */
+	int32_t priority;		/* priority of a location added */
+} libxvman_op_t;
+
+/**
+ * @brief Callback receiving the install locations of a program, the default
+ * one first.
+ *
+ * @return Return 0 to go on, anything else stops the iteration.
+ */
+typedef int (*libxvman_loc_cb)(const libxvman_loc_t *loc, void *arg);
+
+/**
+ * @brief Callback receiving a registered program along with its default
+ * install location and the number of its install locations.
+ *
+ * @return Return 0 to go on, anything else stops the iteration.
+ */
+typedef int (*libxvman_prog_cb)(const char *pname, const libxvman_loc_t *loc,
+		size_t nlocs, void *arg);
+
+/**
+ * @brief Kind of a problem found by libxvman_doctor().
+ */
+typedef enum {
+	LIBXVMAN_ISSUE_MISSING,		/* install location does not exist and
+					   is not flagged missing yet */
+	LIBXVMAN_ISSUE_NOLINK,		/* program has no symlink */
+	LIBXVMAN_ISSUE_MISMATCH,	/* symlink is not the default location */
+	LIBXVMAN_ISSUE_DANGLING,	/* symlink points at nothing */
+	LIBXVMAN_ISSUE_STRAY		/* symlink of an unregistered program */
+} libxvman_issue_t;
+
+/**
+ * @brief Problem found by libxvman_doctor(), valid only during the callback
+ * it is passed to.
+ */
+typedef struct {
+	libxvman_issue_t issue;		/* kind of the problem */
+	const char *pname;		/* name of the program */
+	const char *path;		/* install location missing or target of
+					   the symlink, NULL for a file which is
+					   not a symlink */
+	const char *expected;		/* default install location, NULL for
+					   a missing location or an
+					   unregistered program */
+	int fixed;			/* set if repaired */
+} libxvman_finding_t;
+
+/**
+ * @brief Callback receiving a problem found.
+ *
+ * @return Return 0 to go on, anything else stops the report.
+ */
+typedef int (*libxvman_issue_cb)(const libxvman_finding_t *finding,
+		void *arg);
+
+/**
+ * @brief Policy of libxvman_prune() for the install locations which exist.
+ */
+typedef struct {
+	uint32_t keep;			/* install locations kept per program,
+					   0 for no limit */
+	int64_t before;			/* only the locations added before this
+					   time are pruned, 0 for any time */
+} libxvman_policy_t;
+
+/**
+ * @brief What libxvman_prune() has removed.
+ */
+typedef struct {
+	size_t programs;		/* programs rewritten */
+	size_t entries;			/* install locations removed */
+	size_t bytes;			/* bytes of the registry reclaimed */
+} libxvman_pruned_t;
+
+/**
+ * @brief Callback receiving an executable found by libxvman_discover().
+ *
+ * @param pname - name of the program the executable belongs to.
+ * @param path - install location found.
+ * @param status - LIBXVMAN_OK if registered, LIBXVMAN_EEXIST if registered
+ * already, another error code if it could not be registered.
+ * @param arg - argument given to libxvman_discover().
+ *
+ * @return Return 0 to go on, anything else stops the report.
+ */
+typedef int (*libxvman_found_cb)(const char *pname, const char *path,
+		int status, void *arg);
+
+/**
+ * @brief Callback receiving a change made by libxvman_watch_process(): an
+ * addition of a version installed or back again, a version gone flagged
+ * missing or a selection of the default install location for a symlink put
+ * back.
+ *
+ * @param op - operation made.
+ * @param status - LIBXVMAN_OK if made, an error code otherwise.
+ * @param arg - argument given to libxvman_watch_process().
+ *
+ * @return Return 0 to go on, anything else stops the report.
+ */
+typedef int (*libxvman_change_cb)(const libxvman_op_t *op, int status,
+		void *arg);
+
+/**
+ * @brief Open a context.
+ *
+ * Creates the configuration and the custom binary directories when needed,
+ * opens the registry and finishes the updates a crashed run has left in the
+ * journal. Setting up the shell of the user is left to the caller.
+ *
+ * @param ctx - pointer filled with the new context.
+ * @param home - string containing the directory the configuration lives in,
+ * NULL for $HOME.
+ * @param flags - bitwise or of enum libxvman_flags.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_open(libxvman_t **ctx, const char *home, int flags);
+
+/**
+ * @brief Close a context and release everything it holds.
+ *
+ * @param ctx - pointer to the context, can be NULL.
+ */
+LIBXVMAN_API void libxvman_close(libxvman_t *ctx);
+
+/**
+ * @brief Add an install location to a program.
+ *
+ * A program starts out in the manual selection mode, where the new install
+ * location becomes the default one. Once libxvman_auto() has been called for
+ * it, its install locations are kept ranked by their priority, then by the
+ * version their path names, then by the time they were added, and the one
+ * ranking highest is the default one; an install location ranking below it is
+ * then added without switching the symlink.
+ * An install location registered already which is flagged missing is brought
+ * back instead, keeping its priority and the time it was added.
+ * The same as libxvman_add_priority() with the priority 0.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param ilocation - string containing the install location, which has to
+ * exist.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_add(libxvman_t *ctx, const char *pname,
+		const char *ilocation);
+
+/**
+ * @brief Add an install location to a program with the given priority.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param ilocation - string containing the install location, which has to
+ * exist.
+ * @param priority - priority of the install location, a higher one wins over
+ * any version in the automatic selection mode.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_add_priority(libxvman_t *ctx, const char *pname,
+		const char *ilocation, int32_t priority);
+
+/**
+ * @brief Make a registered install location of a program the default one.
+ *
+ * The program is switched to the manual selection mode, so the choice sticks
+ * until libxvman_auto() is called for it. An install location flagged missing
+ * can not be made the default one.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param ilocation - string containing the install location.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_select(libxvman_t *ctx, const char *pname,
+		const char *ilocation);
+
+/**
+ * @brief Switch a program to the automatic selection mode.
+ *
+ * The install locations are ranked once here and the one ranking highest
+ * becomes the default one. Programs are in the manual selection mode until
+ * then.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_auto(libxvman_t *ctx, const char *pname);
+
+/**
+ * @brief Remove a registered install location of a program.
+ *
+ * The next install location becomes the default one when the default one is
+ * removed, the program is removed along with its symlink when no install
+ * location is left.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param ilocation - string containing the install location.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_remove(libxvman_t *ctx, const char *pname,
+		const char *ilocation);
+
+/**
+ * @brief Apply a set of operations in one go.
+ *
+ * The operations are grouped by program and applied in the given order on
+ * top of the registered install locations. All the programs are written in a
+ * single transaction and every symlink is switched at most once.
+ *
+ * @param ctx - pointer to the context.
+ * @param ops - array of operations.
+ * @param n - number of operations.
+ * @param results - array receiving the result of every operation, can be
+ * NULL.
+ *
+ * @return Returns LIBXVMAN_OK if all the operations succeeded, the error code
+ * of the first failed operation otherwise.
+ */
+LIBXVMAN_API int libxvman_apply(libxvman_t *ctx, const libxvman_op_t *ops,
+		size_t n, int *results);
+
+/**
+ * @brief Iterate over the install locations of a program, the default one
+ * first.
+ *
+ * The default install location is the first one which is not flagged missing,
+ * or the first one when all of them are. The symlink points at it.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param cb - callback receiving every install location.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_query(libxvman_t *ctx, const char *pname,
+		libxvman_loc_cb cb, void *arg);
+
+/**
+ * @brief Copy the default install location of a program.
+ *
+ * @param ctx - pointer to the context.
+ * @param pname - string containing the name of the program.
+ * @param buf - buffer receiving the install location.
+ * @param len - size of the buffer.
+ *
+ * @return Returns LIBXVMAN_OK on success, LIBXVMAN_EINVAL if the buffer is
+ * too small, another error code on failure.
+ */
+LIBXVMAN_API int libxvman_current(libxvman_t *ctx, const char *pname, char *buf,
+		size_t len);
+
+/**
+ * @brief Iterate over the registered programs, in no particular order.
+ *
+ * A program switched while iterating may be passed twice, once with the old
+ * and once with the new default install location.
+ *
+ * @param ctx - pointer to the context.
+ * @param cb - callback receiving every program.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_list(libxvman_t *ctx, libxvman_prog_cb cb, void *arg);
+
+/**
+ * @brief Check every registered program and the custom binary directory.
+ *
+ * Every install location is looked up and the symlink of every program is
+ * compared with its default install location, spread over a pool of worker
+ * threads. The symlinks of the custom binary directory which belong to no
+ * program are reported as well.
+ *
+ * The install locations flagged missing already are not reported again,
+ * libxvman_prune() is the one removing them.
+ *
+ * With LIBXVMAN_DOCTOR_FIX the missing install locations are flagged missing
+ * in a single transaction, like LIBXVMAN_MISSING does, so they are kept for
+ * when they come back; every symlink is pointed at the default install
+ * location left, or deleted when none is left, and the stray symlinks
+ * pointing at nothing are deleted; the other stray symlinks are only
+ * reported. The whole registry is locked for
+ * the check and the repairs then, which a context for reading only can not
+ * do.
+ *
+ * @param ctx - pointer to the context.
+ * @param flags - bitwise or of enum libxvman_doctor_flags.
+ * @param cb - callback receiving every problem, once the repairs are done.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_doctor(libxvman_t *ctx, int flags,
+		libxvman_issue_cb cb, void *arg);
+
+/**
+ * @brief Remove the install locations which are no longer needed.
+ *
+ * The install locations which do not exist any more are always removed. A
+ * policy with either field set removes the existing ones as well, past the
+ * first keep of every program (the default location only, when keep is 0)
+ * and added before the given time. Every install location is looked up on a
+ * pool of worker threads, then only the programs which lose some are
+ * rewritten, all of them in a single transaction. The symlink of a program
+ * whose default location goes follows the next one.
+ *
+ * @param ctx - pointer to the context, which can not be for reading only.
+ * @param policy - pointer to the policy, NULL for the missing locations only.
+ * @param cb - callback receiving every install location removed along with
+ * the number of locations left to the program, can be NULL.
+ * @param arg - argument passed to the callback.
+ * @param pruned - pointer to the totals to be filled, can be NULL.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_prune(libxvman_t *ctx,
+		const libxvman_policy_t *policy, libxvman_prog_cb cb, void *arg,
+		libxvman_pruned_t *pruned);
+
+/**
+ * @brief Find the installed versions of the registered programs and register
+ * them.
+ *
+ * The directory tree under the root is walked by a pool of worker threads,
+ * one per processor, which take work from each other when they run out. The
+ * pattern is matched against the path of every file relative to the root, a
+ * level at a time the way fnmatch() does with FNM_PATHNAME and FNM_PERIOD,
+ * so only the directories the pattern can reach are walked and symlinks to
+ * directories are not followed. A match is kept if it is an executable
+ * regular file, symlinks followed, named after a registered program.
+ *
+ * The executables found are added with libxvman_apply() in a single
+ * transaction, those of a program in increasing order of version so that the
+ * latest one becomes the default install location.
+ *
+ * @param ctx - pointer to the context, which can not be for reading only.
+ * @param root - string containing the directory to be walked.
+ * @param pattern - string containing the pattern of the executables, made of
+ * one glob per level below the root separated by slashes.
+ * @param cb - callback receiving every executable found, can be NULL.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns LIBXVMAN_OK on success, the first error met while adding
+ * otherwise. The locations registered already are not an error.
+ */
+LIBXVMAN_API int libxvman_discover(libxvman_t *ctx, const char *root,
+		const char *pattern, libxvman_found_cb cb, void *arg);
+
+/**
+ * @brief Open a watch keeping the registry in step with install roots.
+ *
+ * The custom binary directory is watched from the start, a symlink of a
+ * registered program removed from it is put back by the next update.
+ *
+ * @param ctx - pointer to the context, which can not be for reading only.
+ * @param watch - pointer filled with the new watch.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_watch_open(libxvman_t *ctx, libxvman_watch_t **watch);
+
+/**
+ * @brief Watch an install root.
+ *
+ * The root and pattern are those of libxvman_discover(), the directories the
+ * pattern reaches are watched with inotify. The next update walks the root
+ * once, registering the executables installed and flagging the install
+ * locations below the root which have gone while nobody was watching as
+ * missing.
+ *
+ * @param watch - pointer to the watch.
+ * @param root - string containing the directory to be watched.
+ * @param pattern - string containing the pattern of the executables, made of
+ * one glob per level below the root separated by slashes.
+ *
+ * @return Returns LIBXVMAN_OK on success, an error code on failure.
+ */
+LIBXVMAN_API int libxvman_watch_add(libxvman_watch_t *watch, const char *root,
+		const char *pattern);
+
+/**
+ * @brief Get the descriptor which becomes readable once there are changes.
+ *
+ * The descriptor is meant for poll() or the event loop of the caller, nothing
+ * is read from it but by libxvman_watch_process().
+ *
+ * @param watch - pointer to the watch.
+ *
+ * @return Returns the descriptor, -1 for no watch.
+ */
+LIBXVMAN_API int libxvman_watch_fd(const libxvman_watch_t *watch);
+
+/**
+ * @brief Bring the registry in step with the changes seen.
+ *
+ * Call it once the descriptor is readable. The burst of events is gathered
+ * till it has been quiet for a tenth of a second, two seconds at most, and
+ * makes a single libxvman_apply() transaction: the executables named after a
+ * registered program which have been installed are added, the latest version
+ * becoming the default one, and the install locations which have gone are
+ * flagged missing. They keep their history and are brought back when they
+ * show up again, libxvman_prune() removes them for good. The symlinks removed
+ * from the custom binary directory are put back afterwards. Events lost by
+ * inotify make the roots walked again.
+ *
+ * @param watch - pointer to the watch.
+ * @param cb - callback receiving every change made, can be NULL.
+ * @param arg - argument passed to the callback.
+ *
+ * @return Returns LIBXVMAN_OK on success, the first error met otherwise.
+ */
+LIBXVMAN_API int libxvman_watch_process(libxvman_watch_t *watch,
+		libxvman_change_cb cb, void *arg);
+
+/**
+ * @brief Stop watching and release everything the watch holds.
+ *
+ * @param watch - pointer to the watch, can be NULL.
+ */
+LIBXVMAN_API void libxvman_watch_close(libxvman_watch_t *watch);
+
+/**
+ * @brief Describe an error code.
+ *
+ * @param err - error code returned by the library.
+ *
+ * @return Returns a static string describing the error.
+ */
+LIBXVMAN_API const char *libxvman_strerror(int err);
+
+#endif
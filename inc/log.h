@@ -33,16 +33,133 @@
  */
 #define DEFAULT_LOG_FILE "./default.log"
 
+/**
+ * @brief Size of the ring buffer holding the records pending to be written
+ * into the log file
+ */
+#define LOG_RING_SIZE (64 * 1024)
+
+/**
+ * @brief Time in milliseconds after which queued records are written out even
+ * if the ring buffer is not yet half full
+ */
+#define LOG_FLUSH_MS 100
+
+/**
+ * @brief Maximum length of a single log record, longer records are truncated
+ */
+#define LOG_REC_MAX 4096
+
+/**
+ * @brief numeric values of the log levels, usable by the preprocessor
+ */
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_INFO 4
+
+/**
+ * @brief minimum log level compiled into the program
+ * @details Logging calls below this level compile to nothing: neither the
+ * call nor the evaluation of the arguments is left in the binary, so these
+ * levels cannot be enabled at runtime either. Set with
+ * -DLOG_MIN_LEVEL=LOG_LEVEL_WARN and the like, by default all the levels are
+ * compiled in.
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
 /**
  * @brief enum containing the log levels - DEBUG, WARN, ERROR, INFO
  */
 enum log_level {
-        DEBUG = 0x01,
-        WARN,
-        ERROR,
-        INFO
+        DEBUG = LOG_LEVEL_DEBUG,
+        WARN = LOG_LEVEL_WARN,
+        ERROR = LOG_LEVEL_ERROR,
+        INFO = LOG_LEVEL_INFO
+};
+
+/**
+ * @brief enum containing the clocks used for the time stamp of the records
+ * @details LOG_CLOCK_WALL stamps records with the local time at a resolution
+ * of a second, LOG_CLOCK_MONO stamps them with the seconds and microseconds
+ * of the monotonic clock, meant for profiling runs.
+ */
+enum log_clock {
+	LOG_CLOCK_WALL = 0,
+	LOG_CLOCK_MONO
+};
+
+/**
+ * @brief enum containing the formats of the log file
+ * @details LOG_FORMAT_TEXT writes the records laid out as per LOG_STRF.
+ * LOG_FORMAT_BINARY writes them into the log file name suffixed with
+ * LOG_BINARY_SUFFIX, each record holding only the id of its call site, a time
+ * stamp and the raw arguments. The xvman-logdump tool turns such a file back
+ * into the text layout.
+ */
+enum log_format {
+	LOG_FORMAT_TEXT = 0,
+	LOG_FORMAT_BINARY
+};
+
+/**
+ * @brief Suffix of the log file written in the binary format
+ */
+#define LOG_BINARY_SUFFIX ".bin"
+
+/**
+ * @brief Version of the binary log format
+ */
+#define LOG_BINARY_VERSION 1
+
+/**
+ * @brief Static description of a logging call site
+ * @details Every logging macro places one of these in the xvman_log_sites
+ * section, the index of the site within the section is its id. The binary
+ * log starts every session with the table of all the sites.
+ */
+struct log_site {
+	const char *fmt;		/* format string */
+	const char *file;		/* __FILE__ of the call site */
+	const char *func;		/* __FUNCTION__ of the call site */
+	long line;			/* __LINE__ of the call site */
+	long level;			/* enum log_level of the call site */
+};
+
+/**
+ * @brief enum containing the argument classes of a conversion in a format
+ */
+enum log_arg {
+	LOG_ARG_NONE = 0,		/* literal %% or %n, takes no argument */
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_INTMAX,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_LDOUBLE,
+	LOG_ARG_STR,
+	LOG_ARG_PTR
 };
 
+/**
+ * @brief Single conversion specification found in a format string
+ */
+struct log_conv {
+	const char *start;		/* the '%' starting the conversion */
+	int len;			/* length of the specification */
+	int stars;			/* '*' width/precision taking an int */
+	enum log_arg arg;		/* class of the argument */
+};
+
+/**
+ * @brief Size of the buffer holding a formatted time stamp
+ */
+#define LOG_TIME_MAX 32
+
 /**
  * @brief enum containing the init states - FALSE(0) and TRUE
  */
@@ -51,29 +168,64 @@ enum init_state {
 	TRUE
 };
 
+/**
+ * @brief discarded logging call of a level that is not compiled in
+ * @details The arguments are still seen by the compiler, so the variables
+ * used only for logging do not end up unused, but the dead branch is removed
+ * along with the format string.
+ */
+#define LOG_DISCARD(x, ...) do {\
+                if (0)\
+                        log_write_fmt(x, __FILE__, __FUNCTION__, __LINE__,\
+                                        0, ##__VA_ARGS__);\
+        } while (0)
+
+/**
+ * @brief logging call with a static call site description
+ */
+#define LOG_SITE(ll, x, ...) do {\
+                static const struct log_site log_site_\
+                        __attribute__((section("xvman_log_sites"), used,\
+                                                aligned(8))) =\
+                        {x, __FILE__, __FUNCTION__, __LINE__, ll};\
+                log_write_site(&log_site_, ##__VA_ARGS__);\
+        } while (0)
+
 /**
  * @brief shortened version of the DEBUG level log_write_fmt function
  */
-#define debug(x, ...) log_write_fmt(x, __FILE__, __FUNCTION__, __LINE__,\
-                DEBUG, ##__VA_ARGS__)
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define debug(x, ...) LOG_SITE(DEBUG, x, ##__VA_ARGS__)
+#else
+#define debug(x, ...) LOG_DISCARD(x, ##__VA_ARGS__)
+#endif
 
 /**
  * @brief shortened version of the WARN level log_write_fmt function
  */
-#define warning(x, ...) log_write_fmt(x, __FILE__, __FUNCTION__, __LINE__,\
-                WARN, ##__VA_ARGS__)
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define warning(x, ...) LOG_SITE(WARN, x, ##__VA_ARGS__)
+#else
+#define warning(x, ...) LOG_DISCARD(x, ##__VA_ARGS__)
+#endif
 
 /**
  * @brief shortened version of the ERROR level log_write_fmt function
  */
-#define error(x, ...) log_write_fmt(x, __FILE__, __FUNCTION__, __LINE__,\
-                ERROR, ##__VA_ARGS__)
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
+#define error(x, ...) LOG_SITE(ERROR, x, ##__VA_ARGS__)
+#else
+#define error(x, ...) LOG_DISCARD(x, ##__VA_ARGS__)
+#endif
 
 /**
  * @brief shortened version of the INFO level log_write_fmt function
  */
-#define info(x, ...) log_write_fmt(x, __FILE__, __FUNCTION__, __LINE__,\
-                INFO, ##__VA_ARGS__)
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define info(x, ...) LOG_SITE(INFO, x, ##__VA_ARGS__)
+#else
+#define info(x, ...) LOG_DISCARD(x, ##__VA_ARGS__)
+#endif
 
 /**
  * @brief default log file name provided while initializing the module
@@ -87,6 +239,9 @@ enum init_state {
  * @param[in] ll refers to the LOG_LEVEL. This needs to be filled out. Without
  * providing the log level the logger would not work out
  * @note This function has to be called out if the logging needs to be done
+ * @details The log file is kept open until log_free_lf() is called. Records
+ * written to the file are queued in a ring buffer and written out in batches
+ * by a background thread.
  */
 void log_init(const char *f, enum log_level ll);
 
@@ -100,6 +255,39 @@ void log_init(const char *f, enum log_level ll);
  */
 void log_set_stream(bool ostream, bool fstream);
 
+/**
+ * @brief the logger module clock setter
+ * @param[in] clock clock used for the time stamp of the records, by default
+ * the local time is used
+ */
+void log_set_clock(enum log_clock clock);
+
+/**
+ * @brief the logger module format setter
+ * @param[in] format format of the log file, by default the text format is
+ * used
+ * @note This has to be called right after log_init(), before any records are
+ * written.
+ */
+void log_set_format(enum log_format format);
+
+/**
+ * @brief Find the next conversion specification in a format string
+ * @param[in] fmt format string to be scanned
+ * @param[out] conv conversion found
+ * @return Returns the rest of the format string after the conversion, NULL if
+ * there are no conversions left
+ */
+const char *log_fmt_next(const char *fmt, struct log_conv *conv);
+
+/**
+ * @brief Write a record of a static call site
+ * @param[in] site description of the call site
+ * @details Used by the logging macros, the arguments follow the format string
+ * of the call site.
+ */
+void log_write_site(const struct log_site *site, ...);
+
 /**
  * @brief Variadic function for logging specific string format
  * @param[in] s NULL string will return the control, but else the null
@@ -115,10 +303,16 @@ void log_set_stream(bool ostream, bool fstream);
 void log_write_fmt(const char *fmt, const char *fi, const char *fu, long ln,
                 int ll, ...);
 
+/**
+ * @brief wait until all the queued records are written into the log file
+ */
+void log_flush(void);
+
 /**
  * @brief free the memory allocated for the log file name
  * @details This function needs to be called in order to free the memory
- * allocated to the log file name pointer.
+ * allocated to the log file name pointer. The queued records are flushed, the
+ * background writer is stopped and the log file is closed.
  * @note This must be called before exiting the program, else this will result
  * in memory leak.
  */
@@ -0,0 +1,63 @@
+/**
+ * @file paths.h
+ * @brief Interned table of the paths relative to the $HOME directory.
+ * @details Every path xvman works with below $HOME is built once per process,
+ * with its length checked, into a single allocation. The rest of the code
+ * refers to a path by its handle and gets the same string back every time.
+ */
+
+#ifndef PATHS_H
+#define PATHS_H
+
+#include <stddef.h>
+
+/**
+ * @brief Handles of the interned paths.
+ */
+typedef enum {
+	PATHS_CBIN,			/* custom binary directory */
+	PATHS_CONFDIR,			/* configuration directory */
+	PATHS_CONF,			/* configuration file */
+	PATHS_LOG,			/* log file */
+	PATHS_REGISTRY,			/* program registry */
+	PATHS_JOURNAL,			/* journal of the registry updates */
+	PATHS_LEGACYDIR,		/* migrated per-program files */
+	PATHS_BASHRC,			/* bash configuration file */
+	PATHS_LOCKFILE,			/* marker of the updated bashrc */
+	PATHS_SOCKET,			/* socket of xvmand */
+	PATHS_COUNT
+} paths_id_t;
+
+/**
+ * @brief Intern all the paths below a $HOME directory.
+ *
+ * Nothing is done when the paths below the same directory are interned
+ * already. The strings handed out before stay valid until the paths are
+ * interned below another directory.
+ *
+ * @param home - string containing the $HOME directory.
+ *
+ * @return Returns 0 on success, -1 if a path does not fit in PATH_MAX or on
+ * allocation failure.
+ */
+int paths_init(const char *home);
+
+/**
+ * @brief Get an interned path.
+ *
+ * @param id - handle of the path.
+ *
+ * @return Returns the path, NULL if paths_init() has not gone through.
+ */
+const char *paths_get(paths_id_t id);
+
+/**
+ * @brief Get the length of an interned path.
+ *
+ * @param id - handle of the path.
+ *
+ * @return Returns the length of the path, 0 if it is not interned.
+ */
+size_t paths_len(paths_id_t id);
+
+#endif
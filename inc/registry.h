@@ -0,0 +1,304 @@
+/**
+ * @file registry.h
+ * @brief Memory mapped program registry.
+ * @details All the programs managed by xvman and their install locations are
+ * stored in a single indexed file inside the configuration directory. The
+ * file is read through mmap(2) and consists of a header, an open addressing
+ * hash index keyed on the program name and a heap holding the packed blocks of
+ * install locations along with the string table.
+ *
+ * The first location in the block of a program which is not flagged missing
+ * is the active one. A program in the manual selection mode keeps the
+ * locations in the order they were made active last, one in the automatic
+ * mode keeps them ranked by their priority, their version and the time they
+ * were added, highest first, the locations flagged missing last.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Handle to an opened registry file.
+ */
+typedef struct {
+	int fd;				/* descriptor of the registry file */
+	int lockfd;			/* descriptor of the writer lock file */
+	int locked;			/* depth of the writer lock */
+	int plocked;			/* number of program locks held */
+	bool readonly;			/* opened for reading only */
+	unsigned char *map;		/* mapping of the whole file */
+	size_t size;			/* size of the mapping */
+	size_t locsize;			/* size of a location record */
+	char path[PATH_MAX];		/* path of the registry file */
+} registry_t;
+
+/**
+ * @brief Program flag set while the active install location is picked by
+ * the ranking of the locations rather than by the user.
+ */
+#define REGPROG_AUTO 0x1
+
+/**
+ * @brief Location flag set while the install location has gone from the disk.
+ * It stays registered with its priority, version and time of addition until
+ * it is pruned, and is passed over while it is flagged when picking the
+ * default one.
+ */
+#define REGLOC_MISSING 0x1
+
+/**
+ * @brief View of a single install location.
+ *
+ * When returned by the registry the string points inside the mapping and stays
+ * valid only until the next modification of the registry.
+ */
+typedef struct {
+	const char *path;		/* install location */
+	uint32_t len;			/* length of the install location */
+	uint32_t flags;			/* location state bits, REGLOC_* */
+	int64_t added;			/* time at which the location was added */
+	uint64_t version;		/* sort key of the version in the path,
+					   see version_key() */
+	int32_t priority;		/* priority given by the user */
+} regloc_t;
+
+/**
+ * @brief View of a registered program.
+ */
+typedef struct {
+	const char *name;		/* name of the program */
+	uint32_t nlocs;			/* number of install locations */
+	uint32_t flags;			/* program flags, REGPROG_* */
+	uint32_t block;			/* heap offset of the location block */
+} regentry_t;
+
+/**
+ * @brief Program and its complete list of install locations, used as input
+ * while writing into the registry.
+ */
+typedef struct {
+	const char *name;		/* name of the program */
+	const regloc_t *locs;		/* install locations, active first */
+	size_t nlocs;			/* number of install locations, 0 removes
+					   the program */
+	uint32_t flags;			/* program flags, REGPROG_* */
+} regprog_t;
+
+/**
+ * @brief Open the registry file, creating an empty one if it does not exist.
+ *
+ * @param reg - pointer to the registry handle to be filled.
+ * @param path - string containing the path of the registry file.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_open(registry_t *reg, const char *path);
+
+/**
+ * @brief Open the registry file for reading only.
+ *
+ * Nothing is created and no lock is taken, the readers never wait for the
+ * writers. A registry file which does not exist yet is not an error, the
+ * handle is left without a mapping then and every look up fails.
+ *
+ * @param reg - pointer to the registry handle to be filled.
+ * @param path - string containing the path of the registry file.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_open_readonly(registry_t *reg, const char *path);
+
+/**
+ * @brief Pick up the changes made to the registry by other processes.
+ *
+ * Maps the registry again if it has been compacted or has grown past the
+ * current mapping. Views returned earlier are no longer valid afterwards.
+ *
+ * @param reg - pointer to the registry handle.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_refresh(registry_t *reg);
+
+/**
+ * @brief Take the writer lock of the whole registry.
+ *
+ * Concurrent writers are serialized through a lock file next to the registry.
+ * Once the lock is held the registry is refreshed, so the look ups done
+ * afterwards see the latest state. The lock can be taken recursively. Meant
+ * for the writers touching many programs at once, it waits for all the
+ * program locks held by other processes to be released.
+ *
+ * @param reg - pointer to the registry handle.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_lock(registry_t *reg);
+
+/**
+ * @brief Release the writer lock of the registry.
+ *
+ * @param reg - pointer to the registry handle.
+ */
+void registry_unlock(registry_t *reg);
+
+/**
+ * @brief Take the lock of a single program.
+ *
+ * Readers take the lock shared and writers exclusive, operations on
+ * different programs do not wait for each other. Once the lock is held the
+ * registry is refreshed. Holding the lock of the whole registry covers all
+ * the programs, so the call does nothing then; the whole registry must not
+ * be locked while program locks are held. Only a single program can be
+ * locked through a handle at a time.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param name - string containing the name of the program.
+ * @param exclusive - true for writing, false for reading.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_lock_prog(registry_t *reg, const char *name, bool exclusive);
+
+/**
+ * @brief Release the lock of a single program.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param name - string containing the name of the program.
+ */
+void registry_unlock_prog(registry_t *reg, const char *name);
+
+/**
+ * @brief Flush the registry file to disk.
+ *
+ * @param reg - pointer to the registry handle.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_sync(registry_t *reg);
+
+/**
+ * @brief Unmap and close the registry file.
+ *
+ * @param reg - pointer to the registry handle.
+ */
+void registry_close(registry_t *reg);
+
+/**
+ * @brief Look up a program in the registry.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param name - string containing the name of the program.
+ * @param entry - pointer to the entry to be filled, can be NULL.
+ *
+ * @return Returns true if the program is registered, false otherwise.
+ */
+bool registry_lookup(const registry_t *reg, const char *name,
+		regentry_t *entry);
+
+/**
+ * @brief Fetch an install location of a registered program.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param entry - pointer to the entry returned by the look up.
+ * @param index - index of the install location, 0 being the active one.
+ * @param loc - pointer to the location view to be filled.
+ *
+ * @return Returns 0 on success, -1 if the index is out of range.
+ */
+int registry_loc(const registry_t *reg, const regentry_t *entry,
+		uint32_t index, regloc_t *loc);
+
+/**
+ * @brief Find the index of an install location of a registered program.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param entry - pointer to the entry returned by the look up.
+ * @param path - string containing the install location.
+ *
+ * @return Returns the index of the location, -1 if it is not present.
+ */
+int registry_find(const registry_t *reg, const regentry_t *entry,
+		const char *path);
+
+/**
+ * @brief Iterate over all the registered programs.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param cursor - iteration state, set to 0 before the first call.
+ * @param entry - pointer to the entry to be filled.
+ *
+ * @return Returns true while there are programs left, false at the end.
+ */
+bool registry_next(const registry_t *reg, uint32_t *cursor,
+		regentry_t *entry);
+
+/**
+ * @brief Get the size of the data the registry holds.
+ *
+ * Counts the names, location blocks and install locations which can be
+ * reached, the space left behind by earlier updates is not counted until a
+ * compaction gives it back.
+ *
+ * @param reg - pointer to the registry handle.
+ *
+ * @return Returns the number of bytes in use, 0 for a registry not mapped.
+ */
+size_t registry_live(const registry_t *reg);
+
+/**
+ * @brief Replace the install locations of a set of programs.
+ *
+ * Programs not mentioned in the list are kept as they are, names in the list
+ * must be unique. The new location blocks are appended to the heap and then
+ * published by atomically updating the index, so the cost does not depend on
+ * the size of the registry. Strings of the locations that are already stored
+ * in the registry are shared with the new blocks.
+ *
+ * When the index is getting full or most of the heap is unreachable the
+ * registry is compacted instead: a fresh image is written to a sibling
+ * temporary file which is then renamed over the registry.
+ *
+ * The registry has to be locked with registry_lock(), or the program with
+ * registry_lock_prog(), around the look up of the current lists and the
+ * update. Appends of concurrent writers are serialized internally and
+ * readers are never blocked.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param progs - array of programs along with their complete location lists.
+ * @param n - number of programs in the array.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_put_many(registry_t *reg, const regprog_t *progs, size_t n);
+
+/**
+ * @brief Replace the install locations of a single program.
+ *
+ * @param reg - pointer to the registry handle.
+ * @param name - string containing the name of the program.
+ * @param locs - array of install locations, active first.
+ * @param n - number of locations, 0 removes the program.
+ * @param flags - program flags, REGPROG_*.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int registry_put(registry_t *reg, const char *name, const regloc_t *locs,
+		size_t n, uint32_t flags);
+
+/**
+ * @brief Compute the hash used by the registry index.
+ *
+ * @param s - string to be hashed.
+ * @param len - length of the string.
+ *
+ * @return Returns the 32 bit FNV-1a hash of the string.
+ */
+uint32_t registry_hash(const char *s, size_t len);
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * @file stats.h
+ * @brief Lightweight instrumentation of the phases of a run.
+ * @details Once enabled, every phase records the time spent in it on the
+ * monotonic clock along with the files opened, the files looked up, the
+ * allocations from the arena of the command and the read and write calls made
+ * meanwhile, including the bytes they moved. The
+ * phases nest, a phase accounts for everything done in the phases it
+ * encloses. While disabled, every call returns right away.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Phases of a run which are timed.
+ */
+typedef enum {
+	STATS_TOTAL,			/* everything since the stats were enabled */
+	STATS_SETUP,			/* setting up the prerequisites */
+	STATS_SETUP_CHECK,		/* checking the setup stamp */
+	STATS_SETUP_FULL,		/* first time setup */
+	STATS_MIGRATE,			/* importing the older configuration */
+	STATS_OPEN,			/* reading the registry and the journal */
+	STATS_LOG,			/* setting up the log */
+	STATS_FORWARD,			/* handing the command over to xvmand */
+	STATS_COMMAND,			/* running the command */
+	STATS_LOCK,			/* waiting for the lock of a program */
+	STATS_LOOKUP,			/* looking up a program in the registry */
+	STATS_PROMPT,			/* waiting for the choice of the user */
+	STATS_JOURNAL,			/* recording an update in the journal */
+	STATS_REGISTRY,			/* writing the registry */
+	STATS_LINK,			/* switching a symlink */
+	STATS_TEARDOWN,			/* releasing everything */
+	STATS_PHASES
+} stats_phase_t;
+
+/**
+ * @brief Calls counted at the places they are made.
+ */
+typedef enum {
+	STATS_OPENS,			/* files and directories opened */
+	STATS_STATS,			/* files looked up with a stat */
+	STATS_ALLOCS,			/* allocations from the arena */
+	STATS_ALLOC_BYTES,		/* bytes allocated from the arena */
+	STATS_RESETS,			/* resets of the arena */
+	STATS_COUNTERS
+} stats_counter_t;
+
+/**
+ * @brief Enable the instrumentation, the total phase starts right away.
+ *
+ * The read and write calls are taken from /proc/self/io, they are left out of
+ * the report when it can not be read.
+ *
+ * @param command - string naming the command being run, reported as is.
+ * @param path - string containing the file a JSON line is appended to at the
+ * time of the report, NULL for a summary on stderr.
+ *
+ * @return Returns 0 on success, -1 if enabled already.
+ */
+int stats_enable(const char *command, const char *path);
+
+/**
+ * @brief Check if the instrumentation is enabled.
+ *
+ * @return Returns true if enabled, false otherwise.
+ */
+bool stats_enabled(void);
+
+/**
+ * @brief Start timing a phase.
+ *
+ * @param phase - phase being entered.
+ */
+void stats_begin(stats_phase_t phase);
+
+/**
+ * @brief Stop timing a phase and add it up.
+ *
+ * @param phase - phase being left, nothing is done if it was not entered.
+ */
+void stats_end(stats_phase_t phase);
+
+/**
+ * @brief Count a call.
+ *
+ * @param counter - counter of the call.
+ */
+void stats_count(stats_counter_t counter);
+
+/**
+ * @brief Add an amount to a counter.
+ *
+ * @param counter - counter of the amount.
+ * @param n - amount counted, as the bytes of an allocation.
+ */
+void stats_add(stats_counter_t counter, uint64_t n);
+
+/**
+ * @brief Report the phases and disable the instrumentation.
+ *
+ * The phases still running are ended first.
+ *
+ * @return Returns 0 on success, -1 if the JSON line could not be written or
+ * the instrumentation is not enabled.
+ */
+int stats_report(void);
+
+#endif
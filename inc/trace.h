@@ -0,0 +1,89 @@
+/**
+ * @file trace.h
+ * @brief Tracer writing the spans of a run in the Chrome trace event format.
+ * @details A span covers the rest of the block it is opened in and is
+ * described by a static call site like the ones of the logging macros, the
+ * file, function and line end up in the arguments of the event. The file
+ * written can be opened in chrome://tracing or Perfetto. While the tracer is
+ * stopped, a span costs a single check of a flag on either end.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "log.h"
+
+#include <stdbool.h>
+
+/**
+ * @brief Set while the tracer is writing, read by the span macro.
+ */
+extern bool trace_on;
+
+/**
+ * @brief Open a span lasting till the end of the enclosing block
+ * @details The span is closed on every way out of the block, returns
+ * included. Only one span can be opened per block, its name has to be a
+ * string literal which needs no escaping in JSON. The level of the call site
+ * is left at 0.
+ */
+#define trace_span(name) \
+        static const struct log_site trace_site_ = \
+                {name, __FILE__, __FUNCTION__, __LINE__, 0};\
+        const struct log_site *trace_span_ \
+                __attribute__((cleanup(trace_close), unused)) = \
+                __builtin_expect(trace_on, 0) ? \
+                trace_enter(&trace_site_) : NULL
+
+/**
+ * @brief Start writing a trace.
+ *
+ * @param path - string containing the file the trace is written into.
+ * @param command - string naming the command being run, the process is
+ * named after it in the trace.
+ *
+ * @return Returns 0 on success, -1 if the file could not be created or a
+ * trace is being written already.
+ */
+int trace_start(const char *path, const char *command);
+
+/**
+ * @brief Write the event opening a span, used by trace_span().
+ *
+ * @param site - static description of the span.
+ *
+ * @return Returns the site, to be handed to trace_leave().
+ */
+const struct log_site *trace_enter(const struct log_site *site);
+
+/**
+ * @brief Write the event closing a span.
+ *
+ * @param site - static description of the span.
+ */
+void trace_leave(const struct log_site *site);
+
+/**
+ * @brief Close a span at the end of its block, used by trace_span().
+ */
+static inline void trace_close(const struct log_site **span)
+{
+	if (*span)
+		trace_leave(*span);
+}
+
+/**
+ * @brief Write out the events buffered so far, meant for long running
+ * processes whose trace is looked at while they run.
+ */
+void trace_flush(void);
+
+/**
+ * @brief Finish the trace and close its file.
+ *
+ * @return Returns 0 on success, -1 if the trace could not be written or no
+ * trace is being written.
+ */
+int trace_stop(void);
+
+#endif
@@ -14,4 +14,21 @@
  */
 int util_symlink(const char *target, const char *link);
 
+/**
+ * @brief Utility function to atomically point a symlink to a new target.
+ *
+ * This function creates the new symlink under a temporary name in the same
+ * directory and renames it over the existing link. Programs resolving the
+ * link at any point see either the old or the new target, the link is never
+ * missing.
+ *
+ * @param target - string contains the path of the target resource.
+ * @param dirfd - directory file descriptor the link path is relative to, or
+ * AT_FDCWD.
+ * @param link - string containing the destination path of the symlink.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int util_symlink_switch(const char *target, int dirfd, const char *link);
+
 #endif
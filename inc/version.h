@@ -0,0 +1,96 @@
+/**
+ * @file version.h
+ * @brief Parsing and ordering of the versions found in install locations.
+ * @details Install locations usually name the release they hold somewhere in
+ * their path, as in /opt/goneovim-v0.6.11/goneovim or /usr/bin/python3.11.
+ * The version is picked out of the path and understood as a dotted list of
+ * numbers optionally followed by a pre-release stage, in the spirit of
+ * semantic versioning: 1.2 equals 1.2.0, 1.10 is newer than 1.9 and 2.0-rc1
+ * is older than 2.0. Build metadata after a '+' is ignored.
+ *
+ * A version is folded into a 64 bit key whose integer order follows the
+ * order of the versions, so that the key is computed once when a location is
+ * added and ranking the locations afterwards is an integer comparison.
+ */
+
+#ifndef VERSION_H
+#define VERSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Largest number of numeric components of a version, the rest are
+ * ignored.
+ */
+#define VERSION_PARTS 6
+
+/**
+ * @brief Pre-release stages of a version, in their order.
+ */
+typedef enum {
+	VERSION_DEV,			/* dev */
+	VERSION_ALPHA,			/* alpha, a */
+	VERSION_BETA,			/* beta, b */
+	VERSION_PRE,			/* pre, preview */
+	VERSION_RC,			/* rc */
+	VERSION_RELEASE			/* no pre-release stage */
+} version_stage_t;
+
+/**
+ * @brief Version parsed out of an install location.
+ */
+typedef struct {
+	uint32_t parts[VERSION_PARTS];	/* numeric components, major first */
+	uint32_t nparts;		/* number of components, trailing zeros
+					   left out */
+	version_stage_t stage;		/* pre-release stage */
+	uint32_t pre;			/* pre-release number, as in rc2 */
+} version_t;
+
+/**
+ * @brief Parse the version named by an install location.
+ *
+ * The components of the path are looked at from the last one up, the first
+ * one holding a version wins. Within a component a version starts at a
+ * number at its beginning, after one of "-_.+~@" or after a 'v' following
+ * those; a number glued to a name counts only when a dotted number follows,
+ * as in python3.11, so that names like prog2 are not taken for versions.
+ * Neither is the word size following the name of an architecture and a
+ * separator, as in x86_64, so /opt/tool-2.0-linux-x86_64/bin/tool is the
+ * release 2.0.
+ *
+ * @param path - string containing the install location.
+ * @param len - length of the install location.
+ * @param version - pointer to the version to be filled.
+ *
+ * @return Returns 0 when a version was found, -1 otherwise.
+ */
+int version_parse(const char *path, size_t len, version_t *version);
+
+/**
+ * @brief Compare two versions.
+ *
+ * @param a - pointer to the first version.
+ * @param b - pointer to the second version.
+ *
+ * @return Returns a negative number, 0 or a positive number when the first
+ * version is older than, equal to or newer than the second one.
+ */
+int version_compare(const version_t *a, const version_t *b);
+
+/**
+ * @brief Compute the sort key of the version named by an install location.
+ *
+ * A newer version never gets a smaller key, versions that differ only past
+ * the 64 bits the key holds share it. A location naming no version gets 0,
+ * which sorts below all the others.
+ *
+ * @param path - string containing the install location.
+ * @param len - length of the install location.
+ *
+ * @return Returns the sort key of the version.
+ */
+uint64_t version_key(const char *path, size_t len);
+
+#endif
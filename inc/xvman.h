@@ -3,18 +3,22 @@
 
 #include <linux/limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 /**
  * @brief xvman configuration structure.
  *
  * This structure will be containing the data of the all the configuration the
- * xvman uses while it is running.
+ * xvman uses while it is running. The paths point into the interned table of
+ * paths.h and stay valid for the whole run.
  */
 typedef struct {
-	char cbin[PATH_MAX]; 		/* custom binary location */
-	char confdir[PATH_MAX]; 	/* configuration directory path */
-	char conf_fpath[PATH_MAX]; 	/* configuration file path */
-	char conf_logfpath[PATH_MAX]; 	/* log file path */
+	const char *cbin; 		/* custom binary location */
+	const char *confdir; 		/* configuration directory path */
+	const char *conf_fpath; 	/* configuration file path */
+	const char *conf_logfpath; 	/* log file path */
+	const char *conf_regpath; 	/* program registry path */
+	const char *conf_journalpath; 	/* registry journal path */
 	bool debug; 			/* enable debug mode */
 	bool enable_flog; 		/* enable logging to file */
 	bool enable_slog; 		/* enable logging to stream */
@@ -43,7 +47,8 @@ typedef struct {
 /**
  * @brief Configuration file for xvman.
  *
- * All the program related information will be placed here.
+ * All the program related information will be placed here. The install
+ * roots to be watched are listed one per line as: watch <root> <pattern>
  */
 #define CONF_FPATH ".config/xvman/xvmanrc"
 
@@ -55,6 +60,32 @@ typedef struct {
  */
 #define CONF_LOGFPATH ".config/xvman/xvman.log"
 
+/**
+ * @brief Program registry for xvman.
+ *
+ * All the programs along with their install locations are stored in this
+ * single memory mapped file.
+ */
+#define CONF_REGPATH ".config/xvman/registry"
+
+/**
+ * @brief Journal of the registry updates for xvman.
+ *
+ * Every update of the registry and the symlinks is recorded here before it is
+ * applied, so that an update cut short by a crash can be finished on the next
+ * run.
+ */
+#define CONF_JOURNALPATH ".config/xvman/journal"
+
+/**
+ * @brief Directory holding the migrated per-program configuration files.
+ *
+ * Older versions of xvman kept one text file per program directly in the
+ * configuration directory. These are moved here once they are imported into
+ * the registry.
+ */
+#define LEGACYDIR ".config/xvman/.legacy"
+
 /**
  * @brief BASH configuration file location.
  *
@@ -84,6 +115,24 @@ typedef struct {
  */
 #define LOCKFILE ".config/xvman/.lockfile"
 
+/**
+ * @brief Name of the setup stamp inside the configuration directory.
+ *
+ * Once the full setup has gone through, a symlink by this name pointing to
+ * SETUP_VERSION is placed in the configuration directory. Later runs only read
+ * the stamp back and skip the setup when it matches. Removing the stamp forces
+ * the full setup on the next run.
+ */
+#define SETUP_STAMP ".setup"
+
+/**
+ * @brief Version of the setup recorded in the setup stamp.
+ *
+ * @note Bump this whenever the setup starts creating something new, so that
+ * the existing installations run the full setup once more.
+ */
+#define SETUP_VERSION "xvman-setup-1"
+
 /**
  * @brief Show the program usage.
  *
@@ -114,6 +163,18 @@ void xvman_free_mem(void);
  */
 int xvman_setup_prereq(xvmanconf_t *config);
 
+/**
+ * @brief Setup for the read-only commands.
+ *
+ * Only the paths of the configuration are filled in and the registry is
+ * mapped for reading, nothing is created, locked or logged. Updates left
+ * incomplete by a crash show up once the next regular run has replayed them.
+ *
+ * @param config - pointer to the config structure for xvman.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int xvman_setup_readonly(xvmanconf_t *config);
+
 /**
  * @brief Function to add a program and associated install location.
  *
@@ -125,7 +186,8 @@ int xvman_setup_prereq(xvmanconf_t *config);
  *
  * @param data - string containing the name of the program as well as the
  * install location. The string is separated by a space, the first value is the
- * name of the program, the second is the install location.
+ * name of the program, the second is the install location. An optional third
+ * value is the priority of the install location.
  *
  * @return returns 0 on success, -1 on failure.
  */
@@ -143,4 +205,199 @@ int xvman_add(const char *data);
  */
 int xvman_config(const char *pname);
 
+/**
+ * @brief Function to make an install location of a program the default one.
+ *
+ * This is the non-interactive part of xvman_config(), the install location
+ * has to be registered already.
+ *
+ * @param pname - string containing the name of the already configured program.
+ * @param ilocation - string containing the install location to be used.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_select(const char *pname, const char *ilocation);
+
+/**
+ * @brief Function to let xvman pick the default version of a program.
+ *
+ * The program is switched to the automatic selection mode, the install
+ * location with the highest priority, then the newest version, becomes the
+ * default one and stays so as install locations come and go. Choosing one
+ * through xvman_config() switches it back to the manual mode.
+ *
+ * @param pname - string containing the name of the already configured program.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_auto(const char *pname);
+
+/**
+ * @brief Function to redirect the diagnostics of the commands.
+ *
+ * The messages explaining why xvman_add(), xvman_select() or xvman_query()
+ * failed go to the standard error unless redirected, which lets xvmand hand
+ * them to the client that made the request.
+ *
+ * @param stream - stream the diagnostics go to, NULL for the standard error.
+ */
+void xvman_set_diag(FILE *stream);
+
+/**
+ * @brief Function to print the install locations of a program.
+ *
+ * The install locations are printed one per line, the default one first.
+ *
+ * @param pname - string containing the name of the configured program.
+ * @param out - stream the install locations are printed to.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_query(const char *pname, FILE *out);
+
+/**
+ * @brief Function to list the registered programs.
+ *
+ * Every program is printed along with its default install location, one per
+ * line and separated by a space, in no particular order. The JSON output is
+ * an array of objects holding the program, the default install location and
+ * the number of install locations.
+ *
+ * @param out - stream the programs are printed to.
+ * @param json - true for JSON output, false for plain text.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_list(FILE *out, bool json);
+
+/**
+ * @brief Function to show the install locations of a program without
+ * locking.
+ *
+ * The plain output holds the install locations one per line, the default one
+ * first. The JSON output is an object holding the program, the default
+ * install location and, when all of them are asked for, the install locations
+ * along with the time they were added.
+ *
+ * @param pname - string containing the name of the configured program.
+ * @param all - true for all the install locations, false for the default one.
+ * @param json - true for JSON output, false for plain text.
+ * @param out - stream the install locations are printed to.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_show(const char *pname, bool all, bool json, FILE *out);
+
+/**
+ * @brief Function to check the health of the registry and the symlinks.
+ *
+ * Every problem found is printed on a line of its own: its kind, the program
+ * and the install location missing or the target of the symlink, followed by
+ * a count of the problems. The JSON output is an array of objects holding the
+ * kind, the program, the path, the install location the symlink should point
+ * to and whether the problem has been fixed.
+ *
+ * @param fix - true to repair the problems found, false to only report them.
+ * @param json - true for JSON output, false for plain text.
+ * @param out - stream the problems are printed to.
+ *
+ * @return Returns -1 on failure or if problems are left, 0 on success.
+ */
+int xvman_doctor(bool fix, bool json, FILE *out);
+
+/**
+ * @brief Function to remove the install locations no longer needed.
+ *
+ * The install locations which do not exist any more are removed, and with a
+ * policy given the existing ones past the number to keep and older than the
+ * number of days as well. Every location removed is printed on a line of its
+ * own, followed by the totals. The JSON output is an object holding the
+ * locations removed and the totals.
+ *
+ * @param keep - string containing the number of install locations kept per
+ * program, at least 1, NULL for no limit.
+ * @param older - string containing the age in days of the install locations
+ * which can be removed, NULL for any age.
+ * @param json - true for JSON output, false for plain text.
+ * @param out - stream the locations removed are printed to.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_prune(const char *keep, const char *older, bool json, FILE *out);
+
+/**
+ * @brief Function to find and register the installed versions of the
+ * registered programs.
+ *
+ * Every executable found below the directory is printed on a line of its own,
+ * marked as added, known if it was registered already or failed. The JSON
+ * output is an array of objects holding the program, the install location
+ * and the mark.
+ *
+ * @param data - string containing the directory to be scanned and the pattern
+ * of the executables below it, separated by a space.
+ * @param json - true for JSON output, false for plain text.
+ * @param out - stream the executables found are printed to.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_scan(const char *data, bool json, FILE *out);
+
+/**
+ * @brief Function to start watching the install roots of the configuration
+ * file.
+ *
+ * Every line of the configuration file of the form
+ *   watch <root> <pattern>
+ * names an install root and the pattern of the executables below it, as
+ * taken by xvman_scan(). The roots which can not be watched are reported and
+ * left out.
+ *
+ * @param fd - pointer filled with the descriptor to be polled for changes,
+ * -1 if no install root is being watched.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_watch_open(int *fd);
+
+/**
+ * @brief Function to bring the registry in step with the install roots.
+ *
+ * Meant to be called once the descriptor of xvman_watch_open() is readable,
+ * the first call catches up with the changes made while nobody was watching.
+ * Every change is printed on a line of its own: added, removed, relinked or
+ * failed, followed by the program and the install location.
+ *
+ * @param out - stream the changes are printed to.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int xvman_watch_sync(FILE *out);
+
+/**
+ * @brief Function to stop watching the install roots.
+ */
+void xvman_watch_close(void);
+
+/**
+ * @brief Function to apply a manifest of operations in one go.
+ *
+ * Every line of the manifest holds one operation along with the program name
+ * and the install location, separated by spaces:
+ *   add <program> <install location>
+ *   select <program> <install location>
+ *   remove <program> <install location>
+ *
+ * The operations are grouped by program so that the registry is updated once
+ * and every symlink is switched at most once, no matter how many operations
+ * touch a program. The status of every operation is printed in the order of
+ * the manifest.
+ *
+ * @param manifest - string containing the path of the manifest, "-" to read
+ * it from the standard input.
+ *
+ * @return Returns 0 if all the operations succeeded, -1 otherwise.
+ */
+int xvman_batch(const char *manifest);
+
 #endif
@@ -0,0 +1,110 @@
+/**
+ * @file xvmand.h
+ * @brief Resident switch daemon.
+ * @details The daemon keeps the registry and the custom binary directory open
+ * and serves the requests of the xvman CLI over a Unix domain socket inside
+ * the configuration directory, sparing every switch the start up of a fresh
+ * process.
+ *
+ * A connection carries a single request, sent by the client as one line:
+ *   add <program> <install location> [<priority>]
+ *   select <program> <install location>
+ *   query <program>
+ *   ping
+ *
+ * The daemon answers with the diagnostics of the request, a NUL byte, the
+ * status ('0' for success, '1' for failure) and the output of the request,
+ * then closes the connection. Clients are served as their requests come in,
+ * one that does not send a complete request within a second is dropped.
+ */
+
+#ifndef XVMAND_H
+#define XVMAND_H
+
+#include <linux/limits.h>
+#include <stdio.h>
+
+/**
+ * @brief Socket of the daemon, relative to the $HOME directory.
+ */
+#define XVMAND_SOCK ".config/xvman/xvmand.sock"
+
+/**
+ * @brief Maximum length of the priority of an addition.
+ */
+#define XVMAND_PRIO_MAX 11
+
+/**
+ * @brief Maximum length of a request line.
+ */
+#define XVMAND_REQ_MAX (NAME_MAX + PATH_MAX + 16)
+
+/**
+ * @brief Returned by the client calls when no daemon is listening.
+ */
+#define XVMAND_OFFLINE 1
+
+/**
+ * @brief Serve requests until SIGINT or SIGTERM is received.
+ *
+ * The pre-requisites have to be set up with xvman_setup_prereq() before. A
+ * stale socket left behind by a daemon that is gone is replaced, the call
+ * fails if another daemon is already listening. The install roots of the
+ * configuration file are watched in between requests, see xvman_watch_open().
+ *
+ * @return Returns 0 on a clean shut down, -1 on failure.
+ */
+int xvmand_serve(void);
+
+/**
+ * @brief Keep the registry in step with the install roots until SIGINT or
+ * SIGTERM is received.
+ *
+ * The pre-requisites have to be set up with xvman_setup_prereq() before. The
+ * process sleeps till an install root changes, every change made is printed
+ * to the standard output.
+ *
+ * @return Returns 0 on a clean shut down, -1 on failure or if no install root
+ * is configured.
+ */
+int xvmand_watch(void);
+
+/**
+ * @brief Send a single request to the daemon.
+ *
+ * The diagnostics of the request are copied to the standard error.
+ *
+ * @param request - string containing the request line, without the newline.
+ * @param out - stream the output of the request is copied to, can be NULL.
+ *
+ * @return Returns 0 on success, -1 on failure and XVMAND_OFFLINE if no daemon
+ * is listening.
+ */
+int xvmand_request(const char *request, FILE *out);
+
+/**
+ * @brief Forward an addition to the daemon.
+ *
+ * @param data - string containing the name of the program, the install
+ * location and optionally its priority separated by spaces, as taken by
+ * xvman_add().
+ *
+ * @return Returns 0 on success, -1 on failure and XVMAND_OFFLINE if no daemon
+ * is listening.
+ */
+int xvmand_client_add(const char *data);
+
+/**
+ * @brief Forward the configuration of the default version to the daemon.
+ *
+ * The install locations are fetched from the daemon and the choice is read
+ * from the user as done by xvman_config().
+ *
+ * @param pname - string containing the name of the configured program.
+ *
+ * @return Returns 0 on success, -1 on failure and XVMAND_OFFLINE if no daemon
+ * is listening.
+ */
+int xvmand_client_config(const char *pname);
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @file arena.c
+ * @brief File containing the per-command bump allocator.
+ *
+ * Allocations are served from the newest chunk by bumping its offset. A
+ * request which does not fit gets a new chunk, one larger than ARENA_CHUNK
+ * goes behind the newest chunk so that the room left there is still used.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/arena.h"
+#include "../inc/stats.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct arena_chunk {
+	arena_chunk_t *next;		/* older chunk */
+	size_t size;			/* usable bytes */
+	size_t used;			/* bytes handed out */
+	max_align_t data[];		/* the memory handed out */
+};
+
+static size_t arena_round(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_chunk_t *arena_chunk(size_t size)
+{
+	arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+	if (!chunk)
+		return NULL;
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	if (!arena)
+		return NULL;
+
+	size = arena_round(size ? size : 1);
+	arena_chunk_t *chunk = arena->head;
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_chunk(size > ARENA_CHUNK ? size : ARENA_CHUNK);
+		if (!chunk)
+			return NULL;
+		arena->nchunks++;
+		if (size > ARENA_CHUNK && arena->head) {
+			chunk->next = arena->head->next;
+			arena->head->next = chunk;
+		} else {
+			chunk->next = arena->head;
+			arena->head = chunk;
+		}
+	}
+
+	char *ptr = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	arena->last = ptr;
+	arena->nallocs++;
+	arena->bytes += size;
+	stats_count(STATS_ALLOCS);
+	stats_add(STATS_ALLOC_BYTES, size);
+	return memset(ptr, 0, size);
+}
+
+void *arena_grow(arena_t *arena, void *ptr, size_t old, size_t size)
+{
+	if (!arena)
+		return NULL;
+	if (size <= old && ptr)
+		return ptr;
+
+	/* the latest allocation of the newest chunk only has to bump the
+	 * offset further */
+	arena_chunk_t *chunk = arena->head;
+	if (ptr && ptr == arena->last && chunk) {
+		size_t off = (char *)ptr - (char *)chunk->data;
+		if (off < chunk->used && off + arena_round(size) <= chunk->size) {
+			size_t used = off + arena_round(size);
+			arena->bytes += used - chunk->used;
+			stats_add(STATS_ALLOC_BYTES, used - chunk->used);
+			chunk->used = used;
+			memset((char *)ptr + old, 0, size - old);
+			return ptr;
+		}
+	}
+
+	void *grown = arena_alloc(arena, size);
+	if (grown && ptr)
+		memcpy(grown, ptr, old);
+	return grown;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len)
+{
+	if (!s)
+		return NULL;
+	len = strnlen(s, len);
+	char *copy = arena_alloc(arena, len + 1);
+	if (copy)
+		memcpy(copy, s, len);
+	return copy;
+}
+
+char *arena_read(arena_t *arena, int fd, size_t *len)
+{
+	if (!arena || fd < 0 || !len)
+		return NULL;
+
+	/* a regular file is read in one go into a buffer of its size */
+	struct stat details;
+	size_t cap = 4096;
+	stats_count(STATS_STATS);
+	if (!fstat(fd, &details) && S_ISREG(details.st_mode) &&
+			details.st_size > 0)
+		cap = details.st_size + 1;
+
+	/* the byte kept for the terminator takes the read seeing the end, so
+	 * a file of the size given is not copied into a larger buffer */
+	char *buf = arena_alloc(arena, cap);
+	*len = 0;
+	while (buf) {
+		if (*len == cap) {
+			buf = arena_grow(arena, buf, cap, cap * 2);
+			cap *= 2;
+			continue;
+		}
+		ssize_t result = read(fd, buf + *len, cap - *len);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0)
+			return NULL;
+		if (result == 0)
+			break;
+		*len += result;
+	}
+	return buf;
+}
+
+void arena_reset(arena_t *arena)
+{
+	if (!arena)
+		return;
+
+	/* keep the oldest chunk around when it is of the default size */
+	arena_chunk_t *keep = NULL;
+	for (arena_chunk_t *chunk = arena->head, *next; chunk; chunk = next) {
+		next = chunk->next;
+		if (!next && chunk->size == ARENA_CHUNK) {
+			keep = chunk;
+			break;
+		}
+		free(chunk);
+		arena->nchunks--;
+	}
+	if (keep)
+		keep->used = 0;
+	arena->head = keep;
+	arena->last = NULL;
+	arena->nresets++;
+	stats_count(STATS_RESETS);
+}
+
+void arena_free(arena_t *arena)
+{
+	if (!arena)
+		return;
+	arena_reset(arena);
+	free(arena->head);
+	arena->head = NULL;
+	arena->nchunks = 0;
+}
@@ -1,73 +1,120 @@
+#define _GNU_SOURCE
 #include "../inc/io.h"
+#include "../inc/stats.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Note:
+ * Directories are created relative to descriptors of their parents, so every
+ * component of the path is resolved exactly once no matter how deep the
+ * hierarchy is. The walk starts at the root for absolute paths, at $HOME for
+ * paths starting with ~ and at the current directory otherwise.
+ */
+static int io_open_base(const char **path)
+{
+	const char *p = *path;
+	const char *base = ".";
+	if (p[0] == '/') {
+		base = "/";
+	} else if (p[0] == '~' && (p[1] == '/' || p[1] == '\0')) {
+		base = getenv("HOME");
+		if (!base) {
+			fprintf(stderr, "HOME is not set, unable to resolve: "
+					"%s\n", p);
+			return -1;
+		}
+		p++;
+	}
+	while (*p == '/')
+		p++;
+	*path = p;
+
+	int fd = open(base, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (fd < 0)
+		fprintf(stderr, "Failed while trying to open: %s\n", base);
+	return fd;
+}
 
 int io_mkdir(const char *path, const mode_t mode, bool recursive)
 {
-	if (!path || strlen(path) == 0) {
+	if (!path || path[0] == '\0') {
 		fprintf(stderr, "Path to be created is not specified\n");
 		return -1;
 	}
 
-	if (recursive) {
-		/* implement the recursive directory building */
-		char copy[strlen(path)+1], tmp[strlen(path)+1];
-
-		memset(tmp, '\0', strlen(path)+1);
-		memset(copy, '\0', strlen(path)+1);
-		memcpy(copy, path, strlen(path));
+	const char *p = path;
+	int dfd = io_open_base(&p);
+	if (dfd < 0)
+		return -1;
 
-		/* if the path is unresolved or in root (/) then do not perform
-		 * any action */
-		if (copy[0] == '~' && copy[1] == '/') {
-			fprintf(stderr, "Relative path provided, "
-					"please provide resolved path\n");
+	if (!recursive) {
+		/* only the last directory in the path is created */
+		int result = mkdirat(dfd, p[0] ? p : ".", mode);
+		close(dfd);
+		if (result) {
+			fprintf(stderr, "Failed while trying to create: %s\n",
+					path);
 			return -1;
-		} else if (copy[0] == '/') {
-			/* present from the root */
-			tmp[0] = '/';
-		} else if (copy[0] == '.' && copy[1] == '/') {
-			/* relative to the current directory */
-			tmp[0] = '.';
-			tmp[1] = '/';
 		}
+		return 0;
+	}
 
-		for (char *token = strtok(copy, "/"); token != NULL;
-				token = strtok(NULL, "/")) {
-			/* update tmp */
-			char *str_result = strncat(tmp, token, strlen(token)+1);
-			str_result = strncat(tmp, "/", strlen("/")+1);
-
-			if (str_result == 0) {
-				fprintf(stderr, "Characters could not be "
-						"concatenated\n");
+	char name[NAME_MAX + 1];
+	while (*p) {
+		/* pick the next component */
+		size_t len = strcspn(p, "/");
+		if (len > NAME_MAX) {
+			fprintf(stderr, "Path component too long in: %s\n",
+					path);
+			close(dfd);
+			return -1;
+		}
+		memcpy(name, p, len);
+		name[len] = '\0';
+		p += len;
+		while (*p == '/')
+			p++;
+		if (strcmp(name, ".") == 0)
+			continue;
+
+		/* the last component does not need to be opened */
+		if (!*p) {
+			if (mkdirat(dfd, name, mode) && errno != EEXIST) {
+				fprintf(stderr, "Failed while trying to "
+						"create: %s\n", path);
+				close(dfd);
+				return -1;
 			}
+			break;
+		}
 
-			if (!io_path_exists(tmp)) {
-				if (mkdir(tmp, mode)) {
-					fprintf(stderr, "Failed while trying to "
-							"create: %s",
-							tmp);
-					return -1;
-				}
+		int next = openat(dfd, name, O_PATH | O_DIRECTORY |
+				O_CLOEXEC);
+		stats_count(STATS_OPENS);
+		if (next < 0 && errno == ENOENT) {
+			if (mkdirat(dfd, name, mode) == 0 || errno == EEXIST) {
+				next = openat(dfd, name, O_PATH |
+						O_DIRECTORY | O_CLOEXEC);
+				stats_count(STATS_OPENS);
 			}
 		}
-	} else {
-		/* implement the single directory building */
-		char copy[strlen(path)+1];
-		memset(copy, '\0', strlen(path)+1);
-		memcpy(copy, path, strlen(path));
-
-		/* show an error if a relative path with tilde is provided */
-		if (mkdir(copy, mode)) {
-			fprintf(stderr, "Failed while trying to create: %s",
-					copy);
+		close(dfd);
+		if (next < 0) {
+			fprintf(stderr, "Failed while trying to create: %s\n",
+					path);
 			return -1;
 		}
+		dfd = next;
 	}
+	close(dfd);
 
 	return 0;
 }
@@ -119,11 +166,8 @@ bool io_path_exists(const char *path)
 		return result;
 	}
 
-	char copy[strlen(path)+1];
-	memset(copy, '\0', strlen(path)+1);
-	memcpy(copy, path, strlen(path));
-
 	struct stat details;
-	result = stat(copy, &details);
+	result = stat(path, &details);
+	stats_count(STATS_STATS);
 	return result == 0 ? true : false;
 }
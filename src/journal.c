@@ -0,0 +1,502 @@
+/**
+ * @file journal.c
+ * @brief File containing the write-ahead journal of the registry updates.
+ *
+ * The journal is only ever appended to, through O_APPEND, so the records of
+ * concurrent writers never interleave: every transaction goes in with a single
+ * write(2) followed by one fdatasync(2). A transaction is known by the offset
+ * of its start record, which stays unique until the journal is reset.
+ *
+ * Anything that does not parse, like the tail of a transaction cut short by a
+ * power failure, is skipped up to the next start or done record.
+ *
+ * A boot is told apart by the identifier the kernel draws for it, the done
+ * records of another boot are read as if they were not there.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/journal.h"
+#include "../inc/log.h"
+#include "../inc/stats.h"
+#include "../inc/trace.h"
+#include "../inc/version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JOURNAL_BOOT_PATH "/proc/sys/kernel/random/boot_id"
+
+/* transaction found while parsing the journal */
+struct jnl_txn {
+	off_t off;			/* offset of the start record */
+	size_t first;			/* index of the first program */
+	size_t nprogs;			/* number of programs */
+	size_t firstloc;		/* index of the first location */
+	bool done;			/* done record of this boot seen */
+	bool abandoned;			/* abandon record seen */
+};
+
+/* done or abandon record found while parsing the journal */
+struct jnl_mark {
+	off_t off;			/* offset of the transaction */
+	bool abandoned;			/* abandon record */
+};
+
+/* everything found while parsing the journal, pointing into its copy */
+struct jnl_parse {
+	char *buf;
+	struct jnl_txn *txns;
+	size_t ntxns;
+	regprog_t *progs;
+	size_t nprogs;
+	regloc_t *locs;
+	size_t nlocs;
+	size_t *firstloc;		/* index of the first location of every
+					   program, the lists are only set once
+					   the parse is over */
+	struct jnl_mark *marks;
+	size_t nmarks;
+};
+
+static int journal_write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t result = write(fd, buf, len);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += result;
+		len -= result;
+	}
+	return 0;
+}
+
+int journal_open(journal_t *jnl, const char *path)
+{
+	if (!jnl || !path) {
+		error("Journal handle or path not specified");
+		return -1;
+	}
+
+	jnl->fd = -1;
+	jnl->boot[0] = '\0';
+	if (snprintf(jnl->path, PATH_MAX, "%s", path) >= PATH_MAX) {
+		error("Journal path is too long: %s", path);
+		return -1;
+	}
+
+	jnl->fd = open(jnl->path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC,
+			S_IRUSR | S_IWUSR);
+	stats_count(STATS_OPENS);
+	if (jnl->fd < 0) {
+		error("Unable to open journal: %s", jnl->path);
+		return -1;
+	}
+
+	/* without the boot identifier no done record is trusted */
+	int fd = open(JOURNAL_BOOT_PATH, O_RDONLY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	ssize_t len = fd < 0 ? -1 : read(fd, jnl->boot, JOURNAL_BOOT_LEN - 1);
+	if (fd >= 0)
+		close(fd);
+	jnl->boot[len > 0 ? len : 0] = '\0';
+	jnl->boot[strcspn(jnl->boot, " \n")] = '\0';
+	if (!jnl->boot[0])
+		warning("Unable to identify the boot, the journal is replayed "
+				"whole on startup");
+
+	return 0;
+}
+
+void journal_close(journal_t *jnl)
+{
+	if (!jnl)
+		return;
+	if (jnl->fd >= 0)
+		close(jnl->fd);
+	jnl->fd = -1;
+}
+
+int journal_commit(journal_t *jnl, const regprog_t *progs, size_t n,
+		off_t *txn)
+{
+	trace_span("journal.commit");
+
+	if (!jnl || jnl->fd < 0 || (!progs && n) || !txn) {
+		error("Journal is not open or programs not specified");
+		return -1;
+	}
+
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *rec = open_memstream(&buf, &len);
+	if (!rec) {
+		error("Unable to allocate the journal record");
+		return -1;
+	}
+
+	/* the empty line keeps the transaction apart from a torn tail */
+	fprintf(rec, "\nB %zu\n", n);
+	for (size_t i = 0; i < n; ++i) {
+		fprintf(rec, "R %zu %" PRIu32 " %s\n", progs[i].nlocs,
+				progs[i].flags, progs[i].name);
+		for (size_t j = 0; j < progs[i].nlocs; ++j) {
+			const regloc_t *loc = &progs[i].locs[j];
+			fprintf(rec, "K %" PRId64 " %" PRIu32 " %" PRId32 " %"
+					PRIu64 " %.*s\n", loc->added,
+					loc->flags, loc->priority,
+					loc->version, (int)loc->len,
+					loc->path);
+			if (memchr(loc->path, '\n', loc->len)) {
+				error("Install location contains a newline");
+				fclose(rec);
+				free(buf);
+				return -1;
+			}
+		}
+	}
+	fputs("C\n", rec);
+	if (fclose(rec)) {
+		error("Unable to prepare the journal record");
+		free(buf);
+		return -1;
+	}
+
+	/* the descriptor is only ever written through, so its offset is the
+	 * end of the record appended last */
+	int result = journal_write_all(jnl->fd, buf, len);
+	off_t end = result ? -1 : lseek(jnl->fd, 0, SEEK_CUR);
+	free(buf);
+	if (end < 0 || fdatasync(jnl->fd)) {
+		error("Unable to write the journal: %s", jnl->path);
+		return -1;
+	}
+
+	*txn = end - len + 1;
+	return 0;
+}
+
+int journal_done(journal_t *jnl, off_t txn)
+{
+	trace_span("journal.done");
+
+	if (!jnl || jnl->fd < 0) {
+		error("Journal is not open");
+		return -1;
+	}
+
+	char rec[32 + JOURNAL_BOOT_LEN];
+	int len = snprintf(rec, sizeof(rec), "D %jd%s%s\n", (intmax_t)txn,
+			jnl->boot[0] ? " " : "", jnl->boot);
+	if (journal_write_all(jnl->fd, rec, len)) {
+		error("Unable to write the journal: %s", jnl->path);
+		return -1;
+	}
+	return 0;
+}
+
+int journal_abandon(journal_t *jnl, off_t txn)
+{
+	trace_span("journal.abandon");
+
+	if (!jnl || jnl->fd < 0) {
+		error("Journal is not open");
+		return -1;
+	}
+
+	char rec[32];
+	int len = snprintf(rec, sizeof(rec), "A %jd\n", (intmax_t)txn);
+	if (journal_write_all(jnl->fd, rec, len)) {
+		error("Unable to write the journal: %s", jnl->path);
+		return -1;
+	}
+	return 0;
+}
+
+off_t journal_size(const journal_t *jnl)
+{
+	struct stat details;
+	if (!jnl || jnl->fd < 0)
+		return -1;
+	stats_count(STATS_STATS);
+	if (fstat(jnl->fd, &details))
+		return -1;
+	return details.st_size;
+}
+
+int journal_reset(journal_t *jnl)
+{
+	trace_span("journal.reset");
+
+	if (!jnl || jnl->fd < 0 || ftruncate(jnl->fd, 0)) {
+		error("Unable to reset the journal");
+		return -1;
+	}
+	return 0;
+}
+
+/* make room for one more element of an array growing in powers of two */
+static int journal_reserve(void *array, size_t *cap, size_t n, size_t size)
+{
+	if (n < *cap)
+		return 0;
+	size_t ncap = *cap ? *cap * 2 : 16;
+	void *grown = realloc(*(void **)array, ncap * size);
+	if (!grown)
+		return -1;
+	*(void **)array = grown;
+	*cap = ncap;
+	return 0;
+}
+
+/*
+ * Note:
+ * Parse the whole journal into transactions. A transaction is kept only once
+ * its end record shows up with all the programs and locations it announced,
+ * anything else is rolled back.
+ */
+static int journal_parse(journal_t *jnl, struct jnl_parse *jp)
+{
+	memset(jp, 0, sizeof(struct jnl_parse));
+	off_t size = journal_size(jnl);
+	if (size < 0)
+		return -1;
+	if (!size)
+		return 0;
+
+	jp->buf = malloc(size + 1);
+	if (!jp->buf)
+		return -1;
+	ssize_t len = 0;
+	while (len < size) {
+		ssize_t result = pread(jnl->fd, jp->buf + len, size - len,
+				len);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			break;
+		len += result;
+	}
+	jp->buf[len] = '\0';
+
+	size_t ctxns = 0, cprogs = 0, clocs = 0, cmarks = 0;
+	struct jnl_txn *cur = NULL;
+	size_t nprogs = 0, nlocs = 0;	/* still expected by cur */
+	char *end;
+	for (char *line = jp->buf; line < jp->buf + len; line = end + 1) {
+		end = strchr(line, '\n');
+		if (!end)
+			break;
+		*end = '\0';
+
+		/* any other record within a transaction means it has been cut
+		 * short, roll it back */
+		if (cur && line[0] != 'P' && line[0] != 'R' &&
+				line[0] != 'L' && line[0] != 'K' &&
+				line[0] != 'C') {
+			jp->nprogs = cur->first;
+			jp->nlocs = cur->firstloc;
+			jp->ntxns--;
+			cur = NULL;
+		}
+
+		char *rest = NULL;
+		bool bad = false;
+		switch (line[0]) {
+			case 'B':
+				if (journal_reserve(&jp->txns, &ctxns,
+							jp->ntxns,
+							sizeof(struct jnl_txn)))
+					return -1;
+				cur = &jp->txns[jp->ntxns++];
+				cur->off = line - jp->buf;
+				cur->first = jp->nprogs;
+				cur->firstloc = jp->nlocs;
+				cur->nprogs = 0;
+				cur->done = false;
+				cur->abandoned = false;
+				nprogs = strtoul(line + 1, &rest, 10);
+				nlocs = 0;
+				bad = *rest != '\0';
+				break;
+			case 'P':
+			case 'R': {
+				bad = !cur || nlocs || !nprogs;
+				if (bad)
+					break;
+				size_t ccur = cprogs;
+				if (journal_reserve(&jp->progs, &ccur,
+							jp->nprogs,
+							sizeof(regprog_t)) ||
+						journal_reserve(&jp->firstloc,
+							&cprogs, jp->nprogs,
+							sizeof(size_t)))
+					return -1;
+				regprog_t *prog = &jp->progs[jp->nprogs];
+				jp->firstloc[jp->nprogs++] = jp->nlocs;
+				nlocs = strtoul(line + 1, &rest, 10);
+				prog->nlocs = nlocs;
+				prog->flags = line[0] == 'R' ?
+					strtoul(rest, &rest, 10) : 0;
+				prog->name = rest + 1;
+				bad = *rest != ' ' || !rest[1];
+				cur->nprogs++;
+				nprogs--;
+				break;
+			}
+			case 'L':
+			case 'K': {
+				bad = !cur || !nlocs;
+				if (bad)
+					break;
+				if (journal_reserve(&jp->locs, &clocs,
+							jp->nlocs,
+							sizeof(regloc_t)))
+					return -1;
+				regloc_t *loc = &jp->locs[jp->nlocs++];
+				loc->added = strtoll(line + 1, &rest, 10);
+				loc->flags = strtoul(rest, &rest, 10);
+				loc->priority = 0;
+				if (line[0] == 'K') {
+					loc->priority = strtol(rest, &rest,
+							10);
+					loc->version = strtoull(rest, &rest,
+							10);
+				}
+				loc->path = rest + 1;
+				loc->len = end - loc->path;
+				bad = *rest != ' ' || !loc->len;
+				if (!bad && line[0] == 'L')
+					loc->version = version_key(loc->path,
+							loc->len);
+				nlocs--;
+				break;
+			}
+			case 'C':
+				bad = !cur || nprogs || nlocs;
+				if (!bad)
+					cur = NULL;
+				break;
+			case 'D':
+			case 'A': {
+				size_t size = sizeof(struct jnl_mark);
+				if (journal_reserve(&jp->marks, &cmarks,
+							jp->nmarks, size))
+					return -1;
+				struct jnl_mark *mark = &jp->marks[jp->nmarks];
+				mark->off = strtoll(line + 1, &rest, 10);
+				mark->abandoned = line[0] == 'A';
+				/* a done record counts only during its boot */
+				if (mark->abandoned ? *rest == '\0' :
+						*rest == ' ' && jnl->boot[0] &&
+						!strcmp(rest + 1, jnl->boot))
+					jp->nmarks++;
+				break;
+			}
+		}
+
+		if (bad && cur) {
+			jp->nprogs = cur->first;
+			jp->nlocs = cur->firstloc;
+			jp->ntxns--;
+			cur = NULL;
+		}
+	}
+
+	/* a transaction without its end record never got applied */
+	if (cur) {
+		jp->nprogs = cur->first;
+		jp->nlocs = cur->firstloc;
+		jp->ntxns--;
+	}
+
+	for (size_t i = 0; i < jp->nprogs; ++i)
+		jp->progs[i].locs = &jp->locs[jp->firstloc[i]];
+	for (size_t i = 0; i < jp->nmarks; ++i)
+		for (size_t t = 0; t < jp->ntxns; ++t) {
+			if (jp->txns[t].off != jp->marks[i].off)
+				continue;
+			if (jp->marks[i].abandoned)
+				jp->txns[t].abandoned = true;
+			else
+				jp->txns[t].done = true;
+		}
+
+	return 0;
+}
+
+static void journal_parse_free(struct jnl_parse *jp)
+{
+	free(jp->buf);
+	free(jp->txns);
+	free(jp->progs);
+	free(jp->locs);
+	free(jp->firstloc);
+	free(jp->marks);
+}
+
+int journal_replay(journal_t *jnl, journal_apply_t apply, void *arg)
+{
+	trace_span("journal.replay");
+
+	if (!jnl || jnl->fd < 0) {
+		error("Journal is not open");
+		return -1;
+	}
+
+	struct jnl_parse jp;
+	if (journal_parse(jnl, &jp)) {
+		error("Unable to parse the journal: %s", jnl->path);
+		journal_parse_free(&jp);
+		return -1;
+	}
+
+	int pending = 0;
+	regprog_t *progs = calloc(jp.nprogs + 1, sizeof(regprog_t));
+	for (size_t t = 0; progs && t < jp.ntxns; ++t) {
+		const struct jnl_txn *txn = &jp.txns[t];
+		if (txn->done || txn->abandoned)
+			continue;
+		pending++;
+		if (!apply)
+			continue;
+
+		/* programs touched again later on are left to the later
+		 * transaction, unless it has been abandoned */
+		size_t n = 0;
+		for (size_t i = txn->first; i < txn->first + txn->nprogs; ++i) {
+			bool later = false;
+			for (size_t u = t + 1; !later && u < jp.ntxns; ++u) {
+				const struct jnl_txn *next = &jp.txns[u];
+				for (size_t j = next->first; !next->abandoned &&
+						!later && j < next->first +
+						next->nprogs; ++j)
+					later = strcmp(jp.progs[i].name,
+							jp.progs[j].name) == 0;
+			}
+			if (!later)
+				progs[n++] = jp.progs[i];
+		}
+
+		info("Replaying the journal transaction at %jd with %zu "
+				"programs", (intmax_t)txn->off, n);
+		if (n && apply(progs, n, arg))
+			warning("Unable to replay the journal transaction "
+					"at %jd", (intmax_t)txn->off);
+		journal_done(jnl, txn->off);
+	}
+
+	if (!progs)
+		pending = -1;
+	free(progs);
+	journal_parse_free(&jp);
+	return pending;
+}
@@ -0,0 +1,3046 @@
+/**
+ * @file libxvman.c
+ * @brief File containing the embeddable API of xvman.
+ *
+ * Everything here works on a context handle and reports through error codes,
+ * the messages meant for a user are left to the caller. The diagnostics still
+ * go to the log when the caller has set one up.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/libxvman.h"
+#include "../inc/xvman.h"
+#include "../inc/log.h"
+#include "../inc/io.h"
+#include "../inc/util.h"
+#include "../inc/registry.h"
+#include "../inc/journal.h"
+#include "../inc/stats.h"
+#include "../inc/trace.h"
+#include "../inc/version.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct libxvman {
+	registry_t registry;		/* program registry */
+	journal_t journal;		/* journal of registry updates */
+	int cbin_fd;			/* custom binary directory */
+	int flags;			/* flags the context was opened with */
+	char cbin[PATH_MAX];		/* custom binary directory path */
+	char confdir[PATH_MAX];		/* configuration directory path */
+};
+
+/**
+ * @brief Operations of libxvman_apply() touching the same program.
+ */
+typedef struct {
+	regloc_t *locs;			/* resulting install locations */
+	size_t nlocs;			/* number of resulting locations */
+	char *target;			/* new symlink target, NULL to remove */
+	uint32_t flags;			/* resulting program flags */
+	bool relink;			/* active location has changed */
+	size_t first, end;		/* range of the sorted operations */
+} libxvman_group_t;
+
+static const char *libxvman_errors[] = {
+	"Success",
+	"Invalid argument",
+	"Out of memory",
+	"Unable to open the configuration",
+	"Configuration opened for reading only",
+	"Unable to lock the registry",
+	"Program is not configured",
+	"Install location is not registered",
+	"Install location already added",
+	"Install location does not exist",
+	"Error while writing the journal",
+	"Error while updating the registry",
+	"Error while creating symlink"
+};
+
+/**
+ * @brief Check the name of a program, which becomes a file name and ends a
+ * line of the journal.
+ */
+static bool libxvman_valid_name(const char *pname)
+{
+	if (!pname || !pname[0] || strlen(pname) > NAME_MAX ||
+			strchr(pname, '/') || !strcmp(pname, ".") ||
+			!strcmp(pname, ".."))
+		return false;
+	for (const unsigned char *c = (const unsigned char *)pname; *c; ++c)
+		if (*c < 0x20 || *c == 0x7f)
+			return false;
+	return true;
+}
+
+/**
+ * @brief Check an install location, which the journal keeps on one line.
+ */
+static bool libxvman_valid_loc(const char *ilocation)
+{
+	return ilocation && ilocation[0] && strlen(ilocation) < PATH_MAX &&
+		!strchr(ilocation, '\n');
+}
+
+/**
+ * @brief Compare the rank of two install locations in the automatic selection
+ * mode, a positive result when the first one ranks higher. The ones flagged
+ * missing rank below all the others.
+ */
+static int libxvman_rank_cmp(const regloc_t *a, const regloc_t *b)
+{
+	if ((a->flags ^ b->flags) & REGLOC_MISSING)
+		return a->flags & REGLOC_MISSING ? -1 : 1;
+	if (a->priority != b->priority)
+		return a->priority > b->priority ? 1 : -1;
+	if (a->version != b->version)
+		return a->version > b->version ? 1 : -1;
+	if (a->added != b->added)
+		return a->added > b->added ? 1 : -1;
+	return 0;
+}
+
+/*
+ * Note:
+ * Find where an install location goes in a list ranked highest first. It goes
+ * ahead of the locations ranking the same when asked to, which keeps a new
+ * location ahead of the older ones added within the same second just like the
+ * manual selection mode does.
+ */
+static size_t libxvman_rank(const regloc_t *locs, size_t n,
+		const regloc_t *loc, bool ahead)
+{
+	size_t i = 0;
+	for (; i < n; ++i) {
+		int cmp = libxvman_rank_cmp(loc, &locs[i]);
+		if (cmp > 0 || (ahead && !cmp))
+			break;
+	}
+	return i;
+}
+
+/*
+ * Note:
+ * Flag an install location missing or bring it back. In the automatic
+ * selection mode it moves to its new rank, behind the ones ranking the same,
+ * in the manual one it keeps its place so that a choice made comes back along
+ * with the location.
+ */
+static void libxvman_flag(regloc_t *locs, size_t n, size_t index,
+		bool missing, bool ranked)
+{
+	regloc_t loc = locs[index];
+	if (missing)
+		loc.flags |= REGLOC_MISSING;
+	else
+		loc.flags &= ~REGLOC_MISSING;
+	if (!ranked) {
+		locs[index] = loc;
+		return;
+	}
+	memmove(&locs[index], &locs[index + 1], (n - index - 1) *
+			sizeof(regloc_t));
+	size_t rank = libxvman_rank(locs, n - 1, &loc, false);
+	memmove(&locs[rank + 1], &locs[rank], (n - 1 - rank) *
+			sizeof(regloc_t));
+	locs[rank] = loc;
+}
+
+/**
+ * @brief Find the default install location, the first one which is not
+ * flagged missing or the first one when all of them are.
+ */
+static size_t libxvman_default(const regloc_t *locs, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (!(locs[i].flags & REGLOC_MISSING))
+			return i;
+	return 0;
+}
+
+/**
+ * @brief Fill the default install location of a registered program.
+ *
+ * @return Returns its index, -1 if the program has no install location.
+ */
+static int libxvman_entry_default(registry_t *reg, const regentry_t *entry,
+		regloc_t *loc)
+{
+	int first = -1;
+	regloc_t cur;
+	for (uint32_t i = 0; i < entry->nlocs; ++i) {
+		if (registry_loc(reg, entry, i, &cur))
+			continue;
+		if (first < 0) {
+			first = i;
+			*loc = cur;
+		}
+		if (!(cur.flags & REGLOC_MISSING)) {
+			*loc = cur;
+			return i;
+		}
+	}
+	return first;
+}
+
+/**
+ * @brief Fill an install location about to be added.
+ */
+static void libxvman_new_loc(regloc_t *loc, const char *ilocation,
+		int32_t priority)
+{
+	loc->path = ilocation;
+	loc->len = strlen(ilocation);
+	loc->flags = 0;
+	loc->added = time(NULL);
+	loc->version = version_key(ilocation, loc->len);
+	loc->priority = priority;
+}
+
+/*
+ * Note:
+ * Point the symlink of a program in the custom binary directory to the given
+ * install location, or remove it when there is none. The directory is opened
+ * once and the links are switched relative to it, so a switch costs a
+ * symlinkat and a rename no matter how deep the directory is. It is created
+ * on the first switch when missing.
+ */
+static int libxvman_link(libxvman_t *ctx, const char *pname,
+		const char *target)
+{
+	if (ctx->cbin_fd < 0) {
+		ctx->cbin_fd = open(ctx->cbin, O_PATH | O_DIRECTORY |
+				O_CLOEXEC);
+		stats_count(STATS_OPENS);
+		if (ctx->cbin_fd < 0 && errno == ENOENT &&
+				!io_mkdir(ctx->cbin, S_IRWXU, true)) {
+			ctx->cbin_fd = open(ctx->cbin, O_PATH | O_DIRECTORY |
+					O_CLOEXEC);
+			stats_count(STATS_OPENS);
+		}
+		if (ctx->cbin_fd < 0) {
+			error("Unable to open custom binary directory: %s",
+					ctx->cbin);
+			return -1;
+		}
+	}
+
+	debug("Symlink %s/%s -> %s", CBIN, pname, target ? target : "");
+	int result;
+	stats_begin(STATS_LINK);
+	if (!target)
+		result = unlinkat(ctx->cbin_fd, pname, 0) && errno != ENOENT ?
+			-1 : 0;
+	else
+		result = util_symlink_switch(target, ctx->cbin_fd, pname);
+	stats_end(STATS_LINK);
+	return result;
+}
+
+#ifdef ENABLE_DEBUG
+/*
+ * Note:
+ * Kill the process at the named step of an update when XVMAN_FAULT asks for
+ * it, used to check the recovery from the journal. The steps are "journal"
+ * once the update is recorded, "registry" once the registry is written and
+ * "link" once the symlinks are switched.
+ */
+static void libxvman_fault(const char *step)
+{
+	const char *fault = getenv("XVMAN_FAULT");
+	if (fault && strcmp(fault, step) == 0)
+		kill(getpid(), SIGKILL);
+}
+#else
+#define libxvman_fault(step)
+#endif
+
+/*
+ * Note:
+ * Update a single program with the program locked. The new install locations
+ * are recorded in the journal before the registry is written and the symlink
+ * switched, the transaction is marked as done afterwards. A failure to write
+ * the registry leaves everything as it was, so the transaction is abandoned;
+ * a failure to switch the symlink leaves it to be replayed.
+ */
+static int libxvman_update(libxvman_t *ctx, const char *pname,
+		const regloc_t *locs, size_t nlocs, uint32_t flags,
+		const char *target)
+{
+	off_t txn;
+	regprog_t prog = {pname, locs, nlocs, flags};
+	stats_begin(STATS_JOURNAL);
+	int result = journal_commit(&ctx->journal, &prog, 1, &txn);
+	stats_end(STATS_JOURNAL);
+	if (result) {
+		error("Error while writing the journal");
+		return LIBXVMAN_EJOURNAL;
+	}
+	libxvman_fault("journal");
+
+	stats_begin(STATS_REGISTRY);
+	result = registry_put(&ctx->registry, pname, locs, nlocs, flags);
+	stats_end(STATS_REGISTRY);
+	if (result) {
+		journal_abandon(&ctx->journal, txn);
+		error("Error while updating the registry");
+		return LIBXVMAN_EREGISTRY;
+	}
+	libxvman_fault("registry");
+
+	if (libxvman_link(ctx, pname, target)) {
+		error("Error while creating symlink");
+		return LIBXVMAN_ELINK;
+	}
+	libxvman_fault("link");
+
+	journal_done(&ctx->journal, txn);
+	return LIBXVMAN_OK;
+}
+
+/**
+ * @brief Apply a transaction replayed from the journal.
+ */
+static int libxvman_replay(const regprog_t *progs, size_t n, void *arg)
+{
+	libxvman_t *ctx = arg;
+	if (registry_put_many(&ctx->registry, progs, n))
+		return -1;
+
+	int result = 0;
+	for (size_t i = 0; i < n; ++i) {
+		debug("Replaying %s with %zu locations", progs[i].name,
+				progs[i].nlocs);
+		size_t active = libxvman_default(progs[i].locs,
+				progs[i].nlocs);
+		if (libxvman_link(ctx, progs[i].name, progs[i].nlocs ?
+					progs[i].locs[active].path : NULL))
+			result = -1;
+	}
+	return result;
+}
+
+/**
+ * @brief Flush the registry and the symlinks to disk.
+ */
+static int libxvman_sync(libxvman_t *ctx)
+{
+	if (registry_sync(&ctx->registry))
+		return -1;
+
+	const char *dirs[] = {ctx->cbin, ctx->confdir};
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+		int fd = open(dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		stats_count(STATS_OPENS);
+		if (fd < 0 && errno == ENOENT)
+			continue;
+		if (fd < 0 || fsync(fd)) {
+			error("Unable to sync directory: %s", dirs[i]);
+			if (fd >= 0)
+				close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+	return 0;
+}
+
+/*
+ * Note:
+ * Replay the updates a crashed run or a reboot has left pending, and once the
+ * journal has grown past JOURNAL_CHECKPOINT or anything got replayed sync
+ * everything it covers and truncate it. Only the size is checked unless a
+ * scan is asked for, the scan itself takes no lock. The whole registry is
+ * locked only when there is something to do, which also waits for the
+ * updates in progress to finish.
+ */
+static int libxvman_checkpoint(libxvman_t *ctx, bool scan)
+{
+	off_t size = journal_size(&ctx->journal);
+	if (size < 0)
+		return LIBXVMAN_EJOURNAL;
+	if (size < JOURNAL_CHECKPOINT && (!scan || !size ||
+				journal_replay(&ctx->journal, NULL, NULL) == 0))
+		return LIBXVMAN_OK;
+
+	if (registry_lock(&ctx->registry)) {
+		error("Unable to lock the registry");
+		return LIBXVMAN_ELOCK;
+	}
+	int replayed = journal_replay(&ctx->journal, libxvman_replay, ctx);
+	if (replayed > 0)
+		warning("Replayed %d pending updates from the journal",
+				replayed);
+
+	int result = replayed < 0 ? LIBXVMAN_EJOURNAL : LIBXVMAN_OK;
+	if (!result && (replayed > 0 || journal_size(&ctx->journal) >=
+				JOURNAL_CHECKPOINT)) {
+		info("Checkpointing the journal");
+		result = libxvman_sync(ctx) || journal_reset(&ctx->journal) ?
+			LIBXVMAN_EJOURNAL : LIBXVMAN_OK;
+	}
+	registry_unlock(&ctx->registry);
+	return result;
+}
+
+int libxvman_open(libxvman_t **ctx, const char *home, int flags)
+{
+	trace_span("libxvman.open");
+
+	if (!ctx)
+		return LIBXVMAN_EINVAL;
+	*ctx = NULL;
+	if (!home)
+		home = getenv("HOME");
+	if (!home)
+		return LIBXVMAN_EINVAL;
+
+	libxvman_t *c = calloc(1, sizeof(libxvman_t));
+	if (!c)
+		return LIBXVMAN_ENOMEM;
+	c->registry.fd = c->registry.lockfd = -1;
+	c->journal.fd = -1;
+	c->cbin_fd = -1;
+	c->flags = flags;
+
+	char regpath[PATH_MAX], journalpath[PATH_MAX];
+	if (snprintf(c->cbin, PATH_MAX, "%s/%s", home, CBIN) >= PATH_MAX ||
+			snprintf(c->confdir, PATH_MAX, "%s/%s", home,
+				CONFDIR) >= PATH_MAX ||
+			snprintf(regpath, PATH_MAX, "%s/%s", home,
+				CONF_REGPATH) >= PATH_MAX ||
+			snprintf(journalpath, PATH_MAX, "%s/%s", home,
+				CONF_JOURNALPATH) >= PATH_MAX) {
+		error("Configuration path is too long: %s", home);
+		free(c);
+		return LIBXVMAN_EINVAL;
+	}
+
+	/*
+	 * Note:
+	 * A context for reading only creates nothing, a missing registry is
+	 * an empty one. Otherwise the configuration directory is created only
+	 * when it is missing, the custom binary directory on the first switch,
+	 * so opening an existing configuration costs no more than opening the
+	 * registry and the journal.
+	 */
+	int result = LIBXVMAN_OK;
+	if (flags & LIBXVMAN_READONLY) {
+		if (registry_open_readonly(&c->registry, regpath))
+			result = LIBXVMAN_ESETUP;
+	} else if ((!io_path_exists(c->confdir) &&
+				io_mkdir(c->confdir, S_IRWXU, true)) ||
+			registry_open(&c->registry, regpath) ||
+			journal_open(&c->journal, journalpath)) {
+		result = LIBXVMAN_ESETUP;
+	} else {
+		/* finish the updates a crashed run has left behind */
+		result = libxvman_checkpoint(c, true);
+	}
+	if (result) {
+		libxvman_close(c);
+		return result;
+	}
+
+	*ctx = c;
+	return LIBXVMAN_OK;
+}
+
+void libxvman_close(libxvman_t *ctx)
+{
+	if (!ctx)
+		return;
+	registry_close(&ctx->registry);
+	journal_close(&ctx->journal);
+	if (ctx->cbin_fd >= 0)
+		close(ctx->cbin_fd);
+	free(ctx);
+}
+
+/**
+ * @brief Lock a program, the wait for it is timed.
+ */
+static int libxvman_lock(libxvman_t *ctx, const char *pname, bool exclusive)
+{
+	stats_begin(STATS_LOCK);
+	int result = registry_lock_prog(&ctx->registry, pname, exclusive);
+	stats_end(STATS_LOCK);
+	if (result)
+		error("Unable to lock the registry");
+	return result;
+}
+
+/**
+ * @brief Check the arguments of an update of a single program.
+ */
+static int libxvman_check(const libxvman_t *ctx, const char *pname,
+		const char *ilocation)
+{
+	if (!ctx || !libxvman_valid_name(pname) ||
+			!libxvman_valid_loc(ilocation))
+		return LIBXVMAN_EINVAL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+	return LIBXVMAN_OK;
+}
+
+int libxvman_add(libxvman_t *ctx, const char *pname, const char *ilocation)
+{
+	return libxvman_add_priority(ctx, pname, ilocation, 0);
+}
+
+int libxvman_add_priority(libxvman_t *ctx, const char *pname,
+		const char *ilocation, int32_t priority)
+{
+	int result = libxvman_check(ctx, pname, ilocation);
+	if (result)
+		return result;
+	if (!io_path_exists(ilocation)) {
+		error("Install location specified does not exist");
+		return LIBXVMAN_EMISSING;
+	}
+
+	/*
+	 * Note:
+	 * Look up the program in the registry, a duplicate install location is
+	 * found through the location hashes of the program. The new install
+	 * location is put at the top, followed by the older ones, unless the
+	 * program is in the automatic selection mode where it goes to its
+	 * rank. An install location flagged missing is brought back instead.
+	 * The program stays locked until the symlink has been switched so
+	 * that concurrent additions to it are applied one after the other,
+	 * while the other programs can be updated meanwhile.
+	 */
+	if (libxvman_lock(ctx, pname, true))
+		return LIBXVMAN_ELOCK;
+
+	regentry_t entry;
+	regloc_t loc;
+	size_t nlocs = 1;
+	stats_begin(STATS_LOOKUP);
+	bool found = registry_lookup(&ctx->registry, pname, &entry);
+	int index = found ? registry_find(&ctx->registry, &entry,
+			ilocation) : -1;
+	stats_end(STATS_LOOKUP);
+	if (found) {
+		debug("Program already registered with %u locations",
+				entry.nlocs);
+		if (index >= 0 && (registry_loc(&ctx->registry, &entry,
+						index, &loc) ||
+					!(loc.flags & REGLOC_MISSING))) {
+			warning("Location: %s already added", ilocation);
+			registry_unlock_prog(&ctx->registry, pname);
+			return LIBXVMAN_EEXIST;
+		}
+		nlocs += index < 0 ? entry.nlocs : entry.nlocs - 1;
+	} else {
+		debug("Program is not registered yet");
+	}
+
+	regloc_t *locs = calloc(nlocs, sizeof(regloc_t));
+	if (!locs) {
+		error("Unable to allocate install locations");
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOMEM;
+	}
+	uint32_t flags = found ? entry.flags : 0;
+	if (index >= 0) {
+		for (size_t i = 0; i < nlocs; ++i)
+			registry_loc(&ctx->registry, &entry, i, &locs[i]);
+		libxvman_flag(locs, nlocs, index, false,
+				flags & REGPROG_AUTO);
+	} else {
+		for (size_t i = 1; i < nlocs; ++i)
+			registry_loc(&ctx->registry, &entry, i - 1, &locs[i]);
+		libxvman_new_loc(&loc, ilocation, priority);
+		size_t rank = flags & REGPROG_AUTO ? libxvman_rank(&locs[1],
+				nlocs - 1, &loc, true) : 0;
+		memmove(&locs[0], &locs[1], rank * sizeof(regloc_t));
+		locs[rank] = loc;
+	}
+
+	/* point the symlink to the default install location in one step, the
+	 * copy outlives the mapping an update of the registry may replace */
+	char target[PATH_MAX];
+	size_t active = libxvman_default(locs, nlocs);
+	snprintf(target, PATH_MAX, "%.*s", (int)locs[active].len,
+			locs[active].path);
+	result = libxvman_update(ctx, pname, locs, nlocs, flags, target);
+	free(locs);
+	registry_unlock_prog(&ctx->registry, pname);
+	if (!result)
+		libxvman_checkpoint(ctx, false);
+	return result;
+}
+
+int libxvman_select(libxvman_t *ctx, const char *pname, const char *ilocation)
+{
+	int result = libxvman_check(ctx, pname, ilocation);
+	if (result)
+		return result;
+
+	if (libxvman_lock(ctx, pname, true))
+		return LIBXVMAN_ELOCK;
+	regentry_t entry;
+	stats_begin(STATS_LOOKUP);
+	bool found = registry_lookup(&ctx->registry, pname, &entry);
+	int index = found ? registry_find(&ctx->registry, &entry,
+			ilocation) : -1;
+	stats_end(STATS_LOOKUP);
+	if (!found) {
+		error("Program: %s is not configured", pname);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOPROG;
+	}
+	if (index < 0) {
+		error("Install location %s is not registered", ilocation);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOLOC;
+	}
+
+	regloc_t *ordered = calloc(entry.nlocs, sizeof(regloc_t));
+	if (!ordered) {
+		error("Unable to allocate install locations");
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOMEM;
+	}
+	registry_loc(&ctx->registry, &entry, index, &ordered[0]);
+	if (ordered[0].flags & REGLOC_MISSING) {
+		error("Install location %s is missing", ilocation);
+		free(ordered);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_EMISSING;
+	}
+	for (uint32_t i = 0, o = 1; i < entry.nlocs; ++i)
+		if (i != (uint32_t)index)
+			registry_loc(&ctx->registry, &entry, i, &ordered[o++]);
+
+	/*
+	 * Note:
+	 * Switch the symlink to the chosen install location, which leaves the
+	 * automatic selection mode so that the choice sticks. The new link is
+	 * renamed over the existing one, so the program never goes missing
+	 * from the custom binary directory.
+	 */
+	result = libxvman_update(ctx, pname, ordered, entry.nlocs,
+			entry.flags & ~REGPROG_AUTO, ilocation);
+	free(ordered);
+	registry_unlock_prog(&ctx->registry, pname);
+	if (!result)
+		libxvman_checkpoint(ctx, false);
+	return result;
+}
+
+int libxvman_auto(libxvman_t *ctx, const char *pname)
+{
+	if (!ctx || !libxvman_valid_name(pname))
+		return LIBXVMAN_EINVAL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+
+	if (libxvman_lock(ctx, pname, true))
+		return LIBXVMAN_ELOCK;
+	regentry_t entry;
+	stats_begin(STATS_LOOKUP);
+	bool found = registry_lookup(&ctx->registry, pname, &entry);
+	stats_end(STATS_LOOKUP);
+	if (!found) {
+		error("Program: %s is not configured", pname);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOPROG;
+	}
+
+	regloc_t *ranked = calloc(entry.nlocs, sizeof(regloc_t));
+	if (!ranked) {
+		error("Unable to allocate install locations");
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOMEM;
+	}
+
+	/*
+	 * Note:
+	 * Rank the install locations once, the ones ranking the same keep
+	 * their order. From here on every update puts a location in its place
+	 * right away, so the default one is always the first one.
+	 */
+	uint32_t nranked = 0;
+	for (uint32_t i = 0; i < entry.nlocs; ++i) {
+		regloc_t loc;
+		if (registry_loc(&ctx->registry, &entry, i, &loc))
+			continue;
+		size_t rank = libxvman_rank(ranked, nranked, &loc, false);
+		memmove(&ranked[rank + 1], &ranked[rank],
+				(nranked - rank) * sizeof(regloc_t));
+		ranked[rank] = loc;
+		nranked++;
+	}
+
+	char target[PATH_MAX];
+	size_t active = libxvman_default(ranked, nranked);
+	if (nranked)
+		snprintf(target, PATH_MAX, "%.*s", (int)ranked[active].len,
+				ranked[active].path);
+	debug("Ranked %u locations of %s, default %s", nranked, pname,
+			nranked ? target : "");
+	int result = libxvman_update(ctx, pname, ranked, nranked,
+			entry.flags | REGPROG_AUTO, nranked ? target : NULL);
+	free(ranked);
+	registry_unlock_prog(&ctx->registry, pname);
+	if (!result)
+		libxvman_checkpoint(ctx, false);
+	return result;
+}
+
+int libxvman_remove(libxvman_t *ctx, const char *pname, const char *ilocation)
+{
+	int result = libxvman_check(ctx, pname, ilocation);
+	if (result)
+		return result;
+
+	if (libxvman_lock(ctx, pname, true))
+		return LIBXVMAN_ELOCK;
+	regentry_t entry;
+	stats_begin(STATS_LOOKUP);
+	bool found = registry_lookup(&ctx->registry, pname, &entry);
+	int index = found ? registry_find(&ctx->registry, &entry,
+			ilocation) : -1;
+	stats_end(STATS_LOOKUP);
+	if (!found) {
+		error("Program: %s is not configured", pname);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOPROG;
+	}
+	if (index < 0) {
+		error("Install location %s is not registered", ilocation);
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOLOC;
+	}
+
+	regloc_t *left = calloc(entry.nlocs, sizeof(regloc_t));
+	if (!left) {
+		error("Unable to allocate install locations");
+		registry_unlock_prog(&ctx->registry, pname);
+		return LIBXVMAN_ENOMEM;
+	}
+	uint32_t nleft = 0;
+	for (uint32_t i = 0; i < entry.nlocs; ++i)
+		if (i != (uint32_t)index)
+			registry_loc(&ctx->registry, &entry, i,
+					&left[nleft++]);
+
+	/* the symlink follows the default location, which is the next one
+	 * when the default one goes, and goes along with the last one */
+	char target[PATH_MAX];
+	size_t active = libxvman_default(left, nleft);
+	if (nleft)
+		snprintf(target, PATH_MAX, "%.*s", (int)left[active].len,
+				left[active].path);
+	result = libxvman_update(ctx, pname, left, nleft, entry.flags,
+			nleft ? target : NULL);
+	free(left);
+	registry_unlock_prog(&ctx->registry, pname);
+	if (!result)
+		libxvman_checkpoint(ctx, false);
+	return result;
+}
+
+static int libxvman_apply_cmp(const void *a, const void *b, void *arg)
+{
+	const libxvman_op_t *ops = arg;
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+	int result = strcmp(ops[x].pname, ops[y].pname);
+	if (result)
+		return result;
+	return x < y ? -1 : x > y;
+}
+
+static int libxvman_apply_find(const regloc_t *locs, size_t n,
+		const char *path)
+{
+	for (size_t i = 0; i < n; ++i)
+		if (strcmp(locs[i].path, path) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * Note:
+ * Apply the operations of a single program, in the given order, on top of the
+ * install locations currently in the registry. Nothing is written here, the
+ * resulting list is collected so that the registry is updated once.
+ */
+static void libxvman_apply_group(libxvman_t *ctx, const libxvman_op_t *ops,
+		const size_t *sorted, libxvman_group_t *group, int *results)
+{
+	const char *pname = ops[sorted[group->first]].pname;
+	regentry_t entry;
+	size_t nexisting = 0;
+	group->flags = 0;
+	if (registry_lookup(&ctx->registry, pname, &entry)) {
+		nexisting = entry.nlocs;
+		group->flags = entry.flags;
+	}
+
+	group->locs = calloc(nexisting + group->end - group->first + 1,
+			sizeof(regloc_t));
+	if (!group->locs) {
+		for (size_t i = group->first; i < group->end; ++i)
+			results[sorted[i]] = LIBXVMAN_ENOMEM;
+		return;
+	}
+	for (size_t i = 0; i < nexisting; ++i)
+		if (!registry_loc(&ctx->registry, &entry, i,
+					&group->locs[group->nlocs]))
+			group->nlocs++;
+
+	regloc_t *locs = group->locs;
+	const char *active = group->nlocs ? locs[libxvman_default(locs,
+			group->nlocs)].path : NULL;
+	for (size_t i = group->first; i < group->end; ++i) {
+		const libxvman_op_t *op = &ops[sorted[i]];
+		int *result = &results[sorted[i]];
+		int index = libxvman_apply_find(locs, group->nlocs,
+				op->ilocation);
+		debug("[apply] %d %s %s", op->op, pname, op->ilocation);
+
+		switch (op->op) {
+			case LIBXVMAN_ADD:
+				if (index >= 0 && !(locs[index].flags &
+							REGLOC_MISSING)) {
+					*result = LIBXVMAN_EEXIST;
+				} else if (!io_path_exists(op->ilocation)) {
+					*result = LIBXVMAN_EMISSING;
+				} else if (index >= 0) {
+					libxvman_flag(locs, group->nlocs,
+						index, false, group->flags &
+						REGPROG_AUTO);
+				} else {
+					regloc_t loc;
+					size_t rank = 0;
+					libxvman_new_loc(&loc, op->ilocation,
+							op->priority);
+					if (group->flags & REGPROG_AUTO)
+						rank = libxvman_rank(locs,
+							group->nlocs, &loc,
+							true);
+					memmove(&locs[rank + 1], &locs[rank],
+						(group->nlocs - rank) *
+						sizeof(regloc_t));
+					locs[rank] = loc;
+					group->nlocs++;
+				}
+				break;
+			case LIBXVMAN_SELECT:
+				if (index < 0) {
+					*result = LIBXVMAN_ENOLOC;
+				} else if (locs[index].flags &
+						REGLOC_MISSING) {
+					*result = LIBXVMAN_EMISSING;
+				} else {
+					regloc_t chosen = locs[index];
+					memmove(&locs[1], &locs[0],
+						index * sizeof(regloc_t));
+					locs[0] = chosen;
+					group->flags &= ~REGPROG_AUTO;
+				}
+				break;
+			case LIBXVMAN_REMOVE:
+				if (index < 0) {
+					*result = LIBXVMAN_ENOLOC;
+				} else {
+					memmove(&locs[index], &locs[index+1],
+						(group->nlocs - index - 1) *
+						sizeof(regloc_t));
+					group->nlocs--;
+				}
+				break;
+			case LIBXVMAN_MISSING:
+				if (index < 0)
+					*result = LIBXVMAN_ENOLOC;
+				else if (!(locs[index].flags &
+							REGLOC_MISSING))
+					libxvman_flag(locs, group->nlocs,
+						index, true, group->flags &
+						REGPROG_AUTO);
+				break;
+			default:
+				*result = LIBXVMAN_EINVAL;
+		}
+	}
+
+	/* without a copy of the new target the symlink could not follow, so
+	 * the program is left alone rather than unlinked */
+	const char *now = group->nlocs ? locs[libxvman_default(locs,
+			group->nlocs)].path : NULL;
+	if (now != active && (!now || !active || strcmp(now, active))) {
+		group->target = now ? strdup(now) : NULL;
+		if (now && !group->target) {
+			error("Unable to allocate the new target of %s", pname);
+			for (size_t i = group->first; i < group->end; ++i)
+				results[sorted[i]] = LIBXVMAN_ENOMEM;
+			free(group->locs);
+			group->locs = NULL;
+			group->nlocs = 0;
+			return;
+		}
+		group->relink = true;
+	}
+}
+
+int libxvman_apply(libxvman_t *ctx, const libxvman_op_t *ops, size_t n,
+		int *results)
+{
+	trace_span("libxvman.apply");
+
+	if (!ctx || (!ops && n))
+		return LIBXVMAN_EINVAL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+
+	int *status = results ? results : calloc(n + 1, sizeof(int));
+	size_t *sorted = calloc(n + 1, sizeof(size_t));
+	libxvman_group_t *groups = calloc(n + 1, sizeof(libxvman_group_t));
+	regprog_t *progs = calloc(n + 1, sizeof(regprog_t));
+	if (!status || !sorted || !groups || !progs) {
+		error("Unable to allocate the operation groups");
+		if (status != results)
+			free(status);
+		free(sorted);
+		free(groups);
+		free(progs);
+		return LIBXVMAN_ENOMEM;
+	}
+
+	/* group the well formed operations by program, keeping the given
+	 * order within every program */
+	size_t nsorted = 0;
+	for (size_t i = 0; i < n; ++i) {
+		status[i] = LIBXVMAN_OK;
+		if (libxvman_valid_name(ops[i].pname) &&
+				libxvman_valid_loc(ops[i].ilocation))
+			sorted[nsorted++] = i;
+		else
+			status[i] = LIBXVMAN_EINVAL;
+	}
+	qsort_r(sorted, nsorted, sizeof(size_t), libxvman_apply_cmp,
+			(void *)ops);
+
+	size_t ngroups = 0, nprogs = 0;
+	bool locked = registry_lock(&ctx->registry) == 0;
+	if (!locked) {
+		error("Unable to lock the registry");
+		for (size_t i = 0; i < nsorted; ++i)
+			status[sorted[i]] = LIBXVMAN_ELOCK;
+		nsorted = 0;
+	}
+	for (size_t i = 0; i < nsorted; ++ngroups) {
+		libxvman_group_t *group = &groups[ngroups];
+		const char *pname = ops[sorted[i]].pname;
+		group->first = i;
+		while (i < nsorted && strcmp(ops[sorted[i]].pname, pname) == 0)
+			i++;
+		group->end = i;
+
+		libxvman_apply_group(ctx, ops, sorted, group, status);
+		if (group->locs) {
+			progs[nprogs].name = pname;
+			progs[nprogs].locs = group->locs;
+			progs[nprogs].nlocs = group->nlocs;
+			progs[nprogs].flags = group->flags;
+			nprogs++;
+		}
+	}
+
+	/* a single transaction and a single update of the registry for all
+	 * the operations */
+	off_t txn = -1;
+	bool relinked = true;
+	stats_begin(STATS_JOURNAL);
+	if (locked && nprogs && journal_commit(&ctx->journal, progs, nprogs,
+				&txn))
+		error("Error while writing the journal");
+	stats_end(STATS_JOURNAL);
+	libxvman_fault("journal");
+	stats_begin(STATS_REGISTRY);
+	bool written = locked && (!nprogs || txn >= 0) &&
+		!registry_put_many(&ctx->registry, progs, nprogs);
+	stats_end(STATS_REGISTRY);
+	if (!written) {
+		error("Error while updating the registry");
+		for (size_t i = 0; i < nsorted; ++i)
+			if (!status[sorted[i]])
+				status[sorted[i]] = txn < 0 ?
+					LIBXVMAN_EJOURNAL : LIBXVMAN_EREGISTRY;
+	} else {
+		libxvman_fault("registry");
+		for (size_t g = 0; g < ngroups; ++g) {
+			if (!groups[g].relink)
+				continue;
+
+			const char *pname = ops[sorted[groups[g].first]].pname;
+			if (libxvman_link(ctx, pname, groups[g].target)) {
+				error("Error while switching symlink: %s",
+						pname);
+				for (size_t i = groups[g].first;
+						i < groups[g].end; ++i)
+					if (!status[sorted[i]])
+						status[sorted[i]] =
+							LIBXVMAN_ELINK;
+				relinked = false;
+			}
+		}
+		libxvman_fault("link");
+	}
+	if (txn >= 0 && !written)
+		journal_abandon(&ctx->journal, txn);
+	else if (txn >= 0 && relinked)
+		journal_done(&ctx->journal, txn);
+
+	if (locked)
+		registry_unlock(&ctx->registry);
+	if (txn >= 0)
+		libxvman_checkpoint(ctx, false);
+
+	int result = LIBXVMAN_OK;
+	for (size_t i = 0; !result && i < n; ++i)
+		result = status[i];
+	info("Applied %zu operations across %zu programs", n, ngroups);
+
+	for (size_t g = 0; g < ngroups; ++g) {
+		free(groups[g].locs);
+		free(groups[g].target);
+	}
+	if (status != results)
+		free(status);
+	free(sorted);
+	free(groups);
+	free(progs);
+
+	return result;
+}
+
+/*
+ * Note:
+ * A context lives on across updates made by other processes, the mapping is
+ * brought up to date before reading. A context for reading only which found
+ * no registry looks for it again.
+ */
+static int libxvman_view(libxvman_t *ctx)
+{
+	if (!ctx->registry.map) {
+		char path[PATH_MAX];
+		snprintf(path, PATH_MAX, "%s", ctx->registry.path);
+		registry_close(&ctx->registry);
+		return registry_open_readonly(&ctx->registry, path) ?
+			LIBXVMAN_ESETUP : LIBXVMAN_OK;
+	}
+	return registry_refresh(&ctx->registry) ? LIBXVMAN_ESETUP :
+		LIBXVMAN_OK;
+}
+
+/*
+ * Note:
+ * The reads of a context for reading only do not lock, so a writer may have
+ * grown the registry past the mapping since it was refreshed. A program whose
+ * new location block lies beyond the mapping is then missing from the view,
+ * pick the growth up and look again.
+ */
+static bool libxvman_lookup(libxvman_t *ctx, const char *pname,
+		regentry_t *entry)
+{
+	if (registry_lookup(&ctx->registry, pname, entry))
+		return true;
+
+	size_t size = ctx->registry.size;
+	return ctx->registry.map && !registry_refresh(&ctx->registry) &&
+		ctx->registry.size != size &&
+		registry_lookup(&ctx->registry, pname, entry);
+}
+
+/**
+ * @brief Lock a program for reading, which only a writable context does.
+ */
+static int libxvman_read_lock(libxvman_t *ctx, const char *pname)
+{
+	if (!(ctx->flags & LIBXVMAN_READONLY)) {
+		/* a shared lock waits for a switch of the program in progress,
+		 * so the default location is the one the symlink points to */
+		return libxvman_lock(ctx, pname, false) ? LIBXVMAN_ELOCK :
+			LIBXVMAN_OK;
+	}
+	return libxvman_view(ctx);
+}
+
+static void libxvman_read_unlock(libxvman_t *ctx, const char *pname)
+{
+	if (!(ctx->flags & LIBXVMAN_READONLY))
+		registry_unlock_prog(&ctx->registry, pname);
+}
+
+int libxvman_query(libxvman_t *ctx, const char *pname, libxvman_loc_cb cb,
+		void *arg)
+{
+	if (!ctx || !libxvman_valid_name(pname) || !cb)
+		return LIBXVMAN_EINVAL;
+
+	int result = libxvman_read_lock(ctx, pname);
+	if (result)
+		return result;
+
+	regentry_t entry;
+	if (!libxvman_lookup(ctx, pname, &entry)) {
+		libxvman_read_unlock(ctx, pname);
+		return LIBXVMAN_ENOPROG;
+	}
+
+	/* the default location first, the others in their order */
+	regloc_t loc;
+	int active = libxvman_entry_default(&ctx->registry, &entry, &loc);
+	for (int i = -1; active >= 0 && i < (int)entry.nlocs; ++i) {
+		if (i == active || (i >= 0 && registry_loc(&ctx->registry,
+						&entry, i, &loc)))
+			continue;
+		libxvman_loc_t view = {loc.path, loc.len, loc.added,
+			loc.priority, !!(loc.flags & REGLOC_MISSING)};
+		if (cb(&view, arg))
+			break;
+	}
+
+	libxvman_read_unlock(ctx, pname);
+	return LIBXVMAN_OK;
+}
+
+int libxvman_current(libxvman_t *ctx, const char *pname, char *buf,
+		size_t len)
+{
+	if (!ctx || !libxvman_valid_name(pname) || !buf)
+		return LIBXVMAN_EINVAL;
+
+	int result = libxvman_read_lock(ctx, pname);
+	if (result)
+		return result;
+
+	regentry_t entry;
+	regloc_t loc;
+	if (!libxvman_lookup(ctx, pname, &entry) ||
+			libxvman_entry_default(&ctx->registry, &entry,
+				&loc) < 0)
+		result = LIBXVMAN_ENOPROG;
+	else if (loc.len >= len)
+		result = LIBXVMAN_EINVAL;
+	else
+		snprintf(buf, len, "%.*s", (int)loc.len, loc.path);
+
+	libxvman_read_unlock(ctx, pname);
+	return result;
+}
+
+int libxvman_list(libxvman_t *ctx, libxvman_prog_cb cb, void *arg)
+{
+	if (!ctx || !cb)
+		return LIBXVMAN_EINVAL;
+
+	int result = libxvman_view(ctx);
+	if (result)
+		return result;
+
+	/*
+	 * Note:
+	 * The programs switched while listing whose new location block lies
+	 * beyond the mapping are skipped by the first pass. Once the growth
+	 * of the registry is picked up, a second pass lists just those, so a
+	 * program switched in the middle may show up twice but never goes
+	 * missing.
+	 */
+	registry_t *reg = &ctx->registry;
+	size_t size = 0;
+	for (int pass = 0; pass < 2; ++pass) {
+		uint32_t cursor = 0;
+		regentry_t entry;
+		regloc_t loc;
+		while (registry_next(reg, &cursor, &entry)) {
+			if (entry.block < size ||
+					libxvman_entry_default(reg, &entry,
+						&loc) < 0)
+				continue;
+			libxvman_loc_t view = {loc.path, loc.len, loc.added,
+				loc.priority, !!(loc.flags & REGLOC_MISSING)};
+			if (cb(entry.name, &view, entry.nlocs, arg))
+				return LIBXVMAN_OK;
+		}
+
+		/* a compacted registry is not written any more, the listing
+		 * is complete then */
+		struct stat details;
+		size = reg->size;
+		if (reg->map)
+			stats_count(STATS_STATS);
+		if (!reg->map || fstat(reg->fd, &details) ||
+				(size_t)details.st_size <= size ||
+				registry_refresh(reg))
+			break;
+	}
+
+	return LIBXVMAN_OK;
+}
+
+/**
+ * @brief Programs checked by a worker of a scan at a time.
+ */
+#define LIBXVMAN_SCAN_BATCH 256
+
+/**
+ * @brief Largest number of workers of a scan.
+ */
+#define LIBXVMAN_SCAN_THREADS 8
+
+/**
+ * @brief Program looked at by a scan of the registry.
+ */
+typedef struct {
+	const char *name;		/* name of the program */
+	size_t first;			/* index of the default location in
+					   the paths of the check */
+	uint32_t nlocs;			/* number of install locations */
+	uint32_t active;		/* index of the default location among
+					   them */
+	int link;			/* problem of the symlink, -1 if none */
+	char *target;			/* target of a symlink which is wrong */
+	char *copy;			/* copy of the strings, made before the
+					   registry is written */
+	bool fixed;			/* symlink repaired */
+} libxvman_scanprog_t;
+
+/**
+ * @brief Scan of every registered program, shared by its workers.
+ */
+typedef struct {
+	libxvman_scanprog_t *progs;	/* programs to be checked */
+	size_t nprogs;			/* number of programs */
+	const char **paths;		/* every install location, grouped by
+					   program */
+	int64_t *added;			/* time every location was added */
+	uint8_t *missing;		/* set for every location missing */
+	uint8_t *flagged;		/* set for every location flagged
+					   missing in the registry */
+	bool links;			/* check the symlinks as well */
+	int dirfd;			/* custom binary directory, -1 if none */
+	atomic_size_t next;		/* first program of the next batch */
+	atomic_size_t nstats;		/* look ups made by the workers */
+	pthread_t threads[LIBXVMAN_SCAN_THREADS];
+	size_t nthreads;		/* workers started */
+} libxvman_scan_t;
+
+/**
+ * @brief Check whether a path is missing, its symlinks followed.
+ */
+static bool libxvman_missing(int dirfd, const char *path)
+{
+	struct statx details;
+	return statx(dirfd, path, AT_STATX_DONT_SYNC, STATX_TYPE,
+			&details) && (errno == ENOENT || errno == ENOTDIR);
+}
+
+/*
+ * Note:
+ * Check the programs of a batch: every install location is looked up and,
+ * when asked for, the symlink is read and compared with the default location.
+ * Nothing but the snapshot of the registry is read here, so the workers need
+ * no lock.
+ */
+static void libxvman_scan_batch(libxvman_scan_t *scan, size_t first,
+		size_t end)
+{
+	size_t nstats = 0;
+	char target[PATH_MAX];
+	for (size_t p = first; p < end; ++p) {
+		libxvman_scanprog_t *prog = &scan->progs[p];
+		const char **paths = scan->paths + prog->first;
+		for (uint32_t i = 0; i < prog->nlocs; ++i, ++nstats)
+			scan->missing[prog->first + i] = libxvman_missing(
+					AT_FDCWD, paths[i]);
+		if (!scan->links)
+			continue;
+
+		ssize_t len = scan->dirfd < 0 ? -1 : readlinkat(scan->dirfd,
+				prog->name, target, sizeof(target) - 1);
+		if (len < 0) {
+			/* a program whose every location is flagged missing
+			 * has nothing to link to */
+			if ((scan->dirfd < 0 || errno == ENOENT) &&
+					!scan->flagged[prog->first +
+					prog->active])
+				prog->link = LIBXVMAN_ISSUE_NOLINK;
+			else if (errno == EINVAL)
+				prog->link = LIBXVMAN_ISSUE_MISMATCH;
+			continue;
+		}
+		target[len] = '\0';
+		if (strcmp(target, paths[prog->active]) == 0) {
+			if (!scan->missing[prog->first + prog->active])
+				continue;
+			prog->link = LIBXVMAN_ISSUE_DANGLING;
+		} else {
+			/* a relative target is relative to the custom binary
+			 * directory */
+			prog->link = libxvman_missing(scan->dirfd, target) ?
+				LIBXVMAN_ISSUE_DANGLING :
+				LIBXVMAN_ISSUE_MISMATCH;
+			nstats++;
+		}
+		prog->target = strdup(target);
+	}
+	atomic_fetch_add(&scan->nstats, nstats);
+}
+
+static void *libxvman_scan_worker(void *arg)
+{
+	trace_span("libxvman.scan.worker");
+
+	libxvman_scan_t *scan = arg;
+	for (;;) {
+		size_t first = atomic_fetch_add(&scan->next,
+				LIBXVMAN_SCAN_BATCH);
+		if (first >= scan->nprogs)
+			break;
+		size_t end = first + LIBXVMAN_SCAN_BATCH;
+		libxvman_scan_batch(scan, first, end < scan->nprogs ? end :
+				scan->nprogs);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Take a snapshot of the registered programs.
+ */
+static int libxvman_scan_snap(libxvman_t *ctx, libxvman_scan_t *scan)
+{
+	size_t nprogs = 0, npaths = 0, cprogs = 0, cpaths = 0;
+	uint32_t cursor = 0;
+	regentry_t entry;
+	regloc_t loc;
+	while (registry_next(&ctx->registry, &cursor, &entry)) {
+		if (!entry.nlocs)
+			continue;
+		if (nprogs == cprogs) {
+			cprogs = cprogs ? cprogs * 2 : 64;
+			void *progs = realloc(scan->progs, cprogs *
+					sizeof(libxvman_scanprog_t));
+			if (!progs)
+				return LIBXVMAN_ENOMEM;
+			scan->progs = progs;
+		}
+		if (npaths + entry.nlocs > cpaths) {
+			while (npaths + entry.nlocs > cpaths)
+				cpaths = cpaths ? cpaths * 2 : 256;
+			void *paths = realloc(scan->paths, cpaths *
+					sizeof(char *));
+			if (paths)
+				scan->paths = paths;
+			void *added = realloc(scan->added, cpaths *
+					sizeof(int64_t));
+			if (added)
+				scan->added = added;
+			void *flags = realloc(scan->flagged, cpaths *
+					sizeof(uint8_t));
+			if (flags)
+				scan->flagged = flags;
+			if (!paths || !added || !flags)
+				return LIBXVMAN_ENOMEM;
+		}
+
+		libxvman_scanprog_t *prog = &scan->progs[nprogs];
+		memset(prog, 0, sizeof(libxvman_scanprog_t));
+		prog->name = entry.name;
+		prog->first = npaths;
+		prog->link = -1;
+		bool flagged = true;
+		for (uint32_t i = 0; i < entry.nlocs; ++i) {
+			if (registry_loc(&ctx->registry, &entry, i, &loc))
+				continue;
+			if (flagged && !(loc.flags & REGLOC_MISSING)) {
+				prog->active = prog->nlocs;
+				flagged = false;
+			}
+			scan->paths[npaths + prog->nlocs] = loc.path;
+			scan->flagged[npaths + prog->nlocs] = !!(loc.flags &
+					REGLOC_MISSING);
+			scan->added[npaths + prog->nlocs++] = loc.added;
+		}
+		if (!prog->nlocs)
+			continue;
+		npaths += prog->nlocs;
+		nprogs++;
+	}
+
+	scan->nprogs = nprogs;
+	scan->missing = calloc(npaths + 1, sizeof(uint8_t));
+	return scan->missing ? LIBXVMAN_OK : LIBXVMAN_ENOMEM;
+}
+
+/*
+ * Note:
+ * Snapshot the registry and start the workers checking it. The calling thread
+ * is left free for other work meanwhile and takes its share of the batches in
+ * libxvman_scan_finish(), or all of them when no thread could be started.
+ */
+static int libxvman_scan_start(libxvman_t *ctx, libxvman_scan_t *scan)
+{
+	int result = libxvman_scan_snap(ctx, scan);
+	if (result)
+		return result;
+
+	size_t nbatches = (scan->nprogs + LIBXVMAN_SCAN_BATCH - 1) /
+		LIBXVMAN_SCAN_BATCH;
+	size_t nthreads = nbatches < LIBXVMAN_SCAN_THREADS ? nbatches :
+		LIBXVMAN_SCAN_THREADS;
+	while (scan->nthreads + 1 < nthreads && !pthread_create(
+				&scan->threads[scan->nthreads], NULL,
+				libxvman_scan_worker, scan))
+		scan->nthreads++;
+	return LIBXVMAN_OK;
+}
+
+static void libxvman_scan_finish(libxvman_scan_t *scan)
+{
+	libxvman_scan_worker(scan);
+	for (size_t t = 0; t < scan->nthreads; ++t)
+		pthread_join(scan->threads[t], NULL);
+	scan->nthreads = 0;
+	stats_add(STATS_STATS, atomic_load(&scan->nstats));
+}
+
+static void libxvman_scan_free(libxvman_scan_t *scan)
+{
+	for (size_t p = 0; p < scan->nprogs; ++p) {
+		free(scan->progs[p].target);
+		free(scan->progs[p].copy);
+	}
+	free(scan->progs);
+	free(scan->paths);
+	free(scan->added);
+	free(scan->flagged);
+	free(scan->missing);
+	if (scan->dirfd >= 0)
+		close(scan->dirfd);
+}
+
+/**
+ * @brief Copy the strings of a program with problems out of the registry.
+ */
+static int libxvman_scan_copy(const libxvman_scan_t *scan,
+		libxvman_scanprog_t *prog)
+{
+	const char **paths = scan->paths + prog->first;
+	size_t size = strlen(prog->name) + 1;
+	for (uint32_t i = 0; i < prog->nlocs; ++i)
+		size += strlen(paths[i]) + 1;
+	prog->copy = malloc(size);
+	if (!prog->copy)
+		return -1;
+
+	char *at = stpcpy(prog->copy, prog->name) + 1;
+	prog->name = prog->copy;
+	for (uint32_t i = 0; i < prog->nlocs; ++i) {
+		const char *path = paths[i];
+		paths[i] = at;
+		at = stpcpy(at, path) + 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Check whether an install location is missing and not flagged yet.
+ */
+static bool libxvman_doctor_missing(const libxvman_scan_t *doc, size_t i)
+{
+	return doc->missing[i] && !doc->flagged[i];
+}
+
+/**
+ * @brief Find the first install location of a program which exists and is
+ * not flagged missing.
+ */
+static const char *libxvman_doctor_expected(const libxvman_scan_t *doc,
+		const libxvman_scanprog_t *prog)
+{
+	for (size_t i = prog->first; i < prog->first + prog->nlocs; ++i)
+		if (!doc->missing[i] && !doc->flagged[i])
+			return doc->paths[i];
+	return NULL;
+}
+
+/*
+ * Note:
+ * Flag the missing install locations in a single transaction, which keeps
+ * them for when they come back, and point the symlinks found wrong at the
+ * default location left, which apply has done already for the programs whose
+ * default location went. The registry stays locked, so nobody switches a
+ * program in between.
+ */
+static int libxvman_doctor_fix(libxvman_t *ctx, libxvman_scan_t *doc,
+		int *results)
+{
+	size_t nops = 0;
+	for (size_t p = 0; p < doc->nprogs; ++p)
+		for (uint32_t i = 0; i < doc->progs[p].nlocs; ++i)
+			nops += libxvman_doctor_missing(doc,
+					doc->progs[p].first + i);
+
+	libxvman_op_t *ops = calloc(nops + 1, sizeof(libxvman_op_t));
+	if (!ops)
+		return LIBXVMAN_ENOMEM;
+	size_t op = 0;
+	for (size_t p = 0; p < doc->nprogs; ++p) {
+		const libxvman_scanprog_t *prog = &doc->progs[p];
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i)
+			if (libxvman_doctor_missing(doc, i))
+				ops[op++] = (libxvman_op_t){LIBXVMAN_MISSING,
+					prog->name, doc->paths[i]};
+	}
+	int result = nops ? libxvman_apply(ctx, ops, nops, results) :
+		LIBXVMAN_OK;
+	free(ops);
+	if (result)
+		return result;
+
+	for (size_t p = 0; p < doc->nprogs; ++p) {
+		libxvman_scanprog_t *prog = &doc->progs[p];
+		if (prog->link >= 0)
+			prog->fixed = !libxvman_link(ctx, prog->name,
+					libxvman_doctor_expected(doc, prog));
+	}
+	return result;
+}
+
+/*
+ * Note:
+ * Look through the custom binary directory for the symlinks of programs which
+ * are not registered, done by the calling thread while the workers check the
+ * registered ones. The temporary links of a switch in progress are hidden and
+ * left alone. The stray symlinks are reported right away, the repairs go on
+ * once the callback has had enough.
+ */
+static int libxvman_doctor_strays(libxvman_t *ctx, int dirfd, bool fix,
+		libxvman_issue_cb cb, void *arg, bool *stop)
+{
+	int fd = dirfd < 0 ? -1 : openat(dirfd, ".", O_RDONLY | O_DIRECTORY |
+			O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	DIR *dir = fd < 0 ? NULL : fdopendir(fd);
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	int nissues = 0;
+	struct dirent *ent;
+	regentry_t entry;
+	char target[PATH_MAX];
+	while ((!*stop || fix) && (ent = readdir(dir))) {
+		if (ent->d_name[0] == '.' || (ent->d_type != DT_LNK &&
+					ent->d_type != DT_UNKNOWN) ||
+				registry_lookup(&ctx->registry, ent->d_name,
+					&entry))
+			continue;
+		ssize_t len = readlinkat(dirfd, ent->d_name, target,
+				sizeof(target) - 1);
+		if (len < 0)
+			continue;
+		target[len] = '\0';
+
+		libxvman_finding_t finding = {LIBXVMAN_ISSUE_STRAY,
+			ent->d_name, target, NULL, 0};
+		stats_count(STATS_STATS);
+		if (libxvman_missing(dirfd, target)) {
+			finding.issue = LIBXVMAN_ISSUE_DANGLING;
+			if (fix)
+				finding.fixed = !unlinkat(dirfd, ent->d_name,
+						0);
+		}
+		nissues++;
+		if (!*stop && cb(&finding, arg))
+			*stop = true;
+	}
+	closedir(dir);
+	return nissues;
+}
+
+/**
+ * @brief Hand the problems found in the programs to the callback.
+ */
+static void libxvman_doctor_report(const libxvman_scan_t *doc,
+		const int *results, libxvman_issue_cb cb, void *arg)
+{
+	size_t op = 0;
+	for (size_t p = 0; p < doc->nprogs; ++p) {
+		const libxvman_scanprog_t *prog = &doc->progs[p];
+		if (!prog->copy)
+			continue;
+
+		/* a missing location has no default to compare with, only the
+		 * symlink has */
+		libxvman_finding_t finding = {LIBXVMAN_ISSUE_MISSING,
+			prog->name, NULL, NULL, 0};
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i) {
+			if (!libxvman_doctor_missing(doc, i))
+				continue;
+			finding.path = doc->paths[i];
+			finding.fixed = results && !results[op++];
+			if (cb(&finding, arg))
+				return;
+		}
+		if (prog->link < 0)
+			continue;
+		finding.issue = prog->link;
+		finding.path = prog->target;
+		finding.expected = libxvman_doctor_expected(doc, prog);
+		finding.fixed = prog->fixed;
+		if (cb(&finding, arg))
+			return;
+	}
+}
+
+int libxvman_doctor(libxvman_t *ctx, int flags, libxvman_issue_cb cb,
+		void *arg)
+{
+	trace_span("libxvman.doctor");
+
+	if (!ctx)
+		return LIBXVMAN_EINVAL;
+	bool fix = flags & LIBXVMAN_DOCTOR_FIX;
+	if (fix && (ctx->flags & LIBXVMAN_READONLY))
+		return LIBXVMAN_EREADONLY;
+
+	/*
+	 * Note:
+	 * A check alone reads a view of the registry without locking, like the
+	 * listing. The repairs hold the whole registry from the check on, so
+	 * what is repaired is what has been found.
+	 */
+	int result = LIBXVMAN_OK;
+	if (fix && registry_lock(&ctx->registry)) {
+		error("Unable to lock the registry");
+		return LIBXVMAN_ELOCK;
+	}
+	if (!fix)
+		result = libxvman_view(ctx);
+
+	libxvman_scan_t doc;
+	memset(&doc, 0, sizeof(doc));
+	doc.links = true;
+	doc.dirfd = open(ctx->cbin, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (!result)
+		result = libxvman_scan_start(ctx, &doc);
+	if (result) {
+		if (fix)
+			registry_unlock(&ctx->registry);
+		libxvman_scan_free(&doc);
+		return result;
+	}
+
+	/* the stray symlinks are looked for while the workers run */
+	bool stop = !cb;
+	int nissues = libxvman_doctor_strays(ctx, doc.dirfd, fix, cb, arg,
+			&stop);
+	libxvman_scan_finish(&doc);
+
+	/* the registry is written by the repairs, the programs with problems
+	 * keep their own copy of the strings */
+	size_t nmissing = 0;
+	for (size_t p = 0; p < doc.nprogs; ++p) {
+		libxvman_scanprog_t *prog = &doc.progs[p];
+		bool broken = prog->link >= 0;
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i)
+			if (libxvman_doctor_missing(&doc, i)) {
+				broken = true;
+				nmissing++;
+			}
+		if (broken && libxvman_scan_copy(&doc, prog) && !result) {
+			error("Unable to copy the program: %s", prog->name);
+			result = LIBXVMAN_ENOMEM;
+		}
+		nissues += broken;
+	}
+	info("Checked %zu programs, %d with problems", doc.nprogs, nissues);
+
+	/* what could not be repaired is reported as it is */
+	int *results = NULL;
+	bool copied = !result;
+	if (fix && copied) {
+		results = malloc((nmissing + 1) * sizeof(int));
+		for (size_t i = 0; results && i < nmissing; ++i)
+			results[i] = LIBXVMAN_ENOMEM;
+		result = results ? libxvman_doctor_fix(ctx, &doc, results) :
+			LIBXVMAN_ENOMEM;
+	}
+	if (fix)
+		registry_unlock(&ctx->registry);
+	if (copied && !stop)
+		libxvman_doctor_report(&doc, results, cb, arg);
+	free(results);
+	libxvman_scan_free(&doc);
+	return result;
+}
+
+/**
+ * @brief Mark of an install location which exists but is pruned by policy.
+ */
+#define LIBXVMAN_EXPIRED 2
+
+/*
+ * Note:
+ * Mark the install locations of a program the policy prunes on top of the
+ * missing ones. The locations are counted in the order of the registry, the
+ * default one first, and the missing ones do not count, so a program keeps at
+ * least one location as long as one exists.
+ */
+static size_t libxvman_prune_mark(libxvman_scan_t *scan,
+		const libxvman_scanprog_t *prog, const libxvman_policy_t *policy)
+{
+	size_t npruned = 0;
+	uint32_t kept = 0;
+	uint32_t keep = policy && policy->keep ? policy->keep : 1;
+	bool expire = policy && (policy->keep || policy->before);
+	for (size_t i = prog->first; i < prog->first + prog->nlocs; ++i) {
+		if (!scan->missing[i] && expire && kept >= keep &&
+				(!policy->before ||
+				 scan->added[i] < policy->before))
+			scan->missing[i] = LIBXVMAN_EXPIRED;
+		if (scan->missing[i])
+			npruned++;
+		else
+			kept++;
+	}
+	return npruned;
+}
+
+int libxvman_prune(libxvman_t *ctx, const libxvman_policy_t *policy,
+		libxvman_prog_cb cb, void *arg, libxvman_pruned_t *pruned)
+{
+	trace_span("libxvman.prune");
+
+	if (!ctx)
+		return LIBXVMAN_EINVAL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+	if (registry_lock(&ctx->registry)) {
+		error("Unable to lock the registry");
+		return LIBXVMAN_ELOCK;
+	}
+
+	libxvman_scan_t scan;
+	memset(&scan, 0, sizeof(scan));
+	scan.dirfd = -1;
+	int result = libxvman_scan_start(ctx, &scan);
+	if (!result)
+		libxvman_scan_finish(&scan);
+
+	/* the strings of the programs rewritten are copied, the registry may
+	 * be mapped again by the update */
+	size_t nops = 0;
+	for (size_t p = 0; !result && p < scan.nprogs; ++p) {
+		libxvman_scanprog_t *prog = &scan.progs[p];
+		size_t npruned = libxvman_prune_mark(&scan, prog, policy);
+		if (npruned && libxvman_scan_copy(&scan, prog))
+			result = LIBXVMAN_ENOMEM;
+		nops += npruned;
+	}
+
+	libxvman_op_t *ops = result ? NULL : calloc(nops + 1,
+			sizeof(libxvman_op_t));
+	int *results = result ? NULL : calloc(nops + 1, sizeof(int));
+	if (!result && (!ops || !results))
+		result = LIBXVMAN_ENOMEM;
+	size_t op = 0;
+	for (size_t p = 0; !result && p < scan.nprogs; ++p) {
+		const libxvman_scanprog_t *prog = &scan.progs[p];
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i)
+			if (scan.missing[i])
+				ops[op++] = (libxvman_op_t){LIBXVMAN_REMOVE,
+					prog->name, scan.paths[i]};
+	}
+
+	size_t live = registry_live(&ctx->registry);
+	if (!result && nops)
+		result = libxvman_apply(ctx, ops, nops, results);
+	libxvman_pruned_t totals = {0, 0, 0};
+	if (live > registry_live(&ctx->registry))
+		totals.bytes = live - registry_live(&ctx->registry);
+	registry_unlock(&ctx->registry);
+
+	/* the locations which could not be removed are left out */
+	op = 0;
+	bool stop = !cb;
+	for (size_t p = 0; ops && p < scan.nprogs; ++p) {
+		const libxvman_scanprog_t *prog = &scan.progs[p];
+		if (!prog->copy)
+			continue;
+
+		size_t first = op, nremoved = 0;
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i)
+			if (scan.missing[i] && !results[op++])
+				nremoved++;
+		totals.programs += nremoved != 0;
+		totals.entries += nremoved;
+		op = first;
+		for (size_t i = prog->first; i < prog->first + prog->nlocs;
+				++i) {
+			if (!scan.missing[i] || results[op++] || stop)
+				continue;
+			libxvman_loc_t view = {scan.paths[i],
+				strlen(scan.paths[i]), scan.added[i]};
+			stop = cb(prog->name, &view, prog->nlocs - nremoved,
+					arg) != 0;
+		}
+	}
+	info("Pruned %zu install locations of %zu programs, %zu bytes",
+			totals.entries, totals.programs, totals.bytes);
+	if (pruned)
+		*pruned = totals;
+
+	free(ops);
+	free(results);
+	libxvman_scan_free(&scan);
+	return result;
+}
+
+/**
+ * @brief Largest number of workers of a directory walk.
+ */
+#define LIBXVMAN_WALK_THREADS 64
+
+/**
+ * @brief Directory waiting to be read by a walk.
+ */
+typedef struct {
+	char *path;			/* path of the directory */
+	size_t level;			/* level of the pattern its entries are
+					   matched against */
+} libxvman_dir_t;
+
+/**
+ * @brief Executable found by a walk.
+ */
+typedef struct {
+	char *path;			/* install location */
+	const char *pname;		/* name of the program, inside the path */
+	int status;			/* result of the addition */
+} libxvman_hit_t;
+
+struct libxvman_walk;
+struct libxvman_watch;
+
+static void libxvman_watch_dir(struct libxvman_watch *watch, size_t root,
+		const libxvman_dir_t *dir);
+
+/**
+ * @brief Worker of a walk. The directories it queues are taken back from the
+ * end by the worker itself and from the front by the others.
+ */
+typedef struct {
+	pthread_mutex_t lock;		/* guards the queue */
+	libxvman_dir_t *dirs;		/* queued directories */
+	size_t head, tail, cap;		/* first queued, end and allocated */
+	libxvman_hit_t *hits;		/* executables found */
+	size_t nhits, chits;		/* found and allocated */
+	size_t id;			/* index among the workers */
+	struct libxvman_walk *walk;	/* walk the worker is part of */
+	pthread_t thread;		/* thread running the worker */
+} libxvman_walker_t;
+
+/**
+ * @brief Walk of a directory tree, shared by its workers.
+ */
+typedef struct libxvman_walk {
+	const char **names;		/* registered programs, sorted */
+	size_t nnames;			/* number of programs */
+	char *pattern;			/* copy of the pattern, split up */
+	const char **levels;		/* glob of every level */
+	size_t nlevels;			/* number of levels */
+	libxvman_walker_t *walkers;	/* every worker */
+	size_t nwalkers;		/* number of workers */
+	atomic_size_t pending;		/* directories queued or being read */
+	atomic_size_t queued;		/* directories queued */
+	atomic_size_t nidle;		/* workers waiting for a directory */
+	pthread_mutex_t lock;		/* guards the sleep of the idle
+					   workers */
+	pthread_cond_t wake;		/* signalled when a directory is
+					   queued or the walk is over */
+	atomic_size_t nopens;		/* opens made by the workers */
+	atomic_size_t nstats;		/* look ups made by the workers */
+	atomic_bool failed;		/* some memory could not be allocated */
+	struct libxvman_watch *watch;	/* watch told about every directory
+					   read, NULL for none */
+	size_t root;			/* root of the watch walked */
+} libxvman_walk_t;
+
+static int libxvman_walk_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static int libxvman_hit_cmp(const void *a, const void *b)
+{
+	const libxvman_hit_t *x = a, *y = b;
+	int result = strcmp(x->pname, y->pname);
+	return result ? result : strverscmp(x->path, y->path);
+}
+
+/**
+ * @brief Join a directory and a name into a freshly allocated path.
+ */
+static char *libxvman_walk_path(const char *dir, const char *name)
+{
+	size_t dlen = strlen(dir), nlen = strlen(name);
+	if (dlen + nlen + 2 > PATH_MAX)
+		return NULL;
+	char *path = malloc(dlen + nlen + 2);
+	if (!path)
+		return NULL;
+	memcpy(path, dir, dlen);
+	if (dir[dlen - 1] != '/')
+		path[dlen++] = '/';
+	memcpy(path + dlen, name, nlen + 1);
+	return path;
+}
+
+/*
+ * Note:
+ * Wake the idle workers up for a directory queued, or all of them when the
+ * walk is over. A worker going idle counts itself before it looks at the
+ * queued directories one last time, and the count of the directories goes up
+ * before the idle workers are looked at, so one of the two sees the other;
+ * the lock is taken only when a worker sleeps.
+ */
+static void libxvman_walk_wake(libxvman_walk_t *walk, bool over)
+{
+	if (!over)
+		atomic_fetch_add(&walk->queued, 1);
+	if (!over && !atomic_load(&walk->nidle))
+		return;
+	pthread_mutex_lock(&walk->lock);
+	if (over)
+		pthread_cond_broadcast(&walk->wake);
+	else
+		pthread_cond_signal(&walk->wake);
+	pthread_mutex_unlock(&walk->lock);
+}
+
+static void libxvman_walk_push(libxvman_walker_t *walker, char *path,
+		size_t level)
+{
+	pthread_mutex_lock(&walker->lock);
+	if (walker->tail == walker->cap && walker->head) {
+		memmove(walker->dirs, walker->dirs + walker->head,
+				(walker->tail - walker->head) *
+				sizeof(libxvman_dir_t));
+		walker->tail -= walker->head;
+		walker->head = 0;
+	}
+	if (walker->tail == walker->cap) {
+		size_t cap = walker->cap ? walker->cap * 2 : 64;
+		void *dirs = realloc(walker->dirs, cap *
+				sizeof(libxvman_dir_t));
+		if (!dirs) {
+			pthread_mutex_unlock(&walker->lock);
+			atomic_store(&walker->walk->failed, true);
+			free(path);
+			return;
+		}
+		walker->dirs = dirs;
+		walker->cap = cap;
+	}
+	atomic_fetch_add(&walker->walk->pending, 1);
+	walker->dirs[walker->tail++] = (libxvman_dir_t){path, level};
+	pthread_mutex_unlock(&walker->lock);
+	libxvman_walk_wake(walker->walk, false);
+}
+
+/**
+ * @brief Take a directory off a queue, from its end for the owner.
+ */
+static bool libxvman_walk_take(libxvman_walker_t *walker, bool own,
+		libxvman_dir_t *dir)
+{
+	pthread_mutex_lock(&walker->lock);
+	bool taken = walker->tail > walker->head;
+	if (taken) {
+		*dir = own ? walker->dirs[--walker->tail] :
+			walker->dirs[walker->head++];
+		atomic_fetch_sub(&walker->walk->queued, 1);
+	}
+	if (walker->head == walker->tail)
+		walker->head = walker->tail = 0;
+	pthread_mutex_unlock(&walker->lock);
+	return taken;
+}
+
+static void libxvman_walk_hit(libxvman_walker_t *walker, char *path)
+{
+	if (walker->nhits == walker->chits) {
+		size_t chits = walker->chits ? walker->chits * 2 : 16;
+		void *hits = realloc(walker->hits, chits *
+				sizeof(libxvman_hit_t));
+		if (!hits) {
+			atomic_store(&walker->walk->failed, true);
+			free(path);
+			return;
+		}
+		walker->hits = hits;
+		walker->chits = chits;
+	}
+	walker->hits[walker->nhits++] = (libxvman_hit_t){path,
+		strrchr(path, '/') + 1, LIBXVMAN_OK};
+}
+
+/*
+ * Note:
+ * Read a directory, queueing the subdirectories the pattern goes on into and
+ * keeping the executables it ends on. The type of an entry comes from the
+ * directory itself on most file systems, so only the executables named after
+ * a program cost a look up.
+ */
+static void libxvman_walk_dir(libxvman_walker_t *walker,
+		const libxvman_dir_t *dir)
+{
+	libxvman_walk_t *walk = walker->walk;
+	if (walk->watch)
+		libxvman_watch_dir(walk->watch, walk->root, dir);
+	int fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	atomic_fetch_add(&walk->nopens, 1);
+	DIR *d = fd < 0 ? NULL : fdopendir(fd);
+	if (!d) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	bool last = dir->level + 1 == walk->nlevels;
+	size_t nstats = 0;
+	struct dirent *ent;
+	struct stat details;
+	while ((ent = readdir(d))) {
+		const char *name = ent->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, "..") ||
+				fnmatch(walk->levels[dir->level], name,
+					FNM_PERIOD))
+			continue;
+		unsigned char type = ent->d_type;
+		if (type == DT_UNKNOWN) {
+			nstats++;
+			if (fstatat(fd, name, &details, AT_SYMLINK_NOFOLLOW))
+				continue;
+			type = S_ISDIR(details.st_mode) ? DT_DIR :
+				S_ISLNK(details.st_mode) ? DT_LNK : DT_REG;
+		}
+
+		if (!last) {
+			char *path = type == DT_DIR ? libxvman_walk_path(
+					dir->path, name) : NULL;
+			if (path)
+				libxvman_walk_push(walker, path,
+						dir->level + 1);
+			continue;
+		}
+		if ((type != DT_REG && type != DT_LNK) || !walk->nnames ||
+				!bsearch(&name, walk->names, walk->nnames,
+					sizeof(char *), libxvman_walk_cmp))
+			continue;
+		nstats++;
+		if (fstatat(fd, name, &details, 0) ||
+				!S_ISREG(details.st_mode) ||
+				!(details.st_mode & (S_IXUSR | S_IXGRP |
+						S_IXOTH)))
+			continue;
+		char *path = libxvman_walk_path(dir->path, name);
+		if (path)
+			libxvman_walk_hit(walker, path);
+	}
+	closedir(d);
+	atomic_fetch_add(&walk->nstats, nstats);
+}
+
+/*
+ * Note:
+ * A worker reads the directories it has queued itself last in first out,
+ * which keeps to a subtree, and once it runs dry takes the oldest directory
+ * of another worker, which tends to be the root of a large subtree. With
+ * nothing to take it sleeps until a directory is queued. The walk is over
+ * when no directory is queued or being read any more.
+ */
+static void *libxvman_walk_worker(void *arg)
+{
+	trace_span("libxvman.walk.worker");
+
+	libxvman_walker_t *walker = arg;
+	libxvman_walk_t *walk = walker->walk;
+	libxvman_dir_t dir;
+	for (;;) {
+		bool taken = libxvman_walk_take(walker, true, &dir);
+		for (size_t v = 1; !taken && v < walk->nwalkers; ++v)
+			taken = libxvman_walk_take(&walk->walkers[(walker->id +
+						v) % walk->nwalkers], false,
+					&dir);
+		if (!taken) {
+			pthread_mutex_lock(&walk->lock);
+			atomic_fetch_add(&walk->nidle, 1);
+			while (atomic_load(&walk->pending) &&
+					!atomic_load(&walk->queued))
+				pthread_cond_wait(&walk->wake, &walk->lock);
+			atomic_fetch_sub(&walk->nidle, 1);
+			pthread_mutex_unlock(&walk->lock);
+			if (!atomic_load(&walk->pending))
+				break;
+			continue;
+		}
+		libxvman_walk_dir(walker, &dir);
+		free(dir.path);
+		if (atomic_fetch_sub(&walk->pending, 1) == 1)
+			libxvman_walk_wake(walk, true);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Split the pattern into the globs of its levels.
+ */
+static int libxvman_walk_levels(libxvman_walk_t *walk, const char *pattern)
+{
+	walk->pattern = strdup(pattern);
+	walk->levels = calloc(strlen(pattern) / 2 + 2, sizeof(char *));
+	if (!walk->pattern || !walk->levels)
+		return LIBXVMAN_ENOMEM;
+
+	for (char *level = walk->pattern, *end; level; level = end) {
+		end = strchr(level, '/');
+		if (end)
+			*end++ = '\0';
+		if (!*level)
+			return LIBXVMAN_EINVAL;
+		walk->levels[walk->nlevels++] = level;
+	}
+	return LIBXVMAN_OK;
+}
+
+/**
+ * @brief Walk the directory trees below the given directories with every
+ * worker and gather what is found. The paths of the directories are taken
+ * over.
+ */
+static int libxvman_walk(libxvman_walk_t *walk, libxvman_dir_t *roots,
+		size_t nroots, libxvman_hit_t **hits, size_t *nhits)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	walk->nwalkers = ncpus < 1 ? 1 : ncpus > LIBXVMAN_WALK_THREADS ?
+		LIBXVMAN_WALK_THREADS : ncpus;
+	walk->walkers = calloc(walk->nwalkers, sizeof(libxvman_walker_t));
+	if (!walk->walkers) {
+		for (size_t r = 0; r < nroots; ++r)
+			free(roots[r].path);
+		return LIBXVMAN_ENOMEM;
+	}
+	for (size_t w = 0; w < walk->nwalkers; ++w) {
+		walk->walkers[w].id = w;
+		walk->walkers[w].walk = walk;
+		pthread_mutex_init(&walk->walkers[w].lock, NULL);
+	}
+	pthread_mutex_init(&walk->lock, NULL);
+	pthread_cond_init(&walk->wake, NULL);
+
+	/* the calling thread is the first worker */
+	for (size_t r = 0; r < nroots; ++r)
+		libxvman_walk_push(&walk->walkers[0], roots[r].path,
+				roots[r].level);
+	size_t started = 1;
+	while (started < walk->nwalkers && !pthread_create(
+				&walk->walkers[started].thread, NULL,
+				libxvman_walk_worker, &walk->walkers[started]))
+		started++;
+	libxvman_walk_worker(&walk->walkers[0]);
+	for (size_t w = 1; w < started; ++w)
+		pthread_join(walk->walkers[w].thread, NULL);
+	stats_add(STATS_OPENS, atomic_load(&walk->nopens));
+	stats_add(STATS_STATS, atomic_load(&walk->nstats));
+
+	size_t n = 0;
+	for (size_t w = 0; w < walk->nwalkers; ++w)
+		n += walk->walkers[w].nhits;
+	*hits = calloc(n + 1, sizeof(libxvman_hit_t));
+	for (size_t w = 0; w < walk->nwalkers; ++w) {
+		libxvman_walker_t *walker = &walk->walkers[w];
+		for (size_t h = 0; h < walker->nhits; ++h)
+			if (*hits)
+				(*hits)[(*nhits)++] = walker->hits[h];
+			else
+				free(walker->hits[h].path);
+		free(walker->hits);
+		free(walker->dirs);
+		pthread_mutex_destroy(&walker->lock);
+	}
+	free(walk->walkers);
+	pthread_cond_destroy(&walk->wake);
+	pthread_mutex_destroy(&walk->lock);
+	debug("Walked with %zu workers, %zu executables found", started, n);
+	return !*hits || atomic_load(&walk->failed) ? LIBXVMAN_ENOMEM :
+		LIBXVMAN_OK;
+}
+
+/**
+ * @brief Gather the names of the programs with an install location from a
+ * fresh view of the registry, sorted for the walk.
+ */
+static int libxvman_walk_names(libxvman_t *ctx, libxvman_walk_t *walk)
+{
+	int result = libxvman_view(ctx);
+	size_t cnames = 0;
+	uint32_t cursor = 0;
+	regentry_t entry;
+	while (!result && registry_next(&ctx->registry, &cursor, &entry)) {
+		if (walk->nnames == cnames) {
+			cnames = cnames ? cnames * 2 : 64;
+			void *names = realloc(walk->names, cnames *
+					sizeof(char *));
+			if (!names)
+				result = LIBXVMAN_ENOMEM;
+			else
+				walk->names = names;
+		}
+		if (!result && entry.nlocs)
+			walk->names[walk->nnames++] = entry.name;
+	}
+	if (!result && walk->nnames)
+		qsort(walk->names, walk->nnames, sizeof(char *),
+				libxvman_walk_cmp);
+	return result;
+}
+
+int libxvman_discover(libxvman_t *ctx, const char *root, const char *pattern,
+		libxvman_found_cb cb, void *arg)
+{
+	trace_span("libxvman.discover");
+
+	if (!ctx || !root || !pattern)
+		return LIBXVMAN_EINVAL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+
+	/*
+	 * Note:
+	 * The walk takes no lock, the names of the programs are read from a
+	 * view of the registry which is left alone until the walk is over.
+	 * The executables registered meanwhile by somebody else come back as
+	 * registered already.
+	 */
+	libxvman_walk_t walk;
+	memset(&walk, 0, sizeof(walk));
+	char *base = realpath(root, NULL);
+	int result = base ? libxvman_walk_levels(&walk, pattern) :
+		LIBXVMAN_EINVAL;
+	if (!result)
+		result = libxvman_walk_names(ctx, &walk);
+
+	libxvman_hit_t *hits = NULL;
+	size_t nhits = 0;
+	if (!result && walk.nnames) {
+		libxvman_dir_t start = {base, 0};
+		result = libxvman_walk(&walk, &start, 1, &hits, &nhits);
+		base = NULL;
+	}
+	free(base);
+	free(walk.names);
+	free(walk.levels);
+	free(walk.pattern);
+
+	libxvman_op_t *ops = calloc(nhits + 1, sizeof(libxvman_op_t));
+	int *results = calloc(nhits + 1, sizeof(int));
+	if (!result && (!ops || !results))
+		result = LIBXVMAN_ENOMEM;
+
+	/* the executables which the transaction did not get to, as when the
+	 * registry is opened for reading only, carry the error stopping it */
+	int applied = result;
+	for (size_t h = 0; results && h < nhits; ++h)
+		results[h] = 1;
+	if (!result && nhits) {
+		qsort(hits, nhits, sizeof(libxvman_hit_t), libxvman_hit_cmp);
+		for (size_t h = 0; h < nhits; ++h)
+			ops[h] = (libxvman_op_t){LIBXVMAN_ADD, hits[h].pname,
+				hits[h].path};
+		applied = libxvman_apply(ctx, ops, nhits, results);
+	}
+
+	size_t nadded = 0;
+	bool stop = !cb;
+	for (size_t h = 0; h < nhits; ++h) {
+		int status = !results ? LIBXVMAN_ENOMEM : results[h] > 0 ?
+			applied : results[h];
+		if (!result && status && status != LIBXVMAN_EEXIST)
+			result = status;
+		nadded += !status;
+		if (!stop)
+			stop = cb(hits[h].pname, hits[h].path, status,
+					arg) != 0;
+		free(hits[h].path);
+	}
+	info("Discovered %zu executables, %zu added", nhits, nadded);
+
+	free(hits);
+	free(ops);
+	free(results);
+	return result;
+}
+
+/**
+ * @brief Events reported for a watched directory.
+ */
+#define LIBXVMAN_WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | \
+		IN_ATTRIB | IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | \
+		IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/**
+ * @brief Milliseconds of quiet after which a burst of events is over.
+ */
+#define LIBXVMAN_WATCH_SETTLE 100
+
+/**
+ * @brief Longest time in milliseconds a burst of events is gathered for.
+ */
+#define LIBXVMAN_WATCH_LINGER 2000
+
+/**
+ * @brief Kinds of changes seen by a watch.
+ */
+enum {
+	LIBXVMAN_SEEN_FILE,		/* file created or changed */
+	LIBXVMAN_SEEN_DIR,		/* directory created */
+	LIBXVMAN_SEEN_GONE,		/* file or directory removed */
+	LIBXVMAN_SEEN_LINK		/* symlink of a program removed */
+};
+
+/**
+ * @brief Change seen by a watch, waiting for the next update.
+ */
+typedef struct {
+	int kind;			/* kind of change */
+	char *path;			/* path changed, the name of the program
+					   for a symlink */
+	size_t level;			/* level of the pattern its entries are
+					   matched against, for a directory */
+	size_t root;			/* root the path lies below */
+} libxvman_seen_t;
+
+/**
+ * @brief Directory watched, found by its watch descriptor.
+ */
+typedef struct {
+	char *path;			/* path of the directory, NULL once it
+					   is not watched any more */
+	size_t level;			/* level of the pattern its entries are
+					   matched against */
+	size_t root;			/* root it lies below */
+} libxvman_wdir_t;
+
+/**
+ * @brief Install root watched.
+ */
+typedef struct {
+	char *path;			/* resolved path of the root */
+	char *pattern;			/* copy of the pattern, split up */
+	const char **levels;		/* glob of every level */
+	size_t nlevels;			/* number of levels */
+} libxvman_wroot_t;
+
+struct libxvman_watch {
+	libxvman_t *ctx;		/* context kept up to date */
+	int fd;				/* inotify instance */
+	int cbin_wd;			/* watch of the custom binary dir */
+	pthread_mutex_t lock;		/* guards the directories in a walk */
+	libxvman_wdir_t *dirs;		/* directories, by watch descriptor */
+	size_t cdirs;			/* allocated directories */
+	atomic_size_t nfailed;		/* directories which could not be
+					   watched */
+	libxvman_wroot_t *roots;	/* install roots */
+	size_t nroots;			/* number of install roots */
+	libxvman_seen_t *seen;		/* changes waiting for an update */
+	size_t nseen, cseen;		/* waiting and allocated */
+	bool overflow;			/* changes have been lost */
+};
+
+/**
+ * @brief Keep the directory a watch descriptor stands for, the path is taken
+ * over.
+ */
+static void libxvman_watch_keep(libxvman_watch_t *watch, int wd, char *path,
+		size_t level, size_t root)
+{
+	pthread_mutex_lock(&watch->lock);
+	if ((size_t)wd >= watch->cdirs) {
+		size_t cdirs = watch->cdirs ? watch->cdirs : 64;
+		while (cdirs <= (size_t)wd)
+			cdirs *= 2;
+		void *dirs = realloc(watch->dirs, cdirs *
+				sizeof(libxvman_wdir_t));
+		if (!dirs) {
+			pthread_mutex_unlock(&watch->lock);
+			inotify_rm_watch(watch->fd, wd);
+			atomic_fetch_add(&watch->nfailed, 1);
+			free(path);
+			return;
+		}
+		watch->dirs = dirs;
+		memset(watch->dirs + watch->cdirs, 0, (cdirs - watch->cdirs) *
+				sizeof(libxvman_wdir_t));
+		watch->cdirs = cdirs;
+	}
+	free(watch->dirs[wd].path);
+	watch->dirs[wd] = (libxvman_wdir_t){path, level, root};
+	pthread_mutex_unlock(&watch->lock);
+}
+
+/*
+ * Note:
+ * Called by the workers of a walk for every directory before it is read, so
+ * whatever shows up in it afterwards is reported by an event. A directory
+ * watched already keeps its descriptor.
+ */
+static void libxvman_watch_dir(struct libxvman_watch *watch, size_t root,
+		const libxvman_dir_t *dir)
+{
+	int wd = inotify_add_watch(watch->fd, dir->path, LIBXVMAN_WATCH_MASK);
+	char *path = wd < 0 ? NULL : strdup(dir->path);
+	if (!path) {
+		if (wd >= 0)
+			inotify_rm_watch(watch->fd, wd);
+		atomic_fetch_add(&watch->nfailed, 1);
+		return;
+	}
+	libxvman_watch_keep(watch, wd, path, dir->level, root);
+}
+
+/**
+ * @brief Queue a change for the next update, the path is taken over. A change
+ * which can not be queued is made up for by walking everything again.
+ */
+static void libxvman_watch_seen(libxvman_watch_t *watch, int kind, char *path,
+		size_t level, size_t root)
+{
+	if (path && watch->nseen == watch->cseen) {
+		size_t cseen = watch->cseen ? watch->cseen * 2 : 64;
+		void *seen = realloc(watch->seen, cseen *
+				sizeof(libxvman_seen_t));
+		if (seen) {
+			watch->seen = seen;
+			watch->cseen = cseen;
+		}
+	}
+	if (!path || watch->nseen == watch->cseen) {
+		free(path);
+		watch->overflow = true;
+		return;
+	}
+	watch->seen[watch->nseen++] = (libxvman_seen_t){kind, path, level,
+		root};
+}
+
+static void libxvman_watch_event(libxvman_watch_t *watch,
+		const struct inotify_event *ev)
+{
+	if (ev->mask & IN_Q_OVERFLOW) {
+		watch->overflow = true;
+		return;
+	}
+	if (ev->wd < 0 || (size_t)ev->wd >= watch->cdirs ||
+			!watch->dirs[ev->wd].path)
+		return;
+
+	libxvman_wdir_t *dir = &watch->dirs[ev->wd];
+	if (ev->mask & IN_IGNORED) {
+		free(dir->path);
+		dir->path = NULL;
+		return;
+	}
+	if (ev->wd == watch->cbin_wd) {
+		/* the temporary links of a switch are hidden */
+		if (ev->len && ev->name[0] != '.')
+			libxvman_watch_seen(watch, LIBXVMAN_SEEN_LINK,
+					strdup(ev->name), 0, 0);
+		return;
+	}
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		libxvman_watch_seen(watch, LIBXVMAN_SEEN_GONE,
+				strdup(dir->path), 0, dir->root);
+		return;
+	}
+
+	const libxvman_wroot_t *root = &watch->roots[dir->root];
+	if (!ev->len || fnmatch(root->levels[dir->level], ev->name,
+				FNM_PERIOD))
+		return;
+	bool last = dir->level + 1 == root->nlevels;
+	int kind = -1;
+	if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+		kind = LIBXVMAN_SEEN_GONE;
+	else if (!(ev->mask & IN_ISDIR) && last)
+		kind = LIBXVMAN_SEEN_FILE;
+	else if ((ev->mask & IN_ISDIR) && !last &&
+			(ev->mask & (IN_CREATE | IN_MOVED_TO)))
+		kind = LIBXVMAN_SEEN_DIR;
+	if (kind >= 0)
+		libxvman_watch_seen(watch, kind, libxvman_walk_path(dir->path,
+					ev->name), dir->level + 1, dir->root);
+}
+
+/**
+ * @brief Read the events waiting, counting them.
+ */
+static int libxvman_watch_read(libxvman_watch_t *watch, size_t *nread)
+{
+	char buf[4096] __attribute__((aligned(
+				__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t len = read(watch->fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return len && errno != EAGAIN ? LIBXVMAN_ESETUP :
+				LIBXVMAN_OK;
+		for (char *next = buf; next < buf + len;) {
+			const struct inotify_event *ev = (const void *)next;
+			libxvman_watch_event(watch, ev);
+			next += sizeof(struct inotify_event) + ev->len;
+			(*nread)++;
+		}
+	}
+}
+
+/*
+ * Note:
+ * The events of a burst, like the unpacking of a release, are gathered till
+ * the watch has been quiet for a while so that the whole burst makes a single
+ * update of the registry. A burst going on and on is cut short, so that the
+ * registry lags behind by no more than the limit.
+ */
+static int libxvman_watch_gather(libxvman_watch_t *watch)
+{
+	size_t nread = 0;
+	int result = libxvman_watch_read(watch, &nread);
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!result && nread) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long spent = (now.tv_sec - start.tv_sec) * 1000 +
+			(now.tv_nsec - start.tv_nsec) / 1000000;
+		struct pollfd pfd = {watch->fd, POLLIN, 0};
+		if (spent >= LIBXVMAN_WATCH_LINGER ||
+				poll(&pfd, 1, LIBXVMAN_WATCH_SETTLE) <= 0)
+			break;
+		nread = 0;
+		result = libxvman_watch_read(watch, &nread);
+	}
+	return result;
+}
+
+static int libxvman_seen_cmp(const void *a, const void *b)
+{
+	const libxvman_seen_t *x = a, *y = b;
+	return x->kind != y->kind ? x->kind - y->kind :
+		strcmp(x->path, y->path);
+}
+
+/**
+ * @brief Check whether a path is the given one or lies below it.
+ */
+static bool libxvman_watch_below(const char *path, size_t len,
+		const char *prefix, size_t plen)
+{
+	return len >= plen && !memcmp(path, prefix, plen) && (len == plen ||
+			path[plen] == '/' || prefix[plen - 1] == '/');
+}
+
+/**
+ * @brief Check whether a path lies below one of the paths gone.
+ */
+static bool libxvman_watch_gone(const libxvman_watch_t *watch,
+		const char *path, size_t len)
+{
+	for (size_t s = 0; s < watch->nseen; ++s)
+		if (watch->seen[s].kind == LIBXVMAN_SEEN_GONE &&
+				libxvman_watch_below(path, len,
+					watch->seen[s].path,
+					strlen(watch->seen[s].path)))
+			return true;
+	return false;
+}
+
+/*
+ * Note:
+ * A directory moved away keeps its watch and so do the directories below it,
+ * their events would come with paths which are not theirs any more. The
+ * watches below the paths gone are dropped, whatever is still or again there
+ * is watched anew by the walk of the directories created.
+ */
+static void libxvman_watch_forget(libxvman_watch_t *watch)
+{
+	for (size_t wd = 0; wd < watch->cdirs; ++wd) {
+		libxvman_wdir_t *dir = &watch->dirs[wd];
+		if ((int)wd == watch->cbin_wd || !dir->path ||
+				!libxvman_watch_gone(watch, dir->path,
+					strlen(dir->path)))
+			continue;
+		inotify_rm_watch(watch->fd, (int)wd);
+		free(dir->path);
+		dir->path = NULL;
+	}
+}
+
+/**
+ * @brief Move the executables found by a walk over to the others.
+ */
+static int libxvman_watch_hits(libxvman_hit_t **hits, size_t *nhits,
+		libxvman_hit_t *more, size_t nmore)
+{
+	if (!nmore) {
+		free(more);
+		return LIBXVMAN_OK;
+	}
+	void *all = realloc(*hits, (*nhits + nmore) * sizeof(libxvman_hit_t));
+	if (!all) {
+		for (size_t h = 0; h < nmore; ++h)
+			free(more[h].path);
+		free(more);
+		return LIBXVMAN_ENOMEM;
+	}
+	*hits = all;
+	memcpy(*hits + *nhits, more, nmore * sizeof(libxvman_hit_t));
+	*nhits += nmore;
+	free(more);
+	return LIBXVMAN_OK;
+}
+
+/**
+ * @brief Walk the directories created below a root, watching them as well.
+ */
+static int libxvman_watch_walk(libxvman_watch_t *watch,
+		const libxvman_walk_t *names, size_t root,
+		libxvman_hit_t **hits, size_t *nhits)
+{
+	size_t nstarts = 0;
+	for (size_t s = 0; s < watch->nseen; ++s)
+		nstarts += watch->seen[s].kind == LIBXVMAN_SEEN_DIR &&
+			watch->seen[s].root == root;
+	if (!nstarts)
+		return LIBXVMAN_OK;
+	libxvman_dir_t *starts = calloc(nstarts, sizeof(libxvman_dir_t));
+	if (!starts)
+		return LIBXVMAN_ENOMEM;
+
+	nstarts = 0;
+	for (size_t s = 0; s < watch->nseen; ++s) {
+		libxvman_seen_t *seen = &watch->seen[s];
+		if (seen->kind != LIBXVMAN_SEEN_DIR || seen->root != root)
+			continue;
+		starts[nstarts++] = (libxvman_dir_t){seen->path, seen->level};
+		seen->path = NULL;
+	}
+
+	const libxvman_wroot_t *wroot = &watch->roots[root];
+	libxvman_walk_t walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.names = names->names;
+	walk.nnames = names->nnames;
+	walk.levels = wroot->levels;
+	walk.nlevels = wroot->nlevels;
+	walk.watch = watch;
+	walk.root = root;
+
+	libxvman_hit_t *more = NULL;
+	size_t nmore = 0;
+	int result = libxvman_walk(&walk, starts, nstarts, &more, &nmore);
+	free(starts);
+	if (!more)
+		return result;
+	int moved = libxvman_watch_hits(hits, nhits, more, nmore);
+	return result ? result : moved;
+}
+
+/**
+ * @brief Keep the files created or changed which are executables named after
+ * a program.
+ */
+static int libxvman_watch_files(libxvman_watch_t *watch,
+		const libxvman_walk_t *names, libxvman_hit_t **hits,
+		size_t *nhits)
+{
+	libxvman_hit_t *more = calloc(watch->nseen + 1,
+			sizeof(libxvman_hit_t));
+	if (!more)
+		return LIBXVMAN_ENOMEM;
+
+	size_t nmore = 0;
+	struct stat details;
+	for (size_t s = 0; s < watch->nseen; ++s) {
+		libxvman_seen_t *seen = &watch->seen[s];
+		const char *name = seen->kind == LIBXVMAN_SEEN_FILE ?
+			strrchr(seen->path, '/') + 1 : NULL;
+		if (!name || !names->nnames || !bsearch(&name, names->names,
+					names->nnames, sizeof(char *),
+					libxvman_walk_cmp))
+			continue;
+		stats_count(STATS_STATS);
+		if (stat(seen->path, &details) || !S_ISREG(details.st_mode) ||
+				!(details.st_mode & (S_IXUSR | S_IXGRP |
+						S_IXOTH)))
+			continue;
+		more[nmore++] = (libxvman_hit_t){seen->path, name,
+			LIBXVMAN_OK};
+		seen->path = NULL;
+	}
+	return libxvman_watch_hits(hits, nhits, more, nmore);
+}
+
+/*
+ * Note:
+ * The registered install locations below the paths gone are looked up, the
+ * ones missing are flagged so, which keeps their history for when they come
+ * back. The operations own a copy of the program name followed by the
+ * location, the view is gone once the registry is updated.
+ */
+static int libxvman_watch_removed(libxvman_watch_t *watch,
+		libxvman_op_t **ops, size_t *nops)
+{
+	registry_t *reg = &watch->ctx->registry;
+	size_t cops = *nops;
+	uint32_t cursor = 0;
+	regentry_t entry;
+	regloc_t loc;
+	char path[PATH_MAX];
+	while (registry_next(reg, &cursor, &entry)) {
+		for (uint32_t i = 0; i < entry.nlocs; ++i) {
+			if (registry_loc(reg, &entry, i, &loc) ||
+					loc.len >= PATH_MAX ||
+					(loc.flags & REGLOC_MISSING) ||
+					!libxvman_watch_gone(watch, loc.path,
+						loc.len))
+				continue;
+			memcpy(path, loc.path, loc.len);
+			path[loc.len] = '\0';
+			stats_count(STATS_STATS);
+			if (!libxvman_missing(AT_FDCWD, path))
+				continue;
+
+			if (*nops == cops) {
+				cops = cops ? cops * 2 : 16;
+				void *grown = realloc(*ops, cops *
+						sizeof(libxvman_op_t));
+				if (!grown)
+					return LIBXVMAN_ENOMEM;
+				*ops = grown;
+			}
+			size_t nlen = strlen(entry.name);
+			char *copy = malloc(nlen + loc.len + 2);
+			if (!copy)
+				return LIBXVMAN_ENOMEM;
+			memcpy(copy, entry.name, nlen + 1);
+			memcpy(copy + nlen + 1, path, loc.len + 1);
+			(*ops)[(*nops)++] = (libxvman_op_t){LIBXVMAN_MISSING,
+				copy, copy + nlen + 1};
+		}
+	}
+	return LIBXVMAN_OK;
+}
+
+/*
+ * Note:
+ * Put back the symlink of a program removed from the custom binary directory,
+ * unless the program is gone too or somebody has put the symlink back
+ * meanwhile. The target is left for the report.
+ */
+static int libxvman_watch_relink(libxvman_watch_t *watch, const char *pname,
+		char **target)
+{
+	libxvman_t *ctx = watch->ctx;
+	*target = NULL;
+	if (!libxvman_valid_name(pname))
+		return LIBXVMAN_OK;
+	if (libxvman_lock(ctx, pname, true))
+		return LIBXVMAN_ELOCK;
+
+	int result = LIBXVMAN_OK;
+	regentry_t entry;
+	regloc_t loc;
+	struct stat details;
+	char link[PATH_MAX];
+	if (registry_lookup(&ctx->registry, pname, &entry) &&
+			libxvman_entry_default(&ctx->registry, &entry,
+				&loc) >= 0 &&
+			snprintf(link, PATH_MAX, "%s/%s", ctx->cbin,
+				pname) < PATH_MAX &&
+			lstat(link, &details) && errno == ENOENT) {
+		*target = strndup(loc.path, loc.len);
+		result = !*target ? LIBXVMAN_ENOMEM :
+			libxvman_link(ctx, pname, *target) ? LIBXVMAN_ELINK :
+			LIBXVMAN_OK;
+	}
+	registry_unlock_prog(&ctx->registry, pname);
+	return result;
+}
+
+int libxvman_watch_open(libxvman_t *ctx, libxvman_watch_t **watch)
+{
+	if (!ctx || !watch)
+		return LIBXVMAN_EINVAL;
+	*watch = NULL;
+	if (ctx->flags & LIBXVMAN_READONLY)
+		return LIBXVMAN_EREADONLY;
+
+	libxvman_watch_t *created = calloc(1, sizeof(libxvman_watch_t));
+	if (!created)
+		return LIBXVMAN_ENOMEM;
+	created->ctx = ctx;
+	created->cbin_wd = -1;
+	pthread_mutex_init(&created->lock, NULL);
+	created->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (created->fd < 0) {
+		error("Unable to set up inotify");
+		libxvman_watch_close(created);
+		return LIBXVMAN_ESETUP;
+	}
+
+	/* the switches rename links over each other, which is left out so
+	 * that they do not wake the watch up */
+	char *cbin = strdup(ctx->cbin);
+	created->cbin_wd = cbin ? inotify_add_watch(created->fd, cbin,
+			IN_DELETE | IN_ONLYDIR) : -1;
+	if (created->cbin_wd >= 0)
+		libxvman_watch_keep(created, created->cbin_wd, cbin, 0, 0);
+	else
+		free(cbin);
+	if (created->cbin_wd < 0 || (size_t)created->cbin_wd >=
+			created->cdirs) {
+		warning("Unable to watch custom binary directory: %s",
+				ctx->cbin);
+		created->cbin_wd = -1;
+	}
+
+	*watch = created;
+	return LIBXVMAN_OK;
+}
+
+int libxvman_watch_add(libxvman_watch_t *watch, const char *root,
+		const char *pattern)
+{
+	if (!watch || !root || !pattern)
+		return LIBXVMAN_EINVAL;
+
+	libxvman_walk_t walk;
+	memset(&walk, 0, sizeof(walk));
+	char *base = realpath(root, NULL);
+	int result = base ? libxvman_walk_levels(&walk, pattern) :
+		LIBXVMAN_EINVAL;
+	void *roots = result ? NULL : realloc(watch->roots, (watch->nroots +
+				1) * sizeof(libxvman_wroot_t));
+	if (!result && !roots)
+		result = LIBXVMAN_ENOMEM;
+	if (result) {
+		free(base);
+		free(walk.levels);
+		free(walk.pattern);
+		return result;
+	}
+
+	/* the first update walks the root, which watches its directories and
+	 * catches up with what has changed while nobody was watching */
+	watch->roots = roots;
+	watch->roots[watch->nroots] = (libxvman_wroot_t){base, walk.pattern,
+		walk.levels, walk.nlevels};
+	libxvman_watch_seen(watch, LIBXVMAN_SEEN_DIR, strdup(base), 0,
+			watch->nroots);
+	libxvman_watch_seen(watch, LIBXVMAN_SEEN_GONE, strdup(base), 0,
+			watch->nroots);
+	watch->nroots++;
+	debug("Watching %s for %s", base, pattern);
+	return LIBXVMAN_OK;
+}
+
+int libxvman_watch_fd(const libxvman_watch_t *watch)
+{
+	return watch ? watch->fd : -1;
+}
+
+int libxvman_watch_process(libxvman_watch_t *watch, libxvman_change_cb cb,
+		void *arg)
+{
+	trace_span("libxvman.watch.process");
+
+	if (!watch)
+		return LIBXVMAN_EINVAL;
+	int result = libxvman_watch_gather(watch);
+
+	/* events have been lost, walk everything again */
+	if (watch->overflow) {
+		warning("Changes to the install roots lost, walking them "
+				"again");
+		watch->overflow = false;
+		for (size_t r = 0; r < watch->nroots; ++r) {
+			libxvman_watch_seen(watch, LIBXVMAN_SEEN_DIR,
+					strdup(watch->roots[r].path), 0, r);
+			libxvman_watch_seen(watch, LIBXVMAN_SEEN_GONE,
+					strdup(watch->roots[r].path), 0, r);
+		}
+	}
+	if (result || !watch->nseen)
+		return result;
+
+	/* a change seen a number of times in a burst is made once */
+	qsort(watch->seen, watch->nseen, sizeof(libxvman_seen_t),
+			libxvman_seen_cmp);
+	size_t nseen = 0;
+	for (size_t s = 0; s < watch->nseen; ++s) {
+		if (nseen && !libxvman_seen_cmp(&watch->seen[nseen - 1],
+					&watch->seen[s]))
+			free(watch->seen[s].path);
+		else
+			watch->seen[nseen++] = watch->seen[s];
+	}
+	watch->nseen = nseen;
+	libxvman_watch_forget(watch);
+
+	libxvman_walk_t names;
+	memset(&names, 0, sizeof(names));
+	libxvman_hit_t *hits = NULL;
+	size_t nhits = 0;
+	result = libxvman_walk_names(watch->ctx, &names);
+	for (size_t r = 0; !result && r < watch->nroots; ++r)
+		result = libxvman_watch_walk(watch, &names, r, &hits, &nhits);
+	if (!result)
+		result = libxvman_watch_files(watch, &names, &hits, &nhits);
+	free(names.names);
+	size_t nfailed = atomic_exchange(&watch->nfailed, 0);
+	if (nfailed)
+		warning("Unable to watch %zu directories", nfailed);
+
+	/* the versions of a program are added in order, the last one ends up
+	 * as the default unless the program ranks them automatically */
+	size_t nops = 0;
+	libxvman_op_t *ops = calloc(nhits + 1, sizeof(libxvman_op_t));
+	if (!result && !ops)
+		result = LIBXVMAN_ENOMEM;
+	if (!result && nhits)
+		qsort(hits, nhits, sizeof(libxvman_hit_t), libxvman_hit_cmp);
+	for (size_t h = 0; !result && h < nhits; ++h)
+		if (!nops || strcmp(hits[h].path, ops[nops - 1].ilocation))
+			ops[nops++] = (libxvman_op_t){LIBXVMAN_ADD,
+				hits[h].pname, hits[h].path};
+	size_t nadds = nops;
+	if (!result)
+		result = libxvman_watch_removed(watch, &ops, &nops);
+
+	int *results = calloc(nops + 1, sizeof(int));
+	if (!result && !results)
+		result = LIBXVMAN_ENOMEM;
+	if (!result && nops) {
+		for (size_t o = 0; o < nops; ++o)
+			results[o] = LIBXVMAN_ENOMEM;
+		libxvman_apply(watch->ctx, ops, nops, results);
+	}
+
+	/* the changes made by somebody else are left out */
+	size_t nchanges = 0;
+	bool stop = !cb;
+	int failed = LIBXVMAN_OK;
+	for (size_t o = 0; !result && o < nops; ++o) {
+		int status = results[o];
+		if ((ops[o].op == LIBXVMAN_ADD && status == LIBXVMAN_EEXIST) ||
+				(ops[o].op == LIBXVMAN_MISSING &&
+				 status == LIBXVMAN_ENOLOC))
+			continue;
+		nchanges++;
+		if (!failed)
+			failed = status;
+		if (!stop)
+			stop = cb(&ops[o], status, arg) != 0;
+	}
+	for (size_t s = 0; !result && s < watch->nseen; ++s) {
+		const libxvman_seen_t *seen = &watch->seen[s];
+		if (seen->kind != LIBXVMAN_SEEN_LINK)
+			continue;
+		char *target = NULL;
+		int status = libxvman_watch_relink(watch, seen->path, &target);
+		libxvman_op_t op = {LIBXVMAN_SELECT, seen->path, target};
+		if (!failed)
+			failed = status;
+		nchanges += target != NULL;
+		if (target && !stop)
+			stop = cb(&op, status, arg) != 0;
+		free(target);
+	}
+	info("Watch made %zu changes out of %zu seen", nchanges, nseen);
+
+	for (size_t h = 0; h < nhits; ++h)
+		free(hits[h].path);
+	for (size_t o = nadds; o < nops; ++o)
+		free((char *)ops[o].pname);
+	for (size_t s = 0; s < watch->nseen; ++s)
+		free(watch->seen[s].path);
+	watch->nseen = 0;
+	free(hits);
+	free(ops);
+	free(results);
+	return result ? result : failed;
+}
+
+void libxvman_watch_close(libxvman_watch_t *watch)
+{
+	if (!watch)
+		return;
+	if (watch->fd >= 0)
+		close(watch->fd);
+	for (size_t wd = 0; wd < watch->cdirs; ++wd)
+		free(watch->dirs[wd].path);
+	for (size_t r = 0; r < watch->nroots; ++r) {
+		free(watch->roots[r].path);
+		free(watch->roots[r].pattern);
+		free(watch->roots[r].levels);
+	}
+	for (size_t s = 0; s < watch->nseen; ++s)
+		free(watch->seen[s].path);
+	pthread_mutex_destroy(&watch->lock);
+	free(watch->dirs);
+	free(watch->roots);
+	free(watch->seen);
+	free(watch);
+}
+
+const char *libxvman_strerror(int err)
+{
+	size_t n = sizeof(libxvman_errors) / sizeof(libxvman_errors[0]);
+	if (err > 0 || (size_t)-err >= n)
+		return "Unknown error";
+	return libxvman_errors[-err];
+}
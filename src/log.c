@@ -1,9 +1,17 @@
+#define _GNU_SOURCE
 #include "../inc/log.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 /**
  * DONE: Add the respective function as present in the header file in this
@@ -22,6 +30,53 @@ static bool l_ostream = TRUE; 		/* log the message to the stdout */
 static bool l_fstream = FALSE; 		/* log the message to the file,
 					   disabled by default */
 
+/*
+ * Note:
+ * Records meant for the log file are formatted by the caller and copied into
+ * a ring buffer. A background writer thread drains the ring in batches into
+ * the log file, which stays open for the whole process.
+ */
+static int lfd = -1;			/* log file descriptor */
+static char lring[LOG_RING_SIZE];	/* ring buffer of pending records */
+static size_t lhead;			/* start of the pending records */
+static size_t lused;			/* bytes pending in the ring */
+static bool lstop;			/* writer thread has to exit */
+static bool lidle;			/* writer is waiting for records */
+static unsigned int lflushes;		/* pending flush requests */
+static bool lthread_up = FALSE;		/* writer thread is running */
+static pthread_t lthread;		/* writer thread */
+static pthread_mutex_t lmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ldata = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lspace = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Note:
+ * In the binary format every session starts with a table of all the call
+ * sites of the program, the records that follow only refer to a site by its
+ * index. Since several processes may append to the same file each record also
+ * carries the pid of its writer, which selects the session it belongs to.
+ *
+ * All the integers are in host byte order:
+ *   session: 'S' u8 version, u8 clock, u32 pid, u32 nsites,
+ *            nsites * { u32 line, u8 level, str fmt, str file, str func }
+ *   record:  'R' u16 size, u32 pid, u32 site, u64 time, size bytes of args
+ *   text:    'T' u16 size, u32 pid, u32 line, u64 time, u8 level,
+ *            str file, str func, str msg
+ * where str is a u16 length followed by the bytes, LOG_BIN_NULL as the
+ * length stands for a NULL string. Numeric arguments take 8 bytes each, long
+ * doubles 16 bytes and the time is in nanoseconds of the selected clock.
+ */
+#define LOG_BIN_NULL 0xffff
+#define LOG_BIN_HDR 19			/* bytes before the payload of 'R' */
+#define LOG_SITE_STR_MAX 1024		/* bytes taken by a string of a site */
+
+static enum log_format lformat = LOG_FORMAT_TEXT;	/* log file format */
+
+extern const struct log_site __start_xvman_log_sites[]
+	__attribute__((weak));
+extern const struct log_site __stop_xvman_log_sites[]
+	__attribute__((weak));
+
 static const char *log_get_ll_identifier(enum log_level ll) {
         /* this function will be returning the log level identifier that
          * will be written into the log file */
@@ -44,22 +99,265 @@ static void log_malloc(const char *f) {
         strncpy(lf, f, len);
 }
 
-static char *get_local_time(void)
+/*
+ * Note:
+ * The time stamp is kept per thread and formatted again only when the second
+ * changes. The layout is the one of asctime(), without the trailing newline.
+ */
+static _Thread_local time_t ltime_sec = -1;	/* second of the cached stamp */
+static _Thread_local char ltime_buf[LOG_TIME_MAX];	/* cached time stamp */
+static enum log_clock lclock = LOG_CLOCK_WALL;	/* clock used for stamps */
+
+static const char ldays[7][4] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char lmonths[12][4] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* write the value right aligned in width characters, padded with pad */
+static char *log_put_num(char *p, unsigned long v, int width, char pad)
 {
-	time_t rawtime;
-	struct tm *time_info;
+	char digits[24];
+	int n = 0;
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v && n < (int)sizeof(digits));
+	for (int i = n; i < width; ++i)
+		*p++ = pad;
+	while (n)
+		*p++ = digits[--n];
+	return p;
+}
+
+static const char *get_local_time(void)
+{
+	if (lclock == LOG_CLOCK_MONO) {
+		/* seconds and microseconds since boot */
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		char *p = log_put_num(ltime_buf, ts.tv_sec, 1, '0');
+		*p++ = '.';
+		p = log_put_num(p, ts.tv_nsec / 1000, 6, '0');
+		*p = '\0';
+		ltime_sec = -1;
+		return ltime_buf;
+	}
 
-	time(&rawtime);
-	time_info = localtime(&rawtime);
+	time_t rawtime = time(NULL);
+	if (rawtime == ltime_sec)
+		return ltime_buf;
 
+	struct tm time_info;
+	if (!localtime_r(&rawtime, &time_info))
+		return "";
 
-	/* there seems to be a newline appended at the end of the string */
-	/* remove this newline from the string */
-	char *ltime = asctime(time_info);
-	char *index = strchr(ltime, '\n');
-	if (index)
-		*index = '\0';
-	return ltime;
+	char *p = ltime_buf;
+	memcpy(p, ldays[time_info.tm_wday % 7], 3);
+	p[3] = ' ';
+	memcpy(p + 4, lmonths[time_info.tm_mon % 12], 3);
+	p = log_put_num(p + 7, time_info.tm_mday, 3, ' ');
+	*p++ = ' ';
+	p = log_put_num(p, time_info.tm_hour, 2, '0');
+	*p++ = ':';
+	p = log_put_num(p, time_info.tm_min, 2, '0');
+	*p++ = ':';
+	p = log_put_num(p, time_info.tm_sec, 2, '0');
+	*p++ = ' ';
+	p = log_put_num(p, time_info.tm_year + 1900, 1, '0');
+	*p = '\0';
+
+	ltime_sec = rawtime;
+	return ltime_buf;
+}
+
+static void log_write_all(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t result = write(fd, buf, len);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return;		/* nothing sensible left to do */
+		}
+		buf += result;
+		len -= result;
+	}
+}
+
+static void *log_writer(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&lmutex);
+	for (;;) {
+		/* sleep without a deadline while nothing is queued, an idle
+		 * process does not wake the writer up at all */
+		while (!lused && !lstop && !lflushes) {
+			lidle = TRUE;
+			pthread_cond_wait(&ldata, &lmutex);
+			lidle = FALSE;
+		}
+
+		/* then let the records pile up until the ring is half full, a
+		 * flush is requested or the first record queued has been
+		 * waiting long enough */
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (lused && lused < LOG_RING_SIZE / 2 && !lstop &&
+				!lflushes) {
+			lidle = TRUE;
+			int result = pthread_cond_timedwait(&ldata, &lmutex,
+					&deadline);
+			lidle = FALSE;
+			if (result == ETIMEDOUT)
+				break;
+		}
+		if (!lused) {
+			if (lstop)
+				break;
+			lflushes = 0;
+			pthread_cond_broadcast(&lspace);
+			continue;
+		}
+
+		/* drain everything queued so far as one batch, the producers
+		 * only ever append past the pending records */
+		size_t start = lhead, len = lused;
+		pthread_mutex_unlock(&lmutex);
+
+		size_t first = LOG_RING_SIZE - start < len ?
+			LOG_RING_SIZE - start : len;
+		log_write_all(lfd, lring + start, first);
+		log_write_all(lfd, lring, len - first);
+
+		pthread_mutex_lock(&lmutex);
+		lhead = (lhead + len) % LOG_RING_SIZE;
+		lused -= len;
+		pthread_cond_broadcast(&lspace);
+	}
+	pthread_mutex_unlock(&lmutex);
+
+	return NULL;
+}
+
+static void log_push(const char *rec, size_t len)
+{
+	if (!lthread_up) {
+		log_write_all(lfd, rec, len);
+		return;
+	}
+
+	pthread_mutex_lock(&lmutex);
+	while (LOG_RING_SIZE - lused < len) {
+		pthread_cond_signal(&ldata);
+		pthread_cond_wait(&lspace, &lmutex);
+	}
+
+	size_t tail = (lhead + lused) % LOG_RING_SIZE;
+	size_t first = LOG_RING_SIZE - tail < len ? LOG_RING_SIZE - tail : len;
+	memcpy(lring + tail, rec, first);
+	memcpy(lring, rec + first, len - first);
+	lused += len;
+
+	/* the first record arms the deadline of the writer, half a ring
+	 * drains it right away */
+	if (lidle && (lused == len || lused >= LOG_RING_SIZE / 2))
+		pthread_cond_signal(&ldata);
+	pthread_mutex_unlock(&lmutex);
+}
+
+static char *log_put_bytes(char *p, const void *v, size_t len)
+{
+	memcpy(p, v, len);
+	return p + len;
+}
+
+/* store a string of at most max bytes, truncated to fit */
+static char *log_put_str(char *p, const char *str, size_t max)
+{
+	uint16_t len = LOG_BIN_NULL;
+	if (str) {
+		size_t slen = strlen(str);
+		if (max < sizeof(len))
+			slen = 0;
+		else if (slen > max - sizeof(len))
+			slen = max - sizeof(len);
+		if (slen >= LOG_BIN_NULL)
+			slen = LOG_BIN_NULL - 1;
+		len = slen;
+	}
+	p = log_put_bytes(p, &len, sizeof(len));
+	if (len != LOG_BIN_NULL)
+		p = log_put_bytes(p, str, len);
+	return p;
+}
+
+static uint64_t log_get_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(lclock == LOG_CLOCK_MONO ? CLOCK_MONOTONIC :
+			CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the session header, written straight into the file with a single write so
+ * that it does not interleave with the records of other processes */
+static void log_write_session(int fd)
+{
+	size_t nsites = 0;
+	if (__start_xvman_log_sites && __stop_xvman_log_sites)
+		nsites = __stop_xvman_log_sites - __start_xvman_log_sites;
+
+	/* strings of a site are capped, so each one takes at most this much */
+	size_t site_max = 5 + 3 * LOG_SITE_STR_MAX;
+	char *buf = malloc(11 + nsites * site_max);
+	if (!buf)
+		return;
+
+	char *p = buf;
+	*p++ = 'S';
+	*p++ = LOG_BINARY_VERSION;
+	*p++ = lclock;
+	uint32_t v = getpid();
+	p = log_put_bytes(p, &v, sizeof(v));
+	v = nsites;
+	p = log_put_bytes(p, &v, sizeof(v));
+	for (size_t i = 0; i < nsites; ++i) {
+		const struct log_site *site = __start_xvman_log_sites + i;
+		v = site->line;
+		p = log_put_bytes(p, &v, sizeof(v));
+		*p++ = site->level;
+		p = log_put_str(p, site->fmt, LOG_SITE_STR_MAX);
+		p = log_put_str(p, site->file, LOG_SITE_STR_MAX);
+		p = log_put_str(p, site->func, LOG_SITE_STR_MAX);
+	}
+	log_write_all(fd, buf, p - buf);
+	free(buf);
+}
+
+static int log_open_file(void)
+{
+	char path[PATH_MAX];
+	const char *name = lf;
+	if (lformat == LOG_FORMAT_BINARY) {
+		if (snprintf(path, sizeof(path), "%s" LOG_BINARY_SUFFIX, lf)
+				>= (int)sizeof(path))
+			return -1;
+		name = path;
+	}
+
+	int fd = open(name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd >= 0 && lformat == LOG_FORMAT_BINARY)
+		log_write_session(fd);
+	return fd;
 }
 
 void log_init(const char *f, enum log_level ll) {
@@ -75,6 +373,13 @@ void log_init(const char *f, enum log_level ll) {
                 return;
         else
                 log_malloc(f);
+
+	lfd = log_open_file();
+	if (lfd >= 0) {
+		lstop = FALSE;
+		lthread_up = pthread_create(&lthread, NULL, log_writer,
+				NULL) == 0;
+	}
 	linit = TRUE;
 }
 
@@ -84,46 +389,339 @@ void log_set_stream(bool ostream, bool fstream)
 	l_fstream = fstream;
 }
 
+void log_set_clock(enum log_clock clock)
+{
+	lclock = clock;
+}
+
+void log_set_format(enum log_format format)
+{
+	if (format == lformat)
+		return;
+	lformat = format;
+	if (!linit || lfd < 0)
+		return;
+
+	/* switch the file only once the records of the old format are out,
+	 * the writer thread is idle by then */
+	log_flush();
+	pthread_mutex_lock(&lmutex);
+	int fd = log_open_file();
+	if (fd >= 0) {
+		close(lfd);
+		lfd = fd;
+	}
+	pthread_mutex_unlock(&lmutex);
+}
+
+const char *log_fmt_next(const char *fmt, struct log_conv *conv)
+{
+	const char *p = fmt ? strchr(fmt, '%') : NULL;
+	if (!p)
+		return NULL;
+
+	conv->start = p++;
+	conv->stars = 0;
+	conv->arg = LOG_ARG_NONE;
+	if (*p == '%') {
+		conv->len = 2;
+		return p + 1;
+	}
+
+	/* flags, width and precision */
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+	if (*p == '*') {
+		conv->stars++;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			conv->stars++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	/* length modifier */
+	enum log_arg arg = LOG_ARG_INT;
+	bool wide = FALSE;
+	switch (*p) {
+		case 'h':
+			p += p[1] == 'h' ? 2 : 1;
+			break;
+		case 'l':
+			wide = TRUE;
+			arg = p[1] == 'l' ? LOG_ARG_LLONG : LOG_ARG_LONG;
+			p += p[1] == 'l' ? 2 : 1;
+			break;
+		case 'q':
+			arg = LOG_ARG_LLONG;
+			p++;
+			break;
+		case 'L':
+			arg = LOG_ARG_LDOUBLE;
+			p++;
+			break;
+		case 'j':
+			arg = LOG_ARG_INTMAX;
+			p++;
+			break;
+		case 'z':
+			arg = LOG_ARG_SIZE;
+			p++;
+			break;
+		case 't':
+			arg = LOG_ARG_PTRDIFF;
+			p++;
+			break;
+	}
+
+	switch (*p) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+			conv->arg = arg == LOG_ARG_LDOUBLE ? LOG_ARG_LLONG : arg;
+			break;
+		case 'c':
+			conv->arg = LOG_ARG_INT;
+			break;
+		case 'f': case 'F': case 'e': case 'E':
+		case 'g': case 'G': case 'a': case 'A':
+			conv->arg = arg == LOG_ARG_LDOUBLE ? LOG_ARG_LDOUBLE :
+				LOG_ARG_DOUBLE;
+			break;
+		case 's':
+			conv->arg = wide ? LOG_ARG_PTR : LOG_ARG_STR;
+			break;
+		case 'p': case 'n':
+			conv->arg = LOG_ARG_PTR;
+			break;
+		case '\0':
+			conv->len = p - conv->start;
+			return p;
+	}
+	p++;
+	conv->len = p - conv->start;
+	return p;
+}
+
+/* encode the arguments as described by the format, returns the size taken
+ * or -1 if they do not fit */
+static int log_encode_args(char *buf, size_t max, const char *fmt,
+		va_list vp)
+{
+	char *p = buf, *end = buf + max;
+	struct log_conv conv;
+	while ((fmt = log_fmt_next(fmt, &conv))) {
+		for (int i = 0; i < conv.stars; ++i) {
+			int64_t v = va_arg(vp, int);
+			if (end - p < (ptrdiff_t)sizeof(v))
+				return -1;
+			p = log_put_bytes(p, &v, sizeof(v));
+		}
+
+		int64_t v = 0;
+		switch (conv.arg) {
+			case LOG_ARG_NONE:
+				continue;
+			case LOG_ARG_INT:
+				v = va_arg(vp, int);
+				break;
+			case LOG_ARG_LONG:
+				v = va_arg(vp, long);
+				break;
+			case LOG_ARG_LLONG:
+				v = va_arg(vp, long long);
+				break;
+			case LOG_ARG_SIZE:
+				v = va_arg(vp, size_t);
+				break;
+			case LOG_ARG_INTMAX:
+				v = va_arg(vp, intmax_t);
+				break;
+			case LOG_ARG_PTRDIFF:
+				v = va_arg(vp, ptrdiff_t);
+				break;
+			case LOG_ARG_PTR:
+				v = (intptr_t)va_arg(vp, void *);
+				break;
+			case LOG_ARG_DOUBLE: {
+				double d = va_arg(vp, double);
+				memcpy(&v, &d, sizeof(v));
+				break;
+			}
+			case LOG_ARG_LDOUBLE: {
+				char ld[16] = {0};
+				long double d = va_arg(vp, long double);
+				memcpy(ld, &d, sizeof(d) < sizeof(ld) ?
+						sizeof(d) : sizeof(ld));
+				if (end - p < (ptrdiff_t)sizeof(ld))
+					return -1;
+				p = log_put_bytes(p, ld, sizeof(ld));
+				continue;
+			}
+			case LOG_ARG_STR: {
+				const char *str = va_arg(vp, const char *);
+				if (end - p < 2)
+					return -1;
+				p = log_put_str(p, str, end - p);
+				continue;
+			}
+		}
+		if (end - p < (ptrdiff_t)sizeof(v))
+			return -1;
+		p = log_put_bytes(p, &v, sizeof(v));
+	}
+	return p - buf;
+}
+
+/* site-less record, used for the calls not made through the macros */
+static void log_push_text(const char *fi, const char *fu, long ln, int ll,
+		const char *msg)
+{
+	char rec[LOG_REC_MAX];
+	char *p = rec + 3;
+	uint32_t v = getpid();
+	p = log_put_bytes(p, &v, sizeof(v));
+	v = ln;
+	p = log_put_bytes(p, &v, sizeof(v));
+	uint64_t ns = log_get_ns();
+	p = log_put_bytes(p, &ns, sizeof(ns));
+	*p++ = ll;
+	p = log_put_str(p, fi, LOG_SITE_STR_MAX);
+	p = log_put_str(p, fu, LOG_SITE_STR_MAX);
+	p = log_put_str(p, msg, rec + sizeof(rec) - p);
+
+	uint16_t size = p - rec - LOG_BIN_HDR;
+	rec[0] = 'T';
+	memcpy(rec + 1, &size, sizeof(size));
+	log_push(rec, p - rec);
+}
+
+/* binary record of a call site, false if it has to go out as text */
+static bool log_push_site(const struct log_site *site, va_list vp)
+{
+	if (!site || site < __start_xvman_log_sites ||
+			site >= __stop_xvman_log_sites)
+		return FALSE;		/* not in the table of this program */
+
+	char rec[LOG_REC_MAX];
+	int size = log_encode_args(rec + LOG_BIN_HDR,
+			sizeof(rec) - LOG_BIN_HDR, site->fmt, vp);
+	if (size < 0)
+		return FALSE;		/* arguments too large for a record */
+
+	rec[0] = 'R';
+	uint16_t v16 = size;
+	memcpy(rec + 1, &v16, sizeof(v16));
+	uint32_t v32 = getpid();
+	memcpy(rec + 3, &v32, sizeof(v32));
+	v32 = site - __start_xvman_log_sites;
+	memcpy(rec + 7, &v32, sizeof(v32));
+	uint64_t ns = log_get_ns();
+	memcpy(rec + 11, &ns, sizeof(ns));
+	log_push(rec, LOG_BIN_HDR + size);
+	return TRUE;
+}
+
+static void log_vwrite(const struct log_site *site, const char *fmt,
+		const char *fi, const char *fu, long ln, int ll, va_list vp)
+{
+	char rec[LOG_REC_MAX];
+	bool fstream = l_fstream && lfd >= 0;
+	if (fstream && lformat == LOG_FORMAT_BINARY) {
+		/* the file gets the raw arguments, only stdout is formatted */
+		fstream = FALSE;
+		va_list cp;
+		va_copy(cp, vp);
+		bool done = log_push_site(site, cp);
+		va_end(cp);
+		if (!done) {
+			va_copy(cp, vp);
+			vsnprintf(rec, sizeof(rec), fmt, cp);
+			va_end(cp);
+			log_push_text(fi, fu, ln, ll, rec);
+		}
+	}
+	if (!l_ostream && !fstream)
+		return;
+
+	/* format the record once, it is shared by both the streams */
+	int len = snprintf(rec, LOG_REC_MAX, LOG_STRF " ", get_local_time(),
+			log_get_ll_identifier(ll), fi, fu, ln);
+	if (len >= 0 && len < LOG_REC_MAX - 1)
+		len += vsnprintf(rec + len, LOG_REC_MAX - len, fmt, vp);
+	if (len < 0)
+		return;
+	if (len > LOG_REC_MAX - 2)
+		len = LOG_REC_MAX - 2;	/* record has been truncated */
+	rec[len++] = '\n';
+	rec[len] = '\0';
+
+	if (fstream)
+		log_push(rec, len);
+	if (l_ostream)
+		fwrite(rec, sizeof(char), len, stdout);
+}
+
+void log_write_site(const struct log_site *site, ...)
+{
+	if (!linit)
+		return;			/* not initialised, nothing to log */
+	if (site->level < (int)l || (!l_ostream && !(l_fstream && lfd >= 0)))
+		return;			/* filtered out, nothing to format */
+
+	va_list vp;
+	va_start(vp, site);
+	log_vwrite(site, site->fmt, site->file, site->func, site->line,
+			site->level, vp);
+	va_end(vp);
+}
+
 void log_write_fmt(const char *fmt, const char *fi, const char *fu, long ln,
                 int ll, ...) {
         if (!fmt)
                 return;                 /* nothing to log */
 	if (!linit)
 		return;			/* not initialised, nothing to log */
-        va_list vp, sp;                 /* variable argument pointer */
-        va_start(vp, ll);               /* point vp to the first parameter */
-        va_start(sp, ll);               /* point sp to the first parameter */
-        FILE *f = fopen(lf, "a+");      /* if file present - append,
-                                                else create & write */
-
-        /*  first the usual stuff from the LOG_STR will be printed out */
-        if (ll >= (int)l) {
-		if (l_fstream) {
-			fprintf(f, LOG_STRF, get_local_time(),
-					log_get_ll_identifier(ll), fi, fu, ln);
-			fputc(' ', f);
-			/* then the next formatted string will be
-			 * written to the file */
-			vfprintf(f, fmt, vp);   /* send in the argument pointer
-						   for writing */
-			fputc('\n', f);         /* as a precaution */
-		}
-		if (l_ostream) {
-			fprintf(stdout, LOG_STRF, get_local_time(),
-					log_get_ll_identifier(ll), fi, fu, ln);
-			printf(" ");
-			vfprintf(stdout, fmt, sp);  /* send in the argument
-						       pointer for writing */
-			printf("\n");
-		}
-	}
+	if (ll < (int)l || (!l_ostream && !(l_fstream && lfd >= 0)))
+		return;			/* filtered out, nothing to format */
+
+	va_list vp;                     /* variable argument pointer */
+	va_start(vp, ll);               /* point vp to the first parameter */
+	log_vwrite(NULL, fmt, fi, fu, ln, ll, vp);
+	va_end(vp);                     /* for portability purposes */
+}
+
+void log_flush(void)
+{
+	if (!lthread_up)
+		return;
 
-        fclose(f);                      /* close the file */
-        va_end(vp);                     /* for portability purposes */
-	va_end(sp); 			/* for portability purposes */
+	pthread_mutex_lock(&lmutex);
+	lflushes++;
+	pthread_cond_signal(&ldata);
+	while (lused)
+		pthread_cond_wait(&lspace, &lmutex);
+	pthread_mutex_unlock(&lmutex);
 }
 
 void log_free_lf(void) {
+	if (lthread_up) {
+		pthread_mutex_lock(&lmutex);
+		lstop = TRUE;
+		pthread_cond_signal(&ldata);
+		pthread_mutex_unlock(&lmutex);
+		pthread_join(lthread, NULL);
+		lthread_up = FALSE;
+	}
+	if (lfd >= 0)
+		close(lfd);
+	lfd = -1;
         free(lf);
+	lf = NULL;
+	linit = FALSE;
 }
-
@@ -1,8 +1,11 @@
 #include "../inc/xvman.h"
+#include "../inc/xvmand.h"
 #include "../inc/log.h"
+#include "../inc/stats.h"
+#include "../inc/trace.h"
 
-#include <linux/limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /**
@@ -15,7 +18,7 @@
  * @param lname - string containing the long name of the corresponding option,
  * can be empty as well. If it is empty, set it to NULL.
  * @param values - string which will be containing all the values provided in
- * the CLI argument.
+ * the CLI argument, allocated to fit them while parsing and NULL till then.
  * @param has_args - boolean, set this value to true in order to specify if the
  * option would have arguments.
  * @param is_present - boolean, this value will be set to true if the CLI
@@ -25,15 +28,39 @@
  * needs to be present for the corresponding option.
  */
 typedef struct {
-	char sname[PATH_MAX];
-	char lname[PATH_MAX];
-	char values[PATH_MAX];
+	const char *sname;
+	const char *lname;
+	char *values;
 
 	bool has_args;
 	bool is_present;
 	unsigned int argvalc;
 } cliopt_t;
 
+/**
+ * @brief Release the values of the CLI options.
+ */
+static void cli_free(cliopt_t *options, int optc)
+{
+	for (int index = 0; index < optc; ++index) {
+		free(options[index].values);
+		options[index].values = NULL;
+	}
+}
+
+/**
+ * @brief Name of the command run in a mode, as reported by the stats.
+ */
+static const char *cli_command(unsigned int mode)
+{
+	static const char *commands[] = {
+		"none", "add", "config", "batch", "daemon", "list", "query",
+		"current", "doctor", "prune", "scan", "watch", "auto"
+	};
+	return mode / 100 < sizeof(commands) / sizeof(commands[0]) ?
+		commands[mode / 100] : "unknown";
+}
+
 int main(int argc, char *argv[])
 {
 	if (argc < 2) {
@@ -44,40 +71,57 @@ int main(int argc, char *argv[])
 
 	xvmanconf_t config;
 
-	if (xvman_setup_prereq(&config)) {
-		fprintf(stderr, "Could not setup pre-requisites\n");
-		return -1;
-	}
-
 	/* setting up the argument type struct instance */
 	cliopt_t cli_options[] = {
-		{"-a", "--add", "", true, false, 2},
-		{"-d", "--debug", "", false, false, 0},
-		{"-c", "--config", "", true, false, 1}
+		{"-a", "--add", NULL, true, false, 2},
+		{"-d", "--debug", NULL, false, false, 0},
+		{"-c", "--config", NULL, true, false, 1},
+		{"-b", "--batch", NULL, true, false, 1},
+		{"-D", "--daemon", NULL, false, false, 0},
+		{"-l", "--list", NULL, false, false, 0},
+		{"-q", "--query", NULL, true, false, 1},
+		{"-w", "--current", NULL, true, false, 1},
+		{"-j", "--json", NULL, false, false, 0},
+		{"-S", "--stats", NULL, false, false, 0},
+		{"-T", "--trace", NULL, true, false, 1},
+		{"-k", "--doctor", NULL, false, false, 0},
+		{"-f", "--fix", NULL, false, false, 0},
+		{"-P", "--prune", NULL, false, false, 0},
+		{"-K", "--keep", NULL, true, false, 1},
+		{"-O", "--older", NULL, true, false, 1},
+		{"-s", "--scan", NULL, true, false, 2},
+		{"-W", "--watch", NULL, false, false, 0},
+		{"-p", "--priority", NULL, true, false, 1},
+		{"-A", "--auto", NULL, true, false, 1}
 	};
-	int optc = 3;
+	int optc = sizeof(cli_options) / sizeof(cli_options[0]);
 
 	/* this looks extremely ugly but does the work as intended */
 	for (int argi = 1; argi <= argc - 1;) {
 		for (int optind = 0; optind < optc; ++optind) {
 			if ((strcmp(argv[argi], cli_options[optind].sname) == 0) || (strcmp(argv[argi], cli_options[optind].lname) == 0)) {
 				if (cli_options[optind].has_args) {
-					memset(cli_options[optind].values, '\0', PATH_MAX);
+					/* the values are joined by spaces into a
+					 * buffer sized to fit them */
+					size_t len = 0;
 					for (int inc=1; inc <= cli_options[optind].argvalc; ++inc) {
-						if (argv[argi+inc]) {
-							if (!strlen(cli_options[optind].values))
-								strcpy(cli_options[optind].values, argv[argi + inc]);
-							else
-								strcat(cli_options[optind].values, argv[argi + inc]);
-
-							if (inc < cli_options[optind].argvalc)
-								strcat(cli_options[optind].values, " ");
-						}
-						else {
+						if (argi + inc >= argc) {
 							fprintf(stderr, "Invalid set of arguments\n");
+							cli_free(cli_options, optc);
 							return -1;
 						}
+						len += strlen(argv[argi + inc]) + 1;
 					}
+					char *values = realloc(cli_options[optind].values, len ? len : 1);
+					if (!values) {
+						fprintf(stderr, "Unable to allocate the option values\n");
+						cli_free(cli_options, optc);
+						return -1;
+					}
+					values[0] = '\0';
+					for (int inc=1, off=0; inc <= cli_options[optind].argvalc; ++inc)
+						off += sprintf(values + off, "%s%s", inc > 1 ? " " : "", argv[argi + inc]);
+					cli_options[optind].values = values;
 					argi += cli_options[optind].argvalc == 0 ? 1 : cli_options[optind].argvalc;
 				}
 				cli_options[optind].is_present = true;
@@ -87,14 +131,15 @@ int main(int argc, char *argv[])
 		argi++;
 	}
 
-	unsigned int mode = 0, optind;
+	unsigned int mode = 0, optind = 0;
+	const char *keep = NULL, *older = NULL, *priority = NULL;
+	const char *tracepath = getenv("XVMAN_TRACE");
+	bool debug = false, json = false, stats = false, fix = false;
 	for (int index = 0; index < optc; ++index) {
 		if (cli_options[index].is_present) {
 			if (strcmp(cli_options[index].sname, "-d") == 0) {
 				/* handle debug mode */
-				config.debug = true;
-				config.enable_flog = true;
-				config.enable_slog = true;
+				debug = true;
 			} else if (
 				strcmp(cli_options[index].sname, "-a") == 0) {
 				/* handle addition mode */
@@ -105,11 +150,194 @@ int main(int argc, char *argv[])
 				/* handle config mode */
 				mode = 200; /* mode for config */
 				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-b") == 0) {
+				/* handle batch mode */
+				mode = 300; /* mode for batch */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-D") == 0) {
+				/* handle daemon mode */
+				mode = 400; /* mode for daemon */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-l") == 0) {
+				/* handle list mode */
+				mode = 500; /* mode for list */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-q") == 0) {
+				/* handle query mode */
+				mode = 600; /* mode for query */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-w") == 0) {
+				/* handle current mode */
+				mode = 700; /* mode for current */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-j") == 0) {
+				/* handle JSON output */
+				json = true;
+			} else if (
+				strcmp(cli_options[index].sname, "-S") == 0) {
+				/* handle instrumentation */
+				stats = true;
+			} else if (
+				strcmp(cli_options[index].sname, "-T") == 0) {
+				/* handle tracing */
+				tracepath = cli_options[index].values;
+			} else if (
+				strcmp(cli_options[index].sname, "-k") == 0) {
+				/* handle health check mode */
+				mode = 800; /* mode for doctor */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-f") == 0) {
+				/* handle repairs of the health check */
+				fix = true;
+			} else if (
+				strcmp(cli_options[index].sname, "-P") == 0) {
+				/* handle prune mode */
+				mode = 900; /* mode for prune */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-K") == 0) {
+				/* handle the locations kept by a prune */
+				keep = cli_options[index].values;
+			} else if (
+				strcmp(cli_options[index].sname, "-O") == 0) {
+				/* handle the age of the locations pruned */
+				older = cli_options[index].values;
+			} else if (
+				strcmp(cli_options[index].sname, "-s") == 0) {
+				/* handle scan mode */
+				mode = 1000; /* mode for scan */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-W") == 0) {
+				/* handle watch mode */
+				mode = 1100; /* mode for watch */
+				optind = index;
+			} else if (
+				strcmp(cli_options[index].sname, "-p") == 0) {
+				/* handle the priority of an addition */
+				priority = cli_options[index].values;
+			} else if (
+				strcmp(cli_options[index].sname, "-A") == 0) {
+				/* handle automatic selection mode */
+				mode = 1200; /* mode for auto */
+				optind = index;
 			}
 		}
 	}
 
+	/*
+	 * Note:
+	 * The instrumentation is turned on by --stats or by XVMAN_STATS, which
+	 * names a file to append a line of JSON to, or is set to 1 for the
+	 * summary on stderr that --stats prints.
+	 */
+	const char *statsenv = getenv("XVMAN_STATS");
+	if (statsenv && (!*statsenv || strcmp(statsenv, "0") == 0))
+		statsenv = NULL;
+	if (stats || statsenv)
+		stats_enable(cli_command(mode), statsenv &&
+				strcmp(statsenv, "1") ? statsenv : NULL);
+
+	/* the trace is written to the file given by --trace or XVMAN_TRACE,
+	 * a run goes on without it when the file can not be created */
+	if (tracepath && *tracepath && trace_start(tracepath,
+				cli_command(mode)))
+		fprintf(stderr, "Unable to write the trace: %s\n", tracepath);
+
+	/*
+	 * Note:
+	 * The read-only commands only map the registry, nothing is set up,
+	 * locked or logged so that they can be polled cheaply. A health check
+	 * is one of them unless it repairs what it finds.
+	 */
+	if (mode >= 500 && mode < 900 && !(mode == 800 && fix)) {
+		stats_begin(STATS_SETUP);
+		int result = xvman_setup_readonly(&config);
+		stats_end(STATS_SETUP);
+		stats_begin(STATS_COMMAND);
+		if (!result && mode == 800)
+			result = xvman_doctor(false, json, stdout);
+		else if (!result)
+			result = mode == 500 ? xvman_list(stdout, json) :
+				xvman_show(cli_options[optind].values,
+						mode == 600, json, stdout);
+		stats_end(STATS_COMMAND);
+		xvman_free_mem();
+		cli_free(cli_options, optc);
+		stats_report();
+		trace_stop();
+		return result;
+	}
+
+	/* the priority travels along with the values of the addition, which
+	 * keeps it intact on the way through xvmand */
+	if (mode == 100 && priority) {
+		char *values = cli_options[optind].values;
+		size_t len = strlen(values) + strlen(priority) + 2;
+		values = realloc(values, len);
+		if (!values) {
+			fprintf(stderr, "Unable to allocate the option "
+					"values\n");
+			cli_free(cli_options, optc);
+			stats_report();
+			trace_stop();
+			return -1;
+		}
+		strcat(strcat(values, " "), priority);
+		cli_options[optind].values = values;
+	}
+
+	/*
+	 * Note:
+	 * Hand additions and configurations over to xvmand when it is running,
+	 * nothing needs to be set up locally then. Debug runs are always done
+	 * locally so that the trace ends up on the terminal.
+	 */
+	if (!debug && (mode == 100 || mode == 200)) {
+		stats_begin(STATS_FORWARD);
+		int result = mode == 100 ?
+			xvmand_client_add(cli_options[optind].values) :
+			xvmand_client_config(cli_options[optind].values);
+		stats_end(STATS_FORWARD);
+		if (result != XVMAND_OFFLINE) {
+			cli_free(cli_options, optc);
+			stats_report();
+			trace_stop();
+			return result;
+		}
+	}
+
+	stats_begin(STATS_SETUP);
+	if (xvman_setup_prereq(&config)) {
+		stats_end(STATS_SETUP);
+		fprintf(stderr, "Could not setup pre-requisites\n");
+		cli_free(cli_options, optc);
+		stats_report();
+		trace_stop();
+		return -1;
+	}
+	stats_end(STATS_SETUP);
+	if (debug) {
+		config.debug = true;
+		config.enable_flog = true;
+		config.enable_slog = true;
+	}
+
+	stats_begin(STATS_LOG);
 	log_init(config.conf_logfpath, config.debug ? DEBUG : INFO);
+	if (getenv("XVMAN_LOG_CLOCK") &&
+			strcmp(getenv("XVMAN_LOG_CLOCK"), "mono") == 0)
+		log_set_clock(LOG_CLOCK_MONO);
+	if (getenv("XVMAN_LOG_FORMAT") &&
+			strcmp(getenv("XVMAN_LOG_FORMAT"), "binary") == 0)
+		log_set_format(LOG_FORMAT_BINARY);
 	if (config.debug) {
 		log_set_stream(config.enable_slog, config.enable_flog);
 		debug("Testing a debug log write");
@@ -117,25 +345,66 @@ int main(int argc, char *argv[])
 		log_set_stream(config.enable_slog, config.enable_flog);
 		info("Testing an info log write");
 	}
+	stats_end(STATS_LOG);
 
+	int result = 0;
+	stats_begin(STATS_COMMAND);
 	switch (mode) {
 		case 100:
 			debug("[add] Values provided: %s",
 					cli_options[optind].values);
-			xvman_add(cli_options[optind].values);
+			result = xvman_add(cli_options[optind].values);
 			break;
 		case 200:
 			debug("[config] Values provided: %s",
 					cli_options[optind].values);
-			xvman_config(cli_options[optind].values);
+			result = xvman_config(cli_options[optind].values);
+			break;
+		case 300:
+			debug("[batch] Values provided: %s",
+					cli_options[optind].values);
+			result = xvman_batch(cli_options[optind].values);
+			break;
+		case 400:
+			debug("[daemon] Starting xvmand");
+			result = xvmand_serve();
+			break;
+		case 800:
+			debug("[doctor] Checking the programs");
+			result = xvman_doctor(true, json, stdout);
+			break;
+		case 900:
+			debug("[prune] Keeping %s, older than %s days",
+					keep ? keep : "all",
+					older ? older : "0");
+			result = xvman_prune(keep, older, json, stdout);
+			break;
+		case 1000:
+			debug("[scan] Values provided: %s",
+					cli_options[optind].values);
+			result = xvman_scan(cli_options[optind].values, json,
+					stdout);
+			break;
+		case 1100:
+			debug("[watch] Watching the install roots");
+			result = xvmand_watch();
+			break;
+		case 1200:
+			debug("[auto] Values provided: %s",
+					cli_options[optind].values);
+			result = xvman_auto(cli_options[optind].values);
 			break;
 		default:
 			error("Unknown mode set");
 			fprintf(stderr, "Unknown mode set\n");
 			break;
 	}
+	stats_end(STATS_COMMAND);
 
 	xvman_free_mem();
+	cli_free(cli_options, optc);
+	stats_report();
+	trace_stop();
 
-	return 0;
+	return result;
 }
@@ -0,0 +1,83 @@
+/**
+ * @file paths.c
+ * @brief File containing the interned table of the paths below $HOME.
+ *
+ * The $HOME directory is copied first and every path follows it in the same
+ * allocation, each one terminated, so the whole table costs one malloc and no
+ * zeroing no matter how many paths are looked up afterwards. The table lives
+ * as long as the process does.
+ */
+
+#include "../inc/paths.h"
+#include "../inc/xvman.h"
+#include "../inc/xvmand.h"
+
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Paths relative to the $HOME directory, in the order of the handles.
+ */
+static const char *paths_rel[PATHS_COUNT] = {
+	[PATHS_CBIN] = CBIN,
+	[PATHS_CONFDIR] = CONFDIR,
+	[PATHS_CONF] = CONF_FPATH,
+	[PATHS_LOG] = CONF_LOGFPATH,
+	[PATHS_REGISTRY] = CONF_REGPATH,
+	[PATHS_JOURNAL] = CONF_JOURNALPATH,
+	[PATHS_LEGACYDIR] = LEGACYDIR,
+	[PATHS_BASHRC] = BASH_CONF_FILE,
+	[PATHS_LOCKFILE] = LOCKFILE,
+	[PATHS_SOCKET] = XVMAND_SOCK
+};
+
+static char *paths_pool;			/* $HOME followed by the paths */
+static const char *paths_table[PATHS_COUNT];	/* interned paths */
+static size_t paths_lens[PATHS_COUNT];		/* lengths of the paths */
+
+int paths_init(const char *home)
+{
+	if (!home)
+		return -1;
+	if (paths_pool && strcmp(paths_pool, home) == 0)
+		return 0;
+
+	size_t hlen = strlen(home), size = hlen + 1;
+	for (int id = 0; id < PATHS_COUNT; ++id) {
+		size_t len = hlen + 1 + strlen(paths_rel[id]);
+		if (len >= PATH_MAX)
+			return -1;
+		size += len + 1;
+	}
+
+	char *pool = malloc(size);
+	if (!pool)
+		return -1;
+	free(paths_pool);
+	paths_pool = pool;
+
+	memcpy(pool, home, hlen + 1);
+	char *next = pool + hlen + 1;
+	for (int id = 0; id < PATHS_COUNT; ++id) {
+		size_t rlen = strlen(paths_rel[id]);
+		memcpy(next, home, hlen);
+		next[hlen] = '/';
+		memcpy(next + hlen + 1, paths_rel[id], rlen + 1);
+		paths_table[id] = next;
+		paths_lens[id] = hlen + 1 + rlen;
+		next += paths_lens[id] + 1;
+	}
+
+	return 0;
+}
+
+const char *paths_get(paths_id_t id)
+{
+	return id < PATHS_COUNT ? paths_table[id] : NULL;
+}
+
+size_t paths_len(paths_id_t id)
+{
+	return id < PATHS_COUNT ? paths_lens[id] : 0;
+}
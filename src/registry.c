@@ -0,0 +1,1151 @@
+/**
+ * @file registry.c
+ * @brief File containing the memory mapped program registry.
+ *
+ * Layout of the registry file:
+ *
+ *   header | slots[nslots] | heap
+ *
+ * Every slot of the open addressing index refers to the name of a program and
+ * to its location block, both of which live in the heap. A location block is
+ * a count and the flags of the program followed by the packed location
+ * records, the strings of the locations are stored in the heap as well.
+ *
+ * The heap is append only. An update writes a new location block past the
+ * end of the heap and then publishes it by storing its offset in the slot,
+ * which readers load atomically. A slot whose block is 0 belongs to a removed
+ * program and keeps the probe chain intact until the next compaction.
+ *
+ * The location records of the first version of the format lack the priority
+ * and the version key. Such a registry is still read, the keys being worked
+ * out from the paths, and the first update rewrites it in the current format.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/registry.h"
+#include "../inc/log.h"
+#include "../inc/stats.h"
+#include "../inc/trace.h"
+#include "../inc/version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REG_MAGIC "XVMANREG"
+#define REG_VERSION 2
+#define REG_VERSION_V1 1
+#define REG_MIN_SLOTS 64
+#define REG_ALIGN(x) (((x) + 7) & ~((size_t)7))
+#define REG_PAGE_ALIGN(x) (((x) + 4095) & ~((size_t)4095))
+#define REG_COMPACT_MIN (64 * 1024)
+
+/*
+ * Note:
+ * Writers coordinate through open file description locks on single bytes of
+ * the lock file, none of which needs to exist in the file:
+ *
+ *   REG_LOCK_TABLE          shared by the program locks, exclusive for the
+ *                           writers touching the whole registry
+ *   REG_LOCK_HEAP           exclusive around every append to the heap
+ *   REG_LOCK_PROGS + hash   per program, shared for readers and exclusive
+ *                           for writers
+ *
+ * Operations on different programs only ever meet on the heap lock, which is
+ * held just for the copy of the new location block.
+ */
+#define REG_LOCK_TABLE 0
+#define REG_LOCK_HEAP 1
+#define REG_LOCK_PROGS 2
+
+struct reg_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nslots;		/* size of the index, power of two */
+	uint32_t nentries;		/* number of occupied slots */
+	uint32_t heap_end;		/* end of the used part of the heap */
+	uint32_t garbage;		/* unreachable bytes in the heap */
+	uint32_t retired;		/* set once replaced by a compaction */
+};
+
+struct reg_slot {
+	uint32_t hash;			/* hash of the program name */
+	uint32_t name;			/* heap offset of the program name */
+	uint32_t block;			/* heap offset of the location block */
+	uint32_t reserved;
+};
+
+struct reg_loc {
+	uint32_t path;			/* heap offset of the install location */
+	uint32_t len;			/* length of the install location */
+	uint32_t hash;			/* hash of the install location */
+	uint32_t flags;			/* location state bits */
+	int64_t added;			/* time of addition */
+	uint64_t version;		/* sort key of the version */
+	int32_t priority;		/* priority given by the user */
+	uint32_t reserved;
+};
+
+/* the location records of the first version end with the time of addition */
+#define REG_LOC_V1 offsetof(struct reg_loc, version)
+
+struct reg_block {
+	uint32_t nlocs;
+	uint32_t flags;			/* program state bits */
+	struct reg_loc locs[];
+};
+
+uint32_t registry_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static const struct reg_header *registry_header(const registry_t *reg)
+{
+	return (const struct reg_header *)reg->map;
+}
+
+static const struct reg_slot *registry_slots(const registry_t *reg)
+{
+	return (const struct reg_slot *)(reg->map + sizeof(struct reg_header));
+}
+
+static struct reg_header *registry_wheader(registry_t *reg)
+{
+	return (struct reg_header *)reg->map;
+}
+
+static struct reg_slot *registry_wslots(registry_t *reg)
+{
+	return (struct reg_slot *)(reg->map + sizeof(struct reg_header));
+}
+
+static uint32_t registry_slot_block(const struct reg_slot *slot)
+{
+	return __atomic_load_n(&slot->block, __ATOMIC_ACQUIRE);
+}
+
+static const struct reg_block *registry_block(const registry_t *reg,
+		uint32_t off)
+{
+	if (off + sizeof(struct reg_block) > reg->size)
+		return NULL;
+	const struct reg_block *block = (const void *)(reg->map + off);
+	if (off + sizeof(struct reg_block) +
+			(size_t)block->nlocs * reg->locsize > reg->size)
+		return NULL;
+	return block;
+}
+
+/* the records are packed with the size of the format the file is in */
+static const struct reg_loc *registry_rloc(const registry_t *reg,
+		const struct reg_block *block, uint32_t index)
+{
+	return (const void *)((const unsigned char *)block->locs +
+			(size_t)index * reg->locsize);
+}
+
+static const char *registry_str(const registry_t *reg, uint32_t off)
+{
+	return off < reg->size ? (const char *)reg->map + off : NULL;
+}
+
+static bool registry_slot_entry(const registry_t *reg, uint32_t slot,
+		regentry_t *entry)
+{
+	const struct reg_slot *slots = registry_slots(reg);
+	uint32_t boff = registry_slot_block(&slots[slot]);
+	if (!slots[slot].name || !boff)
+		return false;
+
+	const char *name = registry_str(reg, slots[slot].name);
+	const struct reg_block *block = registry_block(reg, boff);
+	if (!name || !block)
+		return false;
+
+	entry->name = name;
+	entry->nlocs = block->nlocs;
+	entry->flags = block->flags;
+	entry->block = boff;
+	return true;
+}
+
+static int registry_range_lock(const registry_t *reg, short type,
+		off_t start)
+{
+	struct flock lk = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = start,
+		.l_len = 1
+	};
+	while (fcntl(reg->lockfd, F_OFD_SETLKW, &lk)) {
+		if (errno != EINTR) {
+			error("Unable to lock byte %ld of the registry lock",
+					(long)start);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void registry_unmap(registry_t *reg);
+
+static int registry_map(registry_t *reg)
+{
+	trace_span("registry.map");
+
+	reg->fd = open(reg->path, (reg->readonly ? O_RDONLY : O_RDWR) |
+			O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (reg->fd < 0) {
+		/* a registry that is not there yet has nothing to read */
+		if (reg->readonly && errno == ENOENT)
+			return 0;
+		error("Unable to open registry: %s", reg->path);
+		return -1;
+	}
+
+	struct stat details;
+	stats_count(STATS_STATS);
+	if (fstat(reg->fd, &details) ||
+			(size_t)details.st_size < sizeof(struct reg_header)) {
+		error("Registry file is truncated: %s", reg->path);
+		close(reg->fd);
+		reg->fd = -1;
+		return -1;
+	}
+
+	reg->size = details.st_size;
+	reg->map = mmap(NULL, reg->size, reg->readonly ? PROT_READ :
+			PROT_READ | PROT_WRITE, MAP_SHARED, reg->fd, 0);
+	if (reg->map == MAP_FAILED) {
+		error("Unable to map registry: %s", reg->path);
+		reg->map = NULL;
+		close(reg->fd);
+		reg->fd = -1;
+		return -1;
+	}
+
+	const struct reg_header *header = registry_header(reg);
+	reg->locsize = header->version == REG_VERSION_V1 ? REG_LOC_V1 :
+		sizeof(struct reg_loc);
+	if (memcmp(header->magic, REG_MAGIC, sizeof(header->magic)) ||
+			(header->version != REG_VERSION &&
+			 header->version != REG_VERSION_V1) ||
+			sizeof(struct reg_header) + (size_t)header->nslots *
+			sizeof(struct reg_slot) > reg->size ||
+			header->heap_end > reg->size) {
+		error("Registry file is corrupt: %s", reg->path);
+		registry_unmap(reg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void registry_unmap(registry_t *reg)
+{
+	if (reg->map)
+		munmap(reg->map, reg->size);
+	if (reg->fd >= 0)
+		close(reg->fd);
+	reg->map = NULL;
+	reg->size = 0;
+	reg->fd = -1;
+}
+
+static int registry_sync_dir(const char *path)
+{
+	char dir[PATH_MAX];
+	const char *slash = strrchr(path, '/');
+	if (!slash)
+		snprintf(dir, PATH_MAX, ".");
+	else
+		snprintf(dir, PATH_MAX, "%.*s", slash == path ? 1 :
+				(int)(slash - path), path);
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (fd < 0 || fsync(fd)) {
+		error("Unable to sync the registry directory: %s", dir);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/*
+ * Note:
+ * Serialize the programs into a fresh image of the registry and rename it over
+ * the existing file. The image is written in a single pass into a temporary
+ * file placed next to the registry so that the rename stays atomic.
+ */
+static int registry_write(registry_t *reg, const regprog_t *progs, size_t n)
+{
+	size_t nslots = REG_MIN_SLOTS;
+	while (nslots < n * 2)
+		nslots <<= 1;
+
+	size_t heap = REG_ALIGN(sizeof(struct reg_header) +
+			nslots * sizeof(struct reg_slot));
+	size_t total = heap;
+	for (size_t i = 0; i < n; ++i) {
+		total += strlen(progs[i].name) + 1 + 7;
+		total += sizeof(struct reg_block) +
+			progs[i].nlocs * sizeof(struct reg_loc);
+		for (size_t j = 0; j < progs[i].nlocs; ++j)
+			total += progs[i].locs[j].len + 1;
+	}
+	if (total > UINT32_MAX) {
+		error("Registry would exceed the maximum size");
+		return -1;
+	}
+
+	unsigned char *image = calloc(total, sizeof(unsigned char));
+	if (!image) {
+		error("Unable to allocate registry image of %zu bytes", total);
+		return -1;
+	}
+
+	struct reg_header *header = (struct reg_header *)image;
+	struct reg_slot *slots = (struct reg_slot *)(image +
+			sizeof(struct reg_header));
+	memcpy(header->magic, REG_MAGIC, sizeof(header->magic));
+	header->version = REG_VERSION;
+	header->nslots = nslots;
+	header->nentries = n;
+
+	size_t off = heap;
+	for (size_t i = 0; i < n; ++i) {
+		size_t nlen = strlen(progs[i].name);
+		uint32_t name = off;
+		memcpy(image + off, progs[i].name, nlen + 1);
+		off = REG_ALIGN(off + nlen + 1);
+
+		uint32_t boff = off;
+		struct reg_block *block = (struct reg_block *)(image + off);
+		block->nlocs = progs[i].nlocs;
+		block->flags = progs[i].flags;
+		off += sizeof(struct reg_block) +
+			progs[i].nlocs * sizeof(struct reg_loc);
+		for (size_t j = 0; j < progs[i].nlocs; ++j) {
+			const regloc_t *loc = &progs[i].locs[j];
+			block->locs[j].path = off;
+			block->locs[j].len = loc->len;
+			block->locs[j].hash = registry_hash(loc->path,
+					loc->len);
+			block->locs[j].flags = loc->flags;
+			block->locs[j].added = loc->added;
+			block->locs[j].version = loc->version;
+			block->locs[j].priority = loc->priority;
+			memcpy(image + off, loc->path, loc->len);
+			off += loc->len + 1;
+		}
+
+		uint32_t hash = registry_hash(progs[i].name, nlen);
+		size_t slot = hash & (nslots - 1);
+		while (slots[slot].name)
+			slot = (slot + 1) & (nslots - 1);
+		slots[slot].hash = hash;
+		slots[slot].name = name;
+		slots[slot].block = boff;
+	}
+	header->heap_end = off;
+
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, PATH_MAX, "%s.XXXXXX", reg->path) >= PATH_MAX) {
+		error("Registry path is too long: %s", reg->path);
+		free(image);
+		return -1;
+	}
+	int fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		error("Unable to create temporary registry: %s", tmp);
+		free(image);
+		return -1;
+	}
+
+	size_t written = 0;
+	while (written < off) {
+		ssize_t result = write(fd, image + written, off - written);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			error("Error while writing temporary registry: %s",
+					tmp);
+			close(fd);
+			unlink(tmp);
+			free(image);
+			return -1;
+		}
+		written += result;
+	}
+	free(image);
+
+	/* the journal only holds the programs changed since its last
+	 * checkpoint, the rest must be on disk before the rename */
+	if (fsync(fd)) {
+		error("Unable to sync temporary registry: %s", tmp);
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(tmp, reg->path)) {
+		error("Unable to move registry into place: %s", reg->path);
+		unlink(tmp);
+		return -1;
+	}
+	/* the rename itself is durable only once the directory is synced,
+	 * the new file is mapped in either case as it is already in place */
+	int synced = registry_sync_dir(reg->path);
+
+	/* let the other processes know that they need to map the new file */
+	if (reg->map)
+		__atomic_store_n(&registry_wheader(reg)->retired, 1,
+				__ATOMIC_RELEASE);
+
+	registry_unmap(reg);
+	if (registry_map(reg))
+		return -1;
+	return synced;
+}
+
+int registry_open(registry_t *reg, const char *path)
+{
+	if (!reg || !path) {
+		error("Registry handle or path not specified");
+		return -1;
+	}
+
+	memset(reg, 0, sizeof(registry_t));
+	reg->fd = -1;
+	reg->lockfd = -1;
+	char lockpath[PATH_MAX];
+	if (snprintf(reg->path, PATH_MAX, "%s", path) >= PATH_MAX ||
+			snprintf(lockpath, PATH_MAX, "%s.lock", path) >=
+			PATH_MAX) {
+		error("Registry path is too long: %s", path);
+		return -1;
+	}
+
+	reg->lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC,
+			S_IRUSR | S_IWUSR);
+	stats_count(STATS_OPENS);
+	if (reg->lockfd < 0) {
+		error("Unable to open registry lock: %s", lockpath);
+		return -1;
+	}
+
+	stats_count(STATS_STATS);
+	if (access(reg->path, F_OK)) {
+		if (registry_range_lock(reg, F_WRLCK, REG_LOCK_TABLE))
+			return -1;
+		int result = 0;
+		stats_count(STATS_STATS);
+		if (access(reg->path, F_OK)) {
+			info("Registry not present, creating: %s", reg->path);
+			result = registry_write(reg, NULL, 0);
+		} else {
+			result = registry_map(reg);
+		}
+		registry_range_lock(reg, F_UNLCK, REG_LOCK_TABLE);
+		return result;
+	}
+
+	return registry_map(reg);
+}
+
+int registry_open_readonly(registry_t *reg, const char *path)
+{
+	if (!reg || !path) {
+		error("Registry handle or path not specified");
+		return -1;
+	}
+
+	memset(reg, 0, sizeof(registry_t));
+	reg->fd = -1;
+	reg->lockfd = -1;
+	reg->readonly = true;
+	if (snprintf(reg->path, PATH_MAX, "%s", path) >= PATH_MAX) {
+		error("Registry path is too long: %s", path);
+		return -1;
+	}
+
+	return registry_map(reg);
+}
+
+void registry_close(registry_t *reg)
+{
+	if (!reg)
+		return;
+	registry_unmap(reg);
+	if (reg->lockfd >= 0)
+		close(reg->lockfd);
+	reg->lockfd = -1;
+}
+
+int registry_sync(registry_t *reg)
+{
+	if (!reg || reg->fd < 0 || fdatasync(reg->fd)) {
+		error("Unable to sync the registry");
+		return -1;
+	}
+	return 0;
+}
+
+int registry_refresh(registry_t *reg)
+{
+	trace_span("registry.refresh");
+
+	if (!reg || !reg->map) {
+		error("Registry is not open");
+		return -1;
+	}
+
+	if (__atomic_load_n(&registry_header(reg)->retired,
+				__ATOMIC_ACQUIRE)) {
+		debug("Registry has been compacted, mapping it again");
+		registry_unmap(reg);
+		return registry_map(reg);
+	}
+
+	struct stat details;
+	stats_count(STATS_STATS);
+	if (fstat(reg->fd, &details)) {
+		error("Unable to stat registry: %s", reg->path);
+		return -1;
+	}
+	if ((size_t)details.st_size > reg->size) {
+		void *map = mremap(reg->map, reg->size, details.st_size,
+				MREMAP_MAYMOVE);
+		if (map == MAP_FAILED) {
+			error("Unable to remap registry: %s", reg->path);
+			return -1;
+		}
+		reg->map = map;
+		reg->size = details.st_size;
+	}
+
+	return 0;
+}
+
+bool registry_lookup(const registry_t *reg, const char *name,
+		regentry_t *entry)
+{
+	trace_span("registry.lookup");
+
+	if (!reg || !reg->map || !name)
+		return false;
+
+	const struct reg_header *header = registry_header(reg);
+	const struct reg_slot *slots = registry_slots(reg);
+	size_t nlen = strlen(name);
+	uint32_t hash = registry_hash(name, nlen);
+	uint32_t mask = header->nslots - 1;
+
+	for (uint32_t i = 0, slot = hash & mask; i < header->nslots;
+			++i, slot = (slot + 1) & mask) {
+		if (!slots[slot].name)
+			break;
+		uint32_t boff = registry_slot_block(&slots[slot]);
+		if (slots[slot].hash != hash || !boff)
+			continue;
+
+		const char *sname = registry_str(reg, slots[slot].name);
+		const struct reg_block *block = registry_block(reg, boff);
+		if (!sname || !block || strcmp(sname, name))
+			continue;
+
+		if (entry) {
+			entry->name = sname;
+			entry->nlocs = block->nlocs;
+			entry->flags = block->flags;
+			entry->block = boff;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+int registry_loc(const registry_t *reg, const regentry_t *entry,
+		uint32_t index, regloc_t *loc)
+{
+	if (!reg || !entry || !loc || index >= entry->nlocs)
+		return -1;
+
+	const struct reg_block *block = registry_block(reg, entry->block);
+	if (!block || index >= block->nlocs)
+		return -1;
+
+	const struct reg_loc *rloc = registry_rloc(reg, block, index);
+	loc->path = registry_str(reg, rloc->path);
+	if (!loc->path)
+		return -1;
+	loc->len = rloc->len;
+	loc->flags = rloc->flags;
+	loc->added = rloc->added;
+	if (reg->locsize == REG_LOC_V1) {
+		loc->version = version_key(loc->path, loc->len);
+		loc->priority = 0;
+	} else {
+		loc->version = rloc->version;
+		loc->priority = rloc->priority;
+	}
+	return 0;
+}
+
+int registry_find(const registry_t *reg, const regentry_t *entry,
+		const char *path)
+{
+	if (!reg || !entry || !path)
+		return -1;
+
+	const struct reg_block *block = registry_block(reg, entry->block);
+	if (!block)
+		return -1;
+
+	size_t len = strlen(path);
+	uint32_t hash = registry_hash(path, len);
+	for (uint32_t i = 0; i < block->nlocs; ++i) {
+		const struct reg_loc *rloc = registry_rloc(reg, block, i);
+		if (rloc->hash != hash || rloc->len != len)
+			continue;
+		const char *lpath = registry_str(reg, rloc->path);
+		if (lpath && memcmp(lpath, path, len) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+bool registry_next(const registry_t *reg, uint32_t *cursor,
+		regentry_t *entry)
+{
+	if (!reg || !reg->map || !cursor || !entry)
+		return false;
+
+	const struct reg_header *header = registry_header(reg);
+	while (*cursor < header->nslots)
+		if (registry_slot_entry(reg, (*cursor)++, entry))
+			return true;
+
+	return false;
+}
+
+size_t registry_live(const registry_t *reg)
+{
+	if (!reg || !reg->map)
+		return 0;
+
+	const struct reg_header *header = registry_header(reg);
+	size_t heap = REG_ALIGN(sizeof(struct reg_header) +
+			header->nslots * sizeof(struct reg_slot));
+	size_t used = header->heap_end - heap;
+	return used > header->garbage ? used - header->garbage : 0;
+}
+
+/*
+ * Note:
+ * Compact the registry by gathering every registered program along with the
+ * new lists and writing a fresh image of the registry.
+ */
+static int registry_compact(registry_t *reg, const regprog_t *progs, size_t n)
+{
+	/*
+	 * Note:
+	 * Mark the slots of the programs being replaced, then gather every
+	 * other registered program as it is along with the new lists.
+	 */
+	const struct reg_header *header = registry_header(reg);
+	const struct reg_slot *slots = registry_slots(reg);
+	uint32_t mask = header->nslots - 1;
+	bool *replaced = calloc(header->nslots, sizeof(bool));
+	if (!replaced) {
+		error("Unable to allocate registry slot map");
+		return -1;
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		size_t nlen = strlen(progs[i].name);
+		uint32_t hash = registry_hash(progs[i].name, nlen);
+		for (uint32_t k = 0, slot = hash & mask; k < header->nslots;
+				++k, slot = (slot + 1) & mask) {
+			if (!slots[slot].name)
+				break;
+			const char *sname = registry_str(reg,
+					slots[slot].name);
+			if (slots[slot].hash == hash && sname &&
+					strcmp(sname, progs[i].name) == 0) {
+				replaced[slot] = true;
+				break;
+			}
+		}
+	}
+
+	size_t nkept = 0, nlocs = 0;
+	regentry_t entry;
+	for (uint32_t slot = 0; slot < header->nslots; ++slot) {
+		if (replaced[slot] || !registry_slot_entry(reg, slot, &entry))
+			continue;
+		nkept++;
+		nlocs += entry.nlocs;
+	}
+
+	regprog_t *all = calloc(nkept + n + 1, sizeof(regprog_t));
+	regloc_t *locs = calloc(nlocs + 1, sizeof(regloc_t));
+	if (!all || !locs) {
+		error("Unable to allocate registry program list");
+		free(replaced);
+		free(all);
+		free(locs);
+		return -1;
+	}
+
+	size_t nall = 0, lindex = 0;
+	for (uint32_t slot = 0; slot < header->nslots; ++slot) {
+		if (replaced[slot] || !registry_slot_entry(reg, slot, &entry))
+			continue;
+
+		all[nall].name = entry.name;
+		all[nall].flags = entry.flags;
+		all[nall].locs = &locs[lindex];
+		for (uint32_t i = 0; i < entry.nlocs; ++i)
+			if (!registry_loc(reg, &entry, i, &locs[lindex]))
+				lindex++;
+		all[nall].nlocs = &locs[lindex] - all[nall].locs;
+		nall++;
+	}
+	for (size_t i = 0; i < n; ++i)
+		if (progs[i].nlocs)
+			all[nall++] = progs[i];
+
+	info("Compacting the registry with %zu programs", nall);
+	int result = registry_write(reg, all, nall);
+
+	free(replaced);
+	free(all);
+	free(locs);
+	return result;
+}
+
+/*
+ * Note:
+ * Find the slot of a program, including a removed one, or the empty slot
+ * where it would be inserted.
+ */
+static uint32_t registry_probe(const registry_t *reg, const char *name,
+		uint32_t hash, bool *found)
+{
+	const struct reg_header *header = registry_header(reg);
+	const struct reg_slot *slots = registry_slots(reg);
+	uint32_t mask = header->nslots - 1, slot = hash & mask;
+
+	*found = false;
+	for (uint32_t i = 0; i < header->nslots; ++i, slot = (slot + 1) & mask) {
+		if (!slots[slot].name)
+			break;
+		const char *sname = registry_str(reg, slots[slot].name);
+		if (slots[slot].hash == hash && sname &&
+				strcmp(sname, name) == 0) {
+			*found = true;
+			break;
+		}
+	}
+
+	return slot;
+}
+
+/*
+ * Note:
+ * Location strings which already live in the registry are referred to by
+ * their heap offset. These have to be resolved before the file is grown as
+ * growing may move the mapping.
+ */
+static uint32_t registry_offset_of(const registry_t *reg, const char *s)
+{
+	uintptr_t p = (uintptr_t)s, base = (uintptr_t)reg->map;
+	return p > base && p < base + reg->size ? p - base : 0;
+}
+
+static int registry_grow(registry_t *reg, size_t need)
+{
+	struct stat details;
+	stats_count(STATS_STATS);
+	if (fstat(reg->fd, &details)) {
+		error("Unable to stat registry: %s", reg->path);
+		return -1;
+	}
+
+	size_t size = details.st_size;
+	if (size < need) {
+		size = size + size / 2 < need ? need : size + size / 2;
+		size = REG_PAGE_ALIGN(size);
+		if (size > UINT32_MAX || ftruncate(reg->fd, size)) {
+			error("Unable to grow registry to %zu bytes", size);
+			return -1;
+		}
+	}
+
+	if (size != reg->size) {
+		void *map = mremap(reg->map, reg->size, size, MREMAP_MAYMOVE);
+		if (map == MAP_FAILED) {
+			error("Unable to remap registry: %s", reg->path);
+			return -1;
+		}
+		reg->map = map;
+		reg->size = size;
+	}
+
+	return 0;
+}
+
+static size_t registry_block_size(const registry_t *reg, uint32_t boff,
+		const uint32_t *offs, size_t noffs)
+{
+	const struct reg_block *block = registry_block(reg, boff);
+	if (!block)
+		return 0;
+
+	/* the strings no longer referred to by the new block are unreachable
+	 * as well */
+	size_t size = sizeof(struct reg_block) +
+		block->nlocs * reg->locsize;
+	for (uint32_t i = 0; i < block->nlocs; ++i) {
+		const struct reg_loc *rloc = registry_rloc(reg, block, i);
+		bool shared = false;
+		for (size_t j = 0; j < noffs && !shared; ++j)
+			shared = offs[j] == rloc->path;
+		if (!shared)
+			size += rloc->len + 1;
+	}
+	return size;
+}
+
+/*
+ * Note:
+ * Append the location block of a program to the heap and publish it. The end
+ * of the heap is moved before publishing, so that a writer dying half way
+ * leaves nothing but unreachable bytes behind.
+ */
+static void registry_update(registry_t *reg, const regprog_t *prog,
+		const uint32_t *offs)
+{
+	struct reg_header *header = registry_wheader(reg);
+	struct reg_slot *slots = registry_wslots(reg);
+	size_t nlen = strlen(prog->name);
+	uint32_t hash = registry_hash(prog->name, nlen);
+	bool found;
+	uint32_t slot = registry_probe(reg, prog->name, hash, &found);
+	if (!found && !prog->nlocs)
+		return;
+
+	size_t off = header->heap_end;
+	uint32_t name = slots[slot].name;
+	if (!found) {
+		name = off;
+		memcpy(reg->map + off, prog->name, nlen + 1);
+		off += nlen + 1;
+	}
+
+	uint32_t boff = 0;
+	if (prog->nlocs) {
+		off = REG_ALIGN(off);
+		boff = off;
+		struct reg_block *block = (struct reg_block *)(reg->map + off);
+		block->nlocs = prog->nlocs;
+		block->flags = prog->flags;
+		off += sizeof(struct reg_block) +
+			prog->nlocs * sizeof(struct reg_loc);
+		for (size_t j = 0; j < prog->nlocs; ++j) {
+			/* the caller's view of a shared string may point into
+			 * the mapping before it was grown */
+			const regloc_t *loc = &prog->locs[j];
+			const char *path = offs[j] ?
+				(const char *)reg->map + offs[j] : loc->path;
+			block->locs[j].path = offs[j];
+			if (!offs[j]) {
+				block->locs[j].path = off;
+				memcpy(reg->map + off, path, loc->len);
+				reg->map[off + loc->len] = '\0';
+				off += loc->len + 1;
+			}
+			block->locs[j].len = loc->len;
+			block->locs[j].hash = registry_hash(path, loc->len);
+			block->locs[j].flags = loc->flags;
+			block->locs[j].added = loc->added;
+			block->locs[j].version = loc->version;
+			block->locs[j].priority = loc->priority;
+			block->locs[j].reserved = 0;
+		}
+	}
+	header->heap_end = off;
+
+	uint32_t old = registry_slot_block(&slots[slot]);
+	if (old)
+		header->garbage += registry_block_size(reg, old, offs,
+				prog->nlocs);
+	if (!found) {
+		slots[slot].hash = hash;
+		slots[slot].name = name;
+		header->nentries++;
+	}
+	__atomic_store_n(&slots[slot].block, boff, __ATOMIC_RELEASE);
+}
+
+int registry_lock(registry_t *reg)
+{
+	trace_span("registry.lock");
+
+	if (!reg || reg->lockfd < 0) {
+		error("Registry is not open");
+		return -1;
+	}
+
+	if (reg->locked++)
+		return 0;
+
+	if (registry_range_lock(reg, F_WRLCK, REG_LOCK_TABLE)) {
+		error("Unable to lock registry: %s", reg->path);
+		reg->locked = 0;
+		return -1;
+	}
+
+	if (registry_refresh(reg)) {
+		registry_unlock(reg);
+		return -1;
+	}
+
+	return 0;
+}
+
+void registry_unlock(registry_t *reg)
+{
+	if (!reg || !reg->locked)
+		return;
+	if (--reg->locked == 0)
+		registry_range_lock(reg, F_UNLCK, REG_LOCK_TABLE);
+}
+
+int registry_lock_prog(registry_t *reg, const char *name, bool exclusive)
+{
+	trace_span("registry.lock_prog");
+
+	if (!reg || reg->lockfd < 0 || !name) {
+		error("Registry is not open or program not specified");
+		return -1;
+	}
+
+	/* the whole registry is locked already */
+	if (reg->locked)
+		return 0;
+
+	if (reg->plocked++ == 0 &&
+			registry_range_lock(reg, F_RDLCK, REG_LOCK_TABLE)) {
+		reg->plocked = 0;
+		return -1;
+	}
+	off_t byte = REG_LOCK_PROGS +
+		(off_t)registry_hash(name, strlen(name));
+	if (registry_range_lock(reg, exclusive ? F_WRLCK : F_RDLCK, byte)) {
+		if (--reg->plocked == 0)
+			registry_range_lock(reg, F_UNLCK, REG_LOCK_TABLE);
+		return -1;
+	}
+
+	if (registry_refresh(reg)) {
+		registry_unlock_prog(reg, name);
+		return -1;
+	}
+
+	return 0;
+}
+
+void registry_unlock_prog(registry_t *reg, const char *name)
+{
+	if (!reg || reg->locked || !reg->plocked || !name)
+		return;
+
+	registry_range_lock(reg, F_UNLCK, REG_LOCK_PROGS +
+			(off_t)registry_hash(name, strlen(name)));
+	if (--reg->plocked == 0)
+		registry_range_lock(reg, F_UNLCK, REG_LOCK_TABLE);
+}
+
+/*
+ * Note:
+ * Copy the names and the locations of the caller into a single buffer, used
+ * when the mapping they may point into is about to be replaced.
+ */
+static char *registry_detach(const regprog_t *progs, size_t n,
+		regprog_t **own)
+{
+	size_t nlocs = 0, size = 0;
+	for (size_t i = 0; i < n; ++i) {
+		size += strlen(progs[i].name) + 1;
+		for (size_t j = 0; j < progs[i].nlocs; ++j)
+			size += progs[i].locs[j].len + 1;
+		nlocs += progs[i].nlocs;
+	}
+
+	char *buf = malloc(n * sizeof(regprog_t) + nlocs * sizeof(regloc_t) +
+			size);
+	if (!buf)
+		return NULL;
+	regprog_t *cprogs = (regprog_t *)buf;
+	regloc_t *clocs = (regloc_t *)(cprogs + n);
+	char *str = (char *)(clocs + nlocs);
+	for (size_t i = 0; i < n; ++i) {
+		size_t len = strlen(progs[i].name) + 1;
+		cprogs[i].name = memcpy(str, progs[i].name, len);
+		str += len;
+		cprogs[i].locs = clocs;
+		cprogs[i].nlocs = progs[i].nlocs;
+		cprogs[i].flags = progs[i].flags;
+		for (size_t j = 0; j < progs[i].nlocs; ++j, ++clocs) {
+			*clocs = progs[i].locs[j];
+			clocs->path = memcpy(str, progs[i].locs[j].path,
+					progs[i].locs[j].len);
+			str += progs[i].locs[j].len;
+			*str++ = '\0';
+		}
+	}
+
+	*own = cprogs;
+	return buf;
+}
+
+static int registry_put_locked(registry_t *reg, const regprog_t *progs,
+		size_t n)
+{
+	/*
+	 * Note:
+	 * Work out the space needed in the heap and whether the index can take
+	 * the new programs. Compact the registry when the index would become
+	 * more than half full or more than half of the heap is unreachable,
+	 * and when it is still in the first version of the format.
+	 */
+	const struct reg_header *header = registry_header(reg);
+	size_t nnew = 0, nlocs = 0, need = 0;
+	for (size_t i = 0; i < n; ++i) {
+		bool found;
+		registry_probe(reg, progs[i].name,
+				registry_hash(progs[i].name,
+					strlen(progs[i].name)), &found);
+		if (!found && progs[i].nlocs)
+			nnew++;
+		need += strlen(progs[i].name) + 1 + 7;
+		need += sizeof(struct reg_block) +
+			progs[i].nlocs * sizeof(struct reg_loc);
+		for (size_t j = 0; j < progs[i].nlocs; ++j)
+			need += progs[i].locs[j].len + 1;
+		nlocs += progs[i].nlocs;
+	}
+
+	size_t heap = REG_ALIGN(sizeof(struct reg_header) +
+			header->nslots * sizeof(struct reg_slot));
+	size_t used = header->heap_end - heap;
+	if ((header->nentries + nnew) * 2 > header->nslots ||
+			(header->garbage > REG_COMPACT_MIN &&
+			 header->garbage > used / 2) ||
+			header->heap_end + need > UINT32_MAX ||
+			reg->locsize != sizeof(struct reg_loc))
+		return registry_compact(reg, progs, n);
+
+	uint32_t *offs = calloc(nlocs + 1, sizeof(uint32_t));
+	if (!offs) {
+		error("Unable to allocate location offsets");
+		return -1;
+	}
+	for (size_t i = 0, k = 0; i < n; ++i)
+		for (size_t j = 0; j < progs[i].nlocs; ++j)
+			offs[k++] = registry_offset_of(reg,
+					progs[i].locs[j].path);
+
+	if (registry_grow(reg, header->heap_end + need)) {
+		free(offs);
+		return -1;
+	}
+
+	for (size_t i = 0, k = 0; i < n; k += progs[i].nlocs, ++i)
+		registry_update(reg, &progs[i], &offs[k]);
+
+	free(offs);
+	return 0;
+}
+
+int registry_put_many(registry_t *reg, const regprog_t *progs, size_t n)
+{
+	trace_span("registry.put");
+
+	if (!reg || !reg->map || (!progs && n)) {
+		error("Registry handle or programs not specified");
+		return -1;
+	}
+	if (!reg->locked && !reg->plocked) {
+		error("Registry has to be locked for writing");
+		return -1;
+	}
+
+	if (registry_range_lock(reg, F_WRLCK, REG_LOCK_HEAP))
+		return -1;
+
+	/*
+	 * Note:
+	 * Other programs may have been updated since the caller looked its
+	 * locations up. When that has replaced or grown the file, the mapping
+	 * the caller's views point into goes away with the refresh, so they
+	 * are copied first.
+	 */
+	char *detached = NULL;
+	struct stat details;
+	stats_count(STATS_STATS);
+	if (__atomic_load_n(&registry_header(reg)->retired,
+				__ATOMIC_ACQUIRE) ||
+			(!fstat(reg->fd, &details) &&
+			 (size_t)details.st_size > reg->size)) {
+		regprog_t *own = NULL;
+		detached = registry_detach(progs, n, &own);
+		if (!detached) {
+			error("Unable to copy the programs to be written");
+			registry_range_lock(reg, F_UNLCK, REG_LOCK_HEAP);
+			return -1;
+		}
+		progs = own;
+	}
+
+	int result = registry_refresh(reg);
+	if (!result)
+		result = registry_put_locked(reg, progs, n);
+
+	registry_range_lock(reg, F_UNLCK, REG_LOCK_HEAP);
+	free(detached);
+	return result;
+}
+
+int registry_put(registry_t *reg, const char *name, const regloc_t *locs,
+		size_t n, uint32_t flags)
+{
+	if (!name) {
+		error("Program name not specified");
+		return -1;
+	}
+
+	regprog_t prog = {name, locs, n, flags};
+	return registry_put_many(reg, &prog, 1);
+}
@@ -0,0 +1,260 @@
+/**
+ * @file stats.c
+ * @brief File containing the instrumentation of the phases of a run.
+ *
+ * A phase takes a snapshot of the clock and the counters when it is entered
+ * and adds the difference up when it is left. The opens and stats are counted
+ * where they are made, the read and write calls come from /proc/self/io so
+ * that the ones made through stdio and by the log are included as well. The
+ * reads of /proc/self/io itself are taken out again.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/stats.h"
+#include "../inc/buildinfo.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Values kept in a snapshot, the counters come first.
+ */
+enum {
+	STATS_READS = STATS_COUNTERS,	/* read calls */
+	STATS_WRITES,			/* write calls */
+	STATS_RBYTES,			/* bytes read */
+	STATS_WBYTES,			/* bytes written */
+	STATS_VALUES
+};
+
+typedef struct {
+	uint64_t ns;			/* monotonic time */
+	uint64_t values[STATS_VALUES];	/* counters at that time */
+} stats_snap_t;
+
+typedef struct {
+	uint64_t calls;			/* times the phase was left */
+	uint64_t ns;			/* time spent in the phase */
+	uint64_t values[STATS_VALUES];	/* counted within the phase */
+	stats_snap_t start;		/* snapshot taken on entering */
+	bool running;			/* entered and not left yet */
+} stats_phasestat_t;
+
+static const char *stats_names[STATS_PHASES] = {
+	[STATS_TOTAL] = "total",
+	[STATS_SETUP] = "setup",
+	[STATS_SETUP_CHECK] = "setup.check",
+	[STATS_SETUP_FULL] = "setup.full",
+	[STATS_MIGRATE] = "setup.migrate",
+	[STATS_OPEN] = "setup.open",
+	[STATS_LOG] = "log",
+	[STATS_FORWARD] = "forward",
+	[STATS_COMMAND] = "command",
+	[STATS_LOCK] = "lock",
+	[STATS_LOOKUP] = "lookup",
+	[STATS_PROMPT] = "prompt",
+	[STATS_JOURNAL] = "journal",
+	[STATS_REGISTRY] = "registry",
+	[STATS_LINK] = "link",
+	[STATS_TEARDOWN] = "teardown"
+};
+
+static const char *stats_keys[STATS_VALUES] = {
+	[STATS_OPENS] = "opens",
+	[STATS_STATS] = "stats",
+	[STATS_ALLOCS] = "arena_allocs",
+	[STATS_ALLOC_BYTES] = "arena_bytes",
+	[STATS_RESETS] = "arena_resets",
+	[STATS_READS] = "reads",
+	[STATS_WRITES] = "writes",
+	[STATS_RBYTES] = "read_bytes",
+	[STATS_WBYTES] = "write_bytes"
+};
+
+static bool stats_on;				/* instrumentation enabled */
+static const char *stats_command;		/* command being run */
+static const char *stats_path;			/* JSON output, NULL for stderr */
+static int stats_iofd = -1;			/* /proc/self/io */
+static uint64_t stats_selfreads;		/* reads of /proc/self/io */
+static uint64_t stats_selfbytes;		/* bytes read from it */
+static uint64_t stats_counters[STATS_COUNTERS];
+static stats_phasestat_t stats_phases[STATS_PHASES];
+
+/**
+ * @brief Get the value following a key of /proc/self/io.
+ */
+static uint64_t stats_field(const char *buf, const char *key)
+{
+	const char *field = strstr(buf, key);
+	return field ? strtoull(field + strlen(key), NULL, 10) : 0;
+}
+
+static void stats_snap(stats_snap_t *snap)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	snap->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	for (int c = 0; c < STATS_COUNTERS; ++c)
+		snap->values[c] = stats_counters[c];
+	if (stats_iofd < 0)
+		return;
+
+	/* the read going on is not accounted for yet, the earlier ones are */
+	char buf[512];
+	ssize_t len = pread(stats_iofd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+	snap->values[STATS_READS] = stats_field(buf, "syscr: ") -
+		stats_selfreads;
+	snap->values[STATS_WRITES] = stats_field(buf, "syscw: ");
+	snap->values[STATS_RBYTES] = stats_field(buf, "rchar: ") -
+		stats_selfbytes;
+	snap->values[STATS_WBYTES] = stats_field(buf, "wchar: ");
+	stats_selfreads++;
+	stats_selfbytes += len;
+}
+
+int stats_enable(const char *command, const char *path)
+{
+	if (stats_on)
+		return -1;
+
+	stats_command = command ? command : "";
+	stats_path = path;
+	stats_iofd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	memset(stats_counters, 0, sizeof(stats_counters));
+	memset(stats_phases, 0, sizeof(stats_phases));
+	stats_on = true;
+	stats_begin(STATS_TOTAL);
+	return 0;
+}
+
+bool stats_enabled(void)
+{
+	return stats_on;
+}
+
+void stats_begin(stats_phase_t phase)
+{
+	if (!stats_on || phase >= STATS_PHASES)
+		return;
+	stats_snap(&stats_phases[phase].start);
+	stats_phases[phase].running = true;
+}
+
+void stats_end(stats_phase_t phase)
+{
+	if (!stats_on || phase >= STATS_PHASES || !stats_phases[phase].running)
+		return;
+
+	stats_phasestat_t *p = &stats_phases[phase];
+	stats_snap_t now;
+	stats_snap(&now);
+	p->ns += now.ns - p->start.ns;
+	for (int v = 0; v < STATS_VALUES; ++v)
+		p->values[v] += now.values[v] - p->start.values[v];
+	p->calls++;
+	p->running = false;
+}
+
+void stats_count(stats_counter_t counter)
+{
+	if (stats_on && counter < STATS_COUNTERS)
+		stats_counters[counter]++;
+}
+
+void stats_add(stats_counter_t counter, uint64_t n)
+{
+	if (stats_on && counter < STATS_COUNTERS)
+		stats_counters[counter] += n;
+}
+
+static void stats_print(FILE *out)
+{
+	int nvalues = stats_iofd < 0 ? STATS_COUNTERS : STATS_VALUES;
+	fprintf(out, "xvman stats: %s\n%-14s %6s %10s", stats_command,
+			"phase", "calls", "ms");
+	for (int v = 0; v < nvalues; ++v)
+		fprintf(out, " %12s", stats_keys[v]);
+	fputc('\n', out);
+
+	for (int ph = 0; ph < STATS_PHASES; ++ph) {
+		const stats_phasestat_t *p = &stats_phases[ph];
+		if (!p->calls)
+			continue;
+		fprintf(out, "%-14s %6" PRIu64 " %10.3f", stats_names[ph],
+				p->calls, p->ns / 1e6);
+		for (int v = 0; v < nvalues; ++v)
+			fprintf(out, " %12" PRIu64, p->values[v]);
+		fputc('\n', out);
+	}
+}
+
+/*
+ * Note:
+ * One line of JSON per run is appended, so the file collects the runs of a
+ * machine and can be shipped as is. The command names are fixed strings,
+ * nothing in them needs escaping.
+ */
+static int stats_json(FILE *out)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	int nvalues = stats_iofd < 0 ? STATS_COUNTERS : STATS_VALUES;
+
+	fprintf(out, "{\"command\":\"%s\",\"version\":\"%d.%d.%d\","
+			"\"pid\":%d,\"time\":%lld,\"io\":%s,\"phases\":{",
+			stats_command, MAJOR, MINOR, BUILD_NUMBER,
+			(int)getpid(), (long long)ts.tv_sec,
+			stats_iofd < 0 ? "false" : "true");
+	bool first = true;
+	for (int ph = 0; ph < STATS_PHASES; ++ph) {
+		const stats_phasestat_t *p = &stats_phases[ph];
+		if (!p->calls)
+			continue;
+		fprintf(out, "%s\"%s\":{\"calls\":%" PRIu64 ",\"ns\":%" PRIu64,
+				first ? "" : ",", stats_names[ph], p->calls,
+				p->ns);
+		for (int v = 0; v < nvalues; ++v)
+			fprintf(out, ",\"%s\":%" PRIu64, stats_keys[v],
+					p->values[v]);
+		fputc('}', out);
+		first = false;
+	}
+	fputs("}}\n", out);
+	return ferror(out) ? -1 : 0;
+}
+
+int stats_report(void)
+{
+	if (!stats_on)
+		return -1;
+
+	for (int ph = STATS_PHASES - 1; ph >= 0; --ph)
+		stats_end(ph);
+
+	int result = 0;
+	if (stats_path) {
+		FILE *out = fopen(stats_path, "a");
+		if (!out || stats_json(out))
+			result = -1;
+		if (out && fclose(out))
+			result = -1;
+	} else {
+		stats_print(stderr);
+	}
+
+	stats_on = false;
+	if (stats_iofd >= 0)
+		close(stats_iofd);
+	stats_iofd = -1;
+	stats_selfreads = stats_selfbytes = 0;
+	return result;
+}
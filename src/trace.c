@@ -0,0 +1,108 @@
+/**
+ * @file trace.c
+ * @brief File containing the tracer of the spans of a run.
+ *
+ * The events are written in the JSON array form of the trace event format as
+ * they happen, through a large stdio buffer. A trace cut short by a crash
+ * misses only the closing bracket, which the viewers put up with. Every event
+ * is a single fprintf, so the events of the threads do not interleave.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/trace.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Size of the buffer the events are collected in.
+ */
+#define TRACE_BUF_SIZE (64 * 1024)
+
+bool trace_on;
+
+static FILE *trace_out;				/* trace being written */
+static int trace_pid;				/* process traced */
+static __thread int trace_tid;			/* thread writing an event */
+static char trace_buf[TRACE_BUF_SIZE];		/* buffer of trace_out */
+
+int trace_start(const char *path, const char *command)
+{
+	if (trace_out || !path)
+		return -1;
+
+	trace_out = fopen(path, "we");
+	if (!trace_out)
+		return -1;
+	setvbuf(trace_out, trace_buf, _IOFBF, sizeof(trace_buf));
+
+	trace_pid = getpid();
+	fprintf(trace_out, "[\n{\"name\":\"process_name\",\"ph\":\"M\","
+			"\"pid\":%d,\"args\":{\"name\":\"xvman %s\"}}",
+			trace_pid, command ? command : "");
+	trace_on = true;
+	return 0;
+}
+
+static void trace_event(const struct log_site *site, char phase)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (!trace_tid)
+		trace_tid = syscall(SYS_gettid);
+
+	/* the time stamps are in microseconds */
+	uint64_t us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (phase == 'B')
+		fprintf(trace_out, ",\n{\"name\":\"%s\",\"cat\":\"xvman\","
+				"\"ph\":\"B\",\"ts\":%" PRIu64 ".%03ld,"
+				"\"pid\":%d,\"tid\":%d,\"args\":{"
+				"\"file\":\"%s\",\"func\":\"%s\","
+				"\"line\":%ld}}", site->fmt, us,
+				ts.tv_nsec % 1000, trace_pid, trace_tid,
+				site->file, site->func, site->line);
+	else
+		fprintf(trace_out, ",\n{\"name\":\"%s\",\"cat\":\"xvman\","
+				"\"ph\":\"E\",\"ts\":%" PRIu64 ".%03ld,"
+				"\"pid\":%d,\"tid\":%d}", site->fmt, us,
+				ts.tv_nsec % 1000, trace_pid, trace_tid);
+}
+
+const struct log_site *trace_enter(const struct log_site *site)
+{
+	if (!trace_on)
+		return NULL;
+	trace_event(site, 'B');
+	return site;
+}
+
+void trace_leave(const struct log_site *site)
+{
+	/* a span still open when the trace is stopped is left open */
+	if (trace_on && site)
+		trace_event(site, 'E');
+}
+
+void trace_flush(void)
+{
+	if (trace_on)
+		fflush(trace_out);
+}
+
+int trace_stop(void)
+{
+	if (!trace_out)
+		return -1;
+
+	trace_on = false;
+	fputs("\n]\n", trace_out);
+	int result = ferror(trace_out) ? -1 : 0;
+	if (fclose(trace_out))
+		result = -1;
+	trace_out = NULL;
+	return result;
+}
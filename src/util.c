@@ -2,10 +2,17 @@
 #define _GNU_SOURCE
 
 #include "../inc/util.h"
+#include "../inc/trace.h"
 
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+static atomic_uint switch_seq; 	/* sequence for temporary link names */
+
 int util_symlink(const char *target, const char *link)
 {
 	if (!target) {
@@ -19,3 +26,43 @@ int util_symlink(const char *target, const char *link)
 
 	return symlink(target, link);
 }
+
+int util_symlink_switch(const char *target, int dirfd, const char *link)
+{
+	trace_span("symlink.switch");
+
+	if (!target) {
+		fprintf(stderr, "Target path not specified\n");
+		return -1;
+	}
+	if (!link) {
+		fprintf(stderr, "Link path not specified\n");
+		return -1;
+	}
+
+	/*
+	 * Note:
+	 * The temporary link has to live in the same directory as the final
+	 * link for the rename to be atomic. The name carries the pid and a
+	 * sequence number so that concurrent switches never collide.
+	 */
+	char tmp[PATH_MAX];
+	const char *base = strrchr(link, '/');
+	int dlen = base ? (int)(base - link) + 1 : 0;
+	base = base ? base + 1 : link;
+	if (snprintf(tmp, PATH_MAX, "%.*s.%s.%d.%u", dlen, link, base,
+				(int)getpid(),
+				atomic_fetch_add(&switch_seq, 1)) >= PATH_MAX) {
+		fprintf(stderr, "Link path too long: %s\n", link);
+		return -1;
+	}
+
+	if (symlinkat(target, dirfd, tmp))
+		return -1;
+	if (renameat(dirfd, tmp, dirfd, link)) {
+		unlinkat(dirfd, tmp, 0);
+		return -1;
+	}
+
+	return 0;
+}
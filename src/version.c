@@ -0,0 +1,261 @@
+/**
+ * @file version.c
+ * @brief File containing the parsing and ordering of versions.
+ *
+ * The sort key is a bit string read as an integer, most significant bit
+ * first. Every numeric component is a 1 followed by the number, then a 0 ends
+ * the list, followed by the pre-release stage in three bits and the number of
+ * the pre-release. A number n is written as n + 1 in binary without its
+ * leading 1, preceded by as many 1 bits as it has bits left and a 0, so that
+ * a larger number always wins at the first bit where two keys differ. A
+ * shorter list of components has a 0 where the longer one goes on with a 1,
+ * and the trailing zero components are left out beforehand.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/version.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+/**
+ * @brief Characters a version may follow within a path component.
+ */
+#define VERSION_SEPS "-_.+~@"
+
+/**
+ * @brief Words naming a pre-release stage.
+ */
+static const struct {
+	const char *word;
+	version_stage_t stage;
+} version_stages[] = {
+	{"dev", VERSION_DEV},
+	{"alpha", VERSION_ALPHA},
+	{"a", VERSION_ALPHA},
+	{"beta", VERSION_BETA},
+	{"b", VERSION_BETA},
+	{"pre", VERSION_PRE},
+	{"preview", VERSION_PRE},
+	{"rc", VERSION_RC}
+};
+
+static bool version_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static bool version_letter(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool version_sep(char c)
+{
+	return c && strchr(VERSION_SEPS, c);
+}
+
+/**
+ * @brief Names of architectures whose word size follows a separator, as in
+ * x86_64 or x86-64.
+ */
+static const char *const version_archs[] = {
+	"x86", "amd", "arm", "aarch", "ppc", "mips", "sparc", "s390", "riscv",
+	"ia"
+};
+
+/* the word ending right before the separator at sep names an architecture */
+static bool version_arch(const char *s, size_t start, size_t sep)
+{
+	size_t word = sep;
+	while (word > start && (version_letter(s[word - 1]) ||
+				version_digit(s[word - 1])))
+		word--;
+	for (size_t k = 0; k < sizeof(version_archs) /
+			sizeof(version_archs[0]); ++k)
+		if (strlen(version_archs[k]) == sep - word &&
+				!strncasecmp(s + word, version_archs[k],
+					sep - word))
+			return true;
+	return false;
+}
+
+/**
+ * @brief Read a number, saturating instead of wrapping around.
+ */
+static size_t version_number(const char *s, size_t i, size_t end,
+		uint32_t *value)
+{
+	uint64_t n = 0;
+	for (; i < end && version_digit(s[i]); ++i)
+		if ((n = n * 10 + (s[i] - '0')) > UINT32_MAX)
+			n = UINT32_MAX;
+	*value = n;
+	return i;
+}
+
+/*
+ * Note:
+ * Read the version starting at the given number of a path component: the
+ * dotted numbers first, then a pre-release stage along with its number when
+ * one follows. Anything else after the numbers is left alone, so 1.2-linux
+ * is the release 1.2.
+ */
+static void version_read(const char *s, size_t i, size_t end,
+		version_t *version)
+{
+	memset(version, 0, sizeof(version_t));
+	version->stage = VERSION_RELEASE;
+	for (;;) {
+		uint32_t part;
+		i = version_number(s, i, end, &part);
+		if (version->nparts < VERSION_PARTS)
+			version->parts[version->nparts++] = part;
+		if (i + 1 >= end || s[i] != '.' || !version_digit(s[i + 1]))
+			break;
+		i++;
+	}
+	while (version->nparts && !version->parts[version->nparts - 1])
+		version->nparts--;
+
+	/* a single letter stage is only taken when glued to the numbers on
+	 * both sides, as in 3.12.0a1 */
+	bool glued = i < end && version_letter(s[i]);
+	if (i < end && strchr("-._~", s[i]))
+		i++;
+	size_t word = i;
+	while (i < end && version_letter(s[i]))
+		i++;
+	size_t wlen = i - word;
+	for (size_t k = 0; wlen && k < sizeof(version_stages) /
+			sizeof(version_stages[0]); ++k) {
+		if (strlen(version_stages[k].word) != wlen ||
+				strncasecmp(s + word, version_stages[k].word,
+					wlen))
+			continue;
+		if (wlen == 1 && (!glued || i >= end || !version_digit(s[i])))
+			break;
+		if (i + 1 < end && strchr(".-_", s[i]) &&
+				version_digit(s[i + 1]))
+			i++;
+		version->stage = version_stages[k].stage;
+		version_number(s, i, end, &version->pre);
+		break;
+	}
+}
+
+/**
+ * @brief Look for a version within a single path component.
+ */
+static int version_component(const char *s, size_t start, size_t end,
+		version_t *version)
+{
+	for (size_t i = start; i < end; ++i) {
+		if (!version_digit(s[i]) || (i > start &&
+					version_digit(s[i - 1])))
+			continue;
+
+		char prev = i > start ? s[i - 1] : '\0';
+		if (version_sep(prev) && version_arch(s, start, i - 1))
+			continue;
+		bool found = i == start || version_sep(prev) ||
+			((prev == 'v' || prev == 'V') && (i - 1 == start ||
+				version_sep(s[i - 2])));
+		if (!found) {
+			size_t j = i;
+			while (j < end && version_digit(s[j]))
+				j++;
+			found = j + 1 < end && s[j] == '.' &&
+				version_digit(s[j + 1]);
+		}
+		if (found) {
+			version_read(s, i, end, version);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int version_parse(const char *path, size_t len, version_t *version)
+{
+	if (!path || !version)
+		return -1;
+
+	size_t end = len;
+	while (end) {
+		size_t start = end;
+		while (start && path[start - 1] != '/')
+			start--;
+		if (start < end && !version_component(path, start, end,
+					version))
+			return 0;
+		end = start ? start - 1 : 0;
+	}
+	return -1;
+}
+
+int version_compare(const version_t *a, const version_t *b)
+{
+	uint32_t nparts = a->nparts > b->nparts ? a->nparts : b->nparts;
+	for (uint32_t i = 0; i < nparts; ++i) {
+		uint32_t x = i < a->nparts ? a->parts[i] : 0;
+		uint32_t y = i < b->nparts ? b->parts[i] : 0;
+		if (x != y)
+			return x < y ? -1 : 1;
+	}
+	if (a->stage != b->stage)
+		return a->stage < b->stage ? -1 : 1;
+	if (a->pre != b->pre)
+		return a->pre < b->pre ? -1 : 1;
+	return 0;
+}
+
+/**
+ * @brief Sort key being built, from the top bit down.
+ */
+typedef struct {
+	uint64_t key;
+	unsigned nbits;
+} version_bits_t;
+
+/* append the n low bits of a value, the ones past the 64th are dropped */
+static void version_put(version_bits_t *bits, uint64_t value, unsigned n)
+{
+	if (!n || bits->nbits >= 64)
+		return;
+	if (n < 64)
+		value &= ((uint64_t)1 << n) - 1;
+	if (bits->nbits + n > 64) {
+		value >>= bits->nbits + n - 64;
+		n = 64 - bits->nbits;
+	}
+	bits->key |= value << (64 - bits->nbits - n);
+	bits->nbits += n;
+}
+
+static void version_put_number(version_bits_t *bits, uint32_t n)
+{
+	uint64_t value = (uint64_t)n + 1;
+	unsigned width = 64 - __builtin_clzll(value);
+	version_put(bits, UINT64_MAX, width - 1);
+	version_put(bits, 0, 1);
+	version_put(bits, value, width - 1);
+}
+
+uint64_t version_key(const char *path, size_t len)
+{
+	version_t version;
+	if (version_parse(path, len, &version))
+		return 0;
+
+	version_bits_t bits = {0, 0};
+	for (uint32_t i = 0; i < version.nparts; ++i) {
+		version_put(&bits, 1, 1);
+		version_put_number(&bits, version.parts[i]);
+	}
+	version_put(&bits, 0, 1);
+	version_put(&bits, version.stage, 3);
+	version_put_number(&bits, version.pre);
+	return bits.key;
+}
@@ -8,10 +8,21 @@
 
 #define _GNU_SOURCE
 #include "../inc/xvman.h"
+#include "../inc/libxvman.h"
+#include "../inc/arena.h"
+#include "../inc/paths.h"
 #include "../inc/log.h"
 #include "../inc/io.h"
 #include "../inc/util.h"
+#include "../inc/registry.h"
+#include "../inc/stats.h"
+#include "../inc/trace.h"
+#include "../inc/version.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <linux/limits.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -19,8 +30,28 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
 
+static libxvman_t *ctx;				/* library context */
+static bool readonly;				/* set up for reading only */
+static arena_t arena;				/* memory of the running command */
+static libxvman_watch_t *watch;			/* watch of the install roots */
+static FILE *diag;				/* diagnostics, NULL: stderr */
+
+/**
+ * @brief Names inside the configuration directory which are not programs.
+ */
+static const char *reserved_names[] = {
+	"xvmanrc",
+	"xvman.log",
+	"registry",
+	"journal",
+	"xvmand.sock",
+	SETUP_STAMP,
+	NULL
+};
+
 void xvman_show_usage()
 {
 	printf("xvman [OPTIONS [VALUES]]\n");
@@ -28,31 +59,258 @@ void xvman_show_usage()
 
 void xvman_free_mem(void)
 {
+	stats_begin(STATS_TEARDOWN);
 	info("Freeing up all the allocated memory");
+	xvman_watch_close();
+	libxvman_close(ctx);
+	ctx = NULL;
+	info("Arena: %zu allocations, %zu bytes, %zu resets", arena.nallocs,
+			arena.bytes, arena.nresets);
+	arena_free(&arena);
 	log_free_lf();
-	printf("Exiting...\n");
+	stats_end(STATS_TEARDOWN);
+	/* the output of the read-only commands is meant for scripts */
+	if (!readonly)
+		printf("Exiting...\n");
 }
 
-int xvman_setup_prereq(xvmanconf_t *config)
+/**
+ * @brief Check if a name inside the configuration directory is a program.
+ */
+static bool xvman_is_program(const char *name)
 {
-	if (!config) {
-		fprintf(stderr, "XVMAN configuration struct instance "
-				"not provided\n");
+	if (name[0] == '.' || strncmp(name, "registry.", 9) == 0)
+		return false;
+	for (const char **reserved = reserved_names; *reserved; ++reserved)
+		if (strcmp(name, *reserved) == 0)
+			return false;
+	return true;
+}
+
+void xvman_set_diag(FILE *stream)
+{
+	diag = stream;
+}
+
+/**
+ * @brief Stream the diagnostics meant for the user go to.
+ */
+static FILE *xvman_diag(void)
+{
+	return diag ? diag : stderr;
+}
+
+/**
+ * @brief Report a failed call of the library to the user.
+ */
+static int xvman_fail(int err, const char *pname, const char *ilocation)
+{
+	switch (err) {
+		case LIBXVMAN_EMISSING:
+			fprintf(xvman_diag(), "\nError: \nInstall location "
+					"specified does not exist\n\n");
+			break;
+		case LIBXVMAN_EEXIST:
+			fprintf(xvman_diag(), "Location %s already added\n",
+					ilocation);
+			break;
+		case LIBXVMAN_ENOPROG:
+			fprintf(xvman_diag(), "Program: %s is not configured\n",
+					pname);
+			break;
+		case LIBXVMAN_ENOLOC:
+			fprintf(xvman_diag(), "Install location %s is no "
+					"longer registered\n", ilocation);
+			break;
+		default:
+			fprintf(xvman_diag(), "%s\n", libxvman_strerror(err));
+	}
+	error("%s", libxvman_strerror(err));
+	return -1;
+}
+
+/*
+ * Note:
+ * Older versions of xvman kept one text file per program inside the
+ * configuration directory, with the active install location on the first
+ * line. Import all of them into the registry in one go and move them out of
+ * the way so that the import is done only once.
+ */
+static int xvman_migrate(const xvmanconf_t *config)
+{
+	trace_span("migrate");
+
+	DIR *dir = opendir(config->confdir);
+	stats_count(STATS_OPENS);
+	if (!dir) {
+		error("Unable to open configuration directory: %s",
+				config->confdir);
 		return -1;
 	}
 
-	/* clear up the memory and then setup the path properly */
-	memset(config->cbin, '\0', PATH_MAX);
-	memset(config->confdir, '\0', PATH_MAX);
-	memset(config->conf_fpath, '\0', PATH_MAX);
-	memset(config->conf_logfpath, '\0', PATH_MAX);
+	size_t nprogs = 0, cprogs = 0, nlocs = 0, clocs = 0;
+	char **names = NULL;
+	size_t *counts = NULL;
+	regloc_t *locs = NULL;
+	int result = 0;
+	bool failed = false;
+
+	for (struct dirent *dent = readdir(dir); !failed && dent;
+			dent = readdir(dir)) {
+		struct stat details;
+		if (!xvman_is_program(dent->d_name))
+			continue;
+		stats_count(STATS_STATS);
+		if (fstatat(dirfd(dir), dent->d_name, &details,
+					AT_SYMLINK_NOFOLLOW) ||
+				!S_ISREG(details.st_mode))
+			continue;
+
+		/* the whole file is read at once, the install locations are
+		 * the lines of the copy */
+		size_t len;
+		int fd = openat(dirfd(dir), dent->d_name, O_RDONLY | O_CLOEXEC);
+		stats_count(STATS_OPENS);
+		char *content = fd >= 0 ? arena_read(&arena, fd, &len) : NULL;
+		if (fd >= 0)
+			close(fd);
+		if (!content) {
+			warning("Unable to read legacy configuration: %s",
+					dent->d_name);
+			continue;
+		}
+		debug("Importing legacy configuration: %s", dent->d_name);
+
+		if (nprogs == cprogs) {
+			size_t ncap = cprogs ? cprogs * 2 : 16;
+			names = arena_grow(&arena, names, cprogs *
+					sizeof(char *), ncap * sizeof(char *));
+			counts = arena_grow(&arena, counts, cprogs *
+					sizeof(size_t), ncap * sizeof(size_t));
+			cprogs = ncap;
+		}
+		if (names)
+			names[nprogs] = arena_strndup(&arena, dent->d_name,
+					NAME_MAX);
+		failed = !names || !names[nprogs] || !counts;
+
+		for (char *line = content, *end; !failed &&
+				line < content + len; line = end + 1) {
+			end = memchr(line, '\n', content + len - line);
+			if (!end)
+				end = content + len;
+			*end = '\0';
+			if (end == line)
+				continue;
+			if (nlocs == clocs) {
+				size_t ncap = clocs ? clocs * 2 : 64;
+				locs = arena_grow(&arena, locs, clocs *
+						sizeof(regloc_t),
+						ncap * sizeof(regloc_t));
+				clocs = ncap;
+				failed = !locs;
+				if (failed)
+					break;
+			}
+			locs[nlocs].path = line;
+			locs[nlocs].len = end - line;
+			locs[nlocs].flags = 0;
+			locs[nlocs].added = details.st_mtime;
+			locs[nlocs].version = version_key(line, end - line);
+			locs[nlocs].priority = 0;
+			nlocs++;
+			counts[nprogs]++;
+		}
+		nprogs++;
+	}
+	if (failed) {
+		error("Unable to allocate legacy configuration");
+		nprogs = 0;
+		result = -1;
+	}
+
+	if (nprogs) {
+		regprog_t *progs = arena_alloc(&arena,
+				nprogs * sizeof(regprog_t));
+		for (size_t i = 0, lindex = 0; progs && i < nprogs; ++i) {
+			progs[i].name = names[i];
+			progs[i].locs = &locs[lindex];
+			progs[i].nlocs = counts[i];
+			progs[i].flags = 0;
+			lindex += counts[i];
+		}
 
-	/* setup the configuration directory path */
-	sprintf(config->cbin, "%s/%s", getenv("HOME"), CBIN);
-	sprintf(config->confdir, "%s/%s", getenv("HOME"), CONFDIR);
-	sprintf(config->conf_fpath, "%s/%s", getenv("HOME"), CONF_FPATH);
-	sprintf(config->conf_logfpath, "%s/%s", getenv("HOME"), CONF_LOGFPATH);
+		/* the registry is created here, the context is opened on it
+		 * afterwards */
+		registry_t registry;
+		result = progs ? registry_open(&registry,
+				config->conf_regpath) : -1;
+		if (!result) {
+			result = registry_lock(&registry);
+			if (!result)
+				result = registry_put_many(&registry, progs,
+						nprogs);
+			registry_unlock(&registry);
+			registry_close(&registry);
+		}
+		if (result) {
+			error("Unable to import legacy configuration");
+		} else {
+			const char *legacydir = paths_get(PATHS_LEGACYDIR);
+			mkdir(legacydir, S_IRWXU);
+			int ldfd = open(legacydir, O_RDONLY | O_DIRECTORY);
+			stats_count(STATS_OPENS);
+			for (size_t i = 0; ldfd >= 0 && i < nprogs; ++i)
+				renameat(dirfd(dir), names[i], ldfd, names[i]);
+			if (ldfd >= 0)
+				close(ldfd);
+			info("Imported %zu programs into the registry", nprogs);
+		}
+	}
+
+	closedir(dir);
+	arena_reset(&arena);
+
+	return result;
+}
 
+/*
+ * Note:
+ * The setup is complete once the configuration directory holds a setup stamp
+ * of the current version. Checking that costs an open of the directory and a
+ * readlinkat of the stamp, the rest of the setup is skipped afterwards.
+ */
+static bool xvman_setup_stamped(const xvmanconf_t *config)
+{
+	int cfd = open(config->confdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (cfd < 0)
+		return false;
+
+	char stamp[sizeof(SETUP_VERSION)];
+	ssize_t len = readlinkat(cfd, SETUP_STAMP, stamp, sizeof(stamp));
+	close(cfd);
+
+	return len == sizeof(SETUP_VERSION) - 1 &&
+		memcmp(stamp, SETUP_VERSION, len) == 0;
+}
+
+static void xvman_setup_stamp(const xvmanconf_t *config)
+{
+	int cfd = open(config->confdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	stats_count(STATS_OPENS);
+	if (cfd < 0 || util_symlink_switch(SETUP_VERSION, cfd, SETUP_STAMP))
+		fprintf(stderr, "Unable to record the setup stamp, the setup "
+				"will run again next time\n");
+	if (cfd >= 0)
+		close(cfd);
+}
+
+/**
+ * @brief Create the directories and files xvman relies upon.
+ */
+static int xvman_setup_full(const xvmanconf_t *config)
+{
 	/* create the directory and the configuration file */
 	if (io_mkdir(config->confdir, S_IRWXU, true)) {
 		fprintf(stderr, "Error while setting up config directory: %s\n",
@@ -61,6 +319,7 @@ int xvman_setup_prereq(xvmanconf_t *config)
 	}
 	if (!io_path_exists(config->conf_fpath)) {
 		FILE *conf_file = fopen(config->conf_fpath, "w");
+		stats_count(STATS_OPENS);
 		if (!conf_file) {
 			fprintf(stderr, "Error while creating "
 					"configuration file at location: %s\n",
@@ -82,32 +341,12 @@ int xvman_setup_prereq(xvmanconf_t *config)
 	 * As of now, the following portion will assume that BASH is default
 	 * shell.
 	 */
-	char bash_cfilepath[PATH_MAX], export[PATH_MAX];
-	memset(bash_cfilepath, '\0', PATH_MAX);
-	memset(export, '\0', PATH_MAX);
-	int result = 0;
-	if ((result = sprintf(bash_cfilepath,
-				"%s/%s", getenv("HOME"),
-				BASH_CONF_FILE)) < 0) {
-		fprintf(stderr, "Error while preparing the "
-				"bash configuration filepath\n");
-		return -1;
-	}
-	if ((result = sprintf(export, "\nexport %s\n", RCUPDATE)) < 0) {
-		fprintf(stderr, "Error while updating "
-				"configuration file update content\n");
-		return -1;
-	}
+	const char *bash_cfilepath = paths_get(PATHS_BASHRC);
+	const char export[] = "\nexport " RCUPDATE "\n";
 
 	/* create the lock file inside the xvman config directory so that no
 	 * more updation of the bash configuration file is done */
-	char lockfilepath[PATH_MAX];
-	memset(lockfilepath, '\0', PATH_MAX);
-	if ((result = sprintf(lockfilepath, "%s/%s",
-					getenv("HOME"), LOCKFILE)) < 0) {
-		fprintf(stderr, "Error while updating lock filepath\n");
-		return -1;
-	}
+	const char *lockfilepath = paths_get(PATHS_LOCKFILE);
 
 	/*
 	 * Note:
@@ -123,6 +362,7 @@ int xvman_setup_prereq(xvmanconf_t *config)
 			"\n\n", getenv("USER"), RCUPDATE);
 		/* update the bash configuration file */
 		FILE *bash_cfile = fopen(bash_cfilepath, "a+");
+		stats_count(STATS_OPENS);
 		fwrite(export, sizeof(char), strlen(export), bash_cfile);
 		if (bash_cfile) {
 			if (fclose(bash_cfile)) {
@@ -135,8 +375,9 @@ int xvman_setup_prereq(xvmanconf_t *config)
 
 		/* create the lockfile now */
 		FILE *lockfile = fopen(lockfilepath, "w");
+		stats_count(STATS_OPENS);
 		if (lockfile) {
-			if (fclose(bash_cfile)) {
+			if (fclose(lockfile)) {
 				fprintf(stderr, "Unable to close the lock file"
 						" handler\n");
 				return -1;
@@ -144,6 +385,103 @@ int xvman_setup_prereq(xvmanconf_t *config)
 		}
 	}
 
+	return 0;
+}
+
+/**
+ * @brief Fill in the paths of the configuration.
+ */
+static int xvman_setup_paths(xvmanconf_t *config)
+{
+	if (!config) {
+		fprintf(stderr, "XVMAN configuration struct instance "
+				"not provided\n");
+		return -1;
+	}
+
+	/* the paths are built once per process, a $HOME too deep for any of
+	 * them is refused up front */
+	const char *home = getenv("HOME");
+	if (!home) {
+		fprintf(stderr, "HOME is not set\n");
+		return -1;
+	}
+	if (paths_init(home)) {
+		fprintf(stderr, "HOME is too long: %s\n", home);
+		return -1;
+	}
+	config->cbin = paths_get(PATHS_CBIN);
+	config->confdir = paths_get(PATHS_CONFDIR);
+	config->conf_fpath = paths_get(PATHS_CONF);
+	config->conf_logfpath = paths_get(PATHS_LOG);
+	config->conf_regpath = paths_get(PATHS_REGISTRY);
+	config->conf_journalpath = paths_get(PATHS_JOURNAL);
+
+	return 0;
+}
+
+int xvman_setup_readonly(xvmanconf_t *config)
+{
+	trace_span("setup");
+
+	if (xvman_setup_paths(config))
+		return -1;
+
+	readonly = true;
+	int result = libxvman_open(&ctx, NULL, LIBXVMAN_READONLY);
+	if (result) {
+		fprintf(stderr, "Error while opening the program registry: "
+				"%s: %s\n", config->conf_regpath,
+				libxvman_strerror(result));
+		return -1;
+	}
+
+	return 0;
+}
+
+int xvman_setup_prereq(xvmanconf_t *config)
+{
+	trace_span("setup");
+
+	if (xvman_setup_paths(config))
+		return -1;
+
+	/* the full setup runs only till it has gone through once */
+	int result = -1;
+	stats_begin(STATS_SETUP_CHECK);
+	bool stamped = xvman_setup_stamped(config);
+	stats_end(STATS_SETUP_CHECK);
+	if (!stamped) {
+		stats_begin(STATS_SETUP_FULL);
+		if (xvman_setup_full(config))
+			goto out;
+		stats_end(STATS_SETUP_FULL);
+
+		/* import the older configuration files when the registry is
+		 * being created for the first time */
+		stats_begin(STATS_MIGRATE);
+		if (!io_path_exists(config->conf_regpath) &&
+				xvman_migrate(config)) {
+			fprintf(stderr, "Error while importing the older "
+					"program configuration files\n");
+			goto out;
+		}
+		stats_end(STATS_MIGRATE);
+	}
+
+	/* opening the context finishes the updates a crashed run has left
+	 * behind in the journal */
+	stats_begin(STATS_OPEN);
+	int err = libxvman_open(&ctx, NULL, 0);
+	stats_end(STATS_OPEN);
+	if (err) {
+		fprintf(stderr, "Error while opening the program registry: "
+				"%s: %s\n", config->conf_regpath,
+				libxvman_strerror(err));
+		goto out;
+	}
+	if (!stamped)
+		xvman_setup_stamp(config);
 
 	/* debug mode is disabled by default */
 	config->debug = false;
@@ -151,16 +489,24 @@ int xvman_setup_prereq(xvmanconf_t *config)
 	/* enable logging to file, disabling stream by default */
 	config->enable_flog = true;
 	config->enable_slog = false;
+	result = 0;
 
-	return 0;
+out:
+	/* a failed step leaves its phase running, which is closed here so
+	 * that every phase is timed up to the failure */
+	stats_end(STATS_SETUP_FULL);
+	stats_end(STATS_MIGRATE);
+	return result;
 }
 
 int xvman_add(const char *data)
 {
+	trace_span("add");
+
 	if (!data) {
 		error("Data having program name and "
 				"install location not specified");
-		fprintf(stderr, "Data containing program name and "
+		fprintf(xvman_diag(), "Data containing program name and "
 				"install location not provided\n");
 		return -1;
 	}
@@ -174,329 +520,744 @@ int xvman_add(const char *data)
 	 * location separated by a space. Tokenize and perform the operations.
 	 */
 	int index = 0;
-	char pname[100], ilocation[200];
-	memset(pname, '\0', 100);
-	memset(ilocation, '\0', 100);
+	const char *pname = "", *ilocation = "", *priority = "0";
 	for (char *token = strtok((char *)data, " ");
 			token; token = strtok(NULL, " "), index++) {
 		if (index == 0)
-			strcpy(pname, token);
+			pname = token;
 		else if (index == 1)
-			strcpy(ilocation, token);
+			ilocation = token;
+		else if (index == 2)
+			priority = token;
 	}
 
-	debug("Program: %s, install location: %s", pname, ilocation);
-
-	/*
-	 * Note:
-	 * check if the configuration file is created or not, if not return
-	 * with the -1, else write the data into the respective xvman
-	 * configuration, the program configuration and create the symlink
-	 * accordingly. Delete the older symlink if one already exists.
-	 */
-	if (!io_path_exists(ilocation)) {
-		error("Install location specified does not exist");
-		fprintf(stderr, "\nError: \nInstall location "
-				"specified does not exist\n\n");
+	char *end = NULL;
+	errno = 0;
+	long prio = strtol(priority, &end, 10);
+	if (errno || *end || end == priority || prio < INT32_MIN ||
+			prio > INT32_MAX) {
+		error("Invalid priority: %s", priority);
+		fprintf(xvman_diag(), "Invalid priority: %s\n", priority);
 		return -1;
 	}
+	debug("Program: %s, install location: %s, priority: %ld", pname,
+			ilocation, prio);
 
-	/* if the path exists, start the processing */
-	char pconfig[PATH_MAX];
-	memset(pconfig, '\0', PATH_MAX);
-	int result = 0;
-	if ((result = sprintf(pconfig, "%s/%s/%s",
-				getenv("HOME"), CONFDIR, pname)) < 0) {
-		fprintf(stderr, "Error while setting up "
-				"program config file path\n");
-		return -1;
-	}
-	debug("Program config file path: %s", pconfig);
-
-	if (!io_path_exists(pconfig)) {
-		debug("Program configuration file does not exist");
-		/*
-		 * Note:
-		 * If the program configuration file does not exist, create it
-		 * and fill it up with the right path.
-		 */
-
-		/* since the file does not exist, create it and add the install
-		 * location */
-		FILE *pconf_file = fopen(pconfig, "w");
-		fwrite(ilocation, sizeof(char), strlen(ilocation), pconf_file);
-		fwrite("\n", sizeof(char), strlen("\n"), pconf_file);
-		if (pconf_file)
-			fclose(pconf_file);
-	} else {
-		debug("Program configuration file already exists");
-
-		/*
-		 * Note:
-		 * If the program configuration file exists, read the contents
-		 * and save them. Post that, put the recently added install
-		 * location at the top of the file and then add the contents
-		 * under the new install location.
-		 */
-
-		FILE *r_pconf_file = fopen(pconfig, "r");
-		char *line = NULL;
-		size_t len = 0, read;
-
-		while ((read = getline(&line, &len, r_pconf_file)) != -1) {
-			line[read-1] = line[read-1] == '\n' ? '\0' : line[read-1];
-			debug("Line content: %s, length: %zu", line, read);
-			if (strcmp(ilocation, line) ==  0) {
-				warning("Location: %s already added",
-						ilocation);
-				fprintf(stderr, "Location %s already added\n",
-						ilocation);
-				if (r_pconf_file)
-					fclose(r_pconf_file);
-				free(line);
-				return -1;
-			}
-		}
-		if (r_pconf_file)
-			fclose(r_pconf_file);
-
-		free(line);
-
-		/* read the file line by line */
-		FILE *read_pconf_file = fopen(pconfig, "r");
-		FILE *w_tmp_file = fopen("./tmp", "a");
-
-		line = NULL;
-		len = 0, read = 0;
+	/* the library checks the install location, records it ahead of the
+	 * older ones or at its rank and switches the symlink */
+	int result = libxvman_add_priority(ctx, pname, ilocation, prio);
+	if (result)
+		return xvman_fail(result, pname, ilocation);
+	return 0;
+}
 
+/**
+ * @brief Install locations collected from a query.
+ */
+typedef struct {
+	char **paths;			/* copies of the install locations */
+	size_t n, cap;			/* number of locations and capacity */
+} xvman_locs_t;
 
-		while ((read = getline(&line, &len, read_pconf_file)) != -1 ) {
-			if (line[strlen(line)-1] == '\n')
-				line[strlen(line)-1] = '\0';
-			debug("Retrieved line of length: %zu, "
-					"line content: %s",
-					read, line);
-			fwrite(line, sizeof(char), strlen(line), w_tmp_file);
-			fwrite("\n", sizeof(char), strlen("\n"), w_tmp_file);
-		}
+static int xvman_collect(const libxvman_loc_t *loc, void *arg)
+{
+	xvman_locs_t *locs = arg;
+	if (locs->n == locs->cap) {
+		size_t cap = locs->cap ? locs->cap * 2 : 8;
+		locs->paths = arena_grow(&arena, locs->paths,
+				locs->cap * sizeof(char *),
+				cap * sizeof(char *));
+		locs->cap = cap;
+	}
+	char *path = locs->paths ? arena_strndup(&arena, loc->path,
+			loc->len) : NULL;
+	if (!path)
+		return -1;
+	locs->paths[locs->n++] = path;
+	return 0;
+}
 
-		if (read_pconf_file)
-			fclose(read_pconf_file);
-		if (w_tmp_file)
-			fclose(w_tmp_file);
-
-		free(line);
-
-		/*
-		 * Note:
-		 * Now read the tmp file and re-populate the existing program
-		 * configuration file.
-		 */
-
-		FILE *write_pconf_file = fopen(pconfig, "w");
-		FILE *r_tmp_file = fopen("./tmp", "r");
-
-		line = NULL;
-		len = 0, read = 0;
-
-		fwrite(ilocation, sizeof(char), strlen(ilocation),
-				write_pconf_file);
-		fwrite("\n", sizeof(char), strlen("\n"), write_pconf_file);
-		while ((read = getline(&line, &len, r_tmp_file)) != -1) {
-			debug("Writing line content: %s, length: %zu",
-					line, read);
-			fwrite(line, sizeof(char), strlen(line),
-					write_pconf_file);
-		}
+int xvman_config(const char *pname)
+{
+	trace_span("config");
 
-		if (write_pconf_file)
-			fclose(write_pconf_file);
-		if (r_tmp_file)
-			fclose(r_tmp_file);
+	if (!pname) {
+		error("Program name not specified");
+		fprintf(stderr, "Program name not specified\n");
+		return -1;
+	}
 
-		/* delete the tmp file */
-		debug("Cleaning up the tmp file...");
-		remove("./tmp");
+	info("About to configure the version...");
 
-		free(line);
+	/* since the program is registered show the install locations to the
+	 * user, the copies stay valid once the registry has been updated and
+	 * go along with the arena */
+	xvman_locs_t locs = {NULL, 0, 0};
+	stats_begin(STATS_LOOKUP);
+	int result = libxvman_query(ctx, pname, xvman_collect, &locs);
+	stats_end(STATS_LOOKUP);
+	if (result) {
+		arena_reset(&arena);
+		return xvman_fail(result, pname, NULL);
 	}
-
-	char slink[PATH_MAX];
-	memset(slink, '\0', PATH_MAX);
-	if ((result = sprintf(slink, "%s/%s/%s",
-				getenv("HOME"), CBIN, pname)) < 0) {
-		error("Error while forming symlink path");
-		fprintf(stderr, "Error while forming symlink path\n");
-		return -1;
+	for (size_t i = 0; i < locs.n; ++i) {
+		debug("Install location: %s", locs.paths[i]);
+		printf("%zu. %s\n", i+1, locs.paths[i]);
 	}
-	debug("Symlink path: %s", slink);
 
-	if (!io_path_exists(slink)) {
-		info("Symlink is not present, creating it...");
+	int choice = -1;
+	printf("Please enter your choice: ");
+	stats_begin(STATS_PROMPT);
+	int nread = scanf("%d", &choice);
+	stats_end(STATS_PROMPT);
+	if (nread != 1 || choice < 1 || choice > (int)locs.n) {
+		error("Invalid choice provided");
+		fprintf(stderr, "\nInvalid choice provided\n");
+		result = -1;
 	} else {
-		info("Symlink is present, deleting and recreating...");
-		/*
-		 * Note:
-		 * Delete the existing symlink file and recreate the new one
-		 * and then recreate the symlink file.
-		 */
-		remove(slink);
-	}
-
-	if (util_symlink(ilocation, slink)) {
-		error("Error while creating symlink");
-		fprintf(stderr, "Error while creating symlink\n");
+		debug("Install location chosen: %s", locs.paths[choice-1]);
+		printf("Install location chosen: %s\n", locs.paths[choice-1]);
+		result = xvman_select(pname, locs.paths[choice-1]);
+	}
+
+	arena_reset(&arena);
+	return result;
+}
+
+int xvman_select(const char *pname, const char *ilocation)
+{
+	trace_span("select");
+
+	if (!pname || !ilocation) {
+		error("Program name or install location not specified");
+		fprintf(xvman_diag(), "Program name or install location not "
+				"specified\n");
 		return -1;
 	}
 
+	int result = libxvman_select(ctx, pname, ilocation);
+	if (result)
+		return xvman_fail(result, pname, ilocation);
 	return 0;
 }
 
-int xvman_config(const char *pname)
+int xvman_auto(const char *pname)
 {
+	trace_span("auto");
+
 	if (!pname) {
 		error("Program name not specified");
 		fprintf(stderr, "Program name not specified\n");
 		return -1;
 	}
 
-	info("About to configure the version...");
+	int result = libxvman_auto(ctx, pname);
+	if (result)
+		return xvman_fail(result, pname, NULL);
+
+	char current[PATH_MAX];
+	if (!libxvman_current(ctx, pname, current, sizeof(current)))
+		printf("Install location chosen: %s\n", current);
+	return 0;
+}
+
+static int xvman_print_loc(const libxvman_loc_t *loc, void *arg)
+{
+	fprintf(arg, "%.*s\n", (int)loc->len, loc->path);
+	return 0;
+}
 
-	char pconfig_file[PATH_MAX];
-	memset(pconfig_file, '\0', PATH_MAX);
-	int result;
-	if ((result = sprintf(pconfig_file, "%s/%s/%s", getenv("HOME"),
-					CONFDIR, pname)) < 0) {
-		error("Error while preparing program configuration file\n");
-		fprintf(stderr, "Error while preparing program "
-				"configuration file\n");
+int xvman_query(const char *pname, FILE *out)
+{
+	trace_span("query");
+
+	if (!pname || !out) {
+		error("Program name or output not specified");
+		fprintf(xvman_diag(), "Program name or output not specified\n");
 		return -1;
 	}
-	debug("Program configuration file path: %s", pconfig_file);
 
-	if (!io_path_exists(pconfig_file)) {
-		error("Program: %s is not configured", pconfig_file);
-		fprintf(stderr, "Program: %s is not configured\n",
-				pconfig_file);
+	int result = libxvman_query(ctx, pname, xvman_print_loc, out);
+	if (result)
+		return xvman_fail(result, pname, NULL);
+	return 0;
+}
+
+/**
+ * @brief Single operation read from a batch manifest.
+ */
+typedef struct {
+	const char *op;			/* add, select or remove */
+	const char *pname;		/* name of the program */
+	const char *ilocation;		/* install location */
+	size_t lineno;			/* line number in the manifest */
+	const char *status;		/* NULL on success, reason otherwise */
+} batchop_t;
+
+static int xvman_batch_cmp(const void *a, const void *b)
+{
+	return strcmp(((const libxvman_op_t *)a)->pname,
+			((const libxvman_op_t *)b)->pname);
+}
+
+int xvman_batch(const char *manifest)
+{
+	trace_span("batch");
+
+	if (!manifest) {
+		error("Batch manifest not specified");
+		fprintf(stderr, "Batch manifest not specified\n");
 		return -1;
 	}
 
-	/* since the path is present read the contents of the file as well as
-	 * show the same to the user */
-	FILE *r_pconf_file = fopen(pconfig_file, "r");
-
-	/* get the line count in the configuration file */
-	char *line = NULL;
-	size_t len = 0, read = 0, lc = 0;
-	while ((read = getline(&line, &len, r_pconf_file)) != -1)
-		lc++;
-	free(line);
-
-	len = 0;
-	fseek(r_pconf_file, 0, 0);
-	char **locations = calloc(sizeof(char *), lc);
-	size_t location_index = 0;
-	while ((read = getline(&line, &len, r_pconf_file)) != -1) {
-		debug("Install location: %s, length: %zu", line, read);
-		printf("%zu. %s", location_index+1, line);
-		locations[location_index] = calloc(sizeof(char), read+1);
-		if ((result = sprintf(
-				locations[location_index], "%s", line)) < 0) {
-			error("Error while storing install location");
-			break;
-		}
-		location_index++;
-	}
-	free(line);
-	if (r_pconf_file)
-		fclose(r_pconf_file);
+	info("About to apply the batch manifest: %s", manifest);
 
-	int choice = -1;
-	bool write = false;
-	printf("Please enter your choice: ");
-	scanf("%d", &choice);
-	if ((choice < 0) || (choice > lc)) {
-		error("Invalid choice provided");
-		fprintf(stderr, "\nInvalid choice provided\n");
-		write = false;
-	} else
-		write = true;
-
-	/* fixme: this needs to be used for re-writing into the file */
-	if (write) {
-		debug("Install location chosen: %s", locations[choice - 1]);
-		printf("Install location chosen: %s", locations[choice - 1]);
-		FILE *w_pconf_file = fopen(pconfig_file, "w");
-		if (!w_pconf_file) {
-			error("Error while opening "
-				"program config file for updating");
-			fprintf(stderr, "Error while opening "
-				"program config file for updating\n");
-			for (size_t i = 0; i < lc; i++)
-				free(locations[i]);
-			if (locations)
-				free(locations);
-			return -1;
-		}
-		fwrite(locations[choice-1], sizeof(char),
-			strlen(locations[choice-1]), w_pconf_file);
-		for (size_t i = 0; i < lc; ++i) {
-			if (i != (choice-1)) {
-				debug("Appending stored location: %s",
-						locations[i]);
-				fwrite(locations[i], sizeof(char),
-					strlen(locations[i]), w_pconf_file);
-			}
-		}
-		if (w_pconf_file)
-			fclose(w_pconf_file);
+	bool use_stdin = strcmp(manifest, "-") == 0;
+	int fd = use_stdin ? STDIN_FILENO : open(manifest, O_RDONLY |
+			O_CLOEXEC);
+	if (!use_stdin)
+		stats_count(STATS_OPENS);
+	if (fd < 0) {
+		error("Unable to open batch manifest: %s", manifest);
+		fprintf(stderr, "Unable to open batch manifest: %s\n",
+				manifest);
+		return -1;
 	}
 
 	/*
 	 * Note:
-	 * Check if the symlink is already present.
-	 * If the symlink is present, delete it and re-create the symlink.
-	 * If the symlink is not present, create the symlink.
+	 * The manifest is read into the arena at once and the operations are
+	 * tokenized in place, with the arrays sized by the number of lines up
+	 * front. Everything goes with a single reset of the arena.
 	 */
-	char link[PATH_MAX];
-	memset(link, '\0', PATH_MAX);
-	if ((result = sprintf(link, "%s/%s/%s",
-				getenv("HOME"), CBIN, pname)) < 0) {
-		error("Error while setting up symlink path");
-		fprintf(stderr, "Error while setting up symlink path\n");
+	size_t len = 0, nlines = 1;
+	char *content = arena_read(&arena, fd, &len);
+	if (!use_stdin)
+		close(fd);
+	for (size_t i = 0; content && i < len; ++i)
+		nlines += content[i] == '\n';
+	batchop_t *ops = arena_alloc(&arena, nlines * sizeof(batchop_t));
+	libxvman_op_t *lops = arena_alloc(&arena,
+			nlines * sizeof(libxvman_op_t));
+	int *results = arena_alloc(&arena, nlines * sizeof(int));
+	size_t *index = arena_alloc(&arena, nlines * sizeof(size_t));
+	if (!content || !ops || !lops || !results || !index) {
+		error("Unable to read batch manifest: %s", manifest);
+		fprintf(stderr, "Unable to read batch manifest: %s\n",
+				manifest);
+		arena_reset(&arena);
 		return -1;
 	}
-	debug("Symlink path to be checked: %s", link);
-	if (io_path_exists(link)) {
-		debug("Symlink already exists, removing and recreating...");
-		remove(link);
-	} else {
-		debug("Sumlink is not present, creating a new one...");
-	}
 
 	/*
 	 * Note:
-	 * sanitize the chosen install location by removing the newline
-	 * character at the end of the string
+	 * Every line of the manifest is a single operation of the form
+	 * "<add|select|remove> <program> <install location>". Empty lines
+	 * and lines starting with '#' are skipped.
 	 */
-	if (locations[choice-1][strlen(locations[choice-1])-1] == '\n')
-		locations[choice-1][strlen(locations[choice-1])-1] = '\0';
-	if (util_symlink(locations[choice-1], link)) {
-		error("Error while creating symlink");
-		fprintf(stderr, "Error while creating symlink\n");
+	size_t nops = 0, lineno = 0;
+	for (char *line = content, *end; line < content + len;
+			line = end + 1) {
+		end = memchr(line, '\n', content + len - line);
+		if (!end)
+			end = content + len;
+		*end = '\0';
+		lineno++;
+		char *start = line + strspn(line, " \t\r");
+		if (*start == '\0' || *start == '#')
+			continue;
+
+		batchop_t *bop = &ops[nops++];
+		bop->lineno = lineno;
+
+		char *saveptr = NULL;
+		bop->op = strtok_r(start, " \t\r", &saveptr);
+		bop->pname = strtok_r(NULL, " \t\r", &saveptr);
+		bop->ilocation = strtok_r(NULL, " \t\r", &saveptr);
+		if (!bop->pname || !bop->ilocation ||
+				strtok_r(NULL, " \t\r", &saveptr) ||
+				strlen(bop->pname) > NAME_MAX ||
+				strchr(bop->pname, '/')) {
+			bop->status = "malformed operation";
+			bop->pname = NULL;
+		}
+	}
+
+	/* hand the well formed operations to the library, which groups them
+	 * by program and applies them in a single transaction */
+	size_t nlops = 0;
+	for (size_t i = 0; i < nops; ++i) {
+		batchop_t *bop = &ops[i];
+		if (!bop->pname)
+			continue;
+		if (strcmp(bop->op, "add") == 0) {
+			lops[nlops].op = LIBXVMAN_ADD;
+		} else if (strcmp(bop->op, "select") == 0) {
+			lops[nlops].op = LIBXVMAN_SELECT;
+		} else if (strcmp(bop->op, "remove") == 0) {
+			lops[nlops].op = LIBXVMAN_REMOVE;
+		} else {
+			bop->status = "unknown operation";
+			continue;
+		}
+		lops[nlops].pname = bop->pname;
+		lops[nlops].ilocation = bop->ilocation;
+		index[nlops++] = i;
+	}
+
+	/* the results are left untouched when nothing could be tried, those
+	 * operations get the error returned */
+	for (size_t i = 0; i < nlops; ++i)
+		results[i] = 1;
+	int applied = libxvman_apply(ctx, lops, nlops, results);
+	for (size_t i = 0; i < nlops; ++i)
+		if (results[i] > 0)
+			results[i] = applied;
+	for (size_t i = 0; i < nlops; ++i)
+		if (results[i])
+			ops[index[i]].status = libxvman_strerror(results[i]);
+
+	/* the programs touched are counted once the operations are sorted by
+	 * program */
+	size_t nprogs = 0;
+	qsort(lops, nlops, sizeof(libxvman_op_t), xvman_batch_cmp);
+	for (size_t i = 0; i < nlops; ++i)
+		if (!i || strcmp(lops[i].pname, lops[i-1].pname))
+			nprogs++;
+
+	/* report the status of every operation in manifest order */
+	size_t nfailed = 0;
+	for (size_t i = 0; i < nops; ++i) {
+		if (ops[i].status)
+			nfailed++;
+		printf("%zu: %s %s %s: %s\n", ops[i].lineno,
+				ops[i].op ? ops[i].op : "",
+				ops[i].pname ? ops[i].pname : "",
+				ops[i].ilocation ? ops[i].ilocation : "",
+				ops[i].status ? ops[i].status : "ok");
+	}
+	printf("Applied %zu of %zu operations across %zu programs\n",
+			nops - nfailed, nops, nprogs);
+	info("Batch applied %zu of %zu operations across %zu programs",
+			nops - nfailed, nops, nprogs);
+
+	arena_reset(&arena);
+	return nfailed ? -1 : 0;
+}
 
-		for (size_t i = 0; i < lc; i++)
-			free(locations[i]);
-		if (locations)
-			free(locations);
+/**
+ * @brief Print a string as a JSON string literal.
+ */
+static void xvman_json_str(FILE *out, const char *s, size_t len)
+{
+	/* copy the runs which need no escaping in one go */
+	fputc('"', out);
+	size_t run = 0;
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = s[i];
+		if (c != '"' && c != '\\' && c >= 0x20)
+			continue;
+		fwrite(s + run, 1, i - run, out);
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else
+			fprintf(out, "\\u%04x", c);
+		run = i + 1;
+	}
+	fwrite(s + run, 1, len - run, out);
+	fputc('"', out);
+}
 
+/**
+ * @brief State of a listing or of a program being shown.
+ */
+typedef struct {
+	FILE *out;			/* output of the listing */
+	bool json;			/* print JSON instead of lines */
+	bool all;			/* show all the install locations */
+	const char *pname;		/* name of the program shown */
+	size_t n;			/* entries printed so far */
+} xvman_listing_t;
+
+static int xvman_list_prog(const char *pname, const libxvman_loc_t *loc,
+		size_t nlocs, void *arg)
+{
+	xvman_listing_t *listing = arg;
+	FILE *out = listing->out;
+	if (!listing->json) {
+		fprintf(out, "%s %.*s\n", pname, (int)loc->len, loc->path);
+		return 0;
+	}
+	fputs(listing->n++ ? ",{\"program\":" : "{\"program\":", out);
+	xvman_json_str(out, pname, strlen(pname));
+	fputs(",\"current\":", out);
+	xvman_json_str(out, loc->path, loc->len);
+	fprintf(out, ",\"locations\":%zu}", nlocs);
+	return 0;
+}
+
+int xvman_list(FILE *out, bool json)
+{
+	trace_span("list");
+
+	if (!out) {
+		error("Output not specified");
+		fprintf(stderr, "Output not specified\n");
 		return -1;
 	}
 
-	for (size_t i = 0; i < lc; i++)
-		free(locations[i]);
-	if (locations)
-		free(locations);
+	xvman_listing_t listing = {out, json, false, NULL, 0};
+	fputs(json ? "[" : "", out);
+	int result = libxvman_list(ctx, xvman_list_prog, &listing);
+	fputs(json ? "]\n" : "", out);
+	if (result)
+		return xvman_fail(result, NULL, NULL);
+	return 0;
+}
+
+static int xvman_show_loc(const libxvman_loc_t *loc, void *arg)
+{
+	xvman_listing_t *listing = arg;
+	FILE *out = listing->out;
+	if (!listing->json) {
+		fprintf(out, "%.*s\n", (int)loc->len, loc->path);
+		return !listing->all;
+	}
+
+	/* the default install location comes first */
+	if (!listing->n++) {
+		fputs("{\"program\":", out);
+		xvman_json_str(out, listing->pname, strlen(listing->pname));
+		fputs(",\"current\":", out);
+		xvman_json_str(out, loc->path, loc->len);
+		if (!listing->all)
+			return 1;
+		fputs(",\"locations\":[", out);
+	}
+	fputs(listing->n > 1 ? ",{\"path\":" : "{\"path\":", out);
+	xvman_json_str(out, loc->path, loc->len);
+	fprintf(out, ",\"added\":%" PRId64 ",\"priority\":%" PRId32 "%s}",
+			loc->added, loc->priority, loc->missing ?
+			",\"missing\":true" : "");
+	return 0;
+}
+
+int xvman_show(const char *pname, bool all, bool json, FILE *out)
+{
+	trace_span("show");
 
+	if (!pname || !out) {
+		error("Program name or output not specified");
+		fprintf(stderr, "Program name or output not specified\n");
+		return -1;
+	}
+
+	xvman_listing_t listing = {out, json, all, pname, 0};
+	int result = libxvman_query(ctx, pname, xvman_show_loc, &listing);
+	if (result)
+		return xvman_fail(result, pname, NULL);
+	if (json)
+		fputs(all ? "]}\n" : "}\n", out);
 	return 0;
 }
+
+/**
+ * @brief Names of the problems found by libxvman_doctor().
+ */
+static const char *xvman_issues[] = {
+	[LIBXVMAN_ISSUE_MISSING] = "missing",
+	[LIBXVMAN_ISSUE_NOLINK] = "nolink",
+	[LIBXVMAN_ISSUE_MISMATCH] = "mismatch",
+	[LIBXVMAN_ISSUE_DANGLING] = "dangling",
+	[LIBXVMAN_ISSUE_STRAY] = "stray"
+};
+
+/**
+ * @brief State of a health check being reported.
+ */
+typedef struct {
+	FILE *out;			/* output of the report */
+	bool json;			/* print JSON instead of lines */
+	size_t n;			/* problems found */
+	size_t nfixed;			/* problems repaired */
+} xvman_doctor_t;
+
+static void xvman_json_opt(FILE *out, const char *s)
+{
+	if (s)
+		xvman_json_str(out, s, strlen(s));
+	else
+		fputs("null", out);
+}
+
+static int xvman_doctor_issue(const libxvman_finding_t *finding, void *arg)
+{
+	xvman_doctor_t *report = arg;
+	FILE *out = report->out;
+	report->nfixed += finding->fixed != 0;
+	if (!report->json) {
+		report->n++;
+		fprintf(out, "%s %s %s%s\n", xvman_issues[finding->issue],
+				finding->pname, finding->path ?
+				finding->path : "-", finding->fixed ?
+				" [fixed]" : "");
+		return 0;
+	}
+
+	fputs(report->n++ ? ",{\"issue\":\"" : "{\"issue\":\"", out);
+	fprintf(out, "%s\",\"program\":", xvman_issues[finding->issue]);
+	xvman_json_str(out, finding->pname, strlen(finding->pname));
+	fputs(",\"path\":", out);
+	xvman_json_opt(out, finding->path);
+	fputs(",\"expected\":", out);
+	xvman_json_opt(out, finding->expected);
+	fprintf(out, ",\"fixed\":%s}", finding->fixed ? "true" : "false");
+	return 0;
+}
+
+int xvman_doctor(bool fix, bool json, FILE *out)
+{
+	trace_span("doctor");
+
+	if (!out) {
+		error("Output not specified");
+		fprintf(stderr, "Output not specified\n");
+		return -1;
+	}
+
+	xvman_doctor_t report = {out, json, 0, 0};
+	fputs(json ? "[" : "", out);
+	int result = libxvman_doctor(ctx, fix ? LIBXVMAN_DOCTOR_FIX : 0,
+			xvman_doctor_issue, &report);
+	fputs(json ? "]\n" : "", out);
+	if (result)
+		return xvman_fail(result, NULL, NULL);
+
+	if (!json)
+		fprintf(out, "%zu problems found, %zu fixed\n", report.n,
+				report.nfixed);
+	info("Doctor found %zu problems, fixed %zu", report.n,
+			report.nfixed);
+	return report.n > report.nfixed ? -1 : 0;
+}
+
+/**
+ * @brief Parse a count of at least min given on the command line, NULL stands
+ * for 0.
+ */
+static int xvman_count(const char *value, const char *what, long min,
+		long *count)
+{
+	char *end = NULL;
+	*count = value ? strtol(value, &end, 10) : 0;
+	if (value && (end == value || *end || *count < min ||
+				*count > UINT32_MAX)) {
+		error("Invalid %s: %s", what, value);
+		fprintf(stderr, "Invalid %s: %s\n", what, value);
+		return -1;
+	}
+	return 0;
+}
+
+static int xvman_prune_loc(const char *pname, const libxvman_loc_t *loc,
+		size_t nlocs, void *arg)
+{
+	xvman_listing_t *listing = arg;
+	FILE *out = listing->out;
+	if (!listing->json) {
+		fprintf(out, "pruned %s %.*s\n", pname, (int)loc->len,
+				loc->path);
+		return 0;
+	}
+	fputs(listing->n++ ? ",{\"program\":" : "{\"program\":", out);
+	xvman_json_str(out, pname, strlen(pname));
+	fputs(",\"path\":", out);
+	xvman_json_str(out, loc->path, loc->len);
+	fprintf(out, ",\"added\":%" PRId64 ",\"left\":%zu}", loc->added,
+			nlocs);
+	return 0;
+}
+
+int xvman_prune(const char *keep, const char *older, bool json, FILE *out)
+{
+	trace_span("prune");
+
+	long nkeep, days;
+	if (!out) {
+		error("Output not specified");
+		fprintf(stderr, "Output not specified\n");
+		return -1;
+	}
+	/* keeping no location would leave nothing to point the symlink at,
+	 * the default location is the least a program keeps */
+	if (xvman_count(keep, "number of locations to keep", 1, &nkeep) ||
+			xvman_count(older, "number of days", 0, &days))
+		return -1;
+
+	libxvman_policy_t policy = {nkeep, days ? time(NULL) - days *
+		24 * 60 * 60 : 0};
+	libxvman_pruned_t pruned;
+	xvman_listing_t listing = {out, json, false, NULL, 0};
+	fputs(json ? "{\"pruned\":[" : "", out);
+	int result = libxvman_prune(ctx, &policy, xvman_prune_loc, &listing,
+			&pruned);
+	if (json)
+		fprintf(out, "],\"programs\":%zu,\"entries\":%zu,"
+				"\"bytes\":%zu}\n", result ? 0 : pruned.programs,
+				result ? 0 : pruned.entries,
+				result ? 0 : pruned.bytes);
+	if (result)
+		return xvman_fail(result, NULL, NULL);
+	if (!json)
+		fprintf(out, "Pruned %zu install locations of %zu programs, "
+				"%zu bytes reclaimed\n", pruned.entries,
+				pruned.programs, pruned.bytes);
+	return 0;
+}
+
+static int xvman_found(const char *pname, const char *path, int status,
+		void *arg)
+{
+	xvman_listing_t *listing = arg;
+	FILE *out = listing->out;
+	const char *what = status == LIBXVMAN_OK ? "added" :
+		status == LIBXVMAN_EEXIST ? "known" : "failed";
+	if (!listing->json) {
+		listing->n++;
+		fprintf(out, "%s %s %s\n", what, pname, path);
+		return 0;
+	}
+	fputs(listing->n++ ? ",{\"program\":" : "{\"program\":", out);
+	xvman_json_str(out, pname, strlen(pname));
+	fputs(",\"path\":", out);
+	xvman_json_str(out, path, strlen(path));
+	fprintf(out, ",\"status\":\"%s\"}", what);
+	return 0;
+}
+
+int xvman_scan(const char *data, bool json, FILE *out)
+{
+	trace_span("scan");
+
+	if (!data || !out) {
+		error("Directory and pattern to be scanned not specified");
+		fprintf(stderr, "Directory and pattern to be scanned not "
+				"provided\n");
+		return -1;
+	}
+
+	/* the directory and the pattern are separated by a space, like the
+	 * program and the install location of an addition */
+	const char *root = "", *pattern = "";
+	int index = 0;
+	for (char *token = strtok((char *)data, " ");
+			token; token = strtok(NULL, " "), index++) {
+		if (index == 0)
+			root = token;
+		else if (index == 1)
+			pattern = token;
+	}
+	debug("Scanning %s for %s", root, pattern);
+
+	xvman_listing_t listing = {out, json, false, NULL, 0};
+	fputs(json ? "[" : "", out);
+	int result = libxvman_discover(ctx, root, pattern, xvman_found,
+			&listing);
+	fputs(json ? "]\n" : "", out);
+	if (result)
+		return xvman_fail(result, NULL, NULL);
+	if (!json)
+		fprintf(out, "Found %zu executables\n", listing.n);
+	return 0;
+}
+
+int xvman_watch_open(int *fd)
+{
+	trace_span("watch.open");
+
+	*fd = -1;
+	const char *conf_fpath = paths_get(PATHS_CONF);
+	FILE *conf = fopen(conf_fpath, "r");
+	stats_count(STATS_OPENS);
+	if (!conf) {
+		debug("No configuration file to read the install roots from");
+		return 0;
+	}
+
+	/* every install root is on a line of its own: watch <root> <pattern> */
+	char line[2 * PATH_MAX + 16];
+	unsigned int lineno = 0;
+	int result = 0;
+	while (!result && fgets(line, sizeof(line), conf)) {
+		lineno++;
+		char *saveptr = NULL;
+		const char *key = strtok_r(line, " \t\r\n", &saveptr);
+		if (!key || key[0] == '#' || strcmp(key, "watch"))
+			continue;
+		const char *root = strtok_r(NULL, " \t\r\n", &saveptr);
+		const char *pattern = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (!root || !pattern) {
+			warning("%s:%u: install root or pattern missing",
+					conf_fpath, lineno);
+			fprintf(stderr, "%s:%u: install root or pattern "
+					"missing\n", conf_fpath, lineno);
+			continue;
+		}
+
+		int err = watch ? LIBXVMAN_OK :
+			libxvman_watch_open(ctx, &watch);
+		if (err) {
+			result = xvman_fail(err, NULL, NULL);
+			break;
+		}
+		/* a root which does not exist yet is left out, the others are
+		 * still watched */
+		err = libxvman_watch_add(watch, root, pattern);
+		if (err) {
+			warning("Unable to watch %s: %s", root,
+					libxvman_strerror(err));
+			fprintf(stderr, "Unable to watch %s: %s\n", root,
+					libxvman_strerror(err));
+		}
+	}
+	fclose(conf);
+
+	if (!result && watch)
+		*fd = libxvman_watch_fd(watch);
+	return result;
+}
+
+static int xvman_changed(const libxvman_op_t *op, int status, void *arg)
+{
+	FILE *out = arg;
+	const char *what = status ? "failed" : op->op == LIBXVMAN_ADD ?
+		"added" : op->op == LIBXVMAN_MISSING ? "missing" : "relinked";
+	fprintf(out, "%s %s %s\n", what, op->pname, op->ilocation);
+	if (status)
+		warning("Watch could not update %s %s: %s", op->pname,
+				op->ilocation, libxvman_strerror(status));
+	return 0;
+}
+
+int xvman_watch_sync(FILE *out)
+{
+	trace_span("watch.sync");
+
+	if (!watch || !out) {
+		error("No install roots are being watched");
+		return -1;
+	}
+	int result = libxvman_watch_process(watch, xvman_changed, out);
+	fflush(out);
+	if (result) {
+		error("Watch update failed: %s", libxvman_strerror(result));
+		return -1;
+	}
+	return 0;
+}
+
+void xvman_watch_close(void)
+{
+	libxvman_watch_close(watch);
+	watch = NULL;
+}
@@ -0,0 +1,677 @@
+/**
+ * @file xvmand.c
+ * @brief Resident switch daemon and the client side of its protocol.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/xvmand.h"
+#include "../inc/xvman.h"
+#include "../inc/log.h"
+#include "../inc/paths.h"
+#include "../inc/trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief Largest number of clients whose requests are received at once.
+ */
+#define XVMAND_CLIENTS 64
+
+/**
+ * @brief Milliseconds a client has to send its request.
+ */
+#define XVMAND_RECV_MS 1000
+
+/**
+ * @brief Milliseconds a reply may wait for a client to read it.
+ */
+#define XVMAND_SEND_MS 100
+
+static volatile sig_atomic_t xvmand_stop;	/* shut down requested */
+
+static void xvmand_on_signal(int sig)
+{
+	(void)sig;
+	xvmand_stop = 1;
+}
+
+/*
+ * Note:
+ * SIGINT and SIGTERM are only let through while waiting for something to do,
+ * so a request or an update of the registry is never cut short and a signal
+ * coming just before the wait is not missed.
+ */
+static void xvmand_signals(sigset_t *waiting)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = xvmand_on_signal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	sigset_t blocked;
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	sigprocmask(SIG_BLOCK, &blocked, waiting);
+	sigdelset(waiting, SIGINT);
+	sigdelset(waiting, SIGTERM);
+}
+
+/**
+ * @brief Bring the registry in step with the install roots watched.
+ */
+static void xvmand_sync(void)
+{
+	xvman_watch_sync(stdout);
+	log_flush();
+	trace_flush();
+}
+
+static int xvmand_addr(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (paths_init(getenv("HOME")) ||
+			paths_len(PATHS_SOCKET) >= sizeof(addr->sun_path))
+		return -1;
+	memcpy(addr->sun_path, paths_get(PATHS_SOCKET),
+			paths_len(PATHS_SOCKET));
+	return 0;
+}
+
+static int xvmand_connect(void)
+{
+	struct sockaddr_un addr;
+	if (xvmand_addr(&addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int xvmand_send(int fd, const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t result = send(fd, buf, len, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += result;
+		len -= result;
+	}
+	return 0;
+}
+
+/*
+ * Note:
+ * Requests are carried out one at a time, which keeps them in the order they
+ * came in just like the registry lock does for separate processes. The
+ * diagnostics a request prints are collected apart from its output, both are
+ * sent back in the reply.
+ */
+static int xvmand_dispatch(char *req, FILE *out, FILE *diag)
+{
+	/* the install location is the rest of the line, it may hold spaces;
+	 * an addition carries its priority in the last field */
+	char *saveptr = NULL;
+	req[strcspn(req, "\r")] = '\0';
+	const char *op = strtok_r(req, " \t", &saveptr);
+	const char *pname = strtok_r(NULL, " \t", &saveptr);
+	char *ilocation = saveptr ? saveptr + strspn(saveptr, " \t") : NULL;
+	const char *priority = NULL;
+	if (ilocation && !*ilocation)
+		ilocation = NULL;
+	if (ilocation && op && strcmp(op, "add") == 0) {
+		char *last = strrchr(ilocation, ' ');
+		if (last) {
+			*last = '\0';
+			priority = last + 1;
+		}
+	}
+	if (!op) {
+		fprintf(diag, "Empty request\n");
+		return -1;
+	}
+	debug("[xvmand] %s %s %s", op, pname ? pname : "",
+			ilocation ? ilocation : "");
+
+	if (strcmp(op, "ping") == 0)
+		return 0;
+	if (!pname || strlen(pname) > NAME_MAX || strchr(pname, '/')) {
+		fprintf(diag, "Invalid program name in request: %s\n",
+				pname ? pname : "");
+		return -1;
+	}
+
+	if (strcmp(op, "query") == 0)
+		return xvman_query(pname, out);
+	if (!ilocation) {
+		fprintf(diag, "Install location missing in request: %s\n",
+				op);
+		return -1;
+	}
+	if (strlen(ilocation) >= PATH_MAX || (priority &&
+				strlen(priority) > XVMAND_PRIO_MAX)) {
+		fprintf(diag, "Field too long in request: %s\n", op);
+		return -1;
+	}
+	if (strcmp(op, "select") == 0)
+		return xvman_select(pname, ilocation);
+	if (strcmp(op, "add") == 0) {
+		char data[XVMAND_REQ_MAX];
+		snprintf(data, sizeof(data), "%s %s %s", pname, ilocation,
+				priority ? priority : "0");
+		return xvman_add(data);
+	}
+
+	fprintf(diag, "Unknown request: %s\n", op);
+	return -1;
+}
+
+/**
+ * @brief Connection of a client whose request is being received.
+ */
+typedef struct {
+	int fd;				/* connection */
+	size_t len;			/* bytes of the request received */
+	struct timespec deadline;	/* time the request has to be in by */
+	char req[XVMAND_REQ_MAX + 1];	/* request received so far */
+} xvmand_client_t;
+
+static void xvmand_reply(xvmand_client_t *client)
+{
+	trace_span("xvmand.handle");
+
+	char *end = memchr(client->req, '\n', client->len);
+	*end = '\0';
+
+	char *obuf = NULL, *dbuf = NULL;
+	size_t olen = 0, dlen = 0;
+	FILE *out = open_memstream(&obuf, &olen);
+	FILE *diag = open_memstream(&dbuf, &dlen);
+	if (!out || !diag) {
+		error("Unable to allocate the output of a request");
+		if (out)
+			fclose(out);
+		if (diag)
+			fclose(diag);
+		free(obuf);
+		free(dbuf);
+		return;
+	}
+
+	xvman_set_diag(diag);
+	int result = xvmand_dispatch(client->req, out, diag);
+	xvman_set_diag(NULL);
+	fclose(out);
+	fclose(diag);
+
+	/* the reply is small enough for the socket buffer, a client which
+	 * stopped reading only gets a short grace period */
+	struct timeval timeout = {.tv_usec = XVMAND_SEND_MS * 1000};
+	setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			sizeof(timeout));
+	fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) & ~O_NONBLOCK);
+	char status[2] = {'\0', result ? '1' : '0'};
+	if (xvmand_send(client->fd, dbuf, dlen) ||
+			xvmand_send(client->fd, status, sizeof(status)) ||
+			xvmand_send(client->fd, obuf, olen))
+		warning("Unable to send the reply of a request");
+	free(obuf);
+	free(dbuf);
+}
+
+/*
+ * Note:
+ * Read what a client sent so far without waiting for more. Returns 1 once the
+ * request line is complete, 0 while it is not and -1 when the client is to be
+ * dropped.
+ */
+static int xvmand_receive(xvmand_client_t *client)
+{
+	while (client->len < XVMAND_REQ_MAX) {
+		ssize_t result = recv(client->fd, client->req + client->len,
+				XVMAND_REQ_MAX - client->len, 0);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (result <= 0)
+			break;
+		if (memchr(client->req + client->len, '\n', result)) {
+			client->len += result;
+			return 1;
+		}
+		client->len += result;
+	}
+	warning("Dropped an incomplete request");
+	return -1;
+}
+
+static int xvmand_accept(int lfd, xvmand_client_t *client)
+{
+	int conn = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (conn < 0)
+		return -1;
+
+	/* only serve the user owning the daemon */
+	struct ucred cred;
+	socklen_t clen = sizeof(cred);
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &clen) ||
+			cred.uid != getuid()) {
+		warning("Rejected a connection of another user");
+		close(conn);
+		return 0;
+	}
+
+	client->fd = conn;
+	client->len = 0;
+	clock_gettime(CLOCK_MONOTONIC, &client->deadline);
+	client->deadline.tv_sec += XVMAND_RECV_MS / 1000;
+	client->deadline.tv_nsec += XVMAND_RECV_MS % 1000 * 1000000L;
+	if (client->deadline.tv_nsec >= 1000000000L) {
+		client->deadline.tv_sec++;
+		client->deadline.tv_nsec -= 1000000000L;
+	}
+	return 1;
+}
+
+/* time left till the earliest deadline of the clients */
+static struct timespec *xvmand_timeout(const xvmand_client_t *clients,
+		size_t nclients, struct timespec *left)
+{
+	if (!nclients)
+		return NULL;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long ms = -1;
+	for (size_t i = 0; i < nclients; ++i) {
+		long long d = (clients[i].deadline.tv_sec - now.tv_sec) * 1000LL
+			+ (clients[i].deadline.tv_nsec - now.tv_nsec) /
+			1000000L;
+		if (ms < 0 || d < ms)
+			ms = d < 0 ? 0 : d;
+	}
+	left->tv_sec = ms / 1000;
+	left->tv_nsec = ms % 1000 * 1000000L;
+	return left;
+}
+
+static bool xvmand_expired(const xvmand_client_t *client,
+		const struct timespec *now)
+{
+	return now->tv_sec > client->deadline.tv_sec ||
+		(now->tv_sec == client->deadline.tv_sec &&
+		 now->tv_nsec >= client->deadline.tv_nsec);
+}
+
+int xvmand_serve(void)
+{
+	struct sockaddr_un addr;
+	if (xvmand_addr(&addr)) {
+		error("Socket path too long");
+		fprintf(stderr, "Socket path too long\n");
+		return -1;
+	}
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+	if (lfd < 0) {
+		error("Unable to create the socket");
+		fprintf(stderr, "Unable to create the socket\n");
+		return -1;
+	}
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr))) {
+		/* replace the socket of a daemon that is gone */
+		int probe = errno == EADDRINUSE ? xvmand_connect() : -1;
+		if (probe >= 0 || errno != ECONNREFUSED ||
+				unlink(addr.sun_path) ||
+				bind(lfd, (struct sockaddr *)&addr,
+					sizeof(addr))) {
+			if (probe >= 0)
+				close(probe);
+			error("Unable to bind %s, is xvmand running already?",
+					addr.sun_path);
+			fprintf(stderr, "Unable to bind %s, is xvmand running "
+					"already?\n", addr.sun_path);
+			close(lfd);
+			return -1;
+		}
+	}
+	if (listen(lfd, 64)) {
+		error("Unable to listen on %s", addr.sun_path);
+		fprintf(stderr, "Unable to listen on %s\n", addr.sun_path);
+		unlink(addr.sun_path);
+		close(lfd);
+		return -1;
+	}
+
+	/* the install roots of the configuration are kept in step meanwhile */
+	int wfd = -1;
+	if (xvman_watch_open(&wfd)) {
+		unlink(addr.sun_path);
+		close(lfd);
+		return -1;
+	}
+	sigset_t waiting;
+	xvmand_signals(&waiting);
+
+	info("xvmand listening on %s", addr.sun_path);
+	printf("xvmand listening on %s\n", addr.sun_path);
+	fflush(stdout);
+	if (wfd >= 0)
+		xvmand_sync();
+
+	/*
+	 * Note:
+	 * Every client has XVMAND_RECV_MS to send its request, the requests
+	 * of the others are received meanwhile so a stalled client holds up
+	 * nobody. Once all the slots are taken new connections wait in the
+	 * backlog of the socket.
+	 */
+	int result = 0;
+	xvmand_client_t *clients = calloc(XVMAND_CLIENTS,
+			sizeof(xvmand_client_t));
+	struct pollfd pfds[XVMAND_CLIENTS + 2];
+	size_t nclients = 0;
+	if (!clients) {
+		error("Unable to allocate the clients");
+		result = -1;
+	}
+	while (clients && !xvmand_stop) {
+		pfds[0] = (struct pollfd){lfd, nclients < XVMAND_CLIENTS ?
+			POLLIN : 0, 0};
+		pfds[1] = (struct pollfd){wfd, POLLIN, 0};
+		for (size_t i = 0; i < nclients; ++i)
+			pfds[i + 2] = (struct pollfd){clients[i].fd, POLLIN, 0};
+
+		struct timespec left;
+		if (ppoll(pfds, nclients + 2, xvmand_timeout(clients,
+						nclients, &left),
+					&waiting) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("Unable to wait for a connection");
+			result = -1;
+			break;
+		}
+		if (pfds[1].revents & POLLIN)
+			xvmand_sync();
+
+		/* serve the complete requests, drop the stalled clients */
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		size_t kept = 0;
+		for (size_t i = 0; i < nclients; ++i) {
+			xvmand_client_t *client = &clients[i];
+			int state = pfds[i + 2].revents ?
+				xvmand_receive(client) : 0;
+			if (!state && xvmand_expired(client, &now)) {
+				warning("Dropped a stalled client");
+				state = -1;
+			}
+			if (state > 0) {
+				xvmand_reply(client);
+				log_flush();
+				trace_flush();
+			}
+			if (state) {
+				close(client->fd);
+				continue;
+			}
+			if (kept != i)
+				memcpy(&clients[kept], client, sizeof(*client));
+			kept++;
+		}
+		nclients = kept;
+
+		while ((pfds[0].revents & POLLIN) &&
+				nclients < XVMAND_CLIENTS) {
+			int accepted = xvmand_accept(lfd, &clients[nclients]);
+			if (accepted < 0) {
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					error("Unable to accept a connection");
+					result = -1;
+					xvmand_stop = 1;
+				}
+				break;
+			}
+			nclients += accepted;
+		}
+	}
+	for (size_t i = 0; i < nclients; ++i)
+		close(clients[i].fd);
+	free(clients);
+
+	info("xvmand shutting down");
+	xvman_watch_close();
+	unlink(addr.sun_path);
+	close(lfd);
+	return result;
+}
+
+int xvmand_watch(void)
+{
+	int wfd = -1;
+	if (xvman_watch_open(&wfd))
+		return -1;
+	if (wfd < 0) {
+		error("No install roots to watch");
+		fprintf(stderr, "No install roots to watch, list them in %s "
+				"as: watch <root> <pattern>\n",
+				paths_get(PATHS_CONF));
+		return -1;
+	}
+	sigset_t waiting;
+	xvmand_signals(&waiting);
+
+	info("Watching the install roots");
+	xvmand_sync();
+
+	/* nothing runs till the install roots change */
+	int result = 0;
+	struct pollfd pfd = {wfd, POLLIN, 0};
+	while (!xvmand_stop) {
+		if (ppoll(&pfd, 1, NULL, &waiting) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("Unable to wait for changes");
+			result = -1;
+			break;
+		}
+		xvmand_sync();
+	}
+
+	info("Stopped watching the install roots");
+	xvman_watch_close();
+	return result;
+}
+
+int xvmand_request(const char *request, FILE *out)
+{
+	trace_span("xvmand.request");
+
+	int fd = xvmand_connect();
+	if (fd < 0)
+		return XVMAND_OFFLINE;
+
+	size_t len = strlen(request);
+	if (len >= XVMAND_REQ_MAX || strchr(request, '\n') ||
+			xvmand_send(fd, request, len) ||
+			xvmand_send(fd, "\n", 1)) {
+		fprintf(stderr, "Unable to send the request to xvmand\n");
+		close(fd);
+		return -1;
+	}
+
+	/* diagnostics up to the NUL byte, then the status and the output */
+	char buf[4096];
+	int status = -1;
+	bool diag = true;
+	ssize_t result;
+	while ((result = recv(fd, buf, sizeof(buf), 0)) != 0) {
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		char *p = buf, *end = buf + result;
+		if (diag) {
+			char *nul = memchr(p, '\0', end - p);
+			fwrite(p, 1, (nul ? nul : end) - p, stderr);
+			if (!nul)
+				continue;
+			diag = false;
+			p = nul + 1;
+		}
+		if (status < 0 && p < end)
+			status = *p++ == '0' ? 0 : 1;
+		if (out)
+			fwrite(p, 1, end - p, out);
+	}
+	close(fd);
+
+	if (status < 0) {
+		fprintf(stderr, "Connection to xvmand lost\n");
+		return -1;
+	}
+	return status ? -1 : 0;
+}
+
+int xvmand_client_add(const char *data)
+{
+	if (!data)
+		return -1;
+
+	/* a field too long is refused rather than cut, the rest would shift
+	 * into the next field otherwise */
+	char fields[XVMAND_REQ_MAX], *saveptr = NULL;
+	if (strlen(data) >= sizeof(fields)) {
+		fprintf(stderr, "Data provided too long\n");
+		return -1;
+	}
+	strcpy(fields, data);
+	const char *pname = strtok_r(fields, " ", &saveptr);
+	const char *ilocation = strtok_r(NULL, " ", &saveptr);
+	const char *priority = strtok_r(NULL, " ", &saveptr);
+	if (!pname || !ilocation) {
+		fprintf(stderr, "Data containing program name and "
+				"install location not provided\n");
+		return -1;
+	}
+	if (strlen(pname) > NAME_MAX) {
+		fprintf(stderr, "Program name too long: %s\n", pname);
+		return -1;
+	}
+	if (priority && strlen(priority) > XVMAND_PRIO_MAX) {
+		fprintf(stderr, "Invalid priority: %s\n", priority);
+		return -1;
+	}
+
+	/* the daemon does not share the working directory of the client */
+	char request[XVMAND_REQ_MAX];
+	char cwd[PATH_MAX] = "";
+	if (ilocation[0] != '/' && !getcwd(cwd, sizeof(cwd))) {
+		fprintf(stderr, "Unable to resolve the install location: %s\n",
+				ilocation);
+		return -1;
+	}
+	if (strlen(cwd) + strlen(ilocation) + 1 >= PATH_MAX ||
+			snprintf(request, sizeof(request), "add %s %s%s%s %s",
+				pname, cwd, cwd[0] ? "/" : "", ilocation,
+				priority ? priority : "0") >=
+			(int)sizeof(request)) {
+		fprintf(stderr, "Install location too long: %s\n", ilocation);
+		return -1;
+	}
+
+	return xvmand_request(request, NULL);
+}
+
+int xvmand_client_config(const char *pname)
+{
+	if (!pname)
+		return -1;
+
+	char request[XVMAND_REQ_MAX];
+	if (snprintf(request, sizeof(request), "query %s", pname) >=
+			(int)sizeof(request)) {
+		fprintf(stderr, "Program name too long: %s\n", pname);
+		return -1;
+	}
+
+	char *obuf = NULL;
+	size_t olen = 0;
+	FILE *out = open_memstream(&obuf, &olen);
+	if (!out)
+		return -1;
+	int result = xvmand_request(request, out);
+	fclose(out);
+	if (result) {
+		free(obuf);
+		return result;
+	}
+
+	/* same dialogue as xvman_config() */
+	size_t nlocs = 0;
+	for (char *line = obuf; line < obuf + olen; ) {
+		/* a reply cut short leaves the last line without its newline */
+		char *end = memchr(line, '\n', obuf + olen - line);
+		if (!end) {
+			fprintf(stderr, "Connection to xvmand lost\n");
+			free(obuf);
+			return -1;
+		}
+		*end = '\0';
+		printf("%zu. %s\n", ++nlocs, line);
+		line = end + 1;
+	}
+
+	int choice = -1;
+	printf("Please enter your choice: ");
+	if (scanf("%d", &choice) != 1 || choice < 1 || choice > (int)nlocs) {
+		fprintf(stderr, "\nInvalid choice provided\n");
+		free(obuf);
+		return -1;
+	}
+
+	const char *chosen = obuf;
+	for (int i = 1; i < choice; ++i)
+		chosen += strlen(chosen) + 1;
+	printf("Install location chosen: %s\n", chosen);
+
+	if (snprintf(request, sizeof(request), "select %s %s", pname,
+				chosen) >= (int)sizeof(request)) {
+		fprintf(stderr, "Install location too long: %s\n", chosen);
+		free(obuf);
+		return -1;
+	}
+	free(obuf);
+	return xvmand_request(request, NULL);
+}
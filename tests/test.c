@@ -0,0 +1,89 @@
+/**
+ * @file test.c
+ * @brief File containing the helpers shared by the checks.
+ */
+
+#define _GNU_SOURCE
+
+#include "test.h"
+#include "../inc/xvman.h"
+
+#include <ftw.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *test_name = "test";
+static size_t nchecks, nfailed;
+
+void test_init(const char *name)
+{
+	test_name = name;
+	nchecks = nfailed = 0;
+}
+
+void test_check(bool ok, const char *check)
+{
+	nchecks++;
+	if (ok)
+		return;
+	fprintf(stderr, "%s: %s\n", test_name, check);
+	nfailed++;
+}
+
+int test_done(void)
+{
+	printf("%s: %zu checks, %zu failed\n", test_name, nchecks, nfailed);
+	return nfailed ? 1 : 0;
+}
+
+static int test_rm(const char *path, const struct stat *sb, int flag,
+		struct FTW *ftw)
+{
+	(void)sb;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+int test_rmtree(const char *path)
+{
+	return nftw(path, test_rm, 16, FTW_DEPTH | FTW_PHYS) ? -1 : 0;
+}
+
+int test_home(char *home, bool stamped)
+{
+	char path[PATH_MAX];
+	if (!mkdtemp(home))
+		return -1;
+	snprintf(path, PATH_MAX, "%s/opt", home);
+	if (mkdir(path, S_IRWXU))
+		return -1;
+	if (!stamped)
+		return 0;
+
+	snprintf(path, PATH_MAX, "%s/.config", home);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/%s", home, CONFDIR);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/%s/%s", home, CONFDIR, SETUP_STAMP);
+	xvmanconf_t config;
+	return symlink(SETUP_VERSION, path) || setenv("HOME", home, 1) ||
+		xvman_setup_prereq(&config) ? -1 : 0;
+}
+
+bool test_points(libxvman_t *ctx, const char *home, const char *pname,
+		const char *expected)
+{
+	char current[PATH_MAX], link[PATH_MAX], target[PATH_MAX];
+	snprintf(link, PATH_MAX, "%s/%s/%s", home, CBIN, pname);
+	ssize_t len = readlink(link, target, PATH_MAX - 1);
+	if (len < 0)
+		return false;
+	target[len] = '\0';
+	return !libxvman_current(ctx, pname, current, PATH_MAX) &&
+		!strcmp(current, expected) && !strcmp(target, expected);
+}
@@ -0,0 +1,80 @@
+/**
+ * @file test.h
+ * @brief Helpers shared by the checks.
+ * @details The count of the checks, the removal of the temporary trees and
+ * the temporary HOME the programs of the checks are installed in.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include "../inc/libxvman.h"
+
+#include <stdbool.h>
+
+/**
+ * @brief Template of the temporary HOME of a check.
+ */
+#define TEST_HOME "/tmp/xvman-test-home.XXXXXX"
+
+/**
+ * @brief Name the checks of a program and reset their count.
+ *
+ * @param name - string prefixing every line printed, kept as it is.
+ */
+void test_init(const char *name);
+
+/**
+ * @brief Count a check, printing it when it failed.
+ *
+ * @param ok - true if the check passed.
+ * @param check - string describing the failure.
+ */
+void test_check(bool ok, const char *check);
+
+/**
+ * @brief Print the count of the checks.
+ *
+ * @return Returns 1 if any check failed, 0 otherwise, the exit status of the
+ * program.
+ */
+int test_done(void);
+
+/**
+ * @brief Remove a directory tree, symlinks not followed.
+ *
+ * @param path - string containing the root of the tree.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int test_rmtree(const char *path);
+
+/**
+ * @brief Create a temporary HOME holding an opt directory.
+ *
+ * Stamped, the setup is marked as done so the shell is left alone, $HOME is
+ * pointed at the directory and the configuration of xvman is set up, which
+ * the commands of the command line need.
+ *
+ * @param home - string initialised with TEST_HOME, filled with the directory.
+ * @param stamped - true to set up the configuration as well.
+ *
+ * @return Returns -1 on failure, 0 on success.
+ */
+int test_home(char *home, bool stamped);
+
+/**
+ * @brief Check that both the symlink of a program and its default install
+ * location are the given path.
+ *
+ * @param ctx - pointer to the context.
+ * @param home - string containing the HOME the context is open on.
+ * @param pname - string containing the name of the program.
+ * @param expected - string containing the install location expected.
+ *
+ * @return Returns true if both of them are.
+ */
+bool test_points(libxvman_t *ctx, const char *home, const char *pname,
+		const char *expected);
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ * @file test_arena.c
+ * @brief Checks of reading files into the arena.
+ *
+ * Regular files of a few sizes around the size of a chunk are read and have
+ * to come back whole and terminated, out of a single allocation of their
+ * size. The same contents read through a pipe have to come back whole too.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/arena.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const size_t test_sizes[] = {
+	1, 4095, 4096, ARENA_CHUNK - 1, ARENA_CHUNK, ARENA_CHUNK + 1, 300000
+};
+
+static bool test_contents(const char *buf, size_t len, const char *data,
+		size_t size)
+{
+	return buf && len == size && !memcmp(buf, data, size) && !buf[len];
+}
+
+static int test_file(const char *data, size_t size)
+{
+	char path[] = "/tmp/xvman-test-arena.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	unlink(path);
+	bool written = write(fd, data, size) == (ssize_t)size &&
+		lseek(fd, 0, SEEK_SET) == 0;
+
+	/* a single allocation of the size of the file and its terminator */
+	arena_t arena = {0};
+	size_t len = 0;
+	char *buf = written ? arena_read(&arena, fd, &len) : NULL;
+	int result = !test_contents(buf, len, data, size) ||
+		arena.nallocs != 1;
+	arena_free(&arena);
+	close(fd);
+	return result;
+}
+
+static int test_pipe(const char *data, size_t size)
+{
+	int fds[2];
+	if (pipe(fds))
+		return 1;
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		_exit(write(fds[1], data, size) != (ssize_t)size);
+	}
+	close(fds[1]);
+
+	arena_t arena = {0};
+	size_t len = 0;
+	char *buf = pid > 0 ? arena_read(&arena, fds[0], &len) : NULL;
+	int result = !test_contents(buf, len, data, size);
+	arena_free(&arena);
+	close(fds[0]);
+	int status = 0;
+	if (pid > 0)
+		waitpid(pid, &status, 0);
+	return result || status;
+}
+
+int main(void)
+{
+	size_t nsizes = sizeof(test_sizes) / sizeof(test_sizes[0]);
+	size_t nfailed = 0;
+	char *data = malloc(test_sizes[nsizes - 1]);
+	if (!data) {
+		fprintf(stderr, "arena: unable to allocate the contents\n");
+		return 1;
+	}
+	for (size_t i = 0; i < test_sizes[nsizes - 1]; ++i)
+		data[i] = 'a' + i % 26;
+
+	for (size_t i = 0; i < nsizes; ++i) {
+		if (test_file(data, test_sizes[i])) {
+			fprintf(stderr, "arena: file of %zu bytes\n",
+					test_sizes[i]);
+			nfailed++;
+		}
+		if (test_pipe(data, test_sizes[i])) {
+			fprintf(stderr, "arena: pipe of %zu bytes\n",
+					test_sizes[i]);
+			nfailed++;
+		}
+	}
+	free(data);
+
+	printf("arena: %zu checks, %zu failed\n", nsizes * 2, nfailed);
+	return nfailed ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file test_doctor.c
+ * @brief Checks of the health check and the repairs of the programs.
+ *
+ * Four programs are broken in a temporary HOME, one for each kind of problem
+ * of a registered program: an install location deleted, a symlink removed,
+ * one pointing at another install location and one pointing at nothing. The
+ * JSON report has to list every problem, with no default location for the
+ * missing one, and the check has to fail. The repairs have to go through,
+ * keeping the missing location flagged rather than removing it, and leave
+ * nothing for a second check to find.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/libxvman.h"
+#include "../inc/xvman.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char home[] = TEST_HOME;
+
+static const char *test_path(char *path, const char *pname, int release)
+{
+	snprintf(path, PATH_MAX, "%s/opt/%s-%d/%s", home, pname, release,
+			pname);
+	return path;
+}
+
+/* install releases 1 and 2 of a program, the second one is the default */
+static int test_install(const char *pname)
+{
+	char path[PATH_MAX], data[2 * PATH_MAX];
+	for (int release = 1; release <= 2; ++release) {
+		snprintf(path, PATH_MAX, "%s/opt/%s-%d", home, pname, release);
+		mkdir(path, S_IRWXU);
+		int fd = open(test_path(path, pname, release),
+				O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+		if (fd < 0)
+			return -1;
+		close(fd);
+		snprintf(data, sizeof(data), "%s %s", pname, path);
+		if (xvman_add(data))
+			return -1;
+	}
+	return 0;
+}
+
+static int test_relink(const char *pname, const char *target)
+{
+	char link[PATH_MAX];
+	snprintf(link, PATH_MAX, "%s/%s/%s", home, CBIN, pname);
+	if (unlink(link))
+		return -1;
+	return target ? symlink(target, link) : 0;
+}
+
+/* run a check, the output is kept for the report */
+static int test_doctor(bool fix, bool json, char *report, size_t size)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&buf, &len);
+	if (!out)
+		return -2;
+	int result = xvman_doctor(fix, json, out);
+	fclose(out);
+	snprintf(report, size, "%s", buf ? buf : "");
+	free(buf);
+	return result;
+}
+
+static bool test_reported(const char *report, const char *issue,
+		const char *pname, const char *path, const char *expected)
+{
+	char finding[4 * PATH_MAX];
+	snprintf(finding, sizeof(finding), "{\"issue\":\"%s\",\"program\":"
+			"\"%s\",\"path\":\"%s\",\"expected\":%s%s%s,"
+			"\"fixed\":false}", issue, pname, path,
+			expected ? "\"" : "", expected ? expected : "null",
+			expected ? "\"" : "");
+	return strstr(report, finding) != NULL;
+}
+
+/* install location looked for by a query */
+typedef struct {
+	const char *path;		/* install location looked for */
+	bool flagged;			/* registered, flagged missing */
+} test_loc_t;
+
+static int test_find(const libxvman_loc_t *loc, void *arg)
+{
+	test_loc_t *want = arg;
+	if (loc->len != strlen(want->path) ||
+			memcmp(loc->path, want->path, loc->len))
+		return 0;
+	want->flagged = loc->missing;
+	return 1;
+}
+
+static bool test_flagged(const char *pname, const char *path)
+{
+	test_loc_t loc = {path, false};
+	libxvman_t *ctx = NULL;
+	if (!libxvman_open(&ctx, home, LIBXVMAN_READONLY))
+		libxvman_query(ctx, pname, test_find, &loc);
+	libxvman_close(ctx);
+	return loc.flagged;
+}
+
+int main(void)
+{
+	char path[PATH_MAX], other[PATH_MAX], report[16 * PATH_MAX];
+	test_init("doctor");
+	if (test_home(home, true)) {
+		fprintf(stderr, "doctor: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	int result = test_install("gone") || test_install("unlinked") ||
+		test_install("moved") || test_install("dangling");
+	test_check(!result && !test_doctor(false, false, report,
+				sizeof(report)), "setting up failed");
+
+	/* one problem of each kind */
+	snprintf(path, PATH_MAX, "%s/opt/gone-1", home);
+	result = result || test_rmtree(path) ||
+		test_relink("unlinked", NULL) ||
+		test_relink("moved", test_path(path, "moved", 1)) ||
+		test_relink("dangling", "/nonexistent/dangling");
+	test_check(!result && test_doctor(false, true, report,
+				sizeof(report)) == -1,
+			"check with problems left succeeded");
+	test_check(test_reported(report, "missing", "gone",
+				test_path(path, "gone", 1), NULL),
+			"missing location not reported without a default");
+	test_check(strstr(report, "\"issue\":\"nolink\",\"program\":"
+				"\"unlinked\",\"path\":null") != NULL,
+			"missing symlink not reported");
+	test_check(test_reported(report, "mismatch", "moved",
+				test_path(path, "moved", 1),
+				test_path(other, "moved", 2)),
+			"symlink to another location not reported");
+	test_check(test_reported(report, "dangling", "dangling",
+				"/nonexistent/dangling",
+				test_path(other, "dangling", 2)),
+			"symlink to nothing not reported");
+
+	/* the repairs leave nothing for a second check */
+	test_check(!result && !test_doctor(true, false, report,
+				sizeof(report)) &&
+			strstr(report, "4 problems found, 4 fixed") != NULL,
+			"repairs failed");
+	test_check(test_flagged("gone", test_path(path, "gone", 1)),
+			"missing location not kept flagged");
+	test_check(!result && !test_doctor(false, false, report,
+				sizeof(report)) &&
+			!strcmp(report, "0 problems found, 0 fixed\n"),
+			"problems left after the repairs");
+
+	test_rmtree(home);
+	return test_done();
+}
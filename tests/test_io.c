@@ -0,0 +1,108 @@
+/**
+ * @file test_io.c
+ * @brief Checks of creating directories.
+ *
+ * Directories are created inside a temporary directory which is the current
+ * one as well as $HOME, through absolute paths, paths relative to '.' and
+ * paths starting with '~', among them a tree a thousand levels deep.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/io.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DEPTH 1000
+
+static bool test_isdir(const char *path)
+{
+	struct stat details;
+	return !stat(path, &details) && S_ISDIR(details.st_mode);
+}
+
+/* create the path, keeping the diagnostics of the failures expected quiet */
+static void test_mkdir(const char *path, bool recursive, bool succeeds,
+		const char *check)
+{
+	int saved = -1, null = succeeds ? -1 : open("/dev/null", O_WRONLY);
+	if (null >= 0) {
+		fflush(stderr);
+		saved = dup(STDERR_FILENO);
+		dup2(null, STDERR_FILENO);
+		close(null);
+	}
+	int result = io_mkdir(path, S_IRWXU, recursive);
+	if (saved >= 0) {
+		fflush(stderr);
+		dup2(saved, STDERR_FILENO);
+		close(saved);
+	}
+
+	char failure[128];
+	snprintf(failure, sizeof(failure), "%s of %.60s%s %s", recursive ?
+			"recursive creation" : "creation", path,
+			strlen(path) > 60 ? "..." : "",
+			succeeds ? "failed" : "succeeded");
+	test_check((result == 0) == succeeds && (!check || test_isdir(check)),
+			failure);
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/xvman-test-io.XXXXXX", path[PATH_MAX];
+	char *deep = malloc(TEST_DEPTH * 2 + 1);
+	test_init("io");
+	if (!deep || !mkdtemp(dir) || chdir(dir)) {
+		fprintf(stderr, "io: unable to set up a directory\n");
+		free(deep);
+		return 1;
+	}
+	setenv("HOME", dir, 1);
+
+	/* a deep tree relative to the current directory, then again */
+	for (int i = 0; i < TEST_DEPTH; ++i)
+		memcpy(deep + i * 2, "d/", 2);
+	deep[TEST_DEPTH * 2 - 1] = '\0';
+	test_mkdir(deep, true, true, deep);
+	test_mkdir(deep, true, true, deep);
+
+	/* the same tree, starting from $HOME and from the root */
+	snprintf(path, PATH_MAX, "~/%s/e", deep);
+	snprintf(path + strlen(path) + 1, PATH_MAX - strlen(path) - 1,
+			"%s/%s/e", dir, deep);
+	test_mkdir(path, true, true, path + strlen(path) + 1);
+	snprintf(path, PATH_MAX, "%s/abs/%s", dir, deep);
+	test_mkdir(path, true, true, path);
+
+	/* '.' components and repeated slashes */
+	test_mkdir("./dot/./a//b/", true, true, "dot/a/b");
+	test_mkdir(".", true, true, ".");
+	test_mkdir("./single", false, true, "single");
+	test_mkdir("./missing/child", false, false, NULL);
+
+	/* '~' alone and followed by a path */
+	test_mkdir("~", true, true, dir);
+	test_mkdir("~/home/a/b", true, true, "home/a/b");
+	test_mkdir("~/home/c", false, true, "home/c");
+	test_mkdir("~home/x", true, true, "~home/x");
+
+	/* a file in the way of the path */
+	int fd = open("file", O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+	if (fd >= 0)
+		close(fd);
+	test_mkdir("file/x/y", true, false, NULL);
+	test_mkdir("~/file/x", true, false, NULL);
+
+	if (chdir("/") == 0)
+		test_rmtree(dir);
+	free(deep);
+	return test_done();
+}
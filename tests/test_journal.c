@@ -0,0 +1,196 @@
+/**
+ * @file test_journal.c
+ * @brief Checks of the recovery of interrupted updates from the journal.
+ *
+ * An update is killed with XVMAN_FAULT at every step it goes through, once for
+ * an addition and once for a transaction of libxvman_apply() spanning two
+ * programs. Opening the registry afterwards has to replay the journal: the
+ * default install locations and the symlinks are the ones of the update and
+ * the health check finds nothing wrong.
+ *
+ * A power failure is played by putting back the registry and the symlink as
+ * they were before a completed update, with the journal written during
+ * another boot. The update has to be replayed all the same.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/libxvman.h"
+#include "../inc/xvman.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *const test_steps[] = {"journal", "registry", "link"};
+
+static int test_install(const char *home, const char *name, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/opt/%s", home, name);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/opt/%s/tool", home, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int test_count(const libxvman_finding_t *finding, void *arg)
+{
+	(void)finding;
+	(*(int *)arg)++;
+	return 0;
+}
+
+/* read a whole file into a buffer of the given size */
+static ssize_t test_read(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ssize_t len = read(fd, buf, size);
+	close(fd);
+	return len < (ssize_t)size ? len : -1;
+}
+
+static int test_write(const char *path, const char *buf, size_t len)
+{
+	int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ssize_t result = write(fd, buf, len);
+	close(fd);
+	return result == (ssize_t)len ? 0 : -1;
+}
+
+/* lose the pages of the second update and move the journal to another boot */
+static int test_power(const char *home, const char *regpath, const char *reg,
+		size_t reglen, const char *old)
+{
+	char boot[64], path[PATH_MAX], link[PATH_MAX];
+	static char jnl[1 << 16];
+	ssize_t bootlen = test_read("/proc/sys/kernel/random/boot_id", boot,
+			sizeof(boot));
+	snprintf(path, PATH_MAX, "%s/%s", home, CONF_JOURNALPATH);
+	ssize_t len = test_read(path, jnl, sizeof(jnl));
+	if (bootlen < 2 || len < 0 || test_write(regpath, reg, reglen))
+		return -1;
+
+	size_t found = 0;
+	for (char *at = jnl; (at = memmem(at, jnl + len - at, boot,
+					bootlen - 1)); at += bootlen - 1) {
+		memset(at, '0', bootlen - 1);
+		found++;
+	}
+	snprintf(link, PATH_MAX, "%s/%s/tool", home, CBIN);
+	return !found || unlink(link) || symlink(old, link) ||
+		test_write(path, jnl, len) ? -1 : 0;
+}
+
+/* complete an update the registry and the link of which never hit the disk */
+static int test_reboot(void)
+{
+	char home[] = TEST_HOME, old[PATH_MAX], new[PATH_MAX];
+	char regpath[PATH_MAX];
+	static char reg[1 << 20];
+	if (test_home(home, false))
+		return 1;
+	snprintf(regpath, PATH_MAX, "%s/%s", home, CONF_REGPATH);
+
+	libxvman_t *ctx = NULL;
+	int result = test_install(home, "tool-1.0", old) ||
+		test_install(home, "tool-2.0", new) ||
+		libxvman_open(&ctx, home, 0) ||
+		libxvman_add(ctx, "tool", old);
+	libxvman_close(ctx);
+	ctx = NULL;
+	ssize_t reglen = result ? -1 : test_read(regpath, reg, sizeof(reg));
+
+	int issues = 0;
+	result = reglen < 0 || libxvman_open(&ctx, home, 0) ||
+		libxvman_add(ctx, "tool", new);
+	libxvman_close(ctx);
+	ctx = NULL;
+	if (!result)
+		result = test_power(home, regpath, reg, reglen, old) ||
+			libxvman_open(&ctx, home, 0) ||
+			libxvman_doctor(ctx, 0, test_count, &issues) ||
+			issues || !test_points(ctx, home, "tool", new);
+	libxvman_close(ctx);
+	test_rmtree(home);
+	return result;
+}
+
+/* run the update in a child killed at the step, then recover */
+static int test_fault(const char *step, bool batch)
+{
+	char home[] = TEST_HOME, old[PATH_MAX], new[PATH_MAX];
+	char other[PATH_MAX];
+	if (test_home(home, false))
+		return 1;
+
+	libxvman_t *ctx = NULL;
+	int result = test_install(home, "tool-1.0", old) ||
+		test_install(home, "tool-2.0", new) ||
+		test_install(home, "other-1.0", other) ||
+		libxvman_open(&ctx, home, 0) ||
+		libxvman_add(ctx, "tool", old);
+	libxvman_close(ctx);
+	ctx = NULL;
+
+	pid_t pid = result ? -1 : fork();
+	if (pid == 0) {
+		setenv("XVMAN_FAULT", step, 1);
+		libxvman_op_t ops[] = {
+			{LIBXVMAN_ADD, "tool", new, 0},
+			{LIBXVMAN_ADD, "other", other, 0}
+		};
+		if (libxvman_open(&ctx, home, 0))
+			_exit(1);
+		if (batch)
+			libxvman_apply(ctx, ops, 2, NULL);
+		else
+			libxvman_add(ctx, "tool", new);
+		_exit(2);
+	}
+	int status = 0;
+	if (pid > 0)
+		waitpid(pid, &status, 0);
+	if (pid < 0 || !WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL)
+		result = 1;
+
+	int issues = 0;
+	if (!result)
+		result = libxvman_open(&ctx, home, 0) ||
+			libxvman_doctor(ctx, 0, test_count, &issues) ||
+			issues || !test_points(ctx, home, "tool", new) ||
+			(batch && !test_points(ctx, home, "other", other));
+	libxvman_close(ctx);
+	test_rmtree(home);
+	return result;
+}
+
+int main(void)
+{
+	size_t nsteps = sizeof(test_steps) / sizeof(test_steps[0]);
+	char check[64];
+	test_init("journal");
+	for (size_t i = 0; i < nsteps * 2; ++i) {
+		bool batch = i >= nsteps;
+		snprintf(check, sizeof(check), "%s killed at the %s step",
+				batch ? "transaction" : "addition",
+				test_steps[i % nsteps]);
+		test_check(!test_fault(test_steps[i % nsteps], batch), check);
+	}
+
+	test_check(!test_reboot(), "update lost by a power failure");
+	return test_done();
+}
@@ -0,0 +1,193 @@
+/**
+ * @file test_prune.c
+ * @brief Checks of the removal of the install locations no longer needed.
+ *
+ * A program gets three releases, the latest one its default. The release
+ * deleted from the disk has to be pruned while the others stay, and the
+ * symlink has to follow the next release when the default one goes. A policy
+ * has to keep the given number of locations, the default one first, and only
+ * prune the locations added before its time. The command line has to reject
+ * keeping no location at all and counts which are not numbers.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/libxvman.h"
+#include "../inc/xvman.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_RELEASES 3
+
+static int test_install(const char *home, int release, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/opt/tool-%d", home, release);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/opt/tool-%d/tool", home, release);
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int test_uninstall(const char *home, int release)
+{
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/opt/tool-%d", home, release);
+	return test_rmtree(path);
+}
+
+/* register the releases in order, the last one added is the default */
+static int test_register(libxvman_t *ctx, char paths[][PATH_MAX])
+{
+	for (int i = 0; i < TEST_RELEASES; ++i)
+		if (libxvman_add(ctx, "tool", paths[i]))
+			return -1;
+	return 0;
+}
+
+static int test_count(const libxvman_loc_t *loc, void *arg)
+{
+	(void)loc;
+	(*(size_t *)arg)++;
+	return 0;
+}
+
+static size_t test_nlocs(libxvman_t *ctx)
+{
+	size_t n = 0;
+	libxvman_query(ctx, "tool", test_count, &n);
+	return n;
+}
+
+/* install location looked for by a query */
+typedef struct {
+	const char *path;		/* install location looked for */
+	bool found;			/* registered */
+} test_loc_t;
+
+static int test_find(const libxvman_loc_t *loc, void *arg)
+{
+	test_loc_t *want = arg;
+	if (loc->len != strlen(want->path) ||
+			memcmp(loc->path, want->path, loc->len))
+		return 0;
+	want->found = true;
+	return 1;
+}
+
+static bool test_registered(libxvman_t *ctx, const char *path)
+{
+	test_loc_t loc = {path, false};
+	libxvman_query(ctx, "tool", test_find, &loc);
+	return loc.found;
+}
+
+/* the command line rejects the count before it touches the registry */
+static bool test_rejected(const char *keep, const char *older)
+{
+	char msg[128] = "";
+	FILE *diag = tmpfile();
+	int fd = dup(STDERR_FILENO);
+	if (!diag || fd < 0)
+		return false;
+	fflush(stderr);
+	dup2(fileno(diag), STDERR_FILENO);
+	int result = xvman_prune(keep, older, false, diag);
+	fflush(stderr);
+	dup2(fd, STDERR_FILENO);
+	close(fd);
+	rewind(diag);
+	bool read = fgets(msg, sizeof(msg), diag) != NULL;
+	fclose(diag);
+	return result == -1 && read && !strncmp(msg, "Invalid number", 14);
+}
+
+int main(void)
+{
+	char home[] = TEST_HOME, paths[TEST_RELEASES][PATH_MAX];
+	test_init("prune");
+	if (test_home(home, false)) {
+		fprintf(stderr, "prune: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	libxvman_t *ctx = NULL;
+	int result = libxvman_open(&ctx, home, 0);
+	for (int i = 0; i < TEST_RELEASES; ++i)
+		result = result || test_install(home, i, paths[i]);
+	result = result || test_register(ctx, paths);
+	test_check(!result && test_nlocs(ctx) == TEST_RELEASES &&
+			test_points(ctx, home, "tool", paths[2]),
+			"setting up failed");
+
+	/* nothing is pruned while every release exists */
+	libxvman_pruned_t pruned = {1, 1, 1};
+	result = result || libxvman_prune(ctx, NULL, NULL, NULL, &pruned);
+	test_check(!result && !pruned.entries && !pruned.programs &&
+			test_nlocs(ctx) == TEST_RELEASES,
+			"existing locations pruned without a policy");
+
+	/* the release deleted goes, the others stay */
+	result = result || test_uninstall(home, 1) ||
+		libxvman_prune(ctx, NULL, NULL, NULL, &pruned);
+	test_check(!result && pruned.entries == 1 && pruned.programs == 1 &&
+			!test_registered(ctx, paths[1]) &&
+			test_registered(ctx, paths[0]) &&
+			test_registered(ctx, paths[2]),
+			"dead location not pruned or live one pruned");
+	test_check(!result && test_points(ctx, home, "tool", paths[2]),
+			"symlink moved by a prune keeping the default");
+
+	/* the default release deleted, the symlink follows the next one */
+	result = result || test_uninstall(home, 2) ||
+		libxvman_prune(ctx, NULL, NULL, NULL, &pruned);
+	test_check(!result && pruned.entries == 1 && test_nlocs(ctx) == 1 &&
+			test_points(ctx, home, "tool", paths[0]),
+			"symlink does not follow the location kept");
+
+	/* keeping two, the default one and the latest added before it */
+	result = result || test_install(home, 1, paths[1]) ||
+		test_install(home, 2, paths[2]) ||
+		libxvman_add(ctx, "tool", paths[1]) ||
+		libxvman_add(ctx, "tool", paths[2]);
+	libxvman_policy_t policy = {2, 0};
+	result = result || libxvman_prune(ctx, &policy, NULL, NULL, &pruned);
+	test_check(!result && pruned.entries == 1 && test_nlocs(ctx) == 2 &&
+			!test_registered(ctx, paths[0]) &&
+			test_points(ctx, home, "tool", paths[2]),
+			"keeping two does not keep the two latest");
+
+	/* an age cutoff in the past keeps the locations added since */
+	result = result || libxvman_add(ctx, "tool", paths[0]);
+	policy = (libxvman_policy_t){0, time(NULL) - 24 * 60 * 60};
+	result = result || libxvman_prune(ctx, &policy, NULL, NULL, &pruned);
+	test_check(!result && !pruned.entries &&
+			test_nlocs(ctx) == TEST_RELEASES,
+			"locations added after the cutoff pruned");
+
+	/* a cutoff past all of them leaves the default one only */
+	policy = (libxvman_policy_t){0, time(NULL) + 60};
+	result = result || libxvman_prune(ctx, &policy, NULL, NULL, &pruned);
+	test_check(!result && pruned.entries == 2 && test_nlocs(ctx) == 1 &&
+			test_points(ctx, home, "tool", paths[0]),
+			"locations added before the cutoff not pruned");
+
+	test_check(test_rejected("0", NULL), "keeping no location accepted");
+	test_check(test_rejected("-1", NULL), "negative count accepted");
+	test_check(test_rejected("two", NULL), "count not a number accepted");
+	test_check(test_rejected(NULL, "1d"), "age not a number accepted");
+
+	libxvman_close(ctx);
+	test_rmtree(home);
+	return test_done();
+}
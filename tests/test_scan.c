@@ -0,0 +1,126 @@
+/**
+ * @file test_scan.c
+ * @brief Checks of the discovery of the installed versions of the programs.
+ *
+ * Three releases of a registered program are unpacked in a temporary HOME,
+ * the oldest one registered already, next to an executable of a program
+ * which is not registered. A pattern has to be matched a level at a time, so
+ * one stopping at the directory finds nothing. A pattern reaching the
+ * executables has to add the releases not registered yet, report the one
+ * registered as known and leave the other program alone. The latest release
+ * in the order of the versions, not of the names, has to become the default.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/xvman.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char home[] = TEST_HOME;
+
+static const char *test_path(char *path, const char *release,
+		const char *pname)
+{
+	snprintf(path, PATH_MAX, "%s/opt/%s/bin/%s", home, release, pname);
+	return path;
+}
+
+static int test_install(const char *release, const char *pname)
+{
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/opt/%s", home, release);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/opt/%s/bin", home, release);
+	mkdir(path, S_IRWXU);
+	int fd = open(test_path(path, release, pname),
+			O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+/* run a scan of the releases, the output is kept for the report */
+static int test_scan(const char *pattern, char *report, size_t size)
+{
+	char data[2 * PATH_MAX], *buf = NULL;
+	size_t len = 0;
+	snprintf(data, sizeof(data), "%s/opt %s", home, pattern);
+	FILE *out = open_memstream(&buf, &len);
+	if (!out)
+		return -1;
+	int result = xvman_scan(data, false, out);
+	fclose(out);
+	snprintf(report, size, "%s", buf ? buf : "");
+	free(buf);
+	return result;
+}
+
+static bool test_reported(const char *report, const char *what,
+		const char *release, const char *pname)
+{
+	char path[PATH_MAX], line[2 * PATH_MAX];
+	snprintf(line, sizeof(line), "%s %s %s\n", what, pname,
+			test_path(path, release, pname));
+	return strstr(report, line) != NULL;
+}
+
+int main(void)
+{
+	char path[PATH_MAX], data[2 * PATH_MAX], report[16 * PATH_MAX];
+	test_init("scan");
+	if (test_home(home, true)) {
+		fprintf(stderr, "scan: unable to set up a temporary HOME\n");
+		return 1;
+	}
+
+	int result = test_install("tool-1.2", "tool") ||
+		test_install("tool-1.9", "tool") ||
+		test_install("tool-1.10", "tool") ||
+		test_install("tool-1.9", "other");
+	snprintf(data, sizeof(data), "tool %s",
+			test_path(path, "tool-1.2", "tool"));
+	result = result || xvman_add(data);
+	test_check(!result, "setting up failed");
+
+	/* the pattern stops at the directories */
+	test_check(!result && !test_scan("*/bin", report, sizeof(report)) &&
+			!strcmp(report, "Found 0 executables\n"),
+			"pattern of the directories found executables");
+
+	/* the pattern reaches the executables */
+	test_check(!result && !test_scan("*/bin/*", report, sizeof(report)) &&
+			strstr(report, "Found 3 executables\n") != NULL,
+			"pattern of the executables did not find three");
+	test_check(test_reported(report, "added", "tool-1.9", "tool") &&
+			test_reported(report, "added", "tool-1.10", "tool"),
+			"releases not registered were not added");
+	test_check(test_reported(report, "known", "tool-1.2", "tool"),
+			"release registered already not reported as known");
+	test_check(!strstr(report, " other "),
+			"program not registered picked up");
+
+	/* 1.10 follows 1.9 in the order of the versions */
+	char target[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/%s/tool", home, CBIN);
+	ssize_t len = readlink(path, target, PATH_MAX - 1);
+	target[len < 0 ? 0 : len] = '\0';
+	test_check(!strcmp(target, test_path(path, "tool-1.10", "tool")),
+			"latest version is not the default");
+
+	/* a second scan finds every release registered */
+	test_check(!result && !test_scan("*/bin/*", report, sizeof(report)) &&
+			!strstr(report, "added "),
+			"releases added twice");
+
+	test_rmtree(home);
+	return test_done();
+}
@@ -0,0 +1,86 @@
+/**
+ * @file test_switch.c
+ * @brief Stress check of executing a program while its symlink is switched.
+ *
+ * One process keeps switching a symlink between two executables while
+ * another keeps executing the symlink. Every exec has to find one of the two,
+ * an exec failing with ENOENT means the link was missing for a moment.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TEST_EXECS 2000
+
+static const char *const test_targets[] = {"/bin/true", "/bin/false"};
+
+/* exit status of an exec which did not find the program */
+#define TEST_MISSING 127
+
+int main(int argc, char *argv[])
+{
+	long nexecs = argc > 1 ? atol(argv[1]) : TEST_EXECS;
+	char dir[] = "/tmp/xvman-test-switch.XXXXXX", link[PATH_MAX];
+	if (!mkdtemp(dir)) {
+		fprintf(stderr, "switch: unable to set up a directory\n");
+		return 1;
+	}
+	snprintf(link, PATH_MAX, "%s/prog", dir);
+	int dirfd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0 || util_symlink_switch(test_targets[0], dirfd, "prog")) {
+		fprintf(stderr, "switch: unable to create the symlink\n");
+		rmdir(dir);
+		return 1;
+	}
+
+	pid_t switcher = fork();
+	if (switcher == 0) {
+		for (long i = 1; ; ++i)
+			if (util_symlink_switch(test_targets[i % 2], dirfd,
+						"prog"))
+				_exit(1);
+	}
+
+	long nmissing = 0, nfailed = 0;
+	for (long i = 0; switcher > 0 && i < nexecs; ++i) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			char *args[] = {link, NULL};
+			execv(link, args);
+			_exit(errno == ENOENT ? TEST_MISSING : TEST_MISSING + 1);
+		}
+		int status = 0;
+		if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+				!WIFEXITED(status) ||
+				WEXITSTATUS(status) > TEST_MISSING) {
+			nfailed++;
+			continue;
+		}
+		nmissing += WEXITSTATUS(status) == TEST_MISSING;
+	}
+
+	/* the switcher only stops when killed, anything else is a failure */
+	int status = 0;
+	if (switcher > 0) {
+		kill(switcher, SIGKILL);
+		waitpid(switcher, &status, 0);
+	}
+	if (switcher <= 0 || !WIFSIGNALED(status))
+		nfailed++;
+	unlinkat(dirfd, "prog", 0);
+	close(dirfd);
+	rmdir(dir);
+
+	printf("switch: %ld execs, %ld missing, %ld failed\n", nexecs,
+			nmissing, nfailed);
+	return nmissing || nfailed ? 1 : 0;
+}
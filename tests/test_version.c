@@ -0,0 +1,94 @@
+/**
+ * @file test_version.c
+ * @brief Checks of the versions picked out of install locations.
+ *
+ * Every path is parsed and its version compared with the expected one, then
+ * pairs of paths are checked to rank in the expected order by their keys.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/version.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+	const char *path;		/* install location */
+	int nparts;			/* expected components, -1 for none */
+	uint32_t parts[VERSION_PARTS];	/* expected components */
+	version_stage_t stage;		/* expected pre-release stage */
+	uint32_t pre;			/* expected pre-release number */
+} test_case_t;
+
+static const test_case_t test_cases[] = {
+	{"/opt/goneovim-v0.6.11/goneovim", 3, {0, 6, 11}, VERSION_RELEASE, 0},
+	{"/usr/bin/python3.11", 2, {3, 11}, VERSION_RELEASE, 0},
+	{"/opt/tool-2.0-rc1/tool", 1, {2}, VERSION_RC, 1},
+	{"/opt/tool-1.2.0/tool", 2, {1, 2}, VERSION_RELEASE, 0},
+	{"/opt/python-3.12.0a1/bin/python", 2, {3, 12}, VERSION_ALPHA, 1},
+	{"/opt/node-v18.12.1-linux-x64/bin/node", 3, {18, 12, 1},
+		VERSION_RELEASE, 0},
+	{"/opt/tool-1.2-linux/tool", 2, {1, 2}, VERSION_RELEASE, 0},
+	{"/opt/prog2/bin/prog2", -1, {0}, VERSION_RELEASE, 0},
+	{"/opt/tool-linux-x86_64/bin/tool", -1, {0}, VERSION_RELEASE, 0},
+	{"/opt/tool-linux-x86-64/bin/tool", -1, {0}, VERSION_RELEASE, 0},
+	{"/opt/tool-linux-aarch64/bin/tool", -1, {0}, VERSION_RELEASE, 0},
+	{"/opt/tool-linux-arm_64/bin/tool", -1, {0}, VERSION_RELEASE, 0},
+	{"/opt/tool-2.0-linux-x86_64/bin/tool", 1, {2}, VERSION_RELEASE, 0},
+	{"/opt/tool-x86_64-1.3/bin/tool", 2, {1, 3}, VERSION_RELEASE, 0},
+	{"/opt/tool/2.0/tool-linux-x86_64/bin/tool", 1, {2},
+		VERSION_RELEASE, 0},
+	{"/opt/tool-i686/bin/tool", -1, {0}, VERSION_RELEASE, 0}
+};
+
+/* the first path of every pair ranks below the second one */
+static const char *const test_order[][2] = {
+	{"/opt/tool/1.0/tool-linux-x86_64/bin/tool",
+		"/opt/tool/2.0/tool-linux-x86_64/bin/tool"},
+	{"/opt/tool-1.9/tool", "/opt/tool-1.10/tool"},
+	{"/opt/tool-2.0-rc1/tool", "/opt/tool-2.0/tool"},
+	{"/opt/tool-2.0-beta2/tool", "/opt/tool-2.0-rc1/tool"},
+	{"/opt/tool-linux-x86_64/bin/tool", "/opt/tool-0.1/tool"}
+};
+
+static int test_parse(const test_case_t *test)
+{
+	version_t version;
+	int result = version_parse(test->path, strlen(test->path), &version);
+	if (test->nparts < 0)
+		return result == 0;
+	if (result || version.nparts != (uint32_t)test->nparts ||
+			version.stage != test->stage ||
+			version.pre != test->pre)
+		return 1;
+	for (int i = 0; i < test->nparts; ++i)
+		if (version.parts[i] != test->parts[i])
+			return 1;
+	return 0;
+}
+
+int main(void)
+{
+	size_t ncases = sizeof(test_cases) / sizeof(test_cases[0]);
+	size_t norder = sizeof(test_order) / sizeof(test_order[0]);
+	size_t nfailed = 0;
+	for (size_t i = 0; i < ncases; ++i) {
+		if (!test_parse(&test_cases[i]))
+			continue;
+		fprintf(stderr, "version: wrong version of %s\n",
+				test_cases[i].path);
+		nfailed++;
+	}
+	for (size_t i = 0; i < norder; ++i) {
+		const char *older = test_order[i][0], *newer = test_order[i][1];
+		if (version_key(older, strlen(older)) <
+				version_key(newer, strlen(newer)))
+			continue;
+		fprintf(stderr, "version: %s does not rank below %s\n", older,
+				newer);
+		nfailed++;
+	}
+
+	printf("version: %zu checks, %zu failed\n", ncases + norder, nfailed);
+	return nfailed ? 1 : 0;
+}
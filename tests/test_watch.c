@@ -0,0 +1,159 @@
+/**
+ * @file test_watch.c
+ * @brief Checks of the install locations gone and back again under a watch.
+ *
+ * A program ranking its locations automatically has the latest of two
+ * releases removed while a watch runs. The location has to stay registered,
+ * flagged missing with the time it was added, and the symlink has to move to
+ * the older release. Once the release is unpacked again the flag has to go
+ * and the symlink has to come back, the time of addition unchanged. A choice
+ * made in the manual selection mode has to come back the same way, and only
+ * a prune may remove a location flagged missing.
+ */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../inc/libxvman.h"
+#include "../inc/xvman.h"
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* install location as seen by a query */
+typedef struct {
+	const char *path;		/* install location looked for */
+	bool found;			/* registered */
+	int missing;			/* flagged missing */
+	int64_t added;			/* time it was added */
+} test_loc_t;
+
+static int test_install(const char *home, const char *release, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/opt/%s", home, release);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/opt/%s/bin", home, release);
+	mkdir(path, S_IRWXU);
+	snprintf(path, PATH_MAX, "%s/opt/%s/bin/tool", home, release);
+	int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, S_IRWXU);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+}
+
+static int test_uninstall(const char *home, const char *release)
+{
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/opt/%s", home, release);
+	return test_rmtree(path);
+}
+
+/* wait for the events of a change and update the registry */
+static int test_sync(libxvman_watch_t *watch)
+{
+	struct pollfd pfd = {libxvman_watch_fd(watch), POLLIN, 0};
+	if (poll(&pfd, 1, 1000) <= 0)
+		return -1;
+	return libxvman_watch_process(watch, NULL, NULL);
+}
+
+static int test_find(const libxvman_loc_t *loc, void *arg)
+{
+	test_loc_t *want = arg;
+	if (loc->len != strlen(want->path) ||
+			memcmp(loc->path, want->path, loc->len))
+		return 0;
+	want->found = true;
+	want->missing = loc->missing;
+	want->added = loc->added;
+	return 1;
+}
+
+static test_loc_t test_query(libxvman_t *ctx, const char *path)
+{
+	test_loc_t loc = {path, false, 0, 0};
+	libxvman_query(ctx, "tool", test_find, &loc);
+	return loc;
+}
+
+int main(void)
+{
+	char home[] = TEST_HOME, path[PATH_MAX];
+	char old[PATH_MAX], new[PATH_MAX];
+	test_init("watch");
+	if (test_home(home, false)) {
+		fprintf(stderr, "watch: unable to set up a temporary HOME\n");
+		return 1;
+	}
+	snprintf(path, PATH_MAX, "%s/opt", home);
+
+	libxvman_t *ctx = NULL;
+	libxvman_watch_t *watch = NULL;
+	int result = test_install(home, "tool-1.0", old) ||
+		test_install(home, "tool-2.0", new) ||
+		libxvman_open(&ctx, home, 0) ||
+		libxvman_add(ctx, "tool", old) ||
+		libxvman_add(ctx, "tool", new) ||
+		libxvman_auto(ctx, "tool") ||
+		libxvman_watch_open(ctx, &watch) ||
+		libxvman_watch_add(watch, path, "*/bin/*") ||
+		libxvman_watch_process(watch, NULL, NULL);
+	test_loc_t before = test_query(ctx, new);
+	test_check(!result && before.found && !before.missing &&
+			test_points(ctx, home, "tool", new),
+			"setting up failed");
+
+	/* the latest release goes, the older one takes over */
+	result = result || test_uninstall(home, "tool-2.0") ||
+		test_sync(watch);
+	test_loc_t gone = test_query(ctx, new);
+	test_check(!result && gone.found && gone.missing &&
+			gone.added == before.added,
+			"location gone is not flagged missing");
+	test_check(!result && test_points(ctx, home, "tool", old),
+			"symlink does not follow the older release");
+	test_check(libxvman_select(ctx, "tool", new) == LIBXVMAN_EMISSING,
+			"location flagged missing selected");
+
+	/* the release comes back along with its history */
+	result = result || test_install(home, "tool-2.0", new) ||
+		test_sync(watch);
+	test_loc_t back = test_query(ctx, new);
+	test_check(!result && back.found && !back.missing &&
+			back.added == before.added,
+			"location back is still flagged missing");
+	test_check(!result && test_points(ctx, home, "tool", new),
+			"symlink does not come back to the latest release");
+
+	/* a choice made by hand comes back too */
+	result = result || libxvman_select(ctx, "tool", old) ||
+		test_uninstall(home, "tool-1.0") || test_sync(watch);
+	test_check(!result && test_query(ctx, old).missing &&
+			test_points(ctx, home, "tool", new),
+			"symlink does not leave the release chosen and gone");
+	result = result || test_install(home, "tool-1.0", old) ||
+		test_sync(watch);
+	test_check(!result && !test_query(ctx, old).missing &&
+			test_points(ctx, home, "tool", old),
+			"release chosen and back is not the default");
+
+	/* only a prune removes a location flagged missing */
+	result = result || test_uninstall(home, "tool-2.0") ||
+		test_sync(watch) || libxvman_prune(ctx, NULL, NULL, NULL,
+				NULL);
+	test_check(!result && !test_query(ctx, new).found &&
+			test_query(ctx, old).found,
+			"prune leaves the location flagged missing");
+
+	libxvman_watch_close(watch);
+	libxvman_close(ctx);
+	test_rmtree(home);
+	return test_done();
+}
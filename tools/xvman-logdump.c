@@ -0,0 +1,366 @@
+/**
+ * @file xvman-logdump.c
+ * @brief Decoder of the binary log format.
+ *
+ * Reads a log file written with LOG_FORMAT_BINARY and prints every record in
+ * the text layout of the logging module, i.e. LOG_STRF followed by the
+ * message.
+ *
+ * Usage: xvman-logdump [file], the standard input is read if no file is
+ * given.
+ */
+
+#define _GNU_SOURCE
+#include "../inc/log.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_BIN_NULL 0xffff
+
+struct dump_site {
+	char *fmt;
+	char *file;
+	char *func;
+	long line;
+	int level;
+};
+
+struct dump_session {
+	uint32_t pid;
+	int clock;
+	uint32_t nsites;
+	struct dump_site *sites;
+};
+
+/* cursor over the part of the file being decoded */
+struct dump_in {
+	const unsigned char *p;
+	const unsigned char *end;
+	int bad;
+};
+
+static struct dump_session *sessions;
+static size_t nsessions;
+
+static const char *dump_level(int ll)
+{
+	switch (ll) {
+		case DEBUG:
+			return "DEBUG : ";
+		case WARN:
+			return "WARN  : ";
+		case ERROR:
+			return "ERROR : ";
+		case INFO:
+			return "INFO  : ";
+	}
+	return "";
+}
+
+static void dump_get(struct dump_in *in, void *v, size_t len)
+{
+	if (in->bad || (size_t)(in->end - in->p) < len) {
+		in->bad = 1;
+		memset(v, 0, len);
+		return;
+	}
+	memcpy(v, in->p, len);
+	in->p += len;
+}
+
+/* returns a NUL terminated copy of a string, NULL for a NULL string */
+static char *dump_get_str(struct dump_in *in)
+{
+	uint16_t len;
+	dump_get(in, &len, sizeof(len));
+	if (in->bad || len == LOG_BIN_NULL)
+		return NULL;
+	if ((size_t)(in->end - in->p) < len) {
+		in->bad = 1;
+		return NULL;
+	}
+	char *str = strndup((const char *)in->p, len);
+	in->p += len;
+	return str;
+}
+
+static struct dump_session *dump_find(uint32_t pid)
+{
+	for (size_t i = nsessions; i--; )
+		if (sessions[i].pid == pid)
+			return &sessions[i];
+	return NULL;
+}
+
+static int dump_session(struct dump_in *in)
+{
+	uint8_t version, clock;
+	uint32_t pid, nsites;
+	dump_get(in, &version, sizeof(version));
+	dump_get(in, &clock, sizeof(clock));
+	dump_get(in, &pid, sizeof(pid));
+	dump_get(in, &nsites, sizeof(nsites));
+	if (in->bad || version != LOG_BINARY_VERSION) {
+		fprintf(stderr, "Unsupported log format version %u\n",
+				version);
+		return -1;
+	}
+
+	/* a reused pid starts a new session, the newest one wins */
+	struct dump_session *s = realloc(sessions,
+			(nsessions + 1) * sizeof(*sessions));
+	if (!s)
+		return -1;
+	sessions = s;
+	s = &sessions[nsessions++];
+	s->pid = pid;
+	s->clock = clock;
+	s->nsites = 0;
+	s->sites = calloc(nsites ? nsites : 1, sizeof(*s->sites));
+	if (!s->sites)
+		return -1;
+
+	for (; s->nsites < nsites && !in->bad; s->nsites++) {
+		struct dump_site *site = &s->sites[s->nsites];
+		uint32_t line;
+		uint8_t level;
+		dump_get(in, &line, sizeof(line));
+		dump_get(in, &level, sizeof(level));
+		site->line = line;
+		site->level = level;
+		site->fmt = dump_get_str(in);
+		site->file = dump_get_str(in);
+		site->func = dump_get_str(in);
+	}
+	return in->bad ? -1 : 0;
+}
+
+static void dump_time(int clock, uint64_t ns)
+{
+	if (clock == LOG_CLOCK_MONO) {
+		printf("%lu.%06lu", (unsigned long)(ns / 1000000000ULL),
+				(unsigned long)(ns % 1000000000ULL / 1000));
+		return;
+	}
+
+	/* same layout as asctime() */
+	char buf[LOG_TIME_MAX];
+	struct tm tm;
+	time_t sec = ns / 1000000000ULL;
+	if (!localtime_r(&sec, &tm) ||
+			!strftime(buf, sizeof(buf), "%a %b %e %H:%M:%S %Y",
+				&tm))
+		buf[0] = '\0';
+	fputs(buf, stdout);
+}
+
+#define dump_printf(spec, nstars, stars, v) ((nstars) == 2 ?\
+		printf(spec, stars[0], stars[1], v) : (nstars) == 1 ?\
+		printf(spec, stars[0], v) : printf(spec, v))
+
+/* print the message of a record out of its raw arguments */
+static void dump_message(const char *fmt, struct dump_in *in)
+{
+	char spec[64];
+	struct log_conv conv;
+	const char *next;
+	while ((next = log_fmt_next(fmt, &conv))) {
+		fwrite(fmt, 1, conv.start - fmt, stdout);
+		fmt = next;
+
+		int stars[2] = {0, 0};
+		for (int i = 0; i < conv.stars && i < 2; ++i) {
+			int64_t v;
+			dump_get(in, &v, sizeof(v));
+			stars[i] = v;
+		}
+		if (conv.len >= (int)sizeof(spec))
+			conv.len = sizeof(spec) - 1;
+		memcpy(spec, conv.start, conv.len);
+		spec[conv.len] = '\0';
+
+		int64_t v = 0;
+		if (conv.arg != LOG_ARG_NONE && conv.arg != LOG_ARG_STR &&
+				conv.arg != LOG_ARG_LDOUBLE)
+			dump_get(in, &v, sizeof(v));
+		if (in->bad)
+			return;
+
+		switch (conv.arg) {
+			case LOG_ARG_NONE:
+				if (conv.len == 2 && conv.start[1] == '%')
+					putchar('%');
+				break;
+			case LOG_ARG_INT:
+				dump_printf(spec, conv.stars, stars, (int)v);
+				break;
+			case LOG_ARG_LONG:
+				dump_printf(spec, conv.stars, stars, (long)v);
+				break;
+			case LOG_ARG_LLONG:
+				dump_printf(spec, conv.stars, stars,
+						(long long)v);
+				break;
+			case LOG_ARG_SIZE:
+				dump_printf(spec, conv.stars, stars, (size_t)v);
+				break;
+			case LOG_ARG_INTMAX:
+				dump_printf(spec, conv.stars, stars,
+						(intmax_t)v);
+				break;
+			case LOG_ARG_PTRDIFF:
+				dump_printf(spec, conv.stars, stars,
+						(ptrdiff_t)v);
+				break;
+			case LOG_ARG_PTR:
+				/* %n has nothing to print */
+				if (spec[conv.len - 1] == 'p')
+					dump_printf(spec, conv.stars, stars,
+							(void *)(intptr_t)v);
+				break;
+			case LOG_ARG_DOUBLE: {
+				double d;
+				memcpy(&d, &v, sizeof(d));
+				dump_printf(spec, conv.stars, stars, d);
+				break;
+			}
+			case LOG_ARG_LDOUBLE: {
+				char raw[16];
+				long double d = 0;
+				dump_get(in, raw, sizeof(raw));
+				memcpy(&d, raw, sizeof(d) < sizeof(raw) ?
+						sizeof(d) : sizeof(raw));
+				dump_printf(spec, conv.stars, stars, d);
+				break;
+			}
+			case LOG_ARG_STR: {
+				char *str = dump_get_str(in);
+				dump_printf(spec, conv.stars, stars, str);
+				free(str);
+				break;
+			}
+		}
+	}
+	fputs(fmt, stdout);
+}
+
+static int dump_record(struct dump_in *in, char tag)
+{
+	uint16_t size;
+	uint32_t pid, id;
+	uint64_t ns;
+	dump_get(in, &size, sizeof(size));
+	dump_get(in, &pid, sizeof(pid));
+	dump_get(in, &id, sizeof(id));
+	dump_get(in, &ns, sizeof(ns));
+	if (in->bad)
+		return -1;
+
+	const struct dump_session *s = dump_find(pid);
+	struct dump_in args = {in->p, in->p + size, 0};
+	if ((size_t)(in->end - in->p) < size)
+		return -1;
+	in->p += size;
+
+	if (tag == 'T') {
+		/* site-less record, id holds the line */
+		uint8_t level;
+		dump_get(&args, &level, sizeof(level));
+		char *file = dump_get_str(&args);
+		char *func = dump_get_str(&args);
+		char *msg = dump_get_str(&args);
+		dump_time(s ? s->clock : LOG_CLOCK_WALL, ns);
+		printf(" %s%s:%s()[%ld] %s\n", dump_level(level),
+				file ? file : "", func ? func : "", (long)id,
+				msg ? msg : "");
+		free(file);
+		free(func);
+		free(msg);
+		return 0;
+	}
+
+	if (!s || id >= s->nsites || !s->sites[id].fmt) {
+		fprintf(stderr, "Record of unknown site %u of pid %u\n", id,
+				pid);
+		return 0;
+	}
+
+	const struct dump_site *site = &s->sites[id];
+	dump_time(s->clock, ns);
+	printf(" %s%s:%s()[%ld] ", dump_level(site->level),
+			site->file ? site->file : "",
+			site->func ? site->func : "", site->line);
+	dump_message(site->fmt, &args);
+	putchar('\n');
+	if (args.bad)
+		fprintf(stderr, "Truncated arguments of site %u of pid %u\n",
+				id, pid);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f = argc > 1 ? fopen(argv[1], "rb") : stdin;
+	if (!f) {
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	/* slurp the whole file, the sessions refer back to it */
+	size_t len = 0, cap = 1 << 16;
+	unsigned char *buf = malloc(cap);
+	size_t result;
+	while (buf && (result = fread(buf + len, 1, cap - len, f)) > 0) {
+		len += result;
+		if (len == cap) {
+			unsigned char *grown = realloc(buf, cap * 2);
+			if (!grown) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = grown;
+			cap *= 2;
+		}
+	}
+	if (f != stdin)
+		fclose(f);
+	if (!buf) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	int status = 0;
+	struct dump_in in = {buf, buf + len, 0};
+	while (in.p < in.end) {
+		char tag = *in.p++;
+		int ret = -1;
+		if (tag == 'S')
+			ret = dump_session(&in);
+		else if (tag == 'R' || tag == 'T')
+			ret = dump_record(&in, tag);
+		if (ret < 0) {
+			fprintf(stderr, "Corrupt record at offset %zu\n",
+					(size_t)(in.p - buf - 1));
+			status = 1;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < nsessions; ++i) {
+		for (uint32_t j = 0; j < sessions[i].nsites; ++j) {
+			free(sessions[i].sites[j].fmt);
+			free(sessions[i].sites[j].file);
+			free(sessions[i].sites[j].func);
+		}
+		free(sessions[i].sites);
+	}
+	free(sessions);
+	free(buf);
+	return status;
+}